@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Compare two lumin_bench JSON runs.
+
+    python3 bench/compare.py base.json new.json [--threshold 5] [--filter REGEX]
+
+Benchmarks are matched by name. With --benchmark_repetitions the "median"
+aggregate is compared, otherwise the single run. Prints the time ratio and
+the GFLOP/s and GB/s of both runs, and exits with status 1 when any
+benchmark got slower by more than --threshold percent.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        doc = json.load(f)
+    runs = {}
+    medians = {}
+    for b in doc.get("benchmarks", []):
+        if b.get("run_type") == "aggregate":
+            if b.get("aggregate_name") == "median":
+                medians[b["run_name"]] = b
+        elif b.get("error_occurred"):
+            continue
+        else:
+            runs.setdefault(b.get("run_name", b["name"]), b)
+    runs.update(medians)
+    return doc.get("context", {}), runs
+
+
+def fmt(value):
+    return "-" if value is None else "%.3f" % value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("base")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="percent slowdown reported as a regression (default 5)")
+    parser.add_argument("--filter", default=None, help="only compare names matching this regex")
+    args = parser.parse_args()
+
+    base_ctx, base = load(args.base)
+    new_ctx, new = load(args.new)
+    for key in ("peak_gflops", "stream_triad_gbps"):
+        if key in base_ctx or key in new_ctx:
+            print("%-20s %12s -> %s" % (key, base_ctx.get(key, "-"), new_ctx.get(key, "-")))
+
+    names = [n for n in base if n in new]
+    if args.filter:
+        pattern = re.compile(args.filter)
+        names = [n for n in names if pattern.search(n)]
+    width = max([len(n) for n in names] + [9])
+
+    print()
+    print("%-*s %10s %10s %8s %10s %10s %10s %10s" % (
+        width, "benchmark", "base us", "new us", "ratio",
+        "GFLOP/s", "-> new", "GB/s", "-> new"))
+    regressions = []
+    for name in names:
+        b, n = base[name], new[name]
+        if b["time_unit"] != n["time_unit"]:
+            continue
+        ratio = n["real_time"] / b["real_time"] if b["real_time"] else float("inf")
+        flag = ""
+        if ratio > 1.0 + args.threshold / 100.0:
+            flag = "  SLOWER"
+            regressions.append(name)
+        elif ratio < 1.0 - args.threshold / 100.0:
+            flag = "  faster"
+        print("%-*s %10.3f %10.3f %8.3f %10s %10s %10s %10s%s" % (
+            width, name, b["real_time"], n["real_time"], ratio,
+            fmt(b.get("GFLOP/s")), fmt(n.get("GFLOP/s")),
+            fmt(b.get("GB/s")), fmt(n.get("GB/s")), flag))
+
+    missing = sorted(set(base) ^ set(new))
+    if missing:
+        print("\n%d benchmark(s) present in only one run" % len(missing))
+    if regressions:
+        print("\n%d regression(s) above %.1f%%" % (len(regressions), args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
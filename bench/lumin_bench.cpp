@@ -0,0 +1,276 @@
+// lumin_bench: sweeps every Backend op over square, tall-skinny and small
+// shapes on each enabled backend. Besides time, every benchmark reports
+// GFLOP/s and GB/s from an analytic op count, and the same figures as a
+// percentage of a peak-FLOP and STREAM triad baseline measured at startup.
+//
+//   lumin_bench --benchmark_out=run.json --benchmark_out_format=json
+//   python3 bench/compare.py base.json run.json
+//
+// Under mpiexec with more than one rank only the MPI backend is swept; all
+// ranks run the same fixed iteration counts and rank 0 reports.
+
+#include <benchmark/benchmark.h>
+#include "lumin.hpp"
+
+#ifdef LUMIN_ENABLE_MPI
+#include <mpi.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// serial figures for the CPU backend, all-thread figures for the rest
+lumin::Roofline serial_baseline, parallel_baseline;
+int world_rank = 0;
+int world_size = 1;
+
+/* Inputs */
+
+lumin::Matrix filled(size_t rows, size_t cols, unsigned seed) {
+  lumin::Matrix M(rows, cols);
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  for (size_t i = 0; i < rows * cols; i++) {
+    M.data()[i] = dist(gen);
+  }
+  return M;
+}
+
+lumin::SparseMatrix random_sparse(size_t rows, size_t cols, size_t per_row, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<size_t> col(0, cols - 1);
+  std::uniform_real_distribution<double> val(-1.0, 1.0);
+  std::vector<size_t> ri, ci;
+  std::vector<double> v;
+  for (size_t i = 0; i < rows; i++) {
+    for (size_t k = 0; k < per_row; k++) {
+      ri.push_back(i);
+      ci.push_back(col(gen));
+      v.push_back(val(gen));
+    }
+  }
+  return lumin::SparseMatrix::from_coo(rows, cols, ri, ci, v);
+}
+
+/* Benchmarks */
+
+struct Work {
+  double flops;
+  double bytes;
+};
+
+struct BackendEntry {
+  std::string name;
+  std::shared_ptr<lumin::Backend> backend;
+  const lumin::Roofline* baseline;   // null: no host baseline applies (GPU)
+  bool collective;
+};
+
+void sync(const BackendEntry& be) {
+#ifdef LUMIN_ENABLE_MPI
+  if (be.collective) MPI_Barrier(MPI_COMM_WORLD);
+#else
+  (void)be;
+#endif
+}
+
+// times op() per iteration and reports throughput against the baselines
+void run_op(benchmark::State& state, const BackendEntry& be, Work w, const std::function<void()>& op) {
+  double total = 0.0;
+  for (auto _ : state) {
+    sync(be);
+    auto t0 = Clock::now();
+    op();
+    sync(be);
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+    state.SetIterationTime(secs);
+    total += secs;
+  }
+  double iters = static_cast<double>(state.iterations());
+  double gflops = w.flops * iters / total * 1e-9;
+  double gbps = w.bytes * iters / total * 1e-9;
+  state.counters["GFLOP/s"] = gflops;
+  state.counters["GB/s"] = gbps;
+  if (be.baseline) {
+    state.counters["%peak"] = 100.0 * gflops / be.baseline->peak_gflops;
+    state.counters["%stream"] = 100.0 * gbps / be.baseline->bandwidth_gbps;
+  }
+}
+
+void register_op(const BackendEntry& be, const std::string& op, const std::string& shape_class,
+                 const std::string& dims, Work w, std::function<void()> fn) {
+  std::string name = op + "/" + be.name + "/" + shape_class + "/" + dims;
+  benchmark::internal::Benchmark* b = benchmark::RegisterBenchmark(
+    name.c_str(), [be, w, fn](benchmark::State& state) { run_op(state, be, w, fn); });
+  b->UseManualTime()->Unit(benchmark::kMicrosecond);
+  if (be.collective) {
+    // adaptive iteration counts differ between ranks and would deadlock
+    double work = std::max(w.flops, w.bytes);
+    b->Iterations(static_cast<benchmark::IterationCount>(std::clamp(2e8 / work, 3.0, 10000.0)));
+  }
+}
+
+struct Shape {
+  const char* cls;
+  size_t m, n;
+};
+
+struct GemmShape {
+  const char* cls;
+  size_t m, k, n;
+};
+
+struct SparseShape {
+  const char* cls;
+  size_t rows, cols, per_row, rhs;
+};
+
+std::string dims2(size_t m, size_t n) {
+  return std::to_string(m) + "x" + std::to_string(n);
+}
+
+void register_backend(const BackendEntry& be) {
+  const double d = sizeof(double);
+  std::shared_ptr<lumin::Backend> bk = be.backend;
+
+  const Shape elementwise[] = {
+    {"square", 256, 256}, {"square", 1024, 1024}, {"square", 2048, 2048},
+    {"tall_skinny", 65536, 32}, {"tall_skinny", 1048576, 2},
+    {"small", 8, 8}, {"small", 32, 32},
+  };
+  for (const Shape& s : elementwise) {
+    double mn = static_cast<double>(s.m * s.n);
+    auto A = std::make_shared<lumin::Matrix>(filled(s.m, s.n, 1));
+    auto B = std::make_shared<lumin::Matrix>(filled(s.m, s.n, 2));
+    std::string dims = dims2(s.m, s.n);
+    register_op(be, "add", s.cls, dims, {mn, 3 * mn * d},
+                [bk, A, B] { benchmark::DoNotOptimize(bk->add(*A, *B)); });
+    register_op(be, "subtract", s.cls, dims, {mn, 3 * mn * d},
+                [bk, A, B] { benchmark::DoNotOptimize(bk->subtract(*A, *B)); });
+    register_op(be, "scalar", s.cls, dims, {mn, 2 * mn * d},
+                [bk, A] { benchmark::DoNotOptimize(bk->scalar(1.5, *A)); });
+    register_op(be, "transpose", s.cls, dims, {0, 2 * mn * d},
+                [bk, A] { benchmark::DoNotOptimize(bk->transpose(*A)); });
+    register_op(be, "dot", s.cls, dims, {2 * mn, 2 * mn * d},
+                [bk, A, B] { benchmark::DoNotOptimize(bk->dot(*A, *B)); });
+  }
+
+  const GemmShape gemm[] = {
+    {"square", 64, 64, 64}, {"square", 256, 256, 256}, {"square", 512, 512, 512},
+    {"tall_skinny", 16384, 32, 32}, {"tall_skinny", 32, 16384, 32},
+    {"small", 8, 8, 8}, {"small", 16, 16, 16},
+  };
+  for (const GemmShape& s : gemm) {
+    auto A = std::make_shared<lumin::Matrix>(filled(s.m, s.k, 3));
+    auto B = std::make_shared<lumin::Matrix>(filled(s.k, s.n, 4));
+    double flops = 2.0 * s.m * s.k * s.n;
+    double bytes = d * (s.m * s.k + s.k * s.n + s.m * s.n);
+    register_op(be, "multiply", s.cls, dims2(s.m, s.k) + "x" + std::to_string(s.n), {flops, bytes},
+                [bk, A, B] { benchmark::DoNotOptimize(bk->multiply(*A, *B)); });
+  }
+
+  const SparseShape sparse[] = {
+    {"square", 16384, 16384, 16, 16}, {"tall_skinny", 262144, 1024, 8, 4}, {"small", 64, 64, 4, 4},
+  };
+  for (const SparseShape& s : sparse) {
+    auto S = std::make_shared<lumin::SparseMatrix>(random_sparse(s.rows, s.cols, s.per_row, 5));
+    auto x = std::make_shared<lumin::Matrix>(filled(s.cols, 1, 6));
+    auto X = std::make_shared<lumin::Matrix>(filled(s.cols, s.rhs, 7));
+    double nnz = static_cast<double>(S->nnz());
+    // CSR arrays plus one pass over the dense operand and the result
+    double csr_bytes = nnz * (d + sizeof(size_t)) + (s.rows + 1) * sizeof(size_t);
+    std::string dims = dims2(s.rows, s.cols);
+    register_op(be, "spmv", s.cls, dims, {2 * nnz, csr_bytes + d * (s.cols + s.rows)},
+                [bk, S, x] { benchmark::DoNotOptimize(bk->spmv(*S, *x)); });
+    register_op(be, "spmm", s.cls, dims + "x" + std::to_string(s.rhs),
+                {2 * nnz * s.rhs, csr_bytes + d * s.rhs * (s.cols + s.rows)},
+                [bk, S, X] { benchmark::DoNotOptimize(bk->spmm(*S, *X)); });
+  }
+}
+
+// ranks other than 0 run the collectives but report nothing
+class NullReporter : public benchmark::BenchmarkReporter {
+public:
+  bool ReportContext(const Context&) override { return true; }
+  void ReportRuns(const std::vector<Run>&) override {}
+};
+
+}
+
+int main(int argc, char** argv) {
+#ifdef LUMIN_ENABLE_MPI
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+#endif
+
+  // only rank 0 may open --benchmark_out
+  std::vector<char*> args(argv, argv + argc);
+  if (world_rank != 0) {
+    args.erase(std::remove_if(args.begin() + 1, args.end(),
+                              [](char* a) { return std::strncmp(a, "--benchmark_out", 15) == 0; }),
+               args.end());
+  }
+  int nargs = static_cast<int>(args.size());
+  benchmark::Initialize(&nargs, args.data());
+  if (benchmark::ReportUnrecognizedArguments(nargs, args.data())) {
+    return 1;
+  }
+
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  serial_baseline = lumin::measure_roofline(1);
+  parallel_baseline = lumin::measure_roofline(static_cast<unsigned>(threads));
+  benchmark::AddCustomContext("threads", std::to_string(threads));
+  benchmark::AddCustomContext("mpi_ranks", std::to_string(world_size));
+  benchmark::AddCustomContext("peak_gflops_1t", std::to_string(serial_baseline.peak_gflops));
+  benchmark::AddCustomContext("stream_triad_gbps_1t", std::to_string(serial_baseline.bandwidth_gbps));
+  benchmark::AddCustomContext("peak_gflops", std::to_string(parallel_baseline.peak_gflops));
+  benchmark::AddCustomContext("stream_triad_gbps", std::to_string(parallel_baseline.bandwidth_gbps));
+
+  std::vector<BackendEntry> backends;
+  if (world_size == 1) {
+    backends.push_back({"cpu", lumin::create_cpu_backend(), &serial_baseline, false});
+#ifdef LUMIN_ENABLE_OPENMP
+    backends.push_back({"omp", lumin::create_omp_backend(), &parallel_baseline, false});
+#endif
+#ifdef LUMIN_ENABLE_CUDA
+    backends.push_back({"cuda", lumin::create_cuda_backend(), nullptr, false});
+#endif
+  }
+#ifdef LUMIN_ENABLE_MPI
+  backends.push_back({"mpi", lumin::create_mpi_backend(MPI_COMM_WORLD), &parallel_baseline, true});
+#endif
+  for (const BackendEntry& be : backends) {
+    register_backend(be);
+  }
+
+  if (world_rank == 0) {
+    benchmark::RunSpecifiedBenchmarks();
+  }
+  else {
+    NullReporter null_reporter;
+    benchmark::RunSpecifiedBenchmarks(&null_reporter);
+  }
+  benchmark::Shutdown();
+
+#ifdef LUMIN_ENABLE_MPI
+  MPI_Finalize();
+#endif
+  return 0;
+}
@@ -1,7 +1,25 @@
+#include "lumin/async.hpp"
+#include "lumin/auto_backend.hpp"
 #include "lumin/backend.hpp"
+#include "lumin/blas.hpp"
 #include "lumin/cpu_backend.hpp"
+#include "lumin/distance.hpp"
 #include "lumin/factory.hpp"
+#include "lumin/graph.hpp"
+#include "lumin/instrument.hpp"
+#include "lumin/io.hpp"
+#include "lumin/linalg.hpp"
+#include "lumin/map.hpp"
 #include "lumin/matrix.hpp"
+#include "lumin/memory.hpp"
+#include "lumin/perf_counters.hpp"
+#include "lumin/reduce.hpp"
+#include "lumin/sparse_matrix.hpp"
+#include "lumin/structured_matrix.hpp"
+#include "lumin/thread_pool.hpp"
+#include "lumin/threadpool_backend.hpp"
+#include "lumin/tiled_matrix.hpp"
+#include "lumin/trace.hpp"
 
 #ifdef LUMIN_ENABLE_CUDA
 #include "lumin/cuda_backend.hpp"
@@ -0,0 +1,205 @@
+#pragma once
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "matrix.hpp"
+
+namespace lumin {
+
+  namespace detail {
+
+    // shared by a Promise and every copy of its Future
+    template<class T>
+    struct FutureState {
+      std::mutex mutex;
+      std::condition_variable done;
+      std::optional<T> value;
+      std::exception_ptr error;
+      bool ready = false;
+      std::vector<std::function<void()>> callbacks;
+
+      void complete() {
+        std::vector<std::function<void()>> run;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          ready = true;
+          run.swap(callbacks);
+        }
+        done.notify_all();
+        for (std::function<void()>& fn : run) {
+          fn();
+        }
+      }
+    };
+
+  }
+
+  // The result of an async op. Unlike std::future it can be copied and
+  // read any number of times; copies share one result.
+  template<class T>
+  class Future {
+  public:
+    Future() = default;
+
+    bool valid() const { return static_cast<bool>(m_state); }
+
+    bool ready() const {
+      std::lock_guard<std::mutex> lock(state().mutex);
+      return m_state->ready;
+    }
+
+    void wait() const {
+      std::unique_lock<std::mutex> lock(state().mutex);
+      m_state->done.wait(lock, [this] { return m_state->ready; });
+    }
+
+    // waits, then returns the result or rethrows what the op threw
+    const T& get() const {
+      wait();
+      if (m_state->error) {
+        std::rethrow_exception(m_state->error);
+      }
+      return *m_state->value;
+    }
+
+    // Calls fn once the result is set, on the thread that sets it, or
+    // right away on this thread if it already is. For handing results to
+    // event loops without parking a thread in wait().
+    void on_ready(std::function<void()> fn) const {
+      {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        if (!m_state->ready) {
+          m_state->callbacks.push_back(std::move(fn));
+          return;
+        }
+      }
+      fn();
+    }
+
+  private:
+    template<class> friend class Promise;
+    explicit Future(std::shared_ptr<detail::FutureState<T>> state) : m_state(std::move(state)) { }
+
+    detail::FutureState<T>& state() const {
+      if (!m_state) {
+        throw std::runtime_error("Future has no result: it was default-constructed");
+      }
+      return *m_state;
+    }
+
+    std::shared_ptr<detail::FutureState<T>> m_state;
+  };
+
+  // The writing end of a Future; set_value or set_exception is called once.
+  template<class T>
+  class Promise {
+  public:
+    Promise() : m_state(std::make_shared<detail::FutureState<T>>()) { }
+
+    Future<T> future() const { return Future<T>(m_state); }
+
+    void set_value(T value) {
+      {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->value.emplace(std::move(value));
+      }
+      m_state->complete();
+    }
+
+    void set_exception(std::exception_ptr error) {
+      {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->error = error;
+      }
+      m_state->complete();
+    }
+
+  private:
+    std::shared_ptr<detail::FutureState<T>> m_state;
+  };
+
+  // A matrix argument to an async op: either a Matrix or the Future of
+  // one, possibly from another Stream. An op waits for its Future operands
+  // before it runs and fails with their error if they failed.
+  class AsyncOperand {
+  public:
+    AsyncOperand(const Matrix& m) : m_matrix(m) { }
+    AsyncOperand(Future<Matrix> f) : m_future(std::move(f)) { }
+
+    const Matrix& get() const { return m_future.valid() ? m_future.get() : m_matrix; }
+
+  private:
+    Matrix m_matrix;
+    Future<Matrix> m_future;
+  };
+
+  // Runs ops one at a time, in the order they were enqueued, on a thread of
+  // its own, so they overlap with the caller and with other streams. Ops
+  // call the Matrix methods and so run on each operand's backend, which
+  // parallelizes them as usual. Matrix operands are shallow copies: do not
+  // write to their data until the ops reading them are done.
+  //
+  // Under MPI every rank must enqueue the same collective ops in the same
+  // order, and MPI must be initialized with at least MPI_THREAD_SERIALIZED
+  // and not used from other threads while the stream runs them.
+  class Stream {
+  public:
+    Stream();
+    // runs the ops still queued, then stops the thread
+    ~Stream();
+
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
+    Future<Matrix> add(AsyncOperand A, AsyncOperand B);
+    Future<Matrix> subtract(AsyncOperand A, AsyncOperand B);
+    Future<Matrix> multiply(AsyncOperand A, AsyncOperand B);
+    Future<Matrix> scalar(double s, AsyncOperand A);
+    Future<Matrix> transpose(AsyncOperand A);
+    Future<double> dot(AsyncOperand A, AsyncOperand B);
+
+    // runs fn() after every op enqueued before it
+    template<class F>
+    Future<std::invoke_result_t<F>> enqueue(F fn) {
+      using T = std::invoke_result_t<F>;
+      Promise<T> promise;
+      Future<T> future = promise.future();
+      push([promise, fn]() mutable {
+        try {
+          promise.set_value(fn());
+        }
+        catch (...) {
+          promise.set_exception(std::current_exception());
+        }
+      });
+      return future;
+    }
+
+    // blocks until every op enqueued so far has run
+    void synchronize();
+
+  private:
+    void push(std::function<void()> task);
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+  };
+
+  // the stream the *_async functions enqueue on
+  Stream& default_stream();
+
+  Future<Matrix> add_async(AsyncOperand A, AsyncOperand B);
+  Future<Matrix> subtract_async(AsyncOperand A, AsyncOperand B);
+  Future<Matrix> multiply_async(AsyncOperand A, AsyncOperand B);
+  Future<Matrix> scalar_async(double s, AsyncOperand A);
+  Future<Matrix> transpose_async(AsyncOperand A);
+  Future<double> dot_async(AsyncOperand A, AsyncOperand B);
+
+}
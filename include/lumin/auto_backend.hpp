@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "backend.hpp"
+
+#ifdef LUMIN_ENABLE_MPI
+#include <mpi.h>
+#endif
+
+namespace lumin {
+
+  // Op classes AutoBackend routes separately. Work is counted in elements,
+  // except Multiply, which counts m*k*n multiply-adds, and Sparse (spmv and
+  // spmm), which counts nnz times the columns of the dense operand.
+  enum class AutoOp { Elementwise, Transpose, Dot, Multiply, Sparse };
+  static constexpr size_t AUTO_OP_KINDS = 5;
+  static constexpr uint64_t AUTO_NEVER = UINT64_MAX;
+
+  // Per op class, the work at and above which the OpenMP (parallel) and MPI
+  // (distributed) backends take over from the serial CPU backend.
+  // AUTO_NEVER keeps an op class off that backend.
+  struct AutoThresholds {
+    std::array<uint64_t, AUTO_OP_KINDS> parallel;
+    std::array<uint64_t, AUTO_OP_KINDS> distributed;
+  };
+
+  // Routes each op to the serial, OpenMP or MPI backend by op class and
+  // work. Thresholds are read from cache_path() on first use, or measured
+  // by calibrate() and written there when the cache is missing or was made
+  // on a machine with a different core, thread or rank count.
+  class AutoBackend : public Backend {
+  public:
+    // serial CPU, plus OpenMP when built with it
+    AutoBackend();
+#ifdef LUMIN_ENABLE_MPI
+    // Also routes to MPIBackend(comm). Every rank must make the same calls,
+    // as with MPIBackend; ops that stay local return the full result on
+    // every rank rather than only on rank 0.
+    explicit AutoBackend(MPI_Comm comm);
+#endif
+    ~AutoBackend() override;
+
+    Matrix add(const Matrix& A, const Matrix& B) override;
+    Matrix multiply(const Matrix& A, const Matrix& B) override;
+    Matrix subtract(const Matrix& A, const Matrix& B) override;
+    Matrix scalar(double s, const Matrix& A) override;
+    Matrix transpose(const Matrix& A) override;
+    double dot(const Matrix& A, const Matrix& B) override;
+    Matrix hadamard(const Matrix& A, const Matrix& B) override;
+    Matrix spmv(const SparseMatrix& A, const Matrix& x) override;
+    Matrix spmm(const SparseMatrix& A, const Matrix& B) override;
+    void gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+              const Matrix& B, double beta, Matrix& C) override;
+    void gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+              double beta, Matrix& y) override;
+    void ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) override;
+    void syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) override;
+    void trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+              const Matrix& A, Matrix& B) override;
+    void lu(Matrix& A, std::vector<size_t>& piv) override;
+    void cholesky(Matrix& A) override;
+    void qr(Matrix& A, std::vector<double>& tau) override;
+    Matrix lstsq(const Matrix& A, const Matrix& B) override;
+    Matrix sq_distances(const Matrix& A, const Matrix& B) override;
+    void knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+             std::vector<size_t>& indices) override;
+    Matrix reduce(Reduction op, Axis axis, const Matrix& A) override;
+    std::vector<size_t> argmax(Axis axis, const Matrix& A) override;
+    Matrix transform_rows(RowTransform op, const Matrix& A) override;
+    void parallel_ranges(size_t n, const std::function<void(size_t, size_t)>& body) override;
+    const char* name() const override { return "AUTO"; }
+
+    // the backend an op of this class and work runs on
+    Backend& route(AutoOp op, uint64_t work);
+
+    AutoThresholds thresholds();
+    void set_thresholds(const AutoThresholds& thresholds);
+    // Times each backend on growing sizes of every op class, adopts the
+    // crossovers and writes them to cache_path(). Collective under MPI.
+    AutoThresholds calibrate();
+
+    // $LUMIN_AUTO_CACHE, else $XDG_CACHE_HOME/lumin/auto_backend, else
+    // ~/.cache/lumin/auto_backend
+    static std::string cache_path();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+  };
+
+}
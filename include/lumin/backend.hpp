@@ -1,20 +1,122 @@
 #pragma once
+#include <functional>
 #include <memory>
+#include <vector>
 
 namespace lumin {
 
   class Matrix;
+  class SparseMatrix;
+
+  // whether a BLAS-style op reads an operand as stored or transposed
+  enum class Trans { No, Yes };
+  // which triangle of a triangular operand is referenced
+  enum class Triangle { Upper, Lower };
+  // whether the triangular operand of trsm multiplies from the left or right
+  enum class Side { Left, Right };
+  // whether a triangular operand's diagonal is read or taken as all ones
+  enum class Diag { NonUnit, Unit };
+  // what reduce() folds a row or column into: L1 and L2 are norms and
+  // LogSumExp is log(sum(exp(x))), shifted by the maximum so it cannot
+  // overflow
+  enum class Reduction { Sum, Mean, Min, Max, L1, L2, LogSumExp };
+  // Axis::Rows reduces each row to one value, giving a rows x 1 column;
+  // Axis::Cols reduces each column, giving a 1 x cols row
+  enum class Axis { Rows, Cols };
+  // whole-row maps: Softmax makes each row exp(x - max) over its sum,
+  // Normalize divides it by its L2 norm and leaves zero rows alone
+  enum class RowTransform { Softmax, Normalize };
 
   class Backend {
   public:
     virtual ~Backend() = default;
 
+    // add, subtract and hadamard broadcast as NumPy does: each dimension
+    // of A and B must match or be 1 in one of them, and a 1 x n or m x 1
+    // operand is reread for every row or column rather than expanded
     virtual Matrix add(const Matrix& A, const Matrix& B) = 0;
     virtual Matrix multiply(const Matrix& A, const Matrix& B) = 0;
     virtual Matrix subtract(const Matrix& A, const Matrix& B) = 0;
     virtual Matrix scalar(double s, const Matrix& A) = 0;
     virtual Matrix transpose(const Matrix& A) = 0;
     virtual double dot(const Matrix& A, const Matrix& B) = 0;
+    // elementwise product; the default implementation runs serially on the host
+    virtual Matrix hadamard(const Matrix& A, const Matrix& B);
+
+    // sparse x dense; the default implementations run serially on the host
+    virtual Matrix spmv(const SparseMatrix& A, const Matrix& x);
+    virtual Matrix spmm(const SparseMatrix& A, const Matrix& B);
+
+    // C = alpha * op(A) * op(B) + beta * C in place, where op transposes
+    // its operand when asked to by indexing it, without a copy. C must
+    // already have the shape of the product; with beta == 0 its contents
+    // are ignored. The default implementation runs serially on the host.
+    virtual void gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+                      const Matrix& B, double beta, Matrix& C);
+    // y = alpha * op(A) * x + beta * y in place, for vectors x and y
+    // stored as a column or a row
+    virtual void gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+                      double beta, Matrix& y);
+    // A += alpha * x * y^T in place
+    virtual void ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A);
+    // C = alpha * op(A) * op(A)^T + beta * C in place: A * A^T without
+    // trans, A^T * A with it. Only the lower triangle is computed and then
+    // mirrored; with beta != 0 only C's lower triangle is read, so C should
+    // be symmetric.
+    virtual void syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C);
+    // B = alpha * op(A)^-1 * B (Side::Left) or alpha * B * op(A)^-1
+    // (Side::Right) in place, for triangular A. Only the uplo triangle of
+    // A is read, and with Diag::Unit not its diagonal either.
+    virtual void trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+                      const Matrix& A, Matrix& B);
+
+    // P * A = L * U in place, with partial pivoting: A is overwritten by
+    // the unit lower L below its diagonal and U on and above it, and row i
+    // was swapped with row piv[i] at step i. A may be rectangular. Throws
+    // on an exactly zero pivot, after finishing the factorization.
+    virtual void lu(Matrix& A, std::vector<size_t>& piv);
+    // A = L * L^T in place for symmetric positive definite A: the lower
+    // triangle, the only one read, becomes L and the strictly upper
+    // triangle is zeroed. Throws if A is not positive definite.
+    virtual void cholesky(Matrix& A);
+    // A = Q * R in place by blocked Householder reflections, stored as
+    // LAPACK stores them: R on and above the diagonal, each reflector's
+    // vector below it with the unit leading entry implied, and the
+    // reflectors' scales in tau
+    virtual void qr(Matrix& A, std::vector<double>& tau);
+    // X minimizing the norm of A * X - B, for A with at least as many rows
+    // as columns and full column rank; throws if R has a zero diagonal
+    virtual Matrix lstsq(const Matrix& A, const Matrix& B);
+
+    // D(i, j) = |a_i - b_j|^2 for the rows a_i of A and b_j of B, from
+    // one tiled pass that runs the GEMM and adds the row norms
+    virtual Matrix sq_distances(const Matrix& A, const Matrix& B);
+    // For each row of A, the k nearest rows of B: distances becomes the
+    // A.rows() x k ascending squared distances, indices the matching rows
+    // of B, row-major. The full distance matrix is never stored.
+    virtual void knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+                     std::vector<size_t>& indices);
+
+    // op over each row or column of A, each in one pass (LogSumExp takes
+    // two). Min, Max and LogSumExp of an empty row or column are -inf or
+    // +inf as their identities are.
+    virtual Matrix reduce(Reduction op, Axis axis, const Matrix& A);
+    // the index of each row's (Axis::Rows) or column's largest entry; the
+    // first one on ties. Throws if the rows or columns are empty.
+    virtual std::vector<size_t> argmax(Axis axis, const Matrix& A);
+    // op applied to each row of A, fused so the row is read from memory once
+    virtual Matrix transform_rows(RowTransform op, const Matrix& A);
+
+    // Calls body(lo, hi) on disjoint ranges covering [0, n), concurrently
+    // on backends that run host threads. map() and zip() inline their
+    // functor into body, so only the split goes through the backend. The
+    // default implementation makes one call on the calling thread.
+    virtual void parallel_ranges(size_t n, const std::function<void(size_t, size_t)>& body);
+
+    // Whether this process receives op results. False on the ranks of a
+    // distributed backend other than the root, where ops built from other
+    // backend calls (multi_dot, randomized_svd) return 0x0 as its own do.
+    virtual bool holds_results() const { return true; }
 
     virtual const char* name() const = 0;
   };
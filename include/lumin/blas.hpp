@@ -0,0 +1,32 @@
+#pragma once
+#include "backend.hpp"
+#include "matrix.hpp"
+
+namespace lumin {
+
+  // BLAS-style entry points on the default backend. They update their
+  // output in place, so repeated accumulation needs no temporaries.
+
+  // C = alpha * op(A) * op(B) + beta * C; transposed operands are indexed,
+  // not copied, and the scaling is applied inside the kernel
+  void gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+            const Matrix& B, double beta, Matrix& C);
+
+  // y = alpha * op(A) * x + beta * y; x and y may be columns or rows.
+  // Matrix::multiply takes this path by itself when B is a column or A a row.
+  void gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+            double beta, Matrix& y);
+
+  // A += alpha * x * y^T
+  void ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A);
+
+  // C = alpha * A * A^T + beta * C, or alpha * A^T * A with trans; one
+  // triangle is computed and mirrored, for half the work of a multiply
+  void syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C);
+
+  // B = alpha * op(A)^-1 * B, or alpha * B * op(A)^-1 with Side::Right,
+  // for triangular A; blocked so that most of the work is GEMM updates
+  void trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+            const Matrix& A, Matrix& B);
+
+}
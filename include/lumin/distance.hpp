@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "matrix.hpp"
+
+namespace lumin {
+
+  // Distances between the rows of two matrices on the default backend,
+  // computed as |a|^2 + |b|^2 - 2 * a . b with the GEMM and the norm
+  // correction fused into one tiled pass, so no N x M temporaries are made
+  // beyond the result.
+
+  // squared Euclidean distances, A.rows() x B.rows()
+  Matrix sq_distances(const Matrix& A, const Matrix& B);
+
+  struct KNNResult {
+    // A.rows() x k squared distances, ascending along each row
+    Matrix distances;
+    // row-major like distances: the row of B at each distance
+    std::vector<size_t> indices;
+  };
+
+  // The k rows of B nearest to each row of A. Only the k best of each row
+  // are kept while the distances are computed, so memory stays O(A.rows()
+  // * k) however many rows B has.
+  KNNResult knn(const Matrix& A, const Matrix& B, size_t k);
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <memory>
+#include <string>
 
 #ifdef LUMIN_ENABLE_MPI
 #include <mpi.h>
@@ -10,9 +11,15 @@ namespace lumin {
 class Backend;
 
 std::shared_ptr<Backend> create_cpu_backend();
+// runs ops on the shared work-stealing default_thread_pool()
+std::shared_ptr<Backend> create_threadpool_backend();
+// routes each op to CPU or OpenMP by calibrated size thresholds
+std::shared_ptr<Backend> create_auto_backend();
 
 #ifdef LUMIN_ENABLE_MPI
 std::shared_ptr<Backend> create_mpi_backend(MPI_Comm comm);
+// as above, with MPI over comm as a third choice for the largest ops
+std::shared_ptr<Backend> create_auto_backend(MPI_Comm comm);
 #endif
 
 #ifdef LUMIN_ENABLE_CUDA
@@ -26,4 +33,10 @@ std::shared_ptr<Backend> create_omp_backend();
 void set_default_backend(std::shared_ptr<Backend> backend);
 std::shared_ptr<Backend> get_default_backend();
 
+// Sets the default backend by name: "cpu", "threadpool", "openmp" (or
+// "omp"), "cuda", "mpi" or "auto", for those built in. MPI-based choices use
+// MPI_COMM_WORLD; "auto" includes MPI only when MPI is initialized with
+// more than one rank.
+void set_backend(const std::string& name);
+
 }
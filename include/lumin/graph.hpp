@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "matrix.hpp"
+
+namespace lumin {
+
+  // Records the Matrix ops (add, subtract, hadamard, scalar, multiply,
+  // transpose) that the calling thread runs between begin_capture() and
+  // end_capture(); add, subtract and hadamard only on operands of one shape.
+  // The ops still run while they are captured, so the capture doubles as a
+  // first evaluation and its shapes are checked once, there.
+  //
+  // end_capture() optimizes the recording once:
+  //  - ops that no output depends on are dropped;
+  //  - chains of elementwise ops whose intermediates are used only by the
+  //    next op are fused into one pass over the data;
+  //  - chains of multiplies whose intermediates are used only by the next
+  //    multiply are re-associated into the order with the fewest flops,
+  //    as multi_dot() picks it, so A * B * C replays as A * (B * C) when
+  //    that is cheaper;
+  //  - ops are grouped into levels of mutually independent ops, which
+  //    replay() runs concurrently on default_thread_pool();
+  //  - intermediates are assigned buffers by liveness, so an intermediate
+  //    reuses the buffer of one that is dead by then. The buffers are
+  //    allocated once and kept by the graph.
+  //
+  // replay() then runs the plan on new inputs of the captured shapes, with
+  // no per-op checks, dispatch or allocation beyond the outputs it returns.
+  // Replays run on the host thread pool whatever the captured matrices'
+  // backends, and calls to replay() on one graph are serialized.
+  class Graph {
+  public:
+    Graph();
+    ~Graph();
+
+    Graph(Graph&&) noexcept;
+    Graph& operator=(Graph&&) noexcept;
+
+    // starts recording on this thread; a graph is captured once
+    void begin_capture();
+    // Marks m as the next replay input. Call it before the ops that read m;
+    // matrices read but not marked are kept as constants, by reference.
+    void input(const Matrix& m);
+    // marks m, the result of a captured op, input or constant, as the next
+    // replay output
+    void output(const Matrix& m);
+    // stops recording and builds the replay plan
+    void end_capture();
+
+    // inputs in the order input() was called; outputs in output() order
+    std::vector<Matrix> replay(const std::vector<Matrix>& inputs);
+
+    // one line per op of the optimized plan
+    std::string describe() const;
+    // ops in the optimized plan, counting a fused chain once
+    size_t nodes() const;
+    // bytes of intermediate buffers kept between replays
+    size_t arena_bytes() const;
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+  };
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lumin {
+
+  // Wall-time histogram buckets: bucket 0 counts calls under 1 us, bucket i
+  // counts [2^(i-1), 2^i) us and the last bucket everything longer.
+  static constexpr size_t TIME_HISTOGRAM_BUCKETS = 24;
+
+  // Aggregated per (op, backend) pair. FLOPs and bytes are analytic counts
+  // from the operand shapes, not measured traffic.
+  struct OpStats {
+    std::string op;
+    std::string backend;
+    uint64_t calls = 0;
+    double total_seconds = 0.0;
+    double min_seconds = 0.0;
+    double max_seconds = 0.0;
+    std::array<uint64_t, TIME_HISTOGRAM_BUCKETS> time_histogram{};
+    uint64_t flops = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes_allocated = 0;
+  };
+
+  // Per MPI collective on this rank; bytes are those this rank sends plus
+  // those it receives.
+  struct CollectiveStats {
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    double total_seconds = 0.0;
+  };
+
+  // Instrumentation is off by default; while off, every op pays one
+  // predictable branch.
+  void set_instrumentation(bool enabled);
+  bool instrumentation_enabled();
+
+  std::vector<OpStats> op_stats();
+  std::vector<CollectiveStats> collective_stats();
+  void reset_stats();
+  // human-readable table of op_stats() and collective_stats()
+  std::string stats_report();
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+
+namespace lumin {
+
+  class Matrix;
+  class SparseMatrix;
+
+  // Text readers map the file, split it into line-aligned chunks and parse
+  // the chunks on separate threads straight into the result buffer.
+  // num_threads = 0 uses std::thread::hardware_concurrency().
+  // Writers format with std::to_chars into per-thread buffers and hand them
+  // to the kernel in one gathered write. precision < 0 writes the shortest
+  // representation that round-trips exactly.
+
+  Matrix read_csv(const std::string& path, char delimiter = ',', bool skip_header = false,
+                  size_t num_threads = 0);
+  void write_csv(const Matrix& A, const std::string& path, char delimiter = ',',
+                 int precision = -1, size_t num_threads = 0);
+
+  // Matrix Market: "array" (dense, general) and "coordinate" (general,
+  // symmetric, real/integer/pattern) files
+  Matrix read_matrix_market(const std::string& path, size_t num_threads = 0);
+  SparseMatrix read_matrix_market_sparse(const std::string& path, size_t num_threads = 0);
+  void write_matrix_market(const Matrix& A, const std::string& path,
+                           int precision = -1, size_t num_threads = 0);
+  void write_matrix_market(const SparseMatrix& A, const std::string& path,
+                           int precision = -1, size_t num_threads = 0);
+
+}
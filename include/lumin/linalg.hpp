@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "matrix.hpp"
+
+namespace lumin {
+
+  // Factorizations and solves on the default backend. They factor a copy
+  // and leave their arguments alone; Backend::lu and Backend::cholesky
+  // work in place.
+
+  // P * A = L * U with partial pivoting, packed as LAPACK packs it: L,
+  // with its unit diagonal implied, below the diagonal of lu and U on and
+  // above it
+  struct LUFactors {
+    Matrix lu;
+    // row i was swapped with row piv[i] at step i
+    std::vector<size_t> piv;
+  };
+
+  // throws if A is singular
+  LUFactors lu(const Matrix& A);
+  // lower triangular L with A = L * L^T, zero above the diagonal; only
+  // A's lower triangle is read. Throws unless A is positive definite.
+  Matrix cholesky(const Matrix& A);
+
+  // A = Q * R by blocked Householder reflections, packed as LAPACK packs
+  // it: R on and above the diagonal of qr, the reflectors below it
+  struct QRFactors {
+    Matrix qr;
+    std::vector<double> tau;
+  };
+
+  QRFactors qr(const Matrix& A);
+  // the first min(m, n) columns of Q, orthonormal
+  Matrix qr_q(const QRFactors& factors);
+  // the min(m, n) x n upper triangular R
+  Matrix qr_r(const QRFactors& factors);
+
+  // X with A * X = B, from the factors of a square A
+  Matrix lu_solve(const LUFactors& factors, const Matrix& B);
+  // X with L * L^T * X = B
+  Matrix cholesky_solve(const Matrix& L, const Matrix& B);
+  // X with A * X = B for square A, by LU with partial pivoting
+  Matrix solve(const Matrix& A, const Matrix& B);
+  // X minimizing the norm of A * X - B, for A with at least as many rows
+  // as columns and full column rank, by QR. Under MPI the row blocks are
+  // factored on their ranks and only their R factors are combined (TSQR).
+  Matrix lstsq(const Matrix& A, const Matrix& B);
+
+  // chain[0] * chain[1] * ... * chain.back(), multiplied in the order with
+  // the fewest flops, which dynamic programming over the chain's
+  // dimensions finds in O(n^3) for n matrices. For 1e5 x 10, 10 x 1e5 and
+  // 1e5 x 10 that is A * (B * C), with a 10 x 10 intermediate rather than
+  // a 1e5 x 1e5 one. An intermediate's buffer is reused by a later one of
+  // the same shape once it has been consumed.
+  Matrix multi_dot(const std::vector<Matrix>& chain);
+
+  // A ~= U * diag(S) * V^T with k columns in U and V, S descending
+  struct SVDResult {
+    Matrix U;
+    std::vector<double> S;
+    Matrix V;
+  };
+
+  // Rank-k truncated SVD by randomized range finding (Halko, Martinsson
+  // and Tropp): A is multiplied by k + oversample Gaussian vectors, the
+  // product is orthonormalized, optionally refined by power iterations
+  // against A^T and A, and A projected onto it is decomposed exactly.
+  // Costs 2 * power_iterations + 2 passes of GEMM over A. Power
+  // iterations sharpen the result when the singular values decay slowly.
+  SVDResult randomized_svd(const Matrix& A, size_t k, size_t oversample = 10,
+                           size_t power_iterations = 2, uint64_t seed = 0);
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include "matrix.hpp"
+
+namespace lumin {
+
+  namespace detail {
+    // Runs body over [0, n) through the default backend's
+    // parallel_ranges, inside an OpScope for op. operands is the number of
+    // matrices read. Throws while the thread captures a graph.
+    void run_elementwise(const char* op, size_t n, size_t operands,
+                         const std::function<void(size_t, size_t)>& body);
+    // throws unless A and B have the same shape
+    void check_zip_dims(const Matrix& A, const Matrix& B);
+  }
+
+  // R(i, j) = f(A(i, j)). f is any callable taking and returning a double;
+  // it is inlined into the loop over each range, so that loop vectorizes
+  // as far as f allows. Ranges run concurrently on the OpenMP, ThreadPool
+  // and Auto backends, so f must be safe to call from several threads.
+  template <class F>
+  Matrix map(const Matrix& A, F f) {
+    Matrix R(A.rows(), A.cols());
+    const double* a = A.data();
+    double* r = R.data();
+    detail::run_elementwise("map", A.rows() * A.cols(), 1, [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; i++) r[i] = f(a[i]);
+    });
+    return R;
+  }
+
+  // R(i, j) = f(A(i, j), B(i, j)) for A and B of one shape, as map() runs
+  template <class F>
+  Matrix zip(const Matrix& A, const Matrix& B, F f) {
+    detail::check_zip_dims(A, B);
+    Matrix R(A.rows(), A.cols());
+    const double* a = A.data();
+    const double* b = B.data();
+    double* r = R.data();
+    detail::run_elementwise("zip", A.rows() * A.cols(), 2, [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; i++) r[i] = f(a[i], b[i]);
+    });
+    return R;
+  }
+
+  // Prebuilt functors for map() and zip(), also exposed to Python as
+  // lumin.exp(A), lumin.clamp(A, lo, hi), lumin.maximum(A, B) and so on.
+  namespace ufunc {
+    struct Exp { double operator()(double x) const { return std::exp(x); } };
+    struct Log { double operator()(double x) const { return std::log(x); } };
+    struct Sqrt { double operator()(double x) const { return std::sqrt(x); } };
+    struct Abs { double operator()(double x) const { return std::fabs(x); } };
+    struct Square { double operator()(double x) const { return x * x; } };
+    struct Tanh { double operator()(double x) const { return std::tanh(x); } };
+    struct Sigmoid { double operator()(double x) const { return 1.0 / (1.0 + std::exp(-x)); } };
+    struct Relu { double operator()(double x) const { return x > 0.0 ? x : 0.0; } };
+
+    struct Clamp {
+      double lo, hi;
+      double operator()(double x) const { return std::min(std::max(x, lo), hi); }
+    };
+    struct Pow {
+      double p;
+      double operator()(double x) const { return std::pow(x, p); }
+    };
+
+    struct Maximum { double operator()(double x, double y) const { return x > y ? x : y; } };
+    struct Minimum { double operator()(double x, double y) const { return x < y ? x : y; } };
+    struct Divide { double operator()(double x, double y) const { return x / y; } };
+  }
+
+}
@@ -1,9 +1,14 @@
 #pragma once
 #include <memory>
+#include <string>
 #include "backend.hpp"
 
 namespace lumin {
 
+  // Copy reads the payload into a fresh buffer; Map wraps a private
+  // copy-on-write mmap of the file, so pages are only copied if written.
+  enum class LoadMode { Copy, Map };
+
   class Matrix {
   public:
     Matrix(size_t rows, size_t cols);
@@ -17,6 +22,9 @@ namespace lumin {
 
     Matrix add(const Matrix& other) const;
     Matrix subtract(const Matrix& other) const;
+    // elementwise product; like add and subtract, a 1 x n or m x 1 operand
+    // broadcasts along the other's rows or columns
+    Matrix hadamard(const Matrix& other) const;
     Matrix multiply(const Matrix& other) const;
     Matrix scalar(double s) const;
     Matrix transpose() const;
@@ -34,7 +42,17 @@ namespace lumin {
     static Matrix random_int(size_t rows, size_t cols, int max_value);
     std::string to_string(int precision) const;
 
+    // native binary format: 64-byte header (shape, dtype, layout, checksum)
+    // followed by the row-major payload at a 64-byte aligned offset.
+    // verify_checksum reads the whole payload, so with LoadMode::Map it
+    // faults in every page up front; pass false to keep the mapping lazy.
+    void save(const std::string& path) const;
+    static Matrix load(const std::string& path, LoadMode mode = LoadMode::Copy,
+                       bool verify_checksum = true);
+
   private:
+    Matrix(size_t rows, size_t cols, std::shared_ptr<double[]> values);
+
     size_t m_rows, m_cols;
     std::shared_ptr<Backend> backend;
     std::shared_ptr<double[]> m_values;
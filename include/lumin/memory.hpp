@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace lumin {
+
+  // Bytes held in one pool. Matrix storage is charged to the matrix's
+  // backend (or "host" when it has none) with kind "matrix"; buffers a
+  // backend allocates for its own use, such as MPIBackend's staging vectors
+  // or CUDA device copies, use kind "scratch". Tile caches use
+  // ("host", "tiles"). Memory-mapped matrices are file-backed and not counted.
+  struct MemoryPoolStats {
+    std::string backend;
+    std::string kind;
+    uint64_t current_bytes = 0;
+    uint64_t peak_bytes = 0;
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+  };
+
+  struct MemoryStats {
+    uint64_t current_bytes = 0;
+    uint64_t peak_bytes = 0;
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+    uint64_t limit_bytes = 0;   // 0 when no limit is set
+    std::vector<MemoryPoolStats> pools;
+  };
+
+  // Thrown by an allocation that would take current_bytes past the limit.
+  // Nothing is allocated when it is thrown.
+  class MemoryLimitError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+  // Accounting is always on and per process; under MPI every rank has its
+  // own limit and counters.
+  MemoryStats memory_stats();
+  // soft limit on current_bytes across all pools; 0 removes it
+  void set_memory_limit(uint64_t bytes);
+  uint64_t memory_limit();
+  // restarts peak tracking from the current usage
+  void reset_peak_memory();
+  // human-readable table of memory_stats()
+  std::string memory_report();
+
+}
@@ -14,6 +14,27 @@ namespace lumin {
     Matrix scalar(double s, const Matrix& A) override;
     Matrix transpose(const Matrix& A) override;
     double dot(const Matrix& A, const Matrix& B) override;
+    Matrix hadamard(const Matrix& A, const Matrix& B) override;
+    Matrix spmv(const SparseMatrix& A, const Matrix& x) override;
+    Matrix spmm(const SparseMatrix& A, const Matrix& B) override;
+    void gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+              const Matrix& B, double beta, Matrix& C) override;
+    void gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+              double beta, Matrix& y) override;
+    void ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) override;
+    void syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) override;
+    void trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+              const Matrix& A, Matrix& B) override;
+    void lu(Matrix& A, std::vector<size_t>& piv) override;
+    void cholesky(Matrix& A) override;
+    void qr(Matrix& A, std::vector<double>& tau) override;
+    Matrix sq_distances(const Matrix& A, const Matrix& B) override;
+    void knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+             std::vector<size_t>& indices) override;
+    Matrix reduce(Reduction op, Axis axis, const Matrix& A) override;
+    std::vector<size_t> argmax(Axis axis, const Matrix& A) override;
+    Matrix transform_rows(RowTransform op, const Matrix& A) override;
+    void parallel_ranges(size_t n, const std::function<void(size_t, size_t)>& body) override;
     const char* name() const override { return "OPENMP"; }
   };
 
@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lumin {
+
+  // Hardware events read through perf_event_open (Linux only). FPOps is the
+  // FMA-weighted double-precision FLOP count and needs Intel's
+  // FP_ARITH_INST_RETIRED events.
+  enum class HwCounter { Cycles, Instructions, LLCMisses, DTLBMisses, FPOps };
+  static constexpr size_t HW_COUNTER_KINDS = 5;
+
+  // Ceilings for roofline placement, in GFLOP/s and GB/s.
+  struct Roofline {
+    double peak_gflops = 0.0;
+    double bandwidth_gbps = 0.0;
+
+    // arithmetic intensity (FLOP/byte) where the two ceilings meet
+    double ridge() const { return bandwidth_gbps > 0.0 ? peak_gflops / bandwidth_gbps : 0.0; }
+    double attainable_gflops(double intensity) const;
+  };
+
+  // Aggregated per (op, backend) pair. counts is indexed by HwCounter and
+  // holds zeros for counters that could not be opened.
+  struct HwCounterStats {
+    std::string op;
+    std::string backend;
+    uint64_t calls = 0;
+    double seconds = 0.0;
+    std::array<uint64_t, HW_COUNTER_KINDS> counts{};
+    double analytic_flops = 0.0;
+    double analytic_bytes = 0.0;
+
+    uint64_t count(HwCounter c) const { return counts[static_cast<size_t>(c)]; }
+    // instructions per cycle; 0 without both counters
+    double ipc() const;
+    // from FPOps when available, otherwise from the analytic FLOP count
+    double gflops() const;
+    // FLOPs per DRAM byte, taking LLC misses x 64 bytes as DRAM traffic
+    // when available and the analytic byte count otherwise
+    double arithmetic_intensity() const;
+  };
+
+  // Starts reading counters around every backend op, summed over all
+  // threads of the process (so OpenMP workers are included). Returns false
+  // if no hardware counter could be opened, e.g. under
+  // perf_event_paranoid or in a container; ops are then still timed and
+  // hw_counter_error() says why.
+  bool start_hw_counters();
+  void stop_hw_counters();
+  bool hw_counters_enabled();
+  std::vector<HwCounter> available_hw_counters();
+  std::string hw_counter_error();
+
+  std::vector<HwCounterStats> hw_counter_stats();
+  void reset_hw_counters();
+
+  // Ceilings default to a peak-FLOP kernel and STREAM triad measured on
+  // first use; set them to use vendor figures instead.
+  void set_roofline(const Roofline& roofline);
+  Roofline roofline();
+  // runs both kernels on the given number of threads, 0 for every hardware
+  // thread
+  Roofline measure_roofline(unsigned threads = 0);
+
+  // per op: IPC, GFLOP/s, arithmetic intensity, bound and % of attainable
+  std::string roofline_report();
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "matrix.hpp"
+
+namespace lumin {
+
+  // Reductions and whole-row transforms on the default backend. Each
+  // reads A once (LogSumExp and Softmax once more from cache) and writes
+  // only its result; no temporaries the size of A are made.
+
+  // op over each row (Axis::Rows, giving A.rows() x 1) or each column
+  // (Axis::Cols, giving 1 x A.cols()) of A
+  Matrix reduce(Reduction op, Axis axis, const Matrix& A);
+
+  // the index of the first largest entry of each row or column
+  std::vector<size_t> argmax(Axis axis, const Matrix& A);
+
+  // softmax or L2 normalization of each row of A
+  Matrix transform_rows(RowTransform op, const Matrix& A);
+
+}
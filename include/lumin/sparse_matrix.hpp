@@ -0,0 +1,65 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "backend.hpp"
+
+namespace lumin {
+
+  class Matrix;
+
+  enum class SparseFormat { CSR, CSC };
+
+  // Compressed sparse matrix. In CSR format ptr() has rows + 1 entries and
+  // indices() holds column indices; in CSC format ptr() has cols + 1 entries
+  // and indices() holds row indices. Indices are sorted within each row/column.
+  class SparseMatrix {
+  public:
+    SparseMatrix(size_t rows, size_t cols, SparseFormat format = SparseFormat::CSR);
+    SparseMatrix(size_t rows, size_t cols,
+                 std::vector<size_t> ptr, std::vector<size_t> indices, std::vector<double> values,
+                 SparseFormat format = SparseFormat::CSR);
+    SparseMatrix();
+
+    // duplicate (row, col) entries are summed
+    static SparseMatrix from_coo(size_t rows, size_t cols,
+                                 const std::vector<size_t>& row_idx,
+                                 const std::vector<size_t>& col_idx,
+                                 const std::vector<double>& values,
+                                 SparseFormat format = SparseFormat::CSR);
+    // entries with |a| <= tol are dropped
+    static SparseMatrix from_dense(const Matrix& A, SparseFormat format = SparseFormat::CSR,
+                                   double tol = 0.0);
+
+    size_t rows() const { return m_rows; }
+    size_t cols() const { return m_cols; }
+    size_t nnz() const { return m_values.size(); }
+    SparseFormat format() const { return m_format; }
+
+    const std::vector<size_t>& ptr() const { return m_ptr; }
+    const std::vector<size_t>& indices() const { return m_indices; }
+    const std::vector<double>& values() const { return m_values; }
+
+    Matrix to_dense() const;
+    SparseMatrix to_csr() const;
+    SparseMatrix to_csc() const;
+    SparseMatrix transpose() const;
+
+    // y = A x, x is a (cols x 1) column vector
+    Matrix spmv(const Matrix& x) const;
+    // R = A B, B is dense (cols x k)
+    Matrix multiply(const Matrix& B) const;
+
+    Matrix operator*(const Matrix& B) const;
+
+  private:
+    SparseMatrix convert() const;
+
+    size_t m_rows, m_cols;
+    SparseFormat m_format;
+    std::shared_ptr<Backend> backend;
+    std::vector<size_t> m_ptr;
+    std::vector<size_t> m_indices;
+    std::vector<double> m_values;
+  };
+
+}
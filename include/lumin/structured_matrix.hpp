@@ -0,0 +1,135 @@
+#pragma once
+#include <vector>
+#include "backend.hpp"
+
+namespace lumin {
+
+  class Matrix;
+
+  // Square diagonal matrix storing only its n diagonal entries.
+  class DiagonalMatrix {
+  public:
+    explicit DiagonalMatrix(size_t n);
+    explicit DiagonalMatrix(std::vector<double> diag);
+    DiagonalMatrix();
+
+    static DiagonalMatrix from_dense(const Matrix& A);
+
+    size_t rows() const { return m_diag.size(); }
+    size_t cols() const { return m_diag.size(); }
+    double* data() { return m_diag.data(); }
+    const double* data() const { return m_diag.data(); }
+
+    double& operator()(size_t i) { return m_diag[i]; }
+    const double& operator()(size_t i) const { return m_diag[i]; }
+
+    DiagonalMatrix add(const DiagonalMatrix& other) const;
+    DiagonalMatrix multiply(const DiagonalMatrix& other) const;
+    DiagonalMatrix transpose() const { return *this; }
+    Matrix add(const Matrix& B) const;
+    Matrix multiply(const Matrix& B) const;  // scales the rows of B
+    Matrix to_dense() const;
+
+    DiagonalMatrix operator+(const DiagonalMatrix& other) const { return add(other); }
+    DiagonalMatrix operator*(const DiagonalMatrix& other) const { return multiply(other); }
+    Matrix operator*(const Matrix& B) const;
+
+  private:
+    std::vector<double> m_diag;
+  };
+
+  // Banded matrix with kl sub- and ku super-diagonals. Each row stores
+  // kl + ku + 1 slots; entry (i, j) lives at i * (kl + ku + 1) + (j - i + kl).
+  class BandedMatrix {
+  public:
+    BandedMatrix(size_t rows, size_t cols, size_t kl, size_t ku);
+    BandedMatrix();
+
+    static BandedMatrix from_dense(const Matrix& A, size_t kl, size_t ku);
+
+    size_t rows() const { return m_rows; }
+    size_t cols() const { return m_cols; }
+    size_t lower() const { return m_kl; }
+    size_t upper() const { return m_ku; }
+    size_t nnz() const;
+    double* data() { return m_band.data(); }
+    const double* data() const { return m_band.data(); }
+
+    bool in_band(size_t i, size_t j) const { return j + m_kl >= i && j <= i + m_ku; }
+    // first and one-past-last column stored in row i
+    size_t row_begin(size_t i) const { return i > m_kl ? i - m_kl : 0; }
+    size_t row_end(size_t i) const { return i + m_ku + 1 < m_cols ? i + m_ku + 1 : m_cols; }
+
+    double get(size_t i, size_t j) const;  // zero outside the band
+    double& at(size_t i, size_t j);        // throws outside the band
+
+    BandedMatrix add(const BandedMatrix& other) const;
+    BandedMatrix multiply(const BandedMatrix& other) const;
+    BandedMatrix transpose() const;
+    Matrix add(const Matrix& B) const;
+    Matrix multiply(const Matrix& B) const;
+    Matrix to_dense() const;
+
+    BandedMatrix operator+(const BandedMatrix& other) const { return add(other); }
+    BandedMatrix operator*(const BandedMatrix& other) const { return multiply(other); }
+    Matrix operator*(const Matrix& B) const;
+
+  private:
+    double& slot(size_t i, size_t j) { return m_band[i * (m_kl + m_ku + 1) + (j + m_kl - i)]; }
+    const double& slot(size_t i, size_t j) const { return m_band[i * (m_kl + m_ku + 1) + (j + m_kl - i)]; }
+
+    size_t m_rows, m_cols, m_kl, m_ku;
+    std::vector<double> m_band;
+  };
+
+  // Square triangular matrix in packed row-major storage (n * (n + 1) / 2 entries).
+  class TriangularMatrix {
+  public:
+    TriangularMatrix(size_t n, Triangle uplo);
+    TriangularMatrix();
+
+    static TriangularMatrix from_dense(const Matrix& A, Triangle uplo);
+
+    size_t rows() const { return m_n; }
+    size_t cols() const { return m_n; }
+    Triangle uplo() const { return m_uplo; }
+    size_t nnz() const { return m_packed.size(); }
+    double* data() { return m_packed.data(); }
+    const double* data() const { return m_packed.data(); }
+
+    bool in_triangle(size_t i, size_t j) const { return m_uplo == Triangle::Lower ? j <= i : j >= i; }
+    size_t row_begin(size_t i) const { return m_uplo == Triangle::Lower ? 0 : i; }
+    size_t row_end(size_t i) const { return m_uplo == Triangle::Lower ? i + 1 : m_n; }
+
+    double get(size_t i, size_t j) const;  // zero outside the triangle
+    double& at(size_t i, size_t j);        // throws outside the triangle
+
+    TriangularMatrix add(const TriangularMatrix& other) const;
+    TriangularMatrix multiply(const TriangularMatrix& other) const;
+    TriangularMatrix transpose() const;
+    Matrix add(const Matrix& B) const;
+    Matrix multiply(const Matrix& B) const;
+    Matrix to_dense() const;
+
+    TriangularMatrix operator+(const TriangularMatrix& other) const { return add(other); }
+    TriangularMatrix operator*(const TriangularMatrix& other) const { return multiply(other); }
+    Matrix operator*(const Matrix& B) const;
+
+  private:
+    size_t offset(size_t i) const {
+      return m_uplo == Triangle::Lower ? i * (i + 1) / 2 : i * m_n - i * (i - 1) / 2;
+    }
+    double& slot(size_t i, size_t j) { return m_packed[offset(i) + (j - row_begin(i))]; }
+    const double& slot(size_t i, size_t j) const { return m_packed[offset(i) + (j - row_begin(i))]; }
+
+    size_t m_n;
+    Triangle m_uplo;
+    std::vector<double> m_packed;
+  };
+
+  // dense x structured
+  Matrix multiply(const Matrix& A, const DiagonalMatrix& D);
+  Matrix multiply(const Matrix& A, const BandedMatrix& B);
+  Matrix multiply(const Matrix& A, const TriangularMatrix& T);
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace lumin {
+
+  class TaskGroup;
+
+  // Persistent work-stealing pool. Each worker owns a Chase-Lev deque: it
+  // pushes and pops its own tasks at the bottom while idle workers steal
+  // from the top, so recursively spawned work stays local until someone is
+  // free to take it. Tasks spawned from threads outside the pool go through
+  // a shared queue. A thread waiting on a TaskGroup runs tasks itself
+  // instead of blocking, so nested parallel_for and spawn never deadlock
+  // and callers on their own threads add no extra threads.
+  class ThreadPool {
+  public:
+    // threads counts a caller waiting in TaskGroup::wait, so threads - 1
+    // workers are started; 0 picks std::thread::hardware_concurrency()
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t threads() const;
+
+    // Calls body(lo, hi) on disjoint ranges covering [begin, end), none
+    // longer than grain, splitting in halves so idle threads steal large
+    // pieces. Returns once every range is done and rethrows the first
+    // exception a range threw.
+    void parallel_for(size_t begin, size_t end, size_t grain,
+                      const std::function<void(size_t, size_t)>& body);
+
+  private:
+    friend class TaskGroup;
+    struct Task;
+    void submit(Task* task);
+    // runs one queued task if any can be found; false if none
+    bool run_one();
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+  };
+
+  // Tasks spawned into a group may spawn more; wait() returns once all of
+  // them have finished. The destructor waits too, without rethrowing.
+  class TaskGroup {
+  public:
+    explicit TaskGroup(ThreadPool& pool);
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void spawn(std::function<void()> fn);
+    // rethrows the first exception a task threw
+    void wait();
+
+  private:
+    friend class ThreadPool;
+    void finish(std::exception_ptr error);
+    void drain();
+
+    ThreadPool& m_pool;
+    std::atomic<size_t> m_pending{0};
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+    std::exception_ptr m_error;
+  };
+
+  // Shared by ThreadPoolBackend and the async API. Sized by
+  // $LUMIN_NUM_THREADS when set, otherwise by the hardware.
+  ThreadPool& default_thread_pool();
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <memory>
+#include <string>
+
+namespace lumin {
+
+  class Matrix;
+
+  // How tiles are brought into memory: through an LRU tile cache filled
+  // with pread, or straight out of a shared mmap of the whole file.
+  enum class TileAccess { Cached, Mapped };
+
+  struct TileCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t prefetched = 0;
+    size_t evictions = 0;
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+  };
+
+  // Out-of-core matrix stored on disk as a grid of square tiles. Every tile
+  // occupies tile_size() * tile_size() doubles in row-major order; tiles on
+  // the right and bottom edges are zero-padded. Copies share the same file.
+  class TiledMatrix {
+  public:
+    static constexpr size_t DEFAULT_TILE_SIZE = 512;
+    static constexpr size_t DEFAULT_CACHE_BYTES = size_t(256) << 20;
+
+    static TiledMatrix create(const std::string& path, size_t rows, size_t cols,
+                              size_t tile_size = DEFAULT_TILE_SIZE,
+                              TileAccess access = TileAccess::Cached,
+                              size_t cache_bytes = DEFAULT_CACHE_BYTES);
+    static TiledMatrix open(const std::string& path,
+                            TileAccess access = TileAccess::Cached,
+                            size_t cache_bytes = DEFAULT_CACHE_BYTES);
+    static TiledMatrix from_matrix(const Matrix& A, const std::string& path,
+                                   size_t tile_size = DEFAULT_TILE_SIZE,
+                                   TileAccess access = TileAccess::Cached,
+                                   size_t cache_bytes = DEFAULT_CACHE_BYTES);
+    TiledMatrix();
+
+    size_t rows() const;
+    size_t cols() const;
+    size_t tile_size() const;
+    size_t tile_rows() const;
+    size_t tile_cols() const;
+    const std::string& path() const;
+
+    // Tiles stay valid while the returned pointer is held, even if evicted.
+    std::shared_ptr<const double[]> tile(size_t ti, size_t tj) const;
+    void write_tile(size_t ti, size_t tj, const double* values);
+    // queue a tile for the background read-ahead thread
+    void prefetch(size_t ti, size_t tj) const;
+
+    Matrix to_matrix() const;
+
+    // Results are written to a new tiled file at out_path.
+    TiledMatrix add(const TiledMatrix& B, const std::string& out_path) const;
+    TiledMatrix subtract(const TiledMatrix& B, const std::string& out_path) const;
+    TiledMatrix scalar(double s, const std::string& out_path) const;
+    TiledMatrix multiply(const TiledMatrix& B, const std::string& out_path) const;
+    TiledMatrix transpose(const std::string& out_path) const;
+
+    void set_cache_budget(size_t bytes);
+    TileCacheStats cache_stats() const;
+    void reset_cache_stats();
+
+  private:
+    struct Impl;
+    explicit TiledMatrix(std::shared_ptr<Impl> impl);
+    static std::shared_ptr<Impl> open_impl(const std::string& path, TileAccess access,
+                                           size_t cache_bytes);
+    TiledMatrix elementwise(const TiledMatrix* B, const std::string& out_path,
+                            double sa, double sb) const;
+
+    std::shared_ptr<Impl> impl;
+  };
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#ifdef LUMIN_ENABLE_MPI
+#include <mpi.h>
+#endif
+
+namespace lumin {
+
+  // Timeline tracing in Chrome trace event format, viewable in
+  // chrome://tracing or ui.perfetto.dev. While tracing, every backend op,
+  // buffer allocation and MPI collective records begin/end events into a
+  // fixed-size buffer owned by the calling thread; recording takes no locks.
+  // Events past a thread's capacity are dropped and counted.
+  static constexpr size_t DEFAULT_TRACE_EVENTS_PER_THREAD = size_t(1) << 20;
+
+  // starting discards any events from a previous session
+  void start_tracing(size_t events_per_thread = DEFAULT_TRACE_EVENTS_PER_THREAD);
+  void stop_tracing();
+  bool tracing_enabled();
+
+  // Events are written with pid = rank. clock_offset_us is rank 0's clock
+  // minus this process's and is added to timestamps when per-rank files are
+  // merged.
+  void set_trace_rank(int rank, double clock_offset_us = 0.0);
+
+  // writes the events recorded so far on this process
+  void write_trace(const std::string& path);
+  // combines files from write_trace into one, shifting each file's
+  // timestamps onto rank 0's clock
+  void merge_traces(const std::vector<std::string>& inputs, const std::string& output);
+
+#ifdef LUMIN_ENABLE_MPI
+  // estimates every rank's offset to rank 0 with timed ping-pongs (keeping
+  // the lowest round trip) and calls set_trace_rank
+  void sync_trace_clocks(MPI_Comm comm);
+  // each rank writes "<path>.rank<r>", then rank 0 merges them into path
+  void gather_trace(MPI_Comm comm, const std::string& path);
+#endif
+
+}
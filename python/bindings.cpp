@@ -38,6 +38,80 @@ py::array_t<double> matrix_to_numpy(const Matrix& m) {
     return result;
 }
 
+// The Python exception a failed async op raises when awaited
+py::object async_error(std::exception_ptr error) {
+    py::module_ builtins = py::module_::import("builtins");
+    try {
+        std::rethrow_exception(error);
+    }
+    catch (const MemoryLimitError& e) {
+        return py::module_::import("lumin").attr("MemoryLimitError")(e.what());
+    }
+    catch (const std::exception& e) {
+        return builtins.attr("RuntimeError")(e.what());
+    }
+    catch (...) {
+        return builtins.attr("RuntimeError")("unknown C++ exception");
+    }
+}
+
+// Binds Future<T>. result() waits without holding the GIL; awaiting one
+// hands the result to an asyncio future on the running loop from the
+// thread that produces it, so no thread is parked waiting.
+template<class T>
+void bind_future(py::module_& m, const char* name) {
+    py::class_<Future<T>>(m, name)
+        .def("done", &Future<T>::ready)
+        .def("wait", &Future<T>::wait, py::call_guard<py::gil_scoped_release>())
+        .def("result", [](const Future<T>& f) {
+            {
+                py::gil_scoped_release release;
+                f.wait();
+            }
+            return f.get();
+        })
+        .def("__await__", [](const Future<T>& f) {
+            py::object loop = py::module_::import("asyncio").attr("get_running_loop")();
+            py::object pending = loop.attr("create_future")();
+            // the callback may be copied and dropped on a stream thread,
+            // so the Python objects it holds are released under the GIL
+            std::shared_ptr<py::tuple> waiter(new py::tuple(py::make_tuple(loop, pending)),
+                                              [](py::tuple* t) {
+                                                  py::gil_scoped_acquire gil;
+                                                  delete t;
+                                              });
+            f.on_ready([f, waiter] {
+                py::gil_scoped_acquire gil;
+                py::object target = (*waiter)[1];
+                py::object value = py::none(), error = py::none();
+                try {
+                    value = py::cast(f.get());
+                }
+                catch (...) {
+                    error = async_error(std::current_exception());
+                }
+                py::cpp_function settle([target, value, error] {
+                    if (target.attr("done")().cast<bool>()) {
+                        return;   // cancelled meanwhile
+                    }
+                    if (error.is_none()) {
+                        target.attr("set_result")(value);
+                    }
+                    else {
+                        target.attr("set_exception")(error);
+                    }
+                });
+                try {
+                    (*waiter)[0].attr("call_soon_threadsafe")(settle);
+                }
+                catch (py::error_already_set&) {
+                    // the loop was closed before the op finished
+                }
+            });
+            return pending.attr("__await__")();
+        });
+}
+
 PYBIND11_MODULE(lumin, m) {
     m.doc() = "LUMIN: High-performance matrix operations library with multiple backends";
 
@@ -70,6 +144,7 @@ PYBIND11_MODULE(lumin, m) {
         // Matrix operations
         .def("add", &Matrix::add, py::arg("other"), "Add another matrix")
         .def("subtract", &Matrix::subtract, py::arg("other"), "Subtract another matrix")
+        .def("hadamard", &Matrix::hadamard, py::arg("other"), "Elementwise product with another matrix")
         .def("multiply", &Matrix::multiply, py::arg("other"), "Multiply by another matrix")
         .def("scalar", &Matrix::scalar, py::arg("s"), "Multiply by scalar")
         .def("transpose", &Matrix::transpose, "Transpose the matrix")
@@ -97,11 +172,561 @@ PYBIND11_MODULE(lumin, m) {
         })
         .def_static("random_int", &Matrix::random_int,
                    py::arg("rows"), py::arg("cols"), py::arg("max_value") = 100,
-                   "Create a matrix with random integer values");
+                   "Create a matrix with random integer values")
+
+        // Binary persistence
+        .def("save", &Matrix::save, py::arg("path"),
+             py::call_guard<py::gil_scoped_release>(),
+             "Save in the native binary format")
+        .def_static("load", [](const std::string& path, bool mmap, bool verify) {
+            py::gil_scoped_release release;
+            return Matrix::load(path, mmap ? LoadMode::Map : LoadMode::Copy, verify);
+        }, py::arg("path"), py::arg("mmap") = false, py::arg("verify") = true,
+           "Load a native binary matrix file; mmap=True maps the payload without copying "
+           "(verify=True still reads every page to check the checksum)");
+
+    // Sparse matrices
+    py::enum_<SparseFormat>(m, "SparseFormat")
+        .value("CSR", SparseFormat::CSR)
+        .value("CSC", SparseFormat::CSC);
+
+    py::class_<SparseMatrix>(m, "SparseMatrix")
+        .def(py::init<>())
+        .def(py::init<size_t, size_t, SparseFormat>(),
+             py::arg("rows"), py::arg("cols"), py::arg("format") = SparseFormat::CSR,
+             "Create an empty sparse matrix")
+        .def_static("from_coo", &SparseMatrix::from_coo,
+                   py::arg("rows"), py::arg("cols"),
+                   py::arg("row_idx"), py::arg("col_idx"), py::arg("values"),
+                   py::arg("format") = SparseFormat::CSR,
+                   "Build from COO triplets (duplicates are summed)")
+        .def_static("from_dense", &SparseMatrix::from_dense,
+                   py::arg("matrix"), py::arg("format") = SparseFormat::CSR, py::arg("tol") = 0.0,
+                   "Build from a dense matrix, dropping entries with |a| <= tol")
+
+        // Properties
+        .def("rows", &SparseMatrix::rows, "Get number of rows")
+        .def("cols", &SparseMatrix::cols, "Get number of columns")
+        .def("nnz", &SparseMatrix::nnz, "Get number of stored entries")
+        .def("format", &SparseMatrix::format, "Get storage format")
+        .def("shape", [](const SparseMatrix& s) {
+            return std::make_pair(s.rows(), s.cols());
+        }, "Get matrix shape as (rows, cols) tuple")
+
+        // Conversions
+        .def("to_dense", &SparseMatrix::to_dense, "Convert to a dense Matrix")
+        .def("to_csr", &SparseMatrix::to_csr, "Convert to CSR format")
+        .def("to_csc", &SparseMatrix::to_csc, "Convert to CSC format")
+        .def("transpose", &SparseMatrix::transpose, "Transpose the matrix")
+
+        // Operations
+        .def("spmv", &SparseMatrix::spmv, py::arg("x"), "Sparse matrix-vector product")
+        .def("multiply", &SparseMatrix::multiply, py::arg("other"), "Sparse x dense product")
+        .def("__mul__", [](const SparseMatrix& s, const Matrix& b) {
+            return s * b;
+        }, py::is_operator())
+        .def("__repr__", [](const SparseMatrix& s) {
+            std::ostringstream oss;
+            oss << "<SparseMatrix shape=(" << s.rows() << ", " << s.cols()
+                << ") nnz=" << s.nnz() << ">";
+            return oss.str();
+        });
+
+    // Structured matrices
+    py::enum_<Triangle>(m, "Triangle")
+        .value("Upper", Triangle::Upper)
+        .value("Lower", Triangle::Lower);
+
+    py::class_<DiagonalMatrix>(m, "DiagonalMatrix")
+        .def(py::init<size_t>(), py::arg("n"), "Create an n x n zero diagonal matrix")
+        .def(py::init<std::vector<double>>(), py::arg("diag"), "Create from diagonal entries")
+        .def_static("from_dense", &DiagonalMatrix::from_dense, py::arg("matrix"),
+                   "Take the diagonal of a dense square matrix")
+        .def("rows", &DiagonalMatrix::rows, "Get number of rows")
+        .def("cols", &DiagonalMatrix::cols, "Get number of columns")
+        .def("__getitem__", [](const DiagonalMatrix& d, size_t i) { return d(i); })
+        .def("__setitem__", [](DiagonalMatrix& d, size_t i, double v) { d(i) = v; })
+        .def("transpose", &DiagonalMatrix::transpose, "Transpose the matrix")
+        .def("to_dense", &DiagonalMatrix::to_dense, "Convert to a dense Matrix")
+        .def("__add__", [](const DiagonalMatrix& a, const DiagonalMatrix& b) { return a + b; }, py::is_operator())
+        .def("__add__", [](const DiagonalMatrix& a, const Matrix& b) { return a.add(b); }, py::is_operator())
+        .def("__mul__", [](const DiagonalMatrix& a, const DiagonalMatrix& b) { return a * b; }, py::is_operator())
+        .def("__mul__", [](const DiagonalMatrix& a, const Matrix& b) { return a * b; }, py::is_operator())
+        .def("__rmul__", [](const DiagonalMatrix& a, const Matrix& b) { return multiply(b, a); }, py::is_operator());
+
+    py::class_<BandedMatrix>(m, "BandedMatrix")
+        .def(py::init<size_t, size_t, size_t, size_t>(),
+             py::arg("rows"), py::arg("cols"), py::arg("kl"), py::arg("ku"),
+             "Create a zero banded matrix with kl sub- and ku super-diagonals")
+        .def_static("from_dense", &BandedMatrix::from_dense,
+                   py::arg("matrix"), py::arg("kl"), py::arg("ku"),
+                   "Keep the band of a dense matrix")
+        .def("rows", &BandedMatrix::rows, "Get number of rows")
+        .def("cols", &BandedMatrix::cols, "Get number of columns")
+        .def("lower", &BandedMatrix::lower, "Number of sub-diagonals")
+        .def("upper", &BandedMatrix::upper, "Number of super-diagonals")
+        .def("nnz", &BandedMatrix::nnz, "Number of stored entries")
+        .def("__getitem__", [](const BandedMatrix& b, std::pair<size_t, size_t> idx) {
+            return b.get(idx.first, idx.second);
+        })
+        .def("__setitem__", [](BandedMatrix& b, std::pair<size_t, size_t> idx, double v) {
+            b.at(idx.first, idx.second) = v;
+        })
+        .def("transpose", &BandedMatrix::transpose, "Transpose the matrix")
+        .def("to_dense", &BandedMatrix::to_dense, "Convert to a dense Matrix")
+        .def("__add__", [](const BandedMatrix& a, const BandedMatrix& b) { return a + b; }, py::is_operator())
+        .def("__add__", [](const BandedMatrix& a, const Matrix& b) { return a.add(b); }, py::is_operator())
+        .def("__mul__", [](const BandedMatrix& a, const BandedMatrix& b) { return a * b; }, py::is_operator())
+        .def("__mul__", [](const BandedMatrix& a, const Matrix& b) { return a * b; }, py::is_operator())
+        .def("__rmul__", [](const BandedMatrix& a, const Matrix& b) { return multiply(b, a); }, py::is_operator());
+
+    py::class_<TriangularMatrix>(m, "TriangularMatrix")
+        .def(py::init<size_t, Triangle>(), py::arg("n"), py::arg("uplo"),
+             "Create a zero n x n triangular matrix")
+        .def_static("from_dense", &TriangularMatrix::from_dense,
+                   py::arg("matrix"), py::arg("uplo"),
+                   "Keep one triangle of a dense square matrix")
+        .def("rows", &TriangularMatrix::rows, "Get number of rows")
+        .def("cols", &TriangularMatrix::cols, "Get number of columns")
+        .def("uplo", &TriangularMatrix::uplo, "Stored triangle")
+        .def("nnz", &TriangularMatrix::nnz, "Number of stored entries")
+        .def("__getitem__", [](const TriangularMatrix& t, std::pair<size_t, size_t> idx) {
+            return t.get(idx.first, idx.second);
+        })
+        .def("__setitem__", [](TriangularMatrix& t, std::pair<size_t, size_t> idx, double v) {
+            t.at(idx.first, idx.second) = v;
+        })
+        .def("transpose", &TriangularMatrix::transpose, "Transpose the matrix")
+        .def("to_dense", &TriangularMatrix::to_dense, "Convert to a dense Matrix")
+        .def("__add__", [](const TriangularMatrix& a, const TriangularMatrix& b) { return a + b; }, py::is_operator())
+        .def("__add__", [](const TriangularMatrix& a, const Matrix& b) { return a.add(b); }, py::is_operator())
+        .def("__mul__", [](const TriangularMatrix& a, const TriangularMatrix& b) { return a * b; }, py::is_operator())
+        .def("__mul__", [](const TriangularMatrix& a, const Matrix& b) { return a * b; }, py::is_operator())
+        .def("__rmul__", [](const TriangularMatrix& a, const Matrix& b) { return multiply(b, a); }, py::is_operator());
+
+    // Out-of-core tiled matrices
+    py::enum_<TileAccess>(m, "TileAccess")
+        .value("Cached", TileAccess::Cached)
+        .value("Mapped", TileAccess::Mapped);
+
+    py::class_<TileCacheStats>(m, "TileCacheStats")
+        .def_readonly("hits", &TileCacheStats::hits)
+        .def_readonly("misses", &TileCacheStats::misses)
+        .def_readonly("prefetched", &TileCacheStats::prefetched)
+        .def_readonly("evictions", &TileCacheStats::evictions)
+        .def_readonly("bytes_read", &TileCacheStats::bytes_read)
+        .def_readonly("bytes_written", &TileCacheStats::bytes_written);
+
+    py::class_<TiledMatrix>(m, "TiledMatrix")
+        .def_static("create", &TiledMatrix::create,
+                   py::arg("path"), py::arg("rows"), py::arg("cols"),
+                   py::arg("tile_size") = TiledMatrix::DEFAULT_TILE_SIZE,
+                   py::arg("access") = TileAccess::Cached,
+                   py::arg("cache_bytes") = TiledMatrix::DEFAULT_CACHE_BYTES,
+                   "Create a zero-filled tiled matrix file")
+        .def_static("open", &TiledMatrix::open,
+                   py::arg("path"), py::arg("access") = TileAccess::Cached,
+                   py::arg("cache_bytes") = TiledMatrix::DEFAULT_CACHE_BYTES,
+                   "Open an existing tiled matrix file")
+        .def_static("from_matrix", &TiledMatrix::from_matrix,
+                   py::arg("matrix"), py::arg("path"),
+                   py::arg("tile_size") = TiledMatrix::DEFAULT_TILE_SIZE,
+                   py::arg("access") = TileAccess::Cached,
+                   py::arg("cache_bytes") = TiledMatrix::DEFAULT_CACHE_BYTES,
+                   "Write an in-memory matrix to a tiled file")
+        .def("rows", &TiledMatrix::rows, "Get number of rows")
+        .def("cols", &TiledMatrix::cols, "Get number of columns")
+        .def("tile_size", &TiledMatrix::tile_size, "Tile edge length")
+        .def("path", &TiledMatrix::path, "Backing file path")
+        .def("to_matrix", &TiledMatrix::to_matrix, "Load the whole matrix into memory")
+        .def("add", &TiledMatrix::add, py::arg("other"), py::arg("out_path"))
+        .def("subtract", &TiledMatrix::subtract, py::arg("other"), py::arg("out_path"))
+        .def("scalar", &TiledMatrix::scalar, py::arg("s"), py::arg("out_path"))
+        .def("multiply", &TiledMatrix::multiply, py::arg("other"), py::arg("out_path"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("transpose", &TiledMatrix::transpose, py::arg("out_path"))
+        .def("set_cache_budget", &TiledMatrix::set_cache_budget, py::arg("bytes"))
+        .def("cache_stats", &TiledMatrix::cache_stats)
+        .def("reset_cache_stats", &TiledMatrix::reset_cache_stats);
     
+    // Text I/O
+    m.def("read_csv", &read_csv,
+          py::arg("path"), py::arg("delimiter") = ',', py::arg("skip_header") = false,
+          py::arg("num_threads") = 0, py::call_guard<py::gil_scoped_release>(),
+          "Read a delimited text file in parallel");
+    m.def("write_csv", &write_csv,
+          py::arg("matrix"), py::arg("path"), py::arg("delimiter") = ',',
+          py::arg("precision") = -1, py::arg("num_threads") = 0,
+          py::call_guard<py::gil_scoped_release>(),
+          "Write a matrix as delimited text (precision < 0: shortest round-trip)");
+    m.def("read_matrix_market", &read_matrix_market,
+          py::arg("path"), py::arg("num_threads") = 0,
+          py::call_guard<py::gil_scoped_release>(),
+          "Read a Matrix Market file into a dense matrix");
+    m.def("read_matrix_market_sparse", &read_matrix_market_sparse,
+          py::arg("path"), py::arg("num_threads") = 0,
+          py::call_guard<py::gil_scoped_release>(),
+          "Read a Matrix Market file into a CSR sparse matrix");
+    m.def("write_matrix_market",
+          py::overload_cast<const Matrix&, const std::string&, int, size_t>(&write_matrix_market),
+          py::arg("matrix"), py::arg("path"), py::arg("precision") = -1, py::arg("num_threads") = 0,
+          py::call_guard<py::gil_scoped_release>(),
+          "Write a dense matrix in Matrix Market array format");
+    m.def("write_matrix_market",
+          py::overload_cast<const SparseMatrix&, const std::string&, int, size_t>(&write_matrix_market),
+          py::arg("matrix"), py::arg("path"), py::arg("precision") = -1, py::arg("num_threads") = 0,
+          py::call_guard<py::gil_scoped_release>(),
+          "Write a sparse matrix in Matrix Market coordinate format");
+
+    // Instrumentation
+    py::class_<OpStats>(m, "OpStats")
+        .def_readonly("op", &OpStats::op)
+        .def_readonly("backend", &OpStats::backend)
+        .def_readonly("calls", &OpStats::calls)
+        .def_readonly("total_seconds", &OpStats::total_seconds)
+        .def_readonly("min_seconds", &OpStats::min_seconds)
+        .def_readonly("max_seconds", &OpStats::max_seconds)
+        .def_readonly("time_histogram", &OpStats::time_histogram)
+        .def_readonly("flops", &OpStats::flops)
+        .def_readonly("bytes_read", &OpStats::bytes_read)
+        .def_readonly("bytes_written", &OpStats::bytes_written)
+        .def_readonly("allocations", &OpStats::allocations)
+        .def_readonly("bytes_allocated", &OpStats::bytes_allocated)
+        .def("__repr__", [](const OpStats& s) {
+            std::ostringstream oss;
+            oss << "<OpStats " << s.op << "/" << s.backend << " calls=" << s.calls
+                << " total_seconds=" << s.total_seconds << ">";
+            return oss.str();
+        });
+
+    py::class_<CollectiveStats>(m, "CollectiveStats")
+        .def_readonly("name", &CollectiveStats::name)
+        .def_readonly("calls", &CollectiveStats::calls)
+        .def_readonly("bytes", &CollectiveStats::bytes)
+        .def_readonly("total_seconds", &CollectiveStats::total_seconds);
+
+    m.def("set_instrumentation", &set_instrumentation, py::arg("enabled"),
+          "Turn per-op call, time, FLOP, byte and allocation counters on or off");
+    m.def("instrumentation_enabled", &instrumentation_enabled);
+    m.def("op_stats", &op_stats, "Per (op, backend) statistics collected so far");
+    m.def("collective_stats", &collective_stats, "Per MPI collective statistics on this rank");
+    m.def("reset_stats", &reset_stats, "Clear all collected statistics");
+    m.def("stats_report", &stats_report, "Statistics as a formatted table");
+
+    // Tracing
+    m.def("start_tracing", &start_tracing,
+          py::arg("events_per_thread") = DEFAULT_TRACE_EVENTS_PER_THREAD,
+          "Record begin/end events for ops, allocations and MPI collectives");
+    m.def("stop_tracing", &stop_tracing);
+    m.def("tracing_enabled", &tracing_enabled);
+    m.def("set_trace_rank", &set_trace_rank, py::arg("rank"), py::arg("clock_offset_us") = 0.0);
+    m.def("write_trace", &write_trace, py::arg("path"),
+          py::call_guard<py::gil_scoped_release>(),
+          "Write this process's events as Chrome trace JSON");
+    m.def("merge_traces", &merge_traces, py::arg("inputs"), py::arg("output"),
+          py::call_guard<py::gil_scoped_release>(),
+          "Merge per-rank trace files onto rank 0's clock");
+    #ifdef LUMIN_ENABLE_MPI
+    m.def("sync_trace_clocks", []() { sync_trace_clocks(MPI_COMM_WORLD); },
+          "Estimate each rank's clock offset to rank 0 (MPI_COMM_WORLD)");
+    m.def("gather_trace", [](const std::string& path) { gather_trace(MPI_COMM_WORLD, path); },
+          py::arg("path"), "Write per-rank traces and merge them on rank 0");
+    #endif
+
+    // Hardware counters
+    py::enum_<HwCounter>(m, "HwCounter")
+        .value("Cycles", HwCounter::Cycles)
+        .value("Instructions", HwCounter::Instructions)
+        .value("LLCMisses", HwCounter::LLCMisses)
+        .value("DTLBMisses", HwCounter::DTLBMisses)
+        .value("FPOps", HwCounter::FPOps);
+
+    py::class_<Roofline>(m, "Roofline")
+        .def(py::init([](double peak_gflops, double bandwidth_gbps) {
+            return Roofline{peak_gflops, bandwidth_gbps};
+        }), py::arg("peak_gflops"), py::arg("bandwidth_gbps"))
+        .def_readwrite("peak_gflops", &Roofline::peak_gflops)
+        .def_readwrite("bandwidth_gbps", &Roofline::bandwidth_gbps)
+        .def("ridge", &Roofline::ridge)
+        .def("attainable_gflops", &Roofline::attainable_gflops, py::arg("intensity"));
+
+    py::class_<HwCounterStats>(m, "HwCounterStats")
+        .def_readonly("op", &HwCounterStats::op)
+        .def_readonly("backend", &HwCounterStats::backend)
+        .def_readonly("calls", &HwCounterStats::calls)
+        .def_readonly("seconds", &HwCounterStats::seconds)
+        .def_readonly("analytic_flops", &HwCounterStats::analytic_flops)
+        .def_readonly("analytic_bytes", &HwCounterStats::analytic_bytes)
+        .def("count", &HwCounterStats::count, py::arg("counter"))
+        .def("ipc", &HwCounterStats::ipc)
+        .def("gflops", &HwCounterStats::gflops)
+        .def("arithmetic_intensity", &HwCounterStats::arithmetic_intensity);
+
+    m.def("start_hw_counters", &start_hw_counters,
+          "Read hardware counters around every op; False if none could be opened");
+    m.def("stop_hw_counters", &stop_hw_counters);
+    m.def("hw_counters_enabled", &hw_counters_enabled);
+    m.def("available_hw_counters", &available_hw_counters);
+    m.def("hw_counter_error", &hw_counter_error, "Why hardware counters are unavailable");
+    m.def("hw_counter_stats", &hw_counter_stats);
+    m.def("reset_hw_counters", &reset_hw_counters);
+    m.def("set_roofline", &set_roofline, py::arg("roofline"));
+    m.def("roofline", &roofline, py::call_guard<py::gil_scoped_release>(),
+          "Roofline ceilings, measured on first use unless set");
+    m.def("measure_roofline", &measure_roofline, py::arg("threads") = 0,
+          py::call_guard<py::gil_scoped_release>());
+    m.def("roofline_report", &roofline_report, py::call_guard<py::gil_scoped_release>(),
+          "IPC, GFLOP/s, arithmetic intensity and roofline placement per op");
+
+    // Memory accounting
+    py::register_exception<MemoryLimitError>(m, "MemoryLimitError", PyExc_MemoryError);
+
+    py::class_<MemoryPoolStats>(m, "MemoryPoolStats")
+        .def_readonly("backend", &MemoryPoolStats::backend)
+        .def_readonly("kind", &MemoryPoolStats::kind)
+        .def_readonly("current_bytes", &MemoryPoolStats::current_bytes)
+        .def_readonly("peak_bytes", &MemoryPoolStats::peak_bytes)
+        .def_readonly("allocations", &MemoryPoolStats::allocations)
+        .def_readonly("frees", &MemoryPoolStats::frees);
+
+    py::class_<MemoryStats>(m, "MemoryStats")
+        .def_readonly("current_bytes", &MemoryStats::current_bytes)
+        .def_readonly("peak_bytes", &MemoryStats::peak_bytes)
+        .def_readonly("allocations", &MemoryStats::allocations)
+        .def_readonly("frees", &MemoryStats::frees)
+        .def_readonly("limit_bytes", &MemoryStats::limit_bytes)
+        .def_readonly("pools", &MemoryStats::pools);
+
+    m.def("memory_stats", &memory_stats, "Live and peak bytes and allocation counts, in total and per pool");
+    m.def("set_memory_limit", &set_memory_limit, py::arg("bytes"),
+          "Soft limit on live bytes; allocations past it raise MemoryLimitError. 0 removes it");
+    m.def("memory_limit", &memory_limit);
+    m.def("reset_peak_memory", &reset_peak_memory);
+    m.def("memory_report", &memory_report);
+
+    // BLAS
+    py::enum_<Trans>(m, "Trans")
+        .value("No", Trans::No)
+        .value("Yes", Trans::Yes);
+
+    m.def("gemm", &gemm, py::arg("transA"), py::arg("transB"), py::arg("alpha"), py::arg("A"),
+          py::arg("B"), py::arg("beta"), py::arg("C"), py::call_guard<py::gil_scoped_release>(),
+          "C = alpha * op(A) * op(B) + beta * C, updating C in place");
+    m.def("gemv", &gemv, py::arg("transA"), py::arg("alpha"), py::arg("A"), py::arg("x"),
+          py::arg("beta"), py::arg("y"), py::call_guard<py::gil_scoped_release>(),
+          "y = alpha * op(A) * x + beta * y, updating y in place");
+    m.def("ger", &ger, py::arg("alpha"), py::arg("x"), py::arg("y"), py::arg("A"),
+          py::call_guard<py::gil_scoped_release>(), "A += alpha * x * y^T in place");
+    m.def("syrk", &syrk, py::arg("trans"), py::arg("alpha"), py::arg("A"), py::arg("beta"), py::arg("C"),
+          py::call_guard<py::gil_scoped_release>(),
+          "C = alpha * op(A) * op(A)^T + beta * C in place, computing one triangle and mirroring it");
+
+    py::enum_<Side>(m, "Side")
+        .value("Left", Side::Left)
+        .value("Right", Side::Right);
+    py::enum_<Diag>(m, "Diag")
+        .value("NonUnit", Diag::NonUnit)
+        .value("Unit", Diag::Unit);
+    m.def("trsm", &trsm, py::arg("side"), py::arg("uplo"), py::arg("transA"), py::arg("diag"),
+          py::arg("alpha"), py::arg("A"), py::arg("B"), py::call_guard<py::gil_scoped_release>(),
+          "B = alpha * op(A)^-1 * B (Side.Left) or alpha * B * op(A)^-1 (Side.Right) in place");
+
+    // Linear algebra
+    py::class_<LUFactors>(m, "LUFactors")
+        .def_readonly("lu", &LUFactors::lu)
+        .def_readonly("piv", &LUFactors::piv);
+    m.def("lu", &lu, py::arg("A"), py::call_guard<py::gil_scoped_release>(),
+          "Blocked LU with partial pivoting; raises if A is singular");
+    m.def("cholesky", &cholesky, py::arg("A"), py::call_guard<py::gil_scoped_release>(),
+          "Lower L with A = L * L^T; raises unless A is positive definite");
+    m.def("lu_solve", &lu_solve, py::arg("factors"), py::arg("B"), py::call_guard<py::gil_scoped_release>());
+    m.def("cholesky_solve", &cholesky_solve, py::arg("L"), py::arg("B"),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("solve", &solve, py::arg("A"), py::arg("B"), py::call_guard<py::gil_scoped_release>(),
+          "X with A * X = B for square A");
+    py::class_<QRFactors>(m, "QRFactors")
+        .def_readonly("qr", &QRFactors::qr)
+        .def_readonly("tau", &QRFactors::tau);
+    m.def("qr", &qr, py::arg("A"), py::call_guard<py::gil_scoped_release>(),
+          "Blocked Householder QR in compact WY form");
+    m.def("qr_q", &qr_q, py::arg("factors"), py::call_guard<py::gil_scoped_release>());
+    m.def("qr_r", &qr_r, py::arg("factors"), py::call_guard<py::gil_scoped_release>());
+    m.def("lstsq", &lstsq, py::arg("A"), py::arg("B"), py::call_guard<py::gil_scoped_release>(),
+          "X minimizing ||A * X - B|| for full-rank A with at least as many rows as columns");
+    m.def("multi_dot", &multi_dot, py::arg("chain"), py::call_guard<py::gil_scoped_release>(),
+          "Product of a list of matrices, multiplied in the order with the fewest flops");
+    py::class_<SVDResult>(m, "SVDResult")
+        .def_readonly("U", &SVDResult::U)
+        .def_readonly("S", &SVDResult::S)
+        .def_readonly("V", &SVDResult::V);
+    m.def("randomized_svd", &randomized_svd, py::arg("A"), py::arg("k"), py::arg("oversample") = 10,
+          py::arg("power_iterations") = 2, py::arg("seed") = 0, py::call_guard<py::gil_scoped_release>(),
+          "Rank-k truncated SVD by randomized range finding");
+
+    // Distances
+    py::class_<KNNResult>(m, "KNNResult")
+        .def_readonly("distances", &KNNResult::distances)
+        .def_readonly("indices", &KNNResult::indices);
+    m.def("sq_distances", &sq_distances, py::arg("A"), py::arg("B"), py::call_guard<py::gil_scoped_release>(),
+          "Squared Euclidean distances between the rows of A and B, from one fused pass");
+    m.def("knn", &knn, py::arg("A"), py::arg("B"), py::arg("k"), py::call_guard<py::gil_scoped_release>(),
+          "The k rows of B nearest to each row of A, without storing the distance matrix");
+
+    // Reductions
+    py::enum_<Reduction>(m, "Reduction")
+        .value("Sum", Reduction::Sum)
+        .value("Mean", Reduction::Mean)
+        .value("Min", Reduction::Min)
+        .value("Max", Reduction::Max)
+        .value("L1", Reduction::L1)
+        .value("L2", Reduction::L2)
+        .value("LogSumExp", Reduction::LogSumExp);
+    py::enum_<Axis>(m, "Axis")
+        .value("Rows", Axis::Rows)
+        .value("Cols", Axis::Cols);
+    py::enum_<RowTransform>(m, "RowTransform")
+        .value("Softmax", RowTransform::Softmax)
+        .value("Normalize", RowTransform::Normalize);
+    m.def("reduce", &reduce, py::arg("op"), py::arg("axis"), py::arg("A"),
+          py::call_guard<py::gil_scoped_release>(),
+          "op over each row (Axis.Rows, a column) or each column (Axis.Cols, a row) of A");
+    m.def("argmax", &argmax, py::arg("axis"), py::arg("A"), py::call_guard<py::gil_scoped_release>(),
+          "Index of the first largest entry of each row or column");
+    m.def("transform_rows", &transform_rows, py::arg("op"), py::arg("A"),
+          py::call_guard<py::gil_scoped_release>(), "Softmax or L2 normalization of each row, in one fused pass");
+
+    // Elementwise functions, each one map() or zip() pass in C++
+    m.def("exp", [](const Matrix& A) { return lumin::map(A, ufunc::Exp()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("log", [](const Matrix& A) { return lumin::map(A, ufunc::Log()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("sqrt", [](const Matrix& A) { return lumin::map(A, ufunc::Sqrt()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("abs", [](const Matrix& A) { return lumin::map(A, ufunc::Abs()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("square", [](const Matrix& A) { return lumin::map(A, ufunc::Square()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("tanh", [](const Matrix& A) { return lumin::map(A, ufunc::Tanh()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("sigmoid", [](const Matrix& A) { return lumin::map(A, ufunc::Sigmoid()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>(), "1 / (1 + exp(-x)) of each entry");
+    m.def("relu", [](const Matrix& A) { return lumin::map(A, ufunc::Relu()); }, py::arg("A"),
+          py::call_guard<py::gil_scoped_release>(), "max(x, 0) of each entry");
+    m.def("clamp", [](const Matrix& A, double lo, double hi) { return lumin::map(A, ufunc::Clamp{lo, hi}); },
+          py::arg("A"), py::arg("lo"), py::arg("hi"), py::call_guard<py::gil_scoped_release>(),
+          "Each entry limited to [lo, hi]");
+    m.def("power", [](const Matrix& A, double p) { return lumin::map(A, ufunc::Pow{p}); },
+          py::arg("A"), py::arg("p"), py::call_guard<py::gil_scoped_release>(), "Each entry raised to p");
+    m.def("maximum", [](const Matrix& A, const Matrix& B) { return lumin::zip(A, B, ufunc::Maximum()); },
+          py::arg("A"), py::arg("B"), py::call_guard<py::gil_scoped_release>(),
+          "Elementwise maximum of two matrices of one shape");
+    m.def("minimum", [](const Matrix& A, const Matrix& B) { return lumin::zip(A, B, ufunc::Minimum()); },
+          py::arg("A"), py::arg("B"), py::call_guard<py::gil_scoped_release>(),
+          "Elementwise minimum of two matrices of one shape");
+    m.def("divide", [](const Matrix& A, const Matrix& B) { return lumin::zip(A, B, ufunc::Divide()); },
+          py::arg("A"), py::arg("B"), py::call_guard<py::gil_scoped_release>(),
+          "Elementwise quotient of two matrices of one shape");
+
+    // Graphs
+    py::class_<Graph>(m, "Graph")
+        .def(py::init<>())
+        .def("begin_capture", &Graph::begin_capture)
+        .def("input", &Graph::input, py::arg("matrix"),
+             "Mark a matrix as the next replay input; call before the ops that read it")
+        .def("output", &Graph::output, py::arg("matrix"))
+        .def("end_capture", &Graph::end_capture)
+        .def("__enter__", [](Graph& g) -> Graph& {
+            g.begin_capture();
+            return g;
+        }, py::return_value_policy::reference)
+        .def("__exit__", [](Graph& g, py::object, py::object, py::object) {
+            g.end_capture();
+        })
+        .def("replay", &Graph::replay, py::arg("inputs"), py::call_guard<py::gil_scoped_release>(),
+             "Run the optimized graph on new inputs; returns the outputs")
+        .def("describe", &Graph::describe)
+        .def("nodes", &Graph::nodes)
+        .def("arena_bytes", &Graph::arena_bytes);
+
+    // Async
+    bind_future<Matrix>(m, "MatrixFuture");
+    bind_future<double>(m, "ScalarFuture");
+
+    py::class_<AsyncOperand>(m, "AsyncOperand")
+        .def(py::init<const Matrix&>())
+        .def(py::init<Future<Matrix>>());
+    py::implicitly_convertible<Matrix, AsyncOperand>();
+    py::implicitly_convertible<Future<Matrix>, AsyncOperand>();
+
+    // a stream finishing its queue may need the GIL to settle awaited futures
+    struct ReleaseGilDelete {
+        void operator()(Stream* s) const {
+            py::gil_scoped_release release;
+            delete s;
+        }
+    };
+    py::class_<Stream, std::unique_ptr<Stream, ReleaseGilDelete>>(m, "Stream")
+        .def(py::init<>())
+        .def("add", &Stream::add, py::arg("A"), py::arg("B"))
+        .def("subtract", &Stream::subtract, py::arg("A"), py::arg("B"))
+        .def("multiply", &Stream::multiply, py::arg("A"), py::arg("B"))
+        .def("scalar", &Stream::scalar, py::arg("s"), py::arg("A"))
+        .def("transpose", &Stream::transpose, py::arg("A"))
+        .def("dot", &Stream::dot, py::arg("A"), py::arg("B"))
+        .def("synchronize", &Stream::synchronize, py::call_guard<py::gil_scoped_release>(),
+             "Block until every op enqueued so far has run");
+
+    m.def("add_async", &add_async, py::arg("A"), py::arg("B"));
+    m.def("subtract_async", &subtract_async, py::arg("A"), py::arg("B"));
+    m.def("multiply_async", &multiply_async, py::arg("A"), py::arg("B"));
+    m.def("scalar_async", &scalar_async, py::arg("s"), py::arg("A"));
+    m.def("transpose_async", &transpose_async, py::arg("A"));
+    m.def("dot_async", &dot_async, py::arg("A"), py::arg("B"));
+
+    // Backends
+    py::class_<Backend, std::shared_ptr<Backend>>(m, "Backend")
+        .def_property_readonly("name", &Backend::name);
+
+    py::enum_<AutoOp>(m, "AutoOp")
+        .value("Elementwise", AutoOp::Elementwise)
+        .value("Transpose", AutoOp::Transpose)
+        .value("Dot", AutoOp::Dot)
+        .value("Multiply", AutoOp::Multiply)
+        .value("Sparse", AutoOp::Sparse);
+    m.attr("AUTO_NEVER") = AUTO_NEVER;
+
+    py::class_<AutoThresholds>(m, "AutoThresholds")
+        .def(py::init<>())
+        .def_readwrite("parallel", &AutoThresholds::parallel)
+        .def_readwrite("distributed", &AutoThresholds::distributed);
+
+    py::class_<AutoBackend, Backend, std::shared_ptr<AutoBackend>>(m, "AutoBackend")
+        .def("route", [](AutoBackend& b, AutoOp op, uint64_t work) {
+            return std::string(b.route(op, work).name());
+        }, py::arg("op"), py::arg("work"), "Name of the backend an op of this class and work runs on")
+        .def("thresholds", &AutoBackend::thresholds, py::call_guard<py::gil_scoped_release>())
+        .def("set_thresholds", &AutoBackend::set_thresholds, py::arg("thresholds"))
+        .def("calibrate", &AutoBackend::calibrate, py::call_guard<py::gil_scoped_release>(),
+             "Re-run the crossover micro-benchmark and update the on-disk cache")
+        .def_static("cache_path", &AutoBackend::cache_path);
+
+    py::class_<ThreadPoolBackend, Backend, std::shared_ptr<ThreadPoolBackend>>(m, "ThreadPoolBackend")
+        .def_property_readonly("threads", [](ThreadPoolBackend& b) { return b.pool().threads(); });
+
     // Backend creation functions
     m.def("create_cpu_backend", &create_cpu_backend,
           "Create a CPU backend");
+
+    m.def("create_auto_backend", [] { return std::make_shared<AutoBackend>(); },
+          "Create a backend that picks CPU or OpenMP per op from calibrated thresholds");
+
+    m.def("create_threadpool_backend", [](size_t threads) {
+        if (threads == 0) {
+            return std::make_shared<ThreadPoolBackend>();
+        }
+        return std::make_shared<ThreadPoolBackend>(std::make_shared<ThreadPool>(threads));
+    }, py::arg("threads") = 0,
+       "Create a work-stealing thread pool backend; 0 shares the default pool");
     
     #ifdef LUMIN_ENABLE_OPENMP
     m.def("create_omp_backend", &create_omp_backend,
@@ -134,29 +759,6 @@ PYBIND11_MODULE(lumin, m) {
           "Get the current default backend");
     
     // Convenience function to set backend by name
-    m.def("set_backend", [](const std::string& name) {
-        std::shared_ptr<Backend> backend;
-        if (name == "cpu") {
-            backend = create_cpu_backend();
-        }
-        #ifdef LUMIN_ENABLE_OPENMP
-        else if (name == "openmp" || name == "omp") {
-            backend = create_omp_backend();
-        }
-        #endif
-        #ifdef LUMIN_ENABLE_CUDA
-        else if (name == "cuda") {
-            backend = create_cuda_backend();
-        }
-        #endif
-        #ifdef LUMIN_ENABLE_MPI
-        else if (name == "mpi") {
-            backend = create_mpi_backend(MPI_COMM_WORLD);
-        }
-        #endif
-        else {
-            throw std::runtime_error("Unknown backend: " + name);
-        }
-        set_default_backend(backend);
-    }, py::arg("name"), "Set backend by name (cpu, openmp, cuda, mpi)");
+    m.def("set_backend", &set_backend, py::arg("name"),
+          "Set backend by name (cpu, openmp, cuda, mpi, auto, threadpool)");
 }
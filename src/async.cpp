@@ -0,0 +1,126 @@
+#include "lumin/async.hpp"
+#include "graph_capture.hpp"
+
+#include <deque>
+#include <thread>
+
+namespace lumin {
+
+/* Stream
+ * One thread per stream rather than tasks on default_thread_pool(): a pool
+ * sized for one core has no workers of its own and would only run tasks
+ * when someone waits, and an op that blocks on another stream's Future
+ * would hold a pool thread that the other stream may need. */
+
+struct Stream::Impl {
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::deque<std::function<void()>> queue;
+  bool busy = false;
+  bool stop = false;
+  std::thread worker;
+};
+
+Stream::Stream() : impl(new Impl()) {
+  impl->worker = std::thread([this] {
+    std::unique_lock<std::mutex> lock(impl->mutex);
+    for (;;) {
+      impl->wake.wait(lock, [this] { return impl->stop || !impl->queue.empty(); });
+      if (impl->queue.empty()) {
+        return;
+      }
+      std::function<void()> task = std::move(impl->queue.front());
+      impl->queue.pop_front();
+      impl->busy = true;
+      lock.unlock();
+      task();
+      // drop the task's operands before reporting it done
+      task = nullptr;
+      lock.lock();
+      impl->busy = false;
+      if (impl->queue.empty()) {
+        impl->idle.notify_all();
+      }
+    }
+  });
+}
+
+Stream::~Stream() {
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->stop = true;
+  }
+  impl->wake.notify_one();
+  impl->worker.join();
+}
+
+void Stream::push(std::function<void()> task) {
+  // the op runs on the stream's thread, which is not capturing
+  detail::refuse_capture("async op");
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->queue.push_back(std::move(task));
+  }
+  impl->wake.notify_one();
+}
+
+void Stream::synchronize() {
+  std::unique_lock<std::mutex> lock(impl->mutex);
+  impl->idle.wait(lock, [this] { return impl->queue.empty() && !impl->busy; });
+}
+
+Future<Matrix> Stream::add(AsyncOperand A, AsyncOperand B) {
+  return enqueue([A, B] { return A.get().add(B.get()); });
+}
+
+Future<Matrix> Stream::subtract(AsyncOperand A, AsyncOperand B) {
+  return enqueue([A, B] { return A.get().subtract(B.get()); });
+}
+
+Future<Matrix> Stream::multiply(AsyncOperand A, AsyncOperand B) {
+  return enqueue([A, B] { return A.get().multiply(B.get()); });
+}
+
+Future<Matrix> Stream::scalar(double s, AsyncOperand A) {
+  return enqueue([s, A] { return A.get().scalar(s); });
+}
+
+Future<Matrix> Stream::transpose(AsyncOperand A) {
+  return enqueue([A] { return A.get().transpose(); });
+}
+
+Future<double> Stream::dot(AsyncOperand A, AsyncOperand B) {
+  return enqueue([A, B] { return A.get().dot(B.get()); });
+}
+
+Stream& default_stream() {
+  static Stream stream;
+  return stream;
+}
+
+Future<Matrix> add_async(AsyncOperand A, AsyncOperand B) {
+  return default_stream().add(std::move(A), std::move(B));
+}
+
+Future<Matrix> subtract_async(AsyncOperand A, AsyncOperand B) {
+  return default_stream().subtract(std::move(A), std::move(B));
+}
+
+Future<Matrix> multiply_async(AsyncOperand A, AsyncOperand B) {
+  return default_stream().multiply(std::move(A), std::move(B));
+}
+
+Future<Matrix> scalar_async(double s, AsyncOperand A) {
+  return default_stream().scalar(s, std::move(A));
+}
+
+Future<Matrix> transpose_async(AsyncOperand A) {
+  return default_stream().transpose(std::move(A));
+}
+
+Future<double> dot_async(AsyncOperand A, AsyncOperand B) {
+  return default_stream().dot(std::move(A), std::move(B));
+}
+
+}
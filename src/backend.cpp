@@ -0,0 +1,224 @@
+#include "lumin.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace lumin {
+
+static void check_spmm_dims(const SparseMatrix& A, const Matrix& B, const char* op) {
+  if (A.cols() != B.rows()) {
+    std::ostringstream oss;
+    oss << "Sparse " << op << " dimension mismatch: "
+        << "(" << A.rows() << "x" << A.cols() << ") vs "
+        << "(" << B.rows() << "x" << B.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+Matrix Backend::hadamard(const Matrix& A, const Matrix& B) {
+  detail::check_broadcast_dims("hadamard", A, B);
+  size_t rows = detail::broadcast_extent(A.rows(), B.rows());
+  size_t cols = detail::broadcast_extent(A.cols(), B.cols());
+  Matrix R(rows, cols);
+  detail::broadcast_rows(detail::ElementOp::Multiply, 0, rows, cols, A.data(), A.rows(), A.cols(),
+                         B.data(), B.rows(), B.cols(), R.data());
+  return R;
+}
+
+Matrix Backend::spmv(const SparseMatrix& A, const Matrix& x) {
+  if (x.cols() != 1) {
+    throw std::runtime_error("spmv: x must be a column vector");
+  }
+  check_spmm_dims(A, x, "spmv");
+  return spmm(A, x);
+}
+
+Matrix Backend::spmm(const SparseMatrix& A, const Matrix& B) {
+  check_spmm_dims(A, B, "spmm");
+  size_t n = B.cols();
+  Matrix R(A.rows(), n);
+
+  const std::vector<size_t>& ptr = A.ptr();
+  const std::vector<size_t>& idx = A.indices();
+  const std::vector<double>& val = A.values();
+
+  if (A.format() == SparseFormat::CSR) {
+    for (size_t i = 0; i < A.rows(); i++) {
+      double* r_row = R.data() + i * n;
+      for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+        double a = val[p];
+        const double* b_row = B.data() + idx[p] * n;
+        for (size_t j = 0; j < n; j++) {
+          r_row[j] += a * b_row[j];
+        }
+      }
+    }
+  }
+  else {
+    for (size_t k = 0; k < A.cols(); k++) {
+      const double* b_row = B.data() + k * n;
+      for (size_t p = ptr[k]; p < ptr[k + 1]; p++) {
+        double a = val[p];
+        double* r_row = R.data() + idx[p] * n;
+        for (size_t j = 0; j < n; j++) {
+          r_row[j] += a * b_row[j];
+        }
+      }
+    }
+  }
+  return R;
+}
+
+void Backend::gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+                   const Matrix& B, double beta, Matrix& C) {
+  detail::check_gemm_dims(transA, transB, A, B, C);
+  size_t k = detail::op_cols(transA, A.rows(), A.cols());
+  detail::gemm_rows(transA, transB, 0, C.rows(), C.cols(), k, alpha, A.data(), A.cols(),
+                    B.data(), B.cols(), beta, C.data(), C.cols());
+}
+
+void Backend::gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+                   double beta, Matrix& y) {
+  detail::check_gemv_dims(transA, A, x, y);
+  if (transA == Trans::No) {
+    detail::gemv_rows(0, A.rows(), A.cols(), alpha, A.data(), A.cols(), x.data(), beta, y.data());
+  }
+  else {
+    detail::gemv_t_cols(0, A.cols(), A.rows(), alpha, A.data(), A.cols(), x.data(), beta, y.data());
+  }
+}
+
+void Backend::ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) {
+  detail::check_ger_dims(x, y, A);
+  detail::ger_rows(0, A.rows(), A.cols(), alpha, x.data(), y.data(), A.data(), A.cols());
+}
+
+void Backend::syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) {
+  detail::check_syrk_dims(trans, A, C);
+  size_t n = C.rows(), k = detail::op_cols(trans, A.rows(), A.cols());
+  // row blocks keep the wasted upper part of each diagonal block small
+  for (size_t i0 = 0; i0 < n; i0 += 32) {
+    detail::syrk_rows(trans, i0, std::min(n, i0 + 32), k, alpha, A.data(), A.cols(), beta, C.data(), n, 0);
+  }
+  detail::mirror_lower(0, n, n, C.data(), n);
+}
+
+void Backend::trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+                   const Matrix& A, Matrix& B) {
+  detail::check_trsm_dims(side, A, B);
+  size_t slices = (side == Side::Left) ? B.cols() : B.rows();
+  detail::trsm_slice(side, uplo, transA, diag, 0, slices, A.rows(), alpha, A.data(), A.cols(),
+                     B.data(), B.cols());
+}
+
+void Backend::lu(Matrix& A, std::vector<size_t>& piv) {
+  piv.resize(std::min(A.rows(), A.cols()));
+  detail::check_lu_pivot(detail::lu_factor(A.rows(), A.cols(), A.data(), A.cols(), piv.data()));
+}
+
+void Backend::cholesky(Matrix& A) {
+  if (A.rows() != A.cols()) {
+    throw std::runtime_error("cholesky: matrix must be square");
+  }
+  size_t n = A.rows();
+  detail::check_positive_definite(detail::cholesky_factor(n, A.data(), n));
+  detail::zero_upper(0, n, n, A.data(), n);
+}
+
+void Backend::qr(Matrix& A, std::vector<double>& tau) {
+  tau.resize(std::min(A.rows(), A.cols()));
+  detail::qr_factor(A.rows(), A.cols(), A.data(), A.cols(), tau.data());
+}
+
+Matrix Backend::lstsq(const Matrix& A, const Matrix& B) {
+  detail::check_lstsq_dims(A, B);
+  size_t m = A.rows(), n = A.cols(), r = B.cols();
+  Matrix F(m, n);
+  std::copy(A.data(), A.data() + m * n, F.data());
+  std::vector<double> tau;
+  qr(F, tau);
+  detail::check_full_rank(n, F.data(), n);
+
+  // Q^T * B, whose first n rows R * X must match
+  std::vector<double> QtB(B.data(), B.data() + m * r);
+  detail::apply_q(Trans::Yes, m, n, F.data(), n, tau.data(), 0, r, QtB.data(), r);
+  Matrix X(n, r);
+  std::copy(QtB.begin(), QtB.begin() + n * r, X.data());
+  detail::trsm_slice(Side::Left, Triangle::Upper, Trans::No, Diag::NonUnit, 0, r, n, 1.0,
+                     F.data(), n, X.data(), r);
+  return X;
+}
+
+Matrix Backend::sq_distances(const Matrix& A, const Matrix& B) {
+  detail::check_distance_dims(A, B);
+  size_t n = A.rows(), m = B.rows(), d = A.cols();
+  std::vector<double> an(n), bn(m);
+  detail::row_sq_norms(0, n, d, A.data(), d, an.data());
+  detail::row_sq_norms(0, m, d, B.data(), d, bn.data());
+  Matrix D(n, m);
+  detail::sq_distance_rows(0, n, m, d, A.data(), d, B.data(), d, an.data(), bn.data(), D.data(), m);
+  return D;
+}
+
+void Backend::knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+                  std::vector<size_t>& indices) {
+  detail::check_knn_dims(A, B, k);
+  size_t n = A.rows(), m = B.rows(), d = A.cols();
+  std::vector<double> an(n), bn(m);
+  detail::row_sq_norms(0, n, d, A.data(), d, an.data());
+  detail::row_sq_norms(0, m, d, B.data(), d, bn.data());
+  distances = Matrix(n, k);
+  indices.resize(n * k);
+  detail::knn_rows(0, n, m, d, k, A.data(), d, B.data(), d, an.data(), bn.data(),
+                   distances.data(), indices.data());
+}
+
+Matrix Backend::reduce(Reduction op, Axis axis, const Matrix& A) {
+  size_t m = A.rows(), n = A.cols();
+  if (axis == Axis::Rows) {
+    Matrix R(m, 1);
+    detail::reduce_rows(op, 0, m, n, A.data(), n, R.data());
+    return R;
+  }
+  Matrix R(1, n);
+  std::vector<double> shift;
+  if (op == Reduction::LogSumExp) {
+    shift.resize(n);
+    detail::reduce_cols_init(Reduction::Max, 0, n, shift.data());
+    detail::reduce_cols_fold(Reduction::Max, 0, m, 0, n, A.data(), n, nullptr, shift.data());
+  }
+  detail::reduce_cols_init(op, 0, n, R.data());
+  detail::reduce_cols_fold(op, 0, m, 0, n, A.data(), n, shift.data(), R.data());
+  detail::reduce_cols_finish(op, m, 0, n, shift.data(), R.data());
+  return R;
+}
+
+std::vector<size_t> Backend::argmax(Axis axis, const Matrix& A) {
+  detail::check_argmax_dims(axis, A);
+  size_t m = A.rows(), n = A.cols();
+  if (axis == Axis::Rows) {
+    std::vector<size_t> where(m);
+    detail::argmax_rows(0, m, n, A.data(), n, where.data());
+    return where;
+  }
+  std::vector<double> best(n, -std::numeric_limits<double>::infinity());
+  std::vector<size_t> where(n, detail::npos);
+  detail::argmax_cols_fold(0, m, 0, n, A.data(), n, best.data(), where.data());
+  return where;
+}
+
+Matrix Backend::transform_rows(RowTransform op, const Matrix& A) {
+  size_t m = A.rows(), n = A.cols();
+  Matrix R(m, n);
+  detail::transform_rows(op, 0, m, n, A.data(), n, R.data(), n);
+  return R;
+}
+
+void Backend::parallel_ranges(size_t n, const std::function<void(size_t, size_t)>& body) {
+  if (n > 0) body(0, n);
+}
+
+}
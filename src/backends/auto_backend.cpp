@@ -0,0 +1,455 @@
+#include "lumin.hpp"
+#include "lumin/auto_backend.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef LUMIN_ENABLE_OPENMP
+#include <omp.h>
+#endif
+
+#ifdef LUMIN_ENABLE_MPI
+#include <mpi.h>
+#endif
+
+namespace lumin {
+
+static const char* AUTO_OP_NAMES[AUTO_OP_KINDS] = {"elementwise", "transpose", "dot", "multiply", "sparse"};
+
+struct AutoBackend::Impl {
+  std::shared_ptr<Backend> serial, parallel, distributed;
+  int rank = 0, size = 1;
+#ifdef LUMIN_ENABLE_MPI
+  MPI_Comm comm = MPI_COMM_NULL;
+#endif
+
+  // read on every op without the lock once ready is set
+  std::atomic<bool> ready{false};
+  std::atomic<uint64_t> parallel_at[AUTO_OP_KINDS];
+  std::atomic<uint64_t> distributed_at[AUTO_OP_KINDS];
+  std::mutex mutex;
+
+  void store(const AutoThresholds& t) {
+    for (size_t k = 0; k < AUTO_OP_KINDS; k++) {
+      parallel_at[k].store(t.parallel[k], std::memory_order_relaxed);
+      distributed_at[k].store(t.distributed[k], std::memory_order_relaxed);
+    }
+    ready.store(true, std::memory_order_release);
+  }
+
+  AutoThresholds load() const {
+    AutoThresholds t;
+    for (size_t k = 0; k < AUTO_OP_KINDS; k++) {
+      t.parallel[k] = parallel_at[k].load(std::memory_order_relaxed);
+      t.distributed[k] = distributed_at[k].load(std::memory_order_relaxed);
+    }
+    return t;
+  }
+
+  static int threads() {
+#ifdef LUMIN_ENABLE_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  // thresholds measured here only hold on a machine with the same shape
+  std::string signature() const {
+    std::ostringstream oss;
+    oss << "cpus=" << std::thread::hardware_concurrency() << " threads=" << threads()
+        << " ranks=" << (distributed ? size : 1);
+    return oss.str();
+  }
+
+  bool read_cache(AutoThresholds& t) const;
+  void write_cache(const AutoThresholds& t) const;
+  void share(AutoThresholds& t) const;
+  AutoThresholds calibrate();
+  void ensure_ready();
+};
+
+/* Cache file
+ * "signature <signature>" followed by one "<op class> <parallel>
+ * <distributed>" line per op class, with "never" for AUTO_NEVER. */
+
+static std::string threshold_text(uint64_t v) {
+  return v == AUTO_NEVER ? "never" : std::to_string(v);
+}
+
+static bool parse_threshold(const std::string& s, uint64_t& v) {
+  if (s == "never") {
+    v = AUTO_NEVER;
+    return true;
+  }
+  char* end = nullptr;
+  v = std::strtoull(s.c_str(), &end, 10);
+  return !s.empty() && *end == '\0';
+}
+
+bool AutoBackend::Impl::read_cache(AutoThresholds& t) const {
+  std::string path = AutoBackend::cache_path();
+  if (path.empty()) return false;
+  std::ifstream in(path);
+  std::string key, sig;
+  if (!in || !(in >> key) || key != "signature" || !std::getline(in >> std::ws, sig) || sig != signature()) {
+    return false;
+  }
+  bool seen[AUTO_OP_KINDS] = {};
+  std::string name, par, dist;
+  while (in >> name >> par >> dist) {
+    size_t k = std::find(AUTO_OP_NAMES, AUTO_OP_NAMES + AUTO_OP_KINDS, name) - AUTO_OP_NAMES;
+    if (k == AUTO_OP_KINDS || !parse_threshold(par, t.parallel[k]) || !parse_threshold(dist, t.distributed[k])) {
+      return false;
+    }
+    seen[k] = true;
+  }
+  return std::all_of(seen, seen + AUTO_OP_KINDS, [](bool s) { return s; });
+}
+
+// best effort: an unwritable cache only means calibrating again next time
+void AutoBackend::Impl::write_cache(const AutoThresholds& t) const {
+  std::string path = AutoBackend::cache_path();
+  if (path.empty()) return;
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+  std::ofstream out(path, std::ios::trunc);
+  out << "signature " << signature() << "\n";
+  for (size_t k = 0; k < AUTO_OP_KINDS; k++) {
+    out << AUTO_OP_NAMES[k] << " " << threshold_text(t.parallel[k]) << " "
+        << threshold_text(t.distributed[k]) << "\n";
+  }
+}
+
+// every rank adopts rank 0's thresholds so all of them route alike
+void AutoBackend::Impl::share(AutoThresholds& t) const {
+#ifdef LUMIN_ENABLE_MPI
+  if (distributed) {
+    MPI_Bcast(t.parallel.data(), AUTO_OP_KINDS, MPI_UINT64_T, 0, comm);
+    MPI_Bcast(t.distributed.data(), AUTO_OP_KINDS, MPI_UINT64_T, 0, comm);
+  }
+#else
+  (void)t;
+#endif
+}
+
+/* Calibration
+ * Each op class runs on a geometric series of sizes on every backend. A
+ * backend takes over at the smallest sampled size from which it beats the
+ * alternatives at every larger sample. */
+
+static const double NOT_AVAILABLE = std::numeric_limits<double>::infinity();
+
+// Best per-call seconds over a few rounds. Small ops are batched so a round
+// is long enough to time; the batch depends only on the work, so MPI ranks
+// stay in step.
+template <class F>
+static double time_op(uint64_t work, F&& run) {
+  uint64_t batch = std::max<uint64_t>(1, (uint64_t(1) << 16) / std::max<uint64_t>(work, 1));
+  run();
+  double best = NOT_AVAILABLE;
+  for (int round = 0; round < 3; round++) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t b = 0; b < batch; b++) {
+      run();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    best = std::min(best, secs / batch);
+  }
+  return best;
+}
+
+static uint64_t crossover(const std::vector<uint64_t>& work, const std::vector<double>& incumbent,
+                          const std::vector<double>& candidate) {
+  uint64_t at = AUTO_NEVER;
+  for (size_t i = work.size(); i-- > 0; ) {
+    if (!(candidate[i] < incumbent[i])) break;
+    at = work[i];
+  }
+  return at;
+}
+
+// a 5-point band, about the sparsity of a 2D stencil
+static SparseMatrix banded_sparse(size_t n) {
+  std::vector<size_t> ri, ci;
+  std::vector<double> v;
+  for (size_t i = 0; i < n; i++) {
+    for (size_t off : {size_t(0), size_t(1), size_t(2)}) {
+      if (i + off < n) {
+        ri.push_back(i); ci.push_back(i + off); v.push_back(1.0);
+        if (off) { ri.push_back(i + off); ci.push_back(i); v.push_back(1.0); }
+      }
+    }
+  }
+  return SparseMatrix::from_coo(n, n, ri, ci, v);
+}
+
+AutoThresholds AutoBackend::Impl::calibrate() {
+  AutoThresholds t;
+  // with one thread OpenMP can only lose, whatever the timer noise says
+  Backend* backends[3] = {serial.get(), threads() > 1 ? parallel.get() : nullptr, distributed.get()};
+
+  for (size_t k = 0; k < AUTO_OP_KINDS; k++) {
+    AutoOp op = static_cast<AutoOp>(k);
+    std::vector<uint64_t> work;
+    std::vector<double> times[3];
+
+    std::vector<size_t> sizes;
+    if (op == AutoOp::Multiply) sizes = {8, 16, 32, 64, 128, 256};
+    else if (op == AutoOp::Sparse) sizes = {1 << 10, 1 << 12, 1 << 14, 1 << 16, 1 << 18};
+    else sizes = {16, 32, 64, 128, 256, 512, 1024};
+
+    for (size_t n : sizes) {
+      Matrix A, B, x;
+      SparseMatrix S;
+      uint64_t w;
+      if (op == AutoOp::Sparse) {
+        S = banded_sparse(n);
+        x = Matrix(n, 1);
+        w = S.nnz();
+      }
+      else {
+        A = Matrix(n, n);
+        B = Matrix(n, n);
+        w = (op == AutoOp::Multiply) ? uint64_t(n) * n * n : uint64_t(n) * n;
+      }
+      work.push_back(w);
+
+      for (int b = 0; b < 3; b++) {
+        Backend* be = backends[b];
+        if (!be) {
+          times[b].push_back(NOT_AVAILABLE);
+          continue;
+        }
+        times[b].push_back(time_op(w, [&] {
+          switch (op) {
+            case AutoOp::Elementwise: be->add(A, B); break;
+            case AutoOp::Transpose: be->transpose(A); break;
+            case AutoOp::Dot: be->dot(A, B); break;
+            case AutoOp::Multiply: be->multiply(A, B); break;
+            case AutoOp::Sparse: be->spmv(S, x); break;
+          }
+        }));
+      }
+    }
+
+    t.parallel[k] = crossover(work, times[0], times[1]);
+    std::vector<double> local(work.size());
+    for (size_t i = 0; i < work.size(); i++) {
+      local[i] = std::min(times[0][i], times[1][i]);
+    }
+    t.distributed[k] = crossover(work, local, times[2]);
+  }
+
+  share(t);
+  if (rank == 0) {
+    write_cache(t);
+  }
+  store(t);
+  return t;
+}
+
+// Collective under MPI: rank 0 decides between the cache and calibrating.
+void AutoBackend::Impl::ensure_ready() {
+  if (ready.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (ready.load(std::memory_order_relaxed)) return;
+
+  AutoThresholds t;
+  int cached = (rank == 0) ? read_cache(t) : 0;
+#ifdef LUMIN_ENABLE_MPI
+  if (distributed) {
+    MPI_Bcast(&cached, 1, MPI_INT, 0, comm);
+  }
+#endif
+  if (cached) {
+    share(t);
+    store(t);
+  }
+  else {
+    calibrate();
+  }
+}
+
+AutoBackend::AutoBackend() : impl(new Impl()) {
+  impl->serial = create_cpu_backend();
+#ifdef LUMIN_ENABLE_OPENMP
+  impl->parallel = create_omp_backend();
+#endif
+}
+
+#ifdef LUMIN_ENABLE_MPI
+AutoBackend::AutoBackend(MPI_Comm comm) : AutoBackend() {
+  impl->comm = comm;
+  impl->distributed = create_mpi_backend(comm);
+  MPI_Comm_rank(comm, &impl->rank);
+  MPI_Comm_size(comm, &impl->size);
+}
+#endif
+
+AutoBackend::~AutoBackend() = default;
+
+Backend& AutoBackend::route(AutoOp op, uint64_t work) {
+  impl->ensure_ready();
+  size_t k = static_cast<size_t>(op);
+  if (impl->distributed && work >= impl->distributed_at[k].load(std::memory_order_relaxed)) {
+    return *impl->distributed;
+  }
+  if (impl->parallel && work >= impl->parallel_at[k].load(std::memory_order_relaxed)) {
+    return *impl->parallel;
+  }
+  return *impl->serial;
+}
+
+AutoThresholds AutoBackend::thresholds() {
+  impl->ensure_ready();
+  return impl->load();
+}
+
+void AutoBackend::set_thresholds(const AutoThresholds& thresholds) {
+  std::lock_guard<std::mutex> lock(impl->mutex);
+  impl->store(thresholds);
+}
+
+AutoThresholds AutoBackend::calibrate() {
+  std::lock_guard<std::mutex> lock(impl->mutex);
+  return impl->calibrate();
+}
+
+std::string AutoBackend::cache_path() {
+  if (const char* p = std::getenv("LUMIN_AUTO_CACHE")) {
+    return p;
+  }
+  if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+    if (*xdg) return std::string(xdg) + "/lumin/auto_backend";
+  }
+  if (const char* home = std::getenv("HOME")) {
+    if (*home) return std::string(home) + "/.cache/lumin/auto_backend";
+  }
+  return "";
+}
+
+// elements of an elementwise result, with A or B broadcast
+static uint64_t broadcast_elements(const Matrix& A, const Matrix& B) {
+  uint64_t rows = (A.rows() == 1) ? B.rows() : A.rows();
+  uint64_t cols = (A.cols() == 1) ? B.cols() : A.cols();
+  return rows * cols;
+}
+
+Matrix AutoBackend::add(const Matrix& A, const Matrix& B) {
+  return route(AutoOp::Elementwise, broadcast_elements(A, B)).add(A, B);
+}
+
+Matrix AutoBackend::subtract(const Matrix& A, const Matrix& B) {
+  return route(AutoOp::Elementwise, broadcast_elements(A, B)).subtract(A, B);
+}
+
+Matrix AutoBackend::hadamard(const Matrix& A, const Matrix& B) {
+  return route(AutoOp::Elementwise, broadcast_elements(A, B)).hadamard(A, B);
+}
+
+Matrix AutoBackend::scalar(double s, const Matrix& A) {
+  return route(AutoOp::Elementwise, A.rows() * A.cols()).scalar(s, A);
+}
+
+Matrix AutoBackend::transpose(const Matrix& A) {
+  return route(AutoOp::Transpose, A.rows() * A.cols()).transpose(A);
+}
+
+double AutoBackend::dot(const Matrix& A, const Matrix& B) {
+  return route(AutoOp::Dot, A.rows() * A.cols()).dot(A, B);
+}
+
+Matrix AutoBackend::multiply(const Matrix& A, const Matrix& B) {
+  return route(AutoOp::Multiply, uint64_t(A.rows()) * A.cols() * B.cols()).multiply(A, B);
+}
+
+void AutoBackend::gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+                       const Matrix& B, double beta, Matrix& C) {
+  uint64_t k = (transA == Trans::No) ? A.cols() : A.rows();
+  route(AutoOp::Multiply, uint64_t(C.rows()) * k * C.cols()).gemm(transA, transB, alpha, A, B, beta, C);
+}
+
+void AutoBackend::gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+                       double beta, Matrix& y) {
+  route(AutoOp::Dot, uint64_t(A.rows()) * A.cols()).gemv(transA, alpha, A, x, beta, y);
+}
+
+void AutoBackend::ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) {
+  route(AutoOp::Elementwise, uint64_t(A.rows()) * A.cols()).ger(alpha, x, y, A);
+}
+
+void AutoBackend::syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) {
+  // half the multiply-adds of the equivalent multiply
+  route(AutoOp::Multiply, uint64_t(C.rows()) * A.rows() * A.cols() / 2).syrk(trans, alpha, A, beta, C);
+}
+
+void AutoBackend::trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+                       const Matrix& A, Matrix& B) {
+  // half an n x n by n x rhs multiply
+  uint64_t rhs = (side == Side::Left) ? B.cols() : B.rows();
+  route(AutoOp::Multiply, uint64_t(A.rows()) * A.rows() * rhs / 2).trsm(side, uplo, transA, diag, alpha, A, B);
+}
+
+void AutoBackend::lu(Matrix& A, std::vector<size_t>& piv) {
+  uint64_t k = std::min(A.rows(), A.cols());
+  route(AutoOp::Multiply, uint64_t(A.rows()) * A.cols() * k / 3).lu(A, piv);
+}
+
+void AutoBackend::cholesky(Matrix& A) {
+  route(AutoOp::Multiply, uint64_t(A.rows()) * A.rows() * A.rows() / 6).cholesky(A);
+}
+
+void AutoBackend::qr(Matrix& A, std::vector<double>& tau) {
+  uint64_t k = std::min(A.rows(), A.cols());
+  route(AutoOp::Multiply, uint64_t(A.rows()) * A.cols() * k).qr(A, tau);
+}
+
+Matrix AutoBackend::lstsq(const Matrix& A, const Matrix& B) {
+  return route(AutoOp::Multiply, uint64_t(A.rows()) * A.cols() * (A.cols() + B.cols())).lstsq(A, B);
+}
+
+Matrix AutoBackend::sq_distances(const Matrix& A, const Matrix& B) {
+  return route(AutoOp::Multiply, uint64_t(A.rows()) * B.rows() * A.cols()).sq_distances(A, B);
+}
+
+void AutoBackend::knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+                      std::vector<size_t>& indices) {
+  route(AutoOp::Multiply, uint64_t(A.rows()) * B.rows() * A.cols()).knn(A, B, k, distances, indices);
+}
+
+Matrix AutoBackend::reduce(Reduction op, Axis axis, const Matrix& A) {
+  // one streaming pass over A, like dot
+  return route(AutoOp::Dot, uint64_t(A.rows()) * A.cols()).reduce(op, axis, A);
+}
+
+std::vector<size_t> AutoBackend::argmax(Axis axis, const Matrix& A) {
+  return route(AutoOp::Dot, uint64_t(A.rows()) * A.cols()).argmax(axis, A);
+}
+
+Matrix AutoBackend::transform_rows(RowTransform op, const Matrix& A) {
+  return route(AutoOp::Elementwise, uint64_t(A.rows()) * A.cols()).transform_rows(op, A);
+}
+
+void AutoBackend::parallel_ranges(size_t n, const std::function<void(size_t, size_t)>& body) {
+  route(AutoOp::Elementwise, n).parallel_ranges(n, body);
+}
+
+Matrix AutoBackend::spmv(const SparseMatrix& A, const Matrix& x) {
+  return route(AutoOp::Sparse, A.nnz()).spmv(A, x);
+}
+
+Matrix AutoBackend::spmm(const SparseMatrix& A, const Matrix& B) {
+  return route(AutoOp::Sparse, uint64_t(A.nnz()) * B.cols()).spmm(A, B);
+}
+
+}
@@ -1,37 +1,25 @@
 #include "lumin.hpp"
+#include "../kernels.hpp"
 
 namespace lumin {
 
-static void check_same_size(const Matrix& A, const Matrix& B, const char* op) {
-  if (A.rows() != B.rows() || A.cols() != B.cols()) {
-    throw std::runtime_error("dimension mismatch in operation");
-  }
-}
-
-static void check_multiply_dims(const Matrix& A, const Matrix& B) {
-  if (A.cols() != B.rows()) {
-    throw std::runtime_error("multiply dimension mismatch");
-  }
+// A op B with either operand broadcast along rows or columns
+static Matrix broadcast(detail::ElementOp op, const char* name, const Matrix& A, const Matrix& B) {
+  detail::check_broadcast_dims(name, A, B);
+  size_t rows = detail::broadcast_extent(A.rows(), B.rows());
+  size_t cols = detail::broadcast_extent(A.cols(), B.cols());
+  Matrix R(rows, cols);
+  detail::broadcast_rows(op, 0, rows, cols, A.data(), A.rows(), A.cols(), B.data(), B.rows(), B.cols(),
+                         R.data());
+  return R;
 }
 
 Matrix CPUBackend::add(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "add");
-  Matrix R(A.rows(), A.cols());
-  size_t N = A.rows() * A.cols();
-  for (size_t i = 0; i < N; i++) {
-    R.data()[i] = A.data()[i] + B.data()[i];
-  }
-  return R;
+  return broadcast(detail::ElementOp::Add, "add", A, B);
 }
 
 Matrix CPUBackend::subtract(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "subtract");
-  Matrix R(A.rows(), A.cols());
-  size_t N = A.rows() * A.cols();
-  for (size_t i = 0; i < N; i++) {
-    R.data()[i] = A.data()[i] - B.data()[i];
-  }
-  return R;
+  return broadcast(detail::ElementOp::Subtract, "subtract", A, B);
 }
 
 Matrix CPUBackend::scalar(double s, const Matrix& A) {
@@ -44,8 +32,11 @@ Matrix CPUBackend::scalar(double s, const Matrix& A) {
 }
 
 Matrix CPUBackend::multiply(const Matrix& A, const Matrix& B) {
-  check_multiply_dims(A, B);
+  detail::check_multiply_dims(A, B);
   Matrix R(A.rows(), B.cols());
+  if (detail::multiply_as_gemv(*this, A, B, R)) {
+    return R;
+  }
   for (size_t i = 0; i < A.rows(); i++) {
     for (size_t k = 0; k < A.cols(); k++) {
       double a = A(i, k);
@@ -58,7 +49,7 @@ Matrix CPUBackend::multiply(const Matrix& A, const Matrix& B) {
 }
 
 double CPUBackend::dot(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "dot");
+  detail::check_same_size("dot", A, B);
   double res = 0.0;
   size_t N = A.rows() * A.cols();
   for (size_t i = 0; i < N; i++) {
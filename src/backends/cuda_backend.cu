@@ -1,12 +1,53 @@
 #include "lumin.hpp"
+#include "../kernels.hpp"
+#include "../memory_pool.hpp"
+
+#include <mutex>
+#include <unordered_map>
 
 
 
 namespace lumin {
 
-static double* deviceAllocCopy(const double* host, size_t bytes) {
+/* Device buffers are charged to the ("CUDA", "scratch") memory pool. The
+ * sizes are kept here so deviceFree can release what deviceAlloc charged. */
+
+static std::mutex device_mutex;
+static std::unordered_map<void*, size_t> device_bytes;
+
+static detail::MemoryPool* device_pool() {
+  static detail::MemoryPool* pool = detail::memory_pool("CUDA", "scratch");
+  return pool;
+}
+
+static double* deviceAlloc(size_t bytes) {
+  AllocScope scope(bytes);
+  detail::memory_acquire(device_pool(), bytes);
   double *dev = nullptr;
-  cudaMalloc(&dev, bytes);
+  if (cudaMalloc(&dev, bytes) != cudaSuccess) {
+    detail::memory_release(device_pool(), bytes);
+    throw std::runtime_error("CUDABackend: cudaMalloc failed");
+  }
+  std::lock_guard<std::mutex> lock(device_mutex);
+  device_bytes[dev] = bytes;
+  return dev;
+}
+
+static void deviceFree(double* dev) {
+  cudaFree(dev);
+  size_t bytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(device_mutex);
+    auto it = device_bytes.find(dev);
+    if (it == device_bytes.end()) return;
+    bytes = it->second;
+    device_bytes.erase(it);
+  }
+  detail::memory_release(device_pool(), bytes);
+}
+
+static double* deviceAllocCopy(const double* host, size_t bytes) {
+  double *dev = deviceAlloc(bytes);
   cudaMemcpy(dev, host, bytes, cudaMemcpyHostToDevice);
   return dev;
 }
@@ -157,7 +198,22 @@ CUDABackend::CUDABackend(int device_id) : device(device_id) {
   blockDim = dim3(TILE_SIZE, TILE_SIZE, 1);
 }
 
+// Broadcast shapes run on the host: the device kernels index both
+// operands by the result's shape.
+static Matrix host_broadcast(detail::ElementOp op, const char* name, const Matrix& A, const Matrix& B) {
+  detail::check_broadcast_dims(name, A, B);
+  size_t rows = detail::broadcast_extent(A.rows(), B.rows());
+  size_t cols = detail::broadcast_extent(A.cols(), B.cols());
+  Matrix R(rows, cols);
+  detail::broadcast_rows(op, 0, rows, cols, A.data(), A.rows(), A.cols(), B.data(), B.rows(), B.cols(),
+                         R.data());
+  return R;
+}
+
 Matrix CUDABackend::add(const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return host_broadcast(detail::ElementOp::Add, "add", A, B);
+  }
   size_t M = A.rows();
   size_t N = A.cols();
 
@@ -168,17 +224,16 @@ Matrix CUDABackend::add(const Matrix& A, const Matrix& B) {
 
   double *dA = deviceAllocCopy(A.data(), M * N * sizeof(double));
   double *dB = deviceAllocCopy(B.data(), M * N * sizeof(double));
-  double *dC = nullptr;
-  cudaMalloc(&dC, M * N * sizeof(double));
+  double *dC = deviceAlloc(M * N * sizeof(double));
 
   add_kernel<<<grid, block>>>(dA, dB, dC, M, N);
   cudaDeviceSynchronize();
 
   cudaMemcpy(C.data(), dC, M * N * sizeof(double), cudaMemcpyDeviceToHost);
 
-  cudaFree(dA);
-  cudaFree(dB);
-  cudaFree(dC);
+  deviceFree(dA);
+  deviceFree(dB);
+  deviceFree(dC);
 
   return (M == 0 || N == 0) ? Matrix(0, 0) : C;
 }
@@ -195,22 +250,24 @@ Matrix CUDABackend::multiply(const Matrix& A, const Matrix& B) {
 
   double *dA = deviceAllocCopy(A.data(), M * K * sizeof(double));
   double *dB = deviceAllocCopy(B.data(), K * N * sizeof(double));
-  double *dC = nullptr;
-  cudaMalloc(&dC, M * N * sizeof(double));
+  double *dC = deviceAlloc(M * N * sizeof(double));
 
   multiply_tiled_kernel<<<grid, block>>>(dA, dB, dC, M, K, N);
   cudaDeviceSynchronize();
 
   cudaMemcpy(C.data(), dC, M * N * sizeof(double), cudaMemcpyDeviceToHost);
 
-  cudaFree(dA);
-  cudaFree(dB);
-  cudaFree(dC);
+  deviceFree(dA);
+  deviceFree(dB);
+  deviceFree(dC);
 
   return C;
 }
 
 Matrix CUDABackend::subtract(const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return host_broadcast(detail::ElementOp::Subtract, "subtract", A, B);
+  }
   size_t M = A.rows();
   size_t N = A.cols();
 
@@ -221,16 +278,15 @@ Matrix CUDABackend::subtract(const Matrix& A, const Matrix& B) {
 
   double *dA = deviceAllocCopy(A.data(), M * N * sizeof(double));
   double *dB = deviceAllocCopy(B.data(), M * N * sizeof(double));
-  double *dC = nullptr;
-  cudaMalloc(&dC, M * N * sizeof(double));
+  double *dC = deviceAlloc(M * N * sizeof(double));
 
   subtract_kernel<<<grid, block>>>(dA, dB, dC, M, N);
   cudaDeviceSynchronize();
 
   cudaMemcpy(C.data(), dC, M * N * sizeof(double), cudaMemcpyDeviceToHost);
-  cudaFree(dA);
-  cudaFree(dB);
-  cudaFree(dC);
+  deviceFree(dA);
+  deviceFree(dB);
+  deviceFree(dC);
 
   return (M == 0 || N == 0) ? Matrix(0, 0) : C;
 }
@@ -245,15 +301,14 @@ Matrix CUDABackend::scalar(double s, const Matrix& A) {
   dim3 grid((N + TILE_SIZE - 1) / TILE_SIZE, (M + TILE_SIZE - 1) / TILE_SIZE);
   
   double *dA = deviceAllocCopy(A.data(), M * N * sizeof(double));
-  double *dC = nullptr;
-  cudaMalloc(&dC, M * N * sizeof(double));
+  double *dC = deviceAlloc(M * N * sizeof(double));
 
   scalar_kernel<<<grid, block>>>(dA, s, dC, M, N);
   cudaDeviceSynchronize();
 
   cudaMemcpy(C.data(), dC, M * N * sizeof(double), cudaMemcpyDeviceToHost);
-  cudaFree(dA);
-  cudaFree(dC);
+  deviceFree(dA);
+  deviceFree(dC);
 
   return (M == 0 || N == 0) ? Matrix(0, 0) : C;
 }
@@ -268,15 +323,14 @@ Matrix CUDABackend::transpose(const Matrix& A) {
   dim3 grid((N + TILE_SIZE - 1) / TILE_SIZE, (M + TILE_SIZE - 1) / TILE_SIZE);
   
   double *dA = deviceAllocCopy(A.data(), M * N * sizeof(double));
-  double *dC = nullptr;
-  cudaMalloc(&dC, N * M * sizeof(double));
+  double *dC = deviceAlloc(N * M * sizeof(double));
 
   transpose_kernel<<<grid, block>>>(dA, dC, M, N);
   cudaDeviceSynchronize();
 
   cudaMemcpy(C.data(), dC, N * M * sizeof(double), cudaMemcpyDeviceToHost);
-  cudaFree(dA);
-  cudaFree(dC);
+  deviceFree(dA);
+  deviceFree(dC);
 
   return (M == 0 || N == 0) ? Matrix(0, 0) : C;
 }
@@ -287,8 +341,7 @@ double CUDABackend::dot(const Matrix& A, const Matrix& B) {
 
   double *dA = deviceAllocCopy(A.data(), M * N * sizeof(double));
   double *dB = deviceAllocCopy(B.data(), M * N * sizeof(double));
-  double *dC = nullptr;
-  cudaMalloc(&dC, sizeof(double));
+  double *dC = deviceAlloc(sizeof(double));
 
   dim3 block(TILE_SIZE, TILE_SIZE);
   dim3 grid((N + TILE_SIZE - 1) / TILE_SIZE, (M + TILE_SIZE - 1) / TILE_SIZE);
@@ -298,9 +351,9 @@ double CUDABackend::dot(const Matrix& A, const Matrix& B) {
 
   double result;
   cudaMemcpy(&result, dC, sizeof(double), cudaMemcpyDeviceToHost);
-  cudaFree(dA);
-  cudaFree(dB);
-  cudaFree(dC);
+  deviceFree(dA);
+  deviceFree(dB);
+  deviceFree(dC);
 
   return (M == 0 || N == 0) ? 0.0 : result;
 }
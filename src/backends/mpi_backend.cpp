@@ -1,16 +1,28 @@
 #include "lumin/mpi_backend.hpp"
 #include "lumin/matrix.hpp"
 #include "lumin/backend.hpp"
+#include "lumin/sparse_matrix.hpp"
+#include "../kernels.hpp"
+#include "../memory_pool.hpp"
+#include "../op_scope.hpp"
 
 #include <mpi.h>
+#include <algorithm>
 #include <vector>
 #include <numeric>
 #include <stdexcept>
 #include <iostream>
+#include <cmath>
 #include <cstring>
+#include <limits>
 
 namespace lumin {
 
+// staging buffers are charged to the ("MPI", "scratch") memory pool
+static constexpr char MPI_POOL[] = "MPI";
+template <class T>
+using scratch = detail::scratch_vector<T, MPI_POOL>;
+
 static void mpi_abort_print(int rank, const std::string &msg) {
   if (rank == 0) std::cerr << "MPIBackend error: " << msg << std::endl;
   MPI_Abort(MPI_COMM_WORLD, 1);
@@ -35,6 +47,180 @@ static void compute_counts_displs_rows(int total_rows, int cols, int world_size,
   }
 }
 
+// first row owned by rank under compute_counts_displs_rows' split
+static int first_row(int total_rows, int world_size, int rank) {
+  int base = total_rows / world_size;
+  int rem = total_rows % world_size;
+  return rank * base + std::min(rank, rem);
+}
+
+static MPI_Datatype mpi_size_type() {
+  return (sizeof(size_t) == sizeof(unsigned long long)) ? MPI_UNSIGNED_LONG_LONG : MPI_UNSIGNED;
+}
+
+/* Collectives
+ * Thin wrappers with the MPI signatures that time each call and count the
+ * bytes this rank sends and receives when instrumentation is on. */
+
+static uint64_t type_bytes(MPI_Datatype type, uint64_t count) {
+  int size;
+  MPI_Type_size(type, &size);
+  return count * static_cast<uint64_t>(size);
+}
+
+static uint64_t sum_counts(const int* counts, MPI_Comm comm) {
+  int size;
+  MPI_Comm_size(comm, &size);
+  uint64_t total = 0;
+  for (int r = 0; r < size; r++) {
+    total += static_cast<uint64_t>(counts[r]);
+  }
+  return total;
+}
+
+static bool is_root(int root, MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  return rank == root;
+}
+
+static int timed_scatterv(const void* sendbuf, const int* sendcounts, const int* displs, MPI_Datatype sendtype,
+                          void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  CollectiveScope scope("MPI_Scatterv");
+  if (scope) {
+    scope.add_bytes(type_bytes(recvtype, recvcount));
+    if (is_root(root, comm)) scope.add_bytes(type_bytes(sendtype, sum_counts(sendcounts, comm)));
+  }
+  return MPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+static int timed_gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+                         const int* recvcounts, const int* displs, MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  CollectiveScope scope("MPI_Gatherv");
+  if (scope) {
+    scope.add_bytes(type_bytes(sendtype, sendcount));
+    if (is_root(root, comm)) scope.add_bytes(type_bytes(recvtype, sum_counts(recvcounts, comm)));
+  }
+  return MPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+}
+
+static int timed_bcast(void* buffer, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+  CollectiveScope scope("MPI_Bcast");
+  if (scope) {
+    scope.add_bytes(type_bytes(type, count));
+  }
+  return MPI_Bcast(buffer, count, type, root, comm);
+}
+
+static int timed_reduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                        int root, MPI_Comm comm) {
+  CollectiveScope scope("MPI_Reduce");
+  if (scope) {
+    scope.add_bytes(type_bytes(type, count) * (is_root(root, comm) ? 2 : 1));
+  }
+  return MPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm);
+}
+
+static int timed_allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                           MPI_Comm comm) {
+  CollectiveScope scope("MPI_Allreduce");
+  if (scope) {
+    scope.add_bytes(type_bytes(type, count) * 2);
+  }
+  return MPI_Allreduce(sendbuf, recvbuf, count, type, op, comm);
+}
+
+static int timed_alltoall(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                          void* recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm) {
+  CollectiveScope scope("MPI_Alltoall");
+  if (scope) {
+    int size;
+    MPI_Comm_size(comm, &size);
+    scope.add_bytes((type_bytes(sendtype, sendcount) + type_bytes(recvtype, recvcount)) * size);
+  }
+  return MPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+}
+
+static int timed_alltoallv(const void* sendbuf, const int* sendcounts, const int* sdispls, MPI_Datatype sendtype,
+                           void* recvbuf, const int* recvcounts, const int* rdispls, MPI_Datatype recvtype,
+                           MPI_Comm comm) {
+  CollectiveScope scope("MPI_Alltoallv");
+  if (scope) {
+    scope.add_bytes(type_bytes(sendtype, sum_counts(sendcounts, comm)) +
+                    type_bytes(recvtype, sum_counts(recvcounts, comm)));
+  }
+  return MPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm);
+}
+
+// Scatter row blocks of a CSR matrix held on rank 0. On return local_ptr is
+// rebased to zero and local_idx still holds global column indices.
+static void scatter_csr_rows(const SparseMatrix& csr, int total_rows, int rank, int size, MPI_Comm comm,
+                             std::vector<int> &row_counts, std::vector<int> &row_displs,
+                             scratch<size_t> &local_ptr, scratch<size_t> &local_idx,
+                             scratch<double> &local_val) {
+  compute_counts_displs_rows(total_rows, 1, size, row_counts, row_displs);
+  int local_rows = row_counts[rank];
+
+  std::vector<int> row_len;
+  std::vector<int> nnz_counts(size, 0), nnz_displs(size, 0);
+  if (rank == 0) {
+    const std::vector<size_t>& ptr = csr.ptr();
+    row_len.resize(total_rows);
+    for (int i = 0; i < total_rows; i++) {
+      row_len[i] = static_cast<int>(ptr[i + 1] - ptr[i]);
+    }
+    for (int r = 0; r < size; r++) {
+      nnz_displs[r] = static_cast<int>(ptr[row_displs[r]]);
+      nnz_counts[r] = static_cast<int>(ptr[row_displs[r] + row_counts[r]]) - nnz_displs[r];
+    }
+  }
+
+  std::vector<int> local_len(local_rows);
+  timed_scatterv(
+    (rank == 0 ? row_len.data() : nullptr),
+    row_counts.data(),
+    row_displs.data(),
+    MPI_INT,
+    (local_rows ? local_len.data() : nullptr),
+    local_rows,
+    MPI_INT,
+    0,
+    comm
+  );
+
+  local_ptr.assign(local_rows + 1, 0);
+  for (int i = 0; i < local_rows; i++) {
+    local_ptr[i + 1] = local_ptr[i] + static_cast<size_t>(local_len[i]);
+  }
+  int local_nnz = static_cast<int>(local_ptr[local_rows]);
+  local_idx.resize(local_nnz);
+  local_val.resize(local_nnz);
+
+  timed_scatterv(
+    (rank == 0 ? const_cast<size_t*>(csr.indices().data()) : nullptr),
+    nnz_counts.data(),
+    nnz_displs.data(),
+    mpi_size_type(),
+    (local_nnz ? local_idx.data() : nullptr),
+    local_nnz,
+    mpi_size_type(),
+    0,
+    comm
+  );
+
+  timed_scatterv(
+    (rank == 0 ? const_cast<double*>(csr.values().data()) : nullptr),
+    nnz_counts.data(),
+    nnz_displs.data(),
+    MPI_DOUBLE,
+    (local_nnz ? local_val.data() : nullptr),
+    local_nnz,
+    MPI_DOUBLE,
+    0,
+    comm
+  );
+}
+
 MPIBackend::MPIBackend(MPI_Comm comm)
   : m_comm(comm)
 {
@@ -42,9 +228,64 @@ MPIBackend::MPIBackend(MPI_Comm comm)
   MPI_Comm_size(m_comm, &m_size);
 }
 
+/* Broadcasting elementwise ops
+ * The result's rows are split as for add. An operand with all of the
+ * result's rows is scattered the same way; a one-row operand is broadcast
+ * whole, so neither is ever expanded to the result's shape. */
+
+// the rows of X this rank reads, and how many there are
+static int local_operand(const Matrix& X, int rows, int rank, int size, MPI_Comm comm, scratch<double>& local) {
+  int x_rows = static_cast<int>(X.rows()), x_cols = static_cast<int>(X.cols());
+  if (x_rows == rows) {
+    std::vector<int> counts, displs;
+    compute_counts_displs_rows(rows, x_cols, size, counts, displs);
+    local.resize(counts[rank]);
+    timed_scatterv((rank == 0 ? X.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE,
+                   (counts[rank] ? local.data() : nullptr), counts[rank], MPI_DOUBLE, 0, comm);
+    return first_row(rows, size, rank + 1) - first_row(rows, size, rank);
+  }
+  if (rank == 0) {
+    local.assign(X.data(), X.data() + x_cols);
+  }
+  else {
+    local.assign(x_cols, 0.0);
+  }
+  timed_bcast(local.data(), x_cols, MPI_DOUBLE, 0, comm);
+  return 1;
+}
+
+static Matrix broadcast_elementwise(detail::ElementOp op, const char* name, const Matrix& A, const Matrix& B,
+                                    int rank, int size, MPI_Comm comm) {
+  bool rows_ok = A.rows() == B.rows() || A.rows() == 1 || B.rows() == 1;
+  bool cols_ok = A.cols() == B.cols() || A.cols() == 1 || B.cols() == 1;
+  if (!rows_ok || !cols_ok) {
+    mpi_abort_print(rank, std::string(name) + ": dimensions do not broadcast");
+  }
+  int rows = static_cast<int>(detail::broadcast_extent(A.rows(), B.rows()));
+  int cols = static_cast<int>(detail::broadcast_extent(A.cols(), B.cols()));
+  scratch<double> localA, localB;
+  int a_rows = local_operand(A, rows, rank, size, comm, localA);
+  int b_rows = local_operand(B, rows, rank, size, comm, localB);
+
+  std::vector<int> counts, displs;
+  compute_counts_displs_rows(rows, cols, size, counts, displs);
+  int local_rows = first_row(rows, size, rank + 1) - first_row(rows, size, rank);
+  scratch<double> localC(counts[rank]);
+  detail::broadcast_rows(op, 0, local_rows, cols, localA.data(), a_rows, A.cols(), localB.data(), b_rows,
+                         B.cols(), localC.data());
+
+  Matrix C;
+  if (rank == 0) {
+    C = Matrix(static_cast<size_t>(rows), static_cast<size_t>(cols));
+  }
+  timed_gatherv((counts[rank] ? localC.data() : nullptr), counts[rank], MPI_DOUBLE,
+                (rank == 0 ? C.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE, 0, comm);
+  return (rank == 0) ? C : Matrix(0, 0);
+}
+
 Matrix MPIBackend::add(const Matrix& A, const Matrix& B) {
   if (A.rows() != B.rows() || A.cols() != B.cols()) {
-    mpi_abort_print(m_rank, "add: dimension mismatch");
+    return broadcast_elementwise(detail::ElementOp::Add, "add", A, B, m_rank, m_size, m_comm);
   }
 
   int total_rows = static_cast<int>(A.rows());
@@ -54,11 +295,11 @@ Matrix MPIBackend::add(const Matrix& A, const Matrix& B) {
   compute_counts_displs_rows(total_rows, cols, m_size, counts, displs);
 
   int local_elems = counts[m_rank];
-  std::vector<double> localA(local_elems);
-  std::vector<double> localB(local_elems);
-  std::vector<double> localC(local_elems, 0.0);
+  scratch<double> localA(local_elems);
+  scratch<double> localB(local_elems);
+  scratch<double> localC(local_elems, 0.0);
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(A.data()) : nullptr), // sendbuf
     counts.data(), // sendcounts
     displs.data(), // displs
@@ -70,7 +311,7 @@ Matrix MPIBackend::add(const Matrix& A, const Matrix& B) {
     m_comm // comm
   );
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(B.data()) : nullptr),
     counts.data(),
     displs.data(),
@@ -92,7 +333,7 @@ Matrix MPIBackend::add(const Matrix& A, const Matrix& B) {
     C = Matrix(static_cast<size_t>(total_rows), static_cast<size_t>(cols));
   }
 
-  MPI_Gatherv(
+  timed_gatherv(
     localC.data(),
     local_elems,
     MPI_DOUBLE,
@@ -109,7 +350,7 @@ Matrix MPIBackend::add(const Matrix& A, const Matrix& B) {
 
 Matrix MPIBackend::subtract(const Matrix& A, const Matrix& B) {
   if (A.rows() != B.rows() || A.cols() != B.cols()) {
-    mpi_abort_print(m_rank, "subtract: dimension mismatch");
+    return broadcast_elementwise(detail::ElementOp::Subtract, "subtract", A, B, m_rank, m_size, m_comm);
   }
 
   int total_rows = static_cast<int>(A.rows());
@@ -119,11 +360,11 @@ Matrix MPIBackend::subtract(const Matrix& A, const Matrix& B) {
   compute_counts_displs_rows(total_rows, cols, m_size, counts, displs);
 
   int local_elems = counts[m_rank];
-  std::vector<double> localA(local_elems);
-  std::vector<double> localB(local_elems);
-  std::vector<double> localC(local_elems, 0.0);
+  scratch<double> localA(local_elems);
+  scratch<double> localB(local_elems);
+  scratch<double> localC(local_elems, 0.0);
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(A.data()) : nullptr), // sendbuf
     counts.data(), // sendcounts
     displs.data(), // displs
@@ -135,7 +376,7 @@ Matrix MPIBackend::subtract(const Matrix& A, const Matrix& B) {
     m_comm // comm
   );
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(B.data()) : nullptr),
     counts.data(),
     displs.data(),
@@ -157,7 +398,7 @@ Matrix MPIBackend::subtract(const Matrix& A, const Matrix& B) {
     C = Matrix(static_cast<size_t>(total_rows), static_cast<size_t>(cols));
   }
 
-  MPI_Gatherv(
+  timed_gatherv(
     localC.data(),
     local_elems,
     MPI_DOUBLE,
@@ -172,6 +413,10 @@ Matrix MPIBackend::subtract(const Matrix& A, const Matrix& B) {
   return (m_rank == 0) ? C : Matrix(0, 0);
 }
 
+Matrix MPIBackend::hadamard(const Matrix& A, const Matrix& B) {
+  return broadcast_elementwise(detail::ElementOp::Multiply, "hadamard", A, B, m_rank, m_size, m_comm);
+}
+
 Matrix MPIBackend::scalar(double s, const Matrix& A) {
   int total_rows = static_cast<int>(A.rows());
   int cols = static_cast<int>(A.cols());
@@ -179,10 +424,10 @@ Matrix MPIBackend::scalar(double s, const Matrix& A) {
   compute_counts_displs_rows(total_rows, cols, m_size, counts, displs);
 
   int local_elems = counts[m_rank];
-  std::vector<double> localA(local_elems);
-  std::vector<double> localR(local_elems, 0.0);
+  scratch<double> localA(local_elems);
+  scratch<double> localR(local_elems, 0.0);
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(A.data()) : nullptr),
     counts.data(),
     displs.data(),
@@ -203,7 +448,7 @@ Matrix MPIBackend::scalar(double s, const Matrix& A) {
     R = Matrix(static_cast<size_t>(total_rows), static_cast<size_t>(cols));
   }
 
-  MPI_Gatherv(
+  timed_gatherv(
     localR.data(),
     local_elems,
     MPI_DOUBLE,
@@ -223,6 +468,19 @@ Matrix MPIBackend::multiply(const Matrix& A, const Matrix& B) {
     mpi_abort_print(m_rank, "multiply: incompatible matrix dimensions");
   }
 
+  // vectors take the matrix-vector kernels, which move no copy of A to
+  // every rank
+  if (B.cols() == 1 || A.rows() == 1) {
+    Matrix R(A.rows(), B.cols());
+    if (B.cols() == 1) {
+      gemv(Trans::No, 1.0, A, B, 0.0, R);
+    }
+    else {
+      gemv(Trans::Yes, 1.0, B, A, 0.0, R);
+    }
+    return (m_rank == 0) ? R : Matrix(0, 0);
+  }
+
   int total_rows = static_cast<int>(A.rows());
   int a_cols = static_cast<int>(A.cols());
   int b_cols = static_cast<int>(B.cols());
@@ -237,10 +495,10 @@ Matrix MPIBackend::multiply(const Matrix& A, const Matrix& B) {
   int localC_elems = countsC[m_rank];
   int local_rows = (a_cols == 0) ? 0 : localA_elems / a_cols;
 
-  std::vector<double> localA(localA_elems);
-  std::vector<double> localC(localC_elems, 0.0);
+  scratch<double> localA(localA_elems);
+  scratch<double> localC(localC_elems, 0.0);
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(A.data()) : nullptr),
     countsA.data(),
     displsA.data(),
@@ -252,7 +510,7 @@ Matrix MPIBackend::multiply(const Matrix& A, const Matrix& B) {
     m_comm
   );
 
-  std::vector<double> Bbuf;
+  scratch<double> Bbuf;
   if (m_rank == 0) {
     Bbuf.assign(B.data(), B.data() + static_cast<size_t>(a_cols * b_cols));
   }
@@ -260,7 +518,7 @@ Matrix MPIBackend::multiply(const Matrix& A, const Matrix& B) {
     Bbuf.assign(static_cast<size_t>(a_cols * b_cols), 0.0);
   }
 
-  MPI_Bcast(Bbuf.data(), a_cols * b_cols, MPI_DOUBLE, 0, m_comm);
+  timed_bcast(Bbuf.data(), a_cols * b_cols, MPI_DOUBLE, 0, m_comm);
 
   for (int i = 0; i < local_rows; ++i) {
     for (int k = 0; k < a_cols; ++k) {
@@ -278,7 +536,7 @@ Matrix MPIBackend::multiply(const Matrix& A, const Matrix& B) {
     C = Matrix(static_cast<size_t>(total_rows), static_cast<size_t>(b_cols));
   }
 
-  MPI_Gatherv((localC_elems ? localC.data() : nullptr),
+  timed_gatherv((localC_elems ? localC.data() : nullptr),
     localC_elems,
     MPI_DOUBLE,
     (m_rank == 0 ? C.data() : nullptr),
@@ -304,11 +562,11 @@ double MPIBackend::dot(const Matrix& A, const Matrix& B) {
   compute_counts_displs_rows(total_rows, cols, m_size, counts, displs);
 
   int local_elems = counts[m_rank];
-  std::vector<double> localA(local_elems);
-  std::vector<double> localB(local_elems);
+  scratch<double> localA(local_elems);
+  scratch<double> localB(local_elems);
   double localTotal = 0.0; 
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(A.data()) : nullptr), // sendbuf
     counts.data(), // sendcounts
     displs.data(), // displs
@@ -320,7 +578,7 @@ double MPIBackend::dot(const Matrix& A, const Matrix& B) {
     m_comm // comm
   );
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(B.data()) : nullptr),
     counts.data(),
     displs.data(),
@@ -339,7 +597,7 @@ double MPIBackend::dot(const Matrix& A, const Matrix& B) {
 
   double res = 0.0;
 
-  MPI_Reduce(
+  timed_reduce(
     &localTotal,
     (m_rank == 0 ? &res : nullptr),
     1,
@@ -359,9 +617,9 @@ Matrix MPIBackend::transpose(const Matrix& A) {
   compute_counts_displs_rows(total_rows, cols, m_size, counts, displs);
 
   int local_elems = counts[m_rank];
-  std::vector<double> localBuf(local_elems);
+  scratch<double> localBuf(local_elems);
 
-  MPI_Scatterv(
+  timed_scatterv(
     (m_rank == 0 ? const_cast<double*>(A.data()) : nullptr),
     counts.data(),
     displs.data(),
@@ -378,7 +636,7 @@ Matrix MPIBackend::transpose(const Matrix& A) {
     gathered = Matrix(static_cast<size_t>(total_rows), static_cast<size_t>(cols));
   }
 
-  MPI_Gatherv(
+  timed_gatherv(
     (local_elems ? localBuf.data() : nullptr),
     local_elems,
     MPI_DOUBLE,
@@ -404,4 +662,841 @@ Matrix MPIBackend::transpose(const Matrix& A) {
   return Matrix(0,0);
 }
 
+Matrix MPIBackend::spmv(const SparseMatrix& A, const Matrix& x) {
+  if (x.cols() != 1 || A.cols() != x.rows()) {
+    mpi_abort_print(m_rank, "spmv: incompatible dimensions");
+  }
+
+  int total_rows = static_cast<int>(A.rows());
+  int total_cols = static_cast<int>(A.cols());
+
+  SparseMatrix converted;
+  const SparseMatrix& csr = (m_rank != 0 || A.format() == SparseFormat::CSR) ? A : (converted = A.to_csr());
+
+  std::vector<int> row_counts, row_displs;
+  scratch<size_t> local_ptr, local_idx;
+  scratch<double> local_val;
+  scatter_csr_rows(csr, total_rows, m_rank, m_size, m_comm,
+                   row_counts, row_displs, local_ptr, local_idx, local_val);
+  int local_rows = row_counts[m_rank];
+
+  // x is partitioned over ranks in the same contiguous way as the rows
+  std::vector<int> x_counts, x_displs;
+  compute_counts_displs_rows(total_cols, 1, m_size, x_counts, x_displs);
+  int x_local = x_counts[m_rank];
+  size_t x_begin = static_cast<size_t>(x_displs[m_rank]);
+  size_t x_end = x_begin + static_cast<size_t>(x_local);
+
+  scratch<double> x_ext(x_local);
+  timed_scatterv(
+    (m_rank == 0 ? const_cast<double*>(x.data()) : nullptr),
+    x_counts.data(),
+    x_displs.data(),
+    MPI_DOUBLE,
+    (x_local ? x_ext.data() : nullptr),
+    x_local,
+    MPI_DOUBLE,
+    0,
+    m_comm
+  );
+
+  // halo: the off-rank columns this row block references. Owners hold
+  // contiguous ranges in rank order, so the sorted list is grouped by owner.
+  scratch<size_t> ghosts;
+  for (size_t col : local_idx) {
+    if (col < x_begin || col >= x_end) {
+      ghosts.push_back(col);
+    }
+  }
+  std::sort(ghosts.begin(), ghosts.end());
+  ghosts.erase(std::unique(ghosts.begin(), ghosts.end()), ghosts.end());
+
+  std::vector<int> req_counts(m_size, 0), req_displs(m_size, 0);
+  for (size_t col : ghosts) {
+    int owner = static_cast<int>(std::upper_bound(x_displs.begin(), x_displs.end(),
+                                                  static_cast<int>(col)) - x_displs.begin()) - 1;
+    req_counts[owner]++;
+  }
+  for (int r = 1; r < m_size; r++) {
+    req_displs[r] = req_displs[r - 1] + req_counts[r - 1];
+  }
+
+  std::vector<int> serve_counts(m_size, 0), serve_displs(m_size, 0);
+  timed_alltoall(req_counts.data(), 1, MPI_INT, serve_counts.data(), 1, MPI_INT, m_comm);
+  for (int r = 1; r < m_size; r++) {
+    serve_displs[r] = serve_displs[r - 1] + serve_counts[r - 1];
+  }
+  int n_serve = serve_displs[m_size - 1] + serve_counts[m_size - 1];
+
+  scratch<size_t> serve_idx(n_serve);
+  timed_alltoallv(
+    ghosts.data(), req_counts.data(), req_displs.data(), mpi_size_type(),
+    serve_idx.data(), serve_counts.data(), serve_displs.data(), mpi_size_type(),
+    m_comm
+  );
+
+  scratch<double> serve_val(n_serve);
+  for (int i = 0; i < n_serve; i++) {
+    serve_val[i] = x_ext[serve_idx[i] - x_begin];
+  }
+
+  x_ext.resize(static_cast<size_t>(x_local) + ghosts.size());
+  timed_alltoallv(
+    serve_val.data(), serve_counts.data(), serve_displs.data(), MPI_DOUBLE,
+    x_ext.data() + x_local, req_counts.data(), req_displs.data(), MPI_DOUBLE,
+    m_comm
+  );
+
+  // remap global column indices into positions of [own x | ghost values]
+  for (size_t &col : local_idx) {
+    if (col >= x_begin && col < x_end) {
+      col -= x_begin;
+    }
+    else {
+      col = static_cast<size_t>(x_local) +
+            static_cast<size_t>(std::lower_bound(ghosts.begin(), ghosts.end(), col) - ghosts.begin());
+    }
+  }
+
+  scratch<double> local_y(local_rows, 0.0);
+  for (int i = 0; i < local_rows; i++) {
+    double sum = 0.0;
+    for (size_t p = local_ptr[i]; p < local_ptr[i + 1]; p++) {
+      sum += local_val[p] * x_ext[local_idx[p]];
+    }
+    local_y[i] = sum;
+  }
+
+  Matrix y;
+  if (m_rank == 0) {
+    y = Matrix(static_cast<size_t>(total_rows), 1);
+  }
+
+  timed_gatherv(
+    (local_rows ? local_y.data() : nullptr),
+    local_rows,
+    MPI_DOUBLE,
+    (m_rank == 0 ? y.data() : nullptr),
+    row_counts.data(),
+    row_displs.data(),
+    MPI_DOUBLE,
+    0,
+    m_comm
+  );
+
+  return (m_rank == 0) ? y : Matrix(0, 0);
+}
+
+Matrix MPIBackend::spmm(const SparseMatrix& A, const Matrix& B) {
+  if (A.cols() != B.rows()) {
+    mpi_abort_print(m_rank, "spmm: incompatible dimensions");
+  }
+
+  int total_rows = static_cast<int>(A.rows());
+  int a_cols = static_cast<int>(A.cols());
+  int b_cols = static_cast<int>(B.cols());
+
+  SparseMatrix converted;
+  const SparseMatrix& csr = (m_rank != 0 || A.format() == SparseFormat::CSR) ? A : (converted = A.to_csr());
+
+  std::vector<int> row_counts, row_displs;
+  scratch<size_t> local_ptr, local_idx;
+  scratch<double> local_val;
+  scatter_csr_rows(csr, total_rows, m_rank, m_size, m_comm,
+                   row_counts, row_displs, local_ptr, local_idx, local_val);
+  int local_rows = row_counts[m_rank];
+
+  scratch<double> Bbuf;
+  if (m_rank == 0) {
+    Bbuf.assign(B.data(), B.data() + static_cast<size_t>(a_cols) * b_cols);
+  }
+  else {
+    Bbuf.assign(static_cast<size_t>(a_cols) * b_cols, 0.0);
+  }
+
+  timed_bcast(Bbuf.data(), a_cols * b_cols, MPI_DOUBLE, 0, m_comm);
+
+  scratch<double> localC(static_cast<size_t>(local_rows) * b_cols, 0.0);
+  for (int i = 0; i < local_rows; ++i) {
+    double *c_row = &localC[static_cast<size_t>(i) * b_cols];
+    for (size_t p = local_ptr[i]; p < local_ptr[i + 1]; ++p) {
+      double a_val = local_val[p];
+      const double *b_row = &Bbuf[local_idx[p] * b_cols];
+      for (int j = 0; j < b_cols; ++j) {
+        c_row[j] += a_val * b_row[j];
+      }
+    }
+  }
+
+  std::vector<int> countsC, displsC;
+  compute_counts_displs_rows(total_rows, b_cols, m_size, countsC, displsC);
+  int localC_elems = countsC[m_rank];
+
+  Matrix C;
+  if (m_rank == 0) {
+    C = Matrix(static_cast<size_t>(total_rows), static_cast<size_t>(b_cols));
+  }
+
+  timed_gatherv((localC_elems ? localC.data() : nullptr),
+    localC_elems,
+    MPI_DOUBLE,
+    (m_rank == 0 ? C.data() : nullptr),
+    countsC.data(),
+    displsC.data(),
+    MPI_DOUBLE,
+    0,
+    m_comm
+  );
+
+  return (m_rank == 0) ? C : Matrix(0, 0);
+}
+
+/* GEMM
+ * Without transA, rows of C follow rows of A as in multiply: A (and C when
+ * beta is used) is scattered by rows, B is broadcast and the rows of C are
+ * gathered back. With transA, op(A)'s rows are A's columns, which cannot be
+ * scattered contiguously; the shared dimension k is split instead. Each
+ * rank multiplies its rows of A (and of B, or its columns of a broadcast
+ * B^T) into an m x n partial product, and the partials are summed on rank 0.
+ * That is the usual shape of a gradient, A^T * B with k the batch. */
+
+void MPIBackend::gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+                      const Matrix& B, double beta, Matrix& C) {
+  int m = static_cast<int>(detail::op_rows(transA, A.rows(), A.cols()));
+  int k = static_cast<int>(detail::op_cols(transA, A.rows(), A.cols()));
+  int n = static_cast<int>(detail::op_cols(transB, B.rows(), B.cols()));
+  if (static_cast<int>(detail::op_rows(transB, B.rows(), B.cols())) != k ||
+      static_cast<int>(C.rows()) != m || static_cast<int>(C.cols()) != n) {
+    mpi_abort_print(m_rank, "gemm: incompatible matrix dimensions");
+  }
+  int b_elems = static_cast<int>(B.rows() * B.cols());
+  size_t ldb = B.cols();
+
+  auto broadcast_b = [&](scratch<double>& Bbuf) {
+    if (m_rank == 0) {
+      Bbuf.assign(B.data(), B.data() + b_elems);
+    }
+    else {
+      Bbuf.assign(static_cast<size_t>(b_elems), 0.0);
+    }
+    timed_bcast(Bbuf.data(), b_elems, MPI_DOUBLE, 0, m_comm);
+  };
+
+  if (transA == Trans::No) {
+    std::vector<int> countsA, displsA, countsC, displsC;
+    compute_counts_displs_rows(m, k, m_size, countsA, displsA);
+    compute_counts_displs_rows(m, n, m_size, countsC, displsC);
+    int local_rows = first_row(m, m_size, m_rank + 1) - first_row(m, m_size, m_rank);
+
+    scratch<double> localA(countsA[m_rank]);
+    timed_scatterv((m_rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE,
+                   (countsA[m_rank] ? localA.data() : nullptr), countsA[m_rank], MPI_DOUBLE, 0, m_comm);
+    scratch<double> Bbuf;
+    broadcast_b(Bbuf);
+    scratch<double> localC(countsC[m_rank], 0.0);
+    if (beta != 0.0) {
+      timed_scatterv((m_rank == 0 ? C.data() : nullptr), countsC.data(), displsC.data(), MPI_DOUBLE,
+                     (countsC[m_rank] ? localC.data() : nullptr), countsC[m_rank], MPI_DOUBLE, 0, m_comm);
+    }
+
+    detail::gemm_rows(Trans::No, transB, 0, static_cast<size_t>(local_rows), n, k, alpha,
+                      localA.data(), k, Bbuf.data(), ldb, beta, localC.data(), n);
+
+    timed_gatherv((countsC[m_rank] ? localC.data() : nullptr), countsC[m_rank], MPI_DOUBLE,
+                  (m_rank == 0 ? C.data() : nullptr), countsC.data(), displsC.data(), MPI_DOUBLE, 0, m_comm);
+    return;
+  }
+
+  // A is k x m: split k
+  std::vector<int> countsA, displsA;
+  compute_counts_displs_rows(k, m, m_size, countsA, displsA);
+  int p0 = first_row(k, m_size, m_rank);
+  int local_k = first_row(k, m_size, m_rank + 1) - p0;
+
+  scratch<double> localA(countsA[m_rank]);
+  timed_scatterv((m_rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE,
+                 (countsA[m_rank] ? localA.data() : nullptr), countsA[m_rank], MPI_DOUBLE, 0, m_comm);
+
+  scratch<double> Bbuf;
+  const double* b_slice = nullptr;
+  if (transB == Trans::No) {
+    // B is k x n: the same rows of it
+    std::vector<int> countsB, displsB;
+    compute_counts_displs_rows(k, n, m_size, countsB, displsB);
+    Bbuf.assign(static_cast<size_t>(countsB[m_rank]), 0.0);
+    timed_scatterv((m_rank == 0 ? B.data() : nullptr), countsB.data(), displsB.data(), MPI_DOUBLE,
+                   (countsB[m_rank] ? Bbuf.data() : nullptr), countsB[m_rank], MPI_DOUBLE, 0, m_comm);
+    b_slice = Bbuf.data();
+  }
+  else {
+    // B is n x k: the same columns of it, read in place
+    broadcast_b(Bbuf);
+    b_slice = Bbuf.data() + p0;
+  }
+
+  size_t mn = static_cast<size_t>(m) * n;
+  scratch<double> partial(mn, 0.0);
+  detail::gemm_rows(Trans::Yes, transB, 0, m, n, local_k, alpha, localA.data(), m,
+                    b_slice, ldb, 0.0, partial.data(), n);
+
+  scratch<double> sum(m_rank == 0 ? mn : 0);
+  timed_reduce(partial.data(), (m_rank == 0 ? sum.data() : nullptr), static_cast<int>(mn),
+               MPI_DOUBLE, MPI_SUM, 0, m_comm);
+  if (m_rank == 0) {
+    double* c = C.data();
+    for (size_t i = 0; i < mn; i++) {
+      c[i] = (beta == 0.0) ? sum[i] : beta * c[i] + sum[i];
+    }
+  }
+}
+
+/* GEMV and GER
+ * A is scattered by rows, so each rank reads only its share of the matrix.
+ * Untransposed, each rank produces its entries of y; transposed, the rows
+ * are the reduction dimension and partial results are summed on rank 0. */
+
+void MPIBackend::gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+                      double beta, Matrix& y) {
+  int m = static_cast<int>(A.rows());
+  int n = static_cast<int>(A.cols());
+  int x_len = (transA == Trans::No) ? n : m;
+  int y_len = (transA == Trans::No) ? m : n;
+  if (static_cast<int>(x.rows() * x.cols()) != x_len || static_cast<int>(y.rows() * y.cols()) != y_len) {
+    mpi_abort_print(m_rank, "gemv: incompatible vector dimensions");
+  }
+
+  std::vector<int> countsA, displsA, countsV, displsV;
+  compute_counts_displs_rows(m, n, m_size, countsA, displsA);
+  compute_counts_displs_rows(m, 1, m_size, countsV, displsV);
+  int local_rows = countsV[m_rank];
+
+  scratch<double> localA(countsA[m_rank]);
+  timed_scatterv((m_rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE,
+                 (countsA[m_rank] ? localA.data() : nullptr), countsA[m_rank], MPI_DOUBLE, 0, m_comm);
+
+  if (transA == Trans::No) {
+    scratch<double> xbuf;
+    if (m_rank == 0) {
+      xbuf.assign(x.data(), x.data() + n);
+    }
+    else {
+      xbuf.assign(static_cast<size_t>(n), 0.0);
+    }
+    timed_bcast(xbuf.data(), n, MPI_DOUBLE, 0, m_comm);
+    scratch<double> localY(local_rows, 0.0);
+    if (beta != 0.0) {
+      timed_scatterv((m_rank == 0 ? y.data() : nullptr), countsV.data(), displsV.data(), MPI_DOUBLE,
+                     (local_rows ? localY.data() : nullptr), local_rows, MPI_DOUBLE, 0, m_comm);
+    }
+    detail::gemv_rows(0, local_rows, n, alpha, localA.data(), n, xbuf.data(), beta, localY.data());
+    timed_gatherv((local_rows ? localY.data() : nullptr), local_rows, MPI_DOUBLE,
+                  (m_rank == 0 ? y.data() : nullptr), countsV.data(), displsV.data(), MPI_DOUBLE, 0, m_comm);
+    return;
+  }
+
+  scratch<double> localX(local_rows);
+  timed_scatterv((m_rank == 0 ? x.data() : nullptr), countsV.data(), displsV.data(), MPI_DOUBLE,
+                 (local_rows ? localX.data() : nullptr), local_rows, MPI_DOUBLE, 0, m_comm);
+  scratch<double> partial(n, 0.0);
+  detail::gemv_t_cols(0, n, local_rows, alpha, localA.data(), n, localX.data(), 0.0, partial.data());
+  scratch<double> sum(m_rank == 0 ? n : 0);
+  timed_reduce(partial.data(), (m_rank == 0 ? sum.data() : nullptr), n, MPI_DOUBLE, MPI_SUM, 0, m_comm);
+  if (m_rank == 0) {
+    double* yv = y.data();
+    for (int j = 0; j < n; j++) {
+      yv[j] = (beta == 0.0) ? sum[j] : beta * yv[j] + sum[j];
+    }
+  }
+}
+
+void MPIBackend::ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) {
+  int m = static_cast<int>(A.rows());
+  int n = static_cast<int>(A.cols());
+  if (static_cast<int>(x.rows() * x.cols()) != m || static_cast<int>(y.rows() * y.cols()) != n) {
+    mpi_abort_print(m_rank, "ger: incompatible vector dimensions");
+  }
+
+  std::vector<int> countsA, displsA, countsV, displsV;
+  compute_counts_displs_rows(m, n, m_size, countsA, displsA);
+  compute_counts_displs_rows(m, 1, m_size, countsV, displsV);
+  int local_rows = countsV[m_rank];
+
+  scratch<double> localA(countsA[m_rank]);
+  timed_scatterv((m_rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE,
+                 (countsA[m_rank] ? localA.data() : nullptr), countsA[m_rank], MPI_DOUBLE, 0, m_comm);
+  scratch<double> localX(local_rows);
+  timed_scatterv((m_rank == 0 ? x.data() : nullptr), countsV.data(), displsV.data(), MPI_DOUBLE,
+                 (local_rows ? localX.data() : nullptr), local_rows, MPI_DOUBLE, 0, m_comm);
+  scratch<double> ybuf;
+  if (m_rank == 0) {
+    ybuf.assign(y.data(), y.data() + n);
+  }
+  else {
+    ybuf.assign(static_cast<size_t>(n), 0.0);
+  }
+  timed_bcast(ybuf.data(), n, MPI_DOUBLE, 0, m_comm);
+
+  detail::ger_rows(0, local_rows, n, alpha, localX.data(), ybuf.data(), localA.data(), n);
+  timed_gatherv((countsA[m_rank] ? localA.data() : nullptr), countsA[m_rank], MPI_DOUBLE,
+                (m_rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE, 0, m_comm);
+}
+
+/* SYRK
+ * A * A^T: every row of C needs all of A, so A is broadcast and rank r
+ * takes rows [n sqrt(r/P), n sqrt((r+1)/P)) of the lower triangle, which
+ * gives each rank about the same share of its area. A^T * A: A's rows are
+ * the reduction dimension and are scattered; each rank forms the Gram
+ * matrix of its rows and the partials are summed on rank 0. Rank 0
+ * mirrors the triangle either way. */
+
+void MPIBackend::syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) {
+  int n = static_cast<int>(detail::op_rows(trans, A.rows(), A.cols()));
+  int k = static_cast<int>(detail::op_cols(trans, A.rows(), A.cols()));
+  if (static_cast<int>(C.rows()) != n || static_cast<int>(C.cols()) != n) {
+    mpi_abort_print(m_rank, "syrk: incompatible matrix dimensions");
+  }
+  size_t nn = static_cast<size_t>(n) * n;
+
+  if (trans == Trans::No) {
+    std::vector<int> first(m_size + 1), counts(m_size), displs(m_size);
+    for (int r = 0; r <= m_size; r++) {
+      first[r] = static_cast<int>(n * std::sqrt(static_cast<double>(r) / m_size) + 0.5);
+    }
+    first[m_size] = n;
+    for (int r = 0; r < m_size; r++) {
+      counts[r] = (first[r + 1] - first[r]) * n;
+      displs[r] = first[r] * n;
+    }
+
+    int a_elems = n * k;
+    scratch<double> Abuf;
+    if (m_rank == 0) {
+      Abuf.assign(A.data(), A.data() + a_elems);
+    }
+    else {
+      Abuf.assign(static_cast<size_t>(a_elems), 0.0);
+    }
+    timed_bcast(Abuf.data(), a_elems, MPI_DOUBLE, 0, m_comm);
+
+    // local rows of C, which start at global row i0
+    int i0 = first[m_rank], i1 = first[m_rank + 1];
+    scratch<double> localC(counts[m_rank], 0.0);
+    if (beta != 0.0) {
+      timed_scatterv((m_rank == 0 ? C.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE,
+                     (counts[m_rank] ? localC.data() : nullptr), counts[m_rank], MPI_DOUBLE, 0, m_comm);
+    }
+    for (int b = i0; b < i1; b += 32) {
+      detail::syrk_rows(trans, b, std::min(i1, b + 32), k, alpha, Abuf.data(), k, beta, localC.data(), n,
+                        i0);
+    }
+    timed_gatherv((counts[m_rank] ? localC.data() : nullptr), counts[m_rank], MPI_DOUBLE,
+                  (m_rank == 0 ? C.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE, 0, m_comm);
+  }
+  else {
+    // A is k x n
+    std::vector<int> countsA, displsA;
+    compute_counts_displs_rows(k, n, m_size, countsA, displsA);
+    int local_k = (n == 0) ? 0 : countsA[m_rank] / n;
+    scratch<double> localA(countsA[m_rank]);
+    timed_scatterv((m_rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE,
+                   (countsA[m_rank] ? localA.data() : nullptr), countsA[m_rank], MPI_DOUBLE, 0, m_comm);
+
+    scratch<double> partial(nn, 0.0);
+    for (int b = 0; b < n; b += 32) {
+      detail::syrk_rows(trans, b, std::min(n, b + 32), local_k, alpha, localA.data(), n, 0.0,
+                        partial.data(), n, 0);
+    }
+    scratch<double> sum(m_rank == 0 ? nn : 0);
+    timed_reduce(partial.data(), (m_rank == 0 ? sum.data() : nullptr), static_cast<int>(nn),
+                 MPI_DOUBLE, MPI_SUM, 0, m_comm);
+    if (m_rank == 0) {
+      double* c = C.data();
+      for (int i = 0; i < n; i++) {
+        for (int j = 0; j <= i; j++) {
+          size_t at = static_cast<size_t>(i) * n + j;
+          c[at] = (beta == 0.0) ? sum[at] : beta * c[at] + sum[at];
+        }
+      }
+    }
+  }
+  if (m_rank == 0) {
+    detail::mirror_lower(0, n, n, C.data(), n);
+  }
+}
+
+/* trsm
+ * Rows of a right solve are independent: A is broadcast and B scattered by
+ * rows. A left solve is transposed on the root into the right solve
+ * X^T * op(A)^T = alpha * B^T, so it splits the same way. */
+
+void MPIBackend::trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+                      const Matrix& A, Matrix& B) {
+  int n = static_cast<int>(A.rows());
+  int nb = static_cast<int>(side == Side::Left ? B.rows() : B.cols());
+  if (static_cast<int>(A.cols()) != n || nb != n) {
+    mpi_abort_print(m_rank, "trsm: incompatible matrix dimensions");
+  }
+  // rows of the right solve
+  int rows = static_cast<int>(side == Side::Left ? B.cols() : B.rows());
+  int a_elems = n * n;
+
+  scratch<double> Abuf;
+  if (m_rank == 0) {
+    Abuf.assign(A.data(), A.data() + a_elems);
+  }
+  else {
+    Abuf.assign(static_cast<size_t>(a_elems), 0.0);
+  }
+  timed_bcast(Abuf.data(), a_elems, MPI_DOUBLE, 0, m_comm);
+
+  Trans t = transA;
+  scratch<double> Bt;
+  double* full = (m_rank == 0) ? B.data() : nullptr;
+  if (side == Side::Left) {
+    t = (transA == Trans::No) ? Trans::Yes : Trans::No;
+    if (m_rank == 0) {
+      Bt.resize(static_cast<size_t>(rows) * n);
+      for (int i = 0; i < n; i++) {
+        for (int j = 0; j < rows; j++) Bt[static_cast<size_t>(j) * n + i] = B.data()[static_cast<size_t>(i) * rows + j];
+      }
+      full = Bt.data();
+    }
+  }
+
+  std::vector<int> counts, displs;
+  compute_counts_displs_rows(rows, n, m_size, counts, displs);
+  int local_rows = (n == 0) ? 0 : counts[m_rank] / n;
+  scratch<double> localB(counts[m_rank]);
+  timed_scatterv(full, counts.data(), displs.data(), MPI_DOUBLE,
+                 (counts[m_rank] ? localB.data() : nullptr), counts[m_rank], MPI_DOUBLE, 0, m_comm);
+  detail::trsm_slice(Side::Right, uplo, t, diag, 0, local_rows, n, alpha, Abuf.data(), n, localB.data(), n);
+  timed_gatherv((counts[m_rank] ? localB.data() : nullptr), counts[m_rank], MPI_DOUBLE,
+                full, counts.data(), displs.data(), MPI_DOUBLE, 0, m_comm);
+
+  if (side == Side::Left && m_rank == 0) {
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < rows; j++) B.data()[static_cast<size_t>(i) * rows + j] = Bt[static_cast<size_t>(j) * n + i];
+    }
+  }
+}
+
+/* lu / cholesky
+ * Factored on the root, which holds the data, by the serial blocked
+ * kernels; the pivots and the outcome are broadcast so that every rank
+ * returns or throws alike. */
+
+void MPIBackend::lu(Matrix& A, std::vector<size_t>& piv) {
+  size_t kmin = std::min(A.rows(), A.cols());
+  piv.resize(kmin);
+  size_t zero_col = detail::npos;
+  if (m_rank == 0) {
+    zero_col = detail::lu_factor(A.rows(), A.cols(), A.data(), A.cols(), piv.data());
+  }
+  timed_bcast(&zero_col, 1, mpi_size_type(), 0, m_comm);
+  timed_bcast(piv.data(), static_cast<int>(kmin), mpi_size_type(), 0, m_comm);
+  detail::check_lu_pivot(zero_col);
+}
+
+void MPIBackend::cholesky(Matrix& A) {
+  if (A.rows() != A.cols()) {
+    mpi_abort_print(m_rank, "cholesky: matrix must be square");
+  }
+  size_t n = A.rows();
+  size_t bad = detail::npos;
+  if (m_rank == 0) {
+    bad = detail::cholesky_factor(n, A.data(), n);
+    detail::zero_upper(0, n, n, A.data(), n);
+  }
+  timed_bcast(&bad, 1, mpi_size_type(), 0, m_comm);
+  detail::check_positive_definite(bad);
+}
+
+void MPIBackend::qr(Matrix& A, std::vector<double>& tau) {
+  size_t kmin = std::min(A.rows(), A.cols());
+  tau.resize(kmin);
+  if (m_rank == 0) {
+    detail::qr_factor(A.rows(), A.cols(), A.data(), A.cols(), tau.data());
+  }
+  timed_bcast(tau.data(), static_cast<int>(kmin), MPI_DOUBLE, 0, m_comm);
+}
+
+/* lstsq by TSQR
+ * Each rank factors its row block of [A | B] on its own. The top rows of
+ * its R, which hold R_i and the matching rows of Q_i^T * B_i, are all that
+ * leave the rank: one gather brings them to the root, which factors the
+ * stacked R_i the same way and solves with the final R. Column-by-column
+ * distributed Householder would need a collective per column instead. */
+
+Matrix MPIBackend::lstsq(const Matrix& A, const Matrix& B) {
+  int m = static_cast<int>(A.rows()), n = static_cast<int>(A.cols()), r = static_cast<int>(B.cols());
+  if (m < n || static_cast<int>(B.rows()) != m) {
+    mpi_abort_print(m_rank, "lstsq: incompatible matrix dimensions");
+  }
+  int w = n + r;
+
+  std::vector<int> countsA, displsA, countsB, displsB;
+  compute_counts_displs_rows(m, n, m_size, countsA, displsA);
+  compute_counts_displs_rows(m, r, m_size, countsB, displsB);
+  int local_rows = (n == 0) ? 0 : countsA[m_rank] / n;
+  scratch<double> localA(countsA[m_rank]), localB(countsB[m_rank]);
+  timed_scatterv((m_rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE,
+                 (countsA[m_rank] ? localA.data() : nullptr), countsA[m_rank], MPI_DOUBLE, 0, m_comm);
+  timed_scatterv((m_rank == 0 ? B.data() : nullptr), countsB.data(), displsB.data(), MPI_DOUBLE,
+                 (countsB[m_rank] ? localB.data() : nullptr), countsB[m_rank], MPI_DOUBLE, 0, m_comm);
+
+  // [A_i | B_i]; the first n reflectors depend on A_i's columns only
+  scratch<double> aug(static_cast<size_t>(local_rows) * w);
+  for (int i = 0; i < local_rows; i++) {
+    std::copy(localA.data() + static_cast<size_t>(i) * n, localA.data() + static_cast<size_t>(i + 1) * n,
+              aug.data() + static_cast<size_t>(i) * w);
+    std::copy(localB.data() + static_cast<size_t>(i) * r, localB.data() + static_cast<size_t>(i + 1) * r,
+              aug.data() + static_cast<size_t>(i) * w + n);
+  }
+  scratch<double> tau(std::min(local_rows, w));
+  detail::qr_factor(local_rows, w, aug.data(), w, tau.data());
+
+  // rows of R_i that can be nonzero in its first n columns, reflectors cleared
+  int top = std::min(local_rows, n);
+  for (int i = 0; i < top; i++) {
+    std::fill(aug.data() + static_cast<size_t>(i) * w, aug.data() + static_cast<size_t>(i) * w + i, 0.0);
+  }
+  // every rank knows every block's row count, so the sizes need no exchange
+  std::vector<int> counts(m_size), displs(m_size);
+  int stacked_rows = 0;
+  for (int q = 0; q < m_size; q++) {
+    int rows_q = std::min(countsA[q] / std::max(n, 1), n);
+    counts[q] = rows_q * w;
+    displs[q] = stacked_rows * w;
+    stacked_rows += rows_q;
+  }
+  int mine = counts[m_rank];
+  scratch<double> S(m_rank == 0 ? static_cast<size_t>(stacked_rows) * w : 0);
+  timed_gatherv((mine ? aug.data() : nullptr), mine, MPI_DOUBLE,
+                (m_rank == 0 ? S.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE, 0, m_comm);
+
+  Matrix X(0, 0);
+  int rank_deficient = 0;
+  if (m_rank == 0) {
+    scratch<double> tau_s(std::min(stacked_rows, w));
+    detail::qr_factor(stacked_rows, w, S.data(), w, tau_s.data());
+    for (int i = 0; i < n; i++) {
+      if (S[static_cast<size_t>(i) * w + i] == 0.0) rank_deficient = 1;
+    }
+    if (!rank_deficient) {
+      X = Matrix(n, r);
+      for (int i = 0; i < n; i++) {
+        std::copy(S.data() + static_cast<size_t>(i) * w + n, S.data() + static_cast<size_t>(i + 1) * w,
+                  X.data() + static_cast<size_t>(i) * r);
+      }
+      detail::trsm_slice(Side::Left, Triangle::Upper, Trans::No, Diag::NonUnit, 0, r, n, 1.0,
+                         S.data(), w, X.data(), r);
+    }
+  }
+  timed_bcast(&rank_deficient, 1, MPI_INT, 0, m_comm);
+  if (rank_deficient) {
+    throw std::runtime_error("lstsq: A is rank deficient");
+  }
+  return X;
+}
+
+/* sq_distances / knn
+ * Rows of A are scattered and B is broadcast with its row norms; each rank
+ * runs the fused kernel on its rows, so only the result rows (or k of
+ * each) travel back to the root. */
+
+// local rows of A, and B on every rank, for the distance kernels
+static void distribute_distance_operands(const Matrix& A, const Matrix& B, int rank, int size, MPI_Comm comm,
+                                         std::vector<int>& countsA, std::vector<int>& displsA,
+                                         scratch<double>& localA, scratch<double>& Bbuf) {
+  int n = static_cast<int>(A.rows()), m = static_cast<int>(B.rows()), d = static_cast<int>(A.cols());
+  compute_counts_displs_rows(n, d, size, countsA, displsA);
+  localA.resize(countsA[rank]);
+  timed_scatterv((rank == 0 ? A.data() : nullptr), countsA.data(), displsA.data(), MPI_DOUBLE,
+                 (countsA[rank] ? localA.data() : nullptr), countsA[rank], MPI_DOUBLE, 0, comm);
+  if (rank == 0) {
+    Bbuf.assign(B.data(), B.data() + static_cast<size_t>(m) * d);
+  }
+  else {
+    Bbuf.assign(static_cast<size_t>(m) * d, 0.0);
+  }
+  timed_bcast(Bbuf.data(), m * d, MPI_DOUBLE, 0, comm);
+}
+
+Matrix MPIBackend::sq_distances(const Matrix& A, const Matrix& B) {
+  if (A.cols() != B.cols()) {
+    mpi_abort_print(m_rank, "sq_distances: rows of A and B differ in length");
+  }
+  int n = static_cast<int>(A.rows()), m = static_cast<int>(B.rows()), d = static_cast<int>(A.cols());
+  std::vector<int> countsA, displsA, countsD, displsD;
+  scratch<double> localA, Bbuf;
+  distribute_distance_operands(A, B, m_rank, m_size, m_comm, countsA, displsA, localA, Bbuf);
+  int local_rows = first_row(n, m_size, m_rank + 1) - first_row(n, m_size, m_rank);
+
+  scratch<double> an(local_rows), bn(m);
+  detail::row_sq_norms(0, local_rows, d, localA.data(), d, an.data());
+  detail::row_sq_norms(0, m, d, Bbuf.data(), d, bn.data());
+  compute_counts_displs_rows(n, m, m_size, countsD, displsD);
+  scratch<double> localD(countsD[m_rank]);
+  detail::sq_distance_rows(0, local_rows, m, d, localA.data(), d, Bbuf.data(), d, an.data(), bn.data(),
+                           localD.data(), m);
+
+  Matrix D;
+  if (m_rank == 0) {
+    D = Matrix(static_cast<size_t>(n), static_cast<size_t>(m));
+  }
+  timed_gatherv((countsD[m_rank] ? localD.data() : nullptr), countsD[m_rank], MPI_DOUBLE,
+                (m_rank == 0 ? D.data() : nullptr), countsD.data(), displsD.data(), MPI_DOUBLE, 0, m_comm);
+  return (m_rank == 0) ? D : Matrix(0, 0);
+}
+
+void MPIBackend::knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+                     std::vector<size_t>& indices) {
+  if (A.cols() != B.cols() || k == 0 || k > B.rows()) {
+    mpi_abort_print(m_rank, "knn: incompatible dimensions or k out of range");
+  }
+  int n = static_cast<int>(A.rows()), m = static_cast<int>(B.rows()), d = static_cast<int>(A.cols());
+  int kk = static_cast<int>(k);
+  std::vector<int> countsA, displsA, countsK, displsK;
+  scratch<double> localA, Bbuf;
+  distribute_distance_operands(A, B, m_rank, m_size, m_comm, countsA, displsA, localA, Bbuf);
+  int local_rows = first_row(n, m_size, m_rank + 1) - first_row(n, m_size, m_rank);
+
+  scratch<double> an(local_rows), bn(m);
+  detail::row_sq_norms(0, local_rows, d, localA.data(), d, an.data());
+  detail::row_sq_norms(0, m, d, Bbuf.data(), d, bn.data());
+  compute_counts_displs_rows(n, kk, m_size, countsK, displsK);
+  scratch<double> localDist(countsK[m_rank]);
+  scratch<size_t> localIdx(countsK[m_rank]);
+  detail::knn_rows(0, local_rows, m, d, k, localA.data(), d, Bbuf.data(), d, an.data(), bn.data(),
+                   localDist.data(), localIdx.data());
+
+  distances = (m_rank == 0) ? Matrix(static_cast<size_t>(n), k) : Matrix(0, 0);
+  indices.assign(m_rank == 0 ? static_cast<size_t>(n) * k : 0, 0);
+  timed_gatherv((countsK[m_rank] ? localDist.data() : nullptr), countsK[m_rank], MPI_DOUBLE,
+                (m_rank == 0 ? distances.data() : nullptr), countsK.data(), displsK.data(), MPI_DOUBLE, 0, m_comm);
+  timed_gatherv((countsK[m_rank] ? localIdx.data() : nullptr), countsK[m_rank], mpi_size_type(),
+                (m_rank == 0 ? indices.data() : nullptr), countsK.data(), displsK.data(), mpi_size_type(),
+                0, m_comm);
+}
+
+
+/* reduce / argmax / transform_rows
+ * Rows of A are scattered. Row-wise results are gathered back to the root;
+ * column reductions fold each rank's rows into one partial per column and
+ * combine the partials with MPI_Allreduce, so every rank gets the result
+ * and only n values per rank travel. */
+
+// this rank's rows of A
+static void scatter_rows(const Matrix& A, int rank, int size, MPI_Comm comm, scratch<double>& local) {
+  std::vector<int> counts, displs;
+  compute_counts_displs_rows(static_cast<int>(A.rows()), static_cast<int>(A.cols()), size, counts, displs);
+  local.resize(counts[rank]);
+  timed_scatterv((rank == 0 ? A.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE,
+                 (counts[rank] ? local.data() : nullptr), counts[rank], MPI_DOUBLE, 0, comm);
+}
+
+// the MPI op combining partials of a column reduction
+static MPI_Op reduction_mpi_op(Reduction op) {
+  if (op == Reduction::Min) return MPI_MIN;
+  if (op == Reduction::Max) return MPI_MAX;
+  return MPI_SUM;
+}
+
+Matrix MPIBackend::reduce(Reduction op, Axis axis, const Matrix& A) {
+  int m = static_cast<int>(A.rows()), n = static_cast<int>(A.cols());
+  scratch<double> local;
+  scatter_rows(A, m_rank, m_size, m_comm, local);
+  int local_rows = first_row(m, m_size, m_rank + 1) - first_row(m, m_size, m_rank);
+
+  if (axis == Axis::Rows) {
+    scratch<double> localR(local_rows);
+    detail::reduce_rows(op, 0, local_rows, n, local.data(), n, localR.data());
+    std::vector<int> counts, displs;
+    compute_counts_displs_rows(m, 1, m_size, counts, displs);
+    Matrix R;
+    if (m_rank == 0) {
+      R = Matrix(static_cast<size_t>(m), 1);
+    }
+    timed_gatherv((local_rows ? localR.data() : nullptr), local_rows, MPI_DOUBLE,
+                  (m_rank == 0 ? R.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE, 0, m_comm);
+    return (m_rank == 0) ? R : Matrix(0, 0);
+  }
+
+  // LogSumExp shifts by the global column maxima, so those come first
+  scratch<double> shift;
+  if (op == Reduction::LogSumExp) {
+    shift.resize(n);
+    detail::reduce_cols_init(Reduction::Max, 0, n, shift.data());
+    detail::reduce_cols_fold(Reduction::Max, 0, local_rows, 0, n, local.data(), n, nullptr, shift.data());
+    timed_allreduce(MPI_IN_PLACE, shift.data(), n, MPI_DOUBLE, MPI_MAX, m_comm);
+  }
+  Matrix R(1, static_cast<size_t>(n));
+  detail::reduce_cols_init(op, 0, n, R.data());
+  detail::reduce_cols_fold(op, 0, local_rows, 0, n, local.data(), n, shift.data(), R.data());
+  timed_allreduce(MPI_IN_PLACE, R.data(), n, MPI_DOUBLE, reduction_mpi_op(op), m_comm);
+  detail::reduce_cols_finish(op, m, 0, n, shift.data(), R.data());
+  return R;
+}
+
+std::vector<size_t> MPIBackend::argmax(Axis axis, const Matrix& A) {
+  if ((axis == Axis::Rows ? A.cols() : A.rows()) == 0) {
+    mpi_abort_print(m_rank, "argmax: the rows or columns of A are empty");
+  }
+  int m = static_cast<int>(A.rows()), n = static_cast<int>(A.cols());
+  scratch<double> local;
+  scatter_rows(A, m_rank, m_size, m_comm, local);
+  int row0 = first_row(m, m_size, m_rank);
+  int local_rows = first_row(m, m_size, m_rank + 1) - row0;
+
+  if (axis == Axis::Rows) {
+    scratch<size_t> localIdx(local_rows);
+    detail::argmax_rows(0, local_rows, n, local.data(), n, localIdx.data());
+    std::vector<int> counts, displs;
+    compute_counts_displs_rows(m, 1, m_size, counts, displs);
+    std::vector<size_t> where(m_rank == 0 ? static_cast<size_t>(m) : 0);
+    timed_gatherv((local_rows ? localIdx.data() : nullptr), local_rows, mpi_size_type(),
+                  (m_rank == 0 ? where.data() : nullptr), counts.data(), displs.data(), mpi_size_type(),
+                  0, m_comm);
+    return where;
+  }
+
+  scratch<double> best(n, -std::numeric_limits<double>::infinity());
+  scratch<size_t> localWhere(n, detail::npos);
+  detail::argmax_cols_fold(0, local_rows, 0, n, local.data(), n, best.data(), localWhere.data());
+
+  // MPI_MAXLOC keeps the larger value and, on ties, the smaller index,
+  // the earlier row; a rank without rows offers a row that always loses
+  struct ValueIndex { double value; int index; };
+  std::vector<ValueIndex> pairs(n);
+  for (int c = 0; c < n; c++) {
+    pairs[c].value = best[c];
+    pairs[c].index = (localWhere[c] == detail::npos) ? std::numeric_limits<int>::max()
+                                                      : row0 + static_cast<int>(localWhere[c]);
+  }
+  timed_allreduce(MPI_IN_PLACE, pairs.data(), n, MPI_DOUBLE_INT, MPI_MAXLOC, m_comm);
+  std::vector<size_t> where(n);
+  for (int c = 0; c < n; c++) {
+    where[c] = static_cast<size_t>(pairs[c].index);
+  }
+  return where;
+}
+
+Matrix MPIBackend::transform_rows(RowTransform op, const Matrix& A) {
+  int m = static_cast<int>(A.rows()), n = static_cast<int>(A.cols());
+  scratch<double> local;
+  scatter_rows(A, m_rank, m_size, m_comm, local);
+  int local_rows = first_row(m, m_size, m_rank + 1) - first_row(m, m_size, m_rank);
+  detail::transform_rows(op, 0, local_rows, n, local.data(), n, local.data(), n);
+
+  std::vector<int> counts, displs;
+  compute_counts_displs_rows(m, n, m_size, counts, displs);
+  Matrix R;
+  if (m_rank == 0) {
+    R = Matrix(static_cast<size_t>(m), static_cast<size_t>(n));
+  }
+  timed_gatherv((counts[m_rank] ? local.data() : nullptr), counts[m_rank], MPI_DOUBLE,
+                (m_rank == 0 ? R.data() : nullptr), counts.data(), displs.data(), MPI_DOUBLE, 0, m_comm);
+  return (m_rank == 0) ? R : Matrix(0, 0);
+}
+
 }
@@ -1,21 +1,35 @@
 #include "lumin.hpp"
+#include "../kernels.hpp"
 
 namespace lumin {
 
-static void check_same_size(const Matrix& A, const Matrix& B, const char* op) {
-  if (A.rows() != B.rows() || A.cols() != B.cols()) {
-    throw std::runtime_error("dimension mismatch in operation");
-  }
+// rows per block for the row-wise ops, about 16K entries
+static long rows_per_block(size_t n) {
+  return static_cast<long>(std::max<size_t>(1, (size_t(1) << 14) / std::max<size_t>(1, n)));
 }
 
-static void check_multiply_dims(const Matrix& A, const Matrix& B) {
-  if (A.cols() != B.rows()) {
-    throw std::runtime_error("multiply dimension mismatch");
+// A op B with an operand broadcast along rows or columns, by row blocks
+static Matrix broadcast(detail::ElementOp op, const char* name, const Matrix& A, const Matrix& B) {
+  detail::check_broadcast_dims(name, A, B);
+  size_t rows = detail::broadcast_extent(A.rows(), B.rows());
+  size_t cols = detail::broadcast_extent(A.cols(), B.cols());
+  Matrix R(rows, cols);
+  long rows_per = rows_per_block(cols);
+  long blocks = static_cast<long>((rows + rows_per - 1) / rows_per);
+
+  #pragma omp parallel for
+  for (long b = 0; b < blocks; b++) {
+    size_t i0 = static_cast<size_t>(b * rows_per);
+    detail::broadcast_rows(op, i0, std::min(rows, i0 + rows_per), cols, A.data(), A.rows(), A.cols(),
+                           B.data(), B.rows(), B.cols(), R.data());
   }
+  return R;
 }
 
 Matrix OMPBackend::add(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "add");
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return broadcast(detail::ElementOp::Add, "add", A, B);
+  }
   Matrix R(A.rows(), A.cols());
   size_t N = A.rows() * A.cols();
 
@@ -27,7 +41,9 @@ Matrix OMPBackend::add(const Matrix& A, const Matrix& B) {
 }
 
 Matrix OMPBackend::subtract(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "subtract");
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return broadcast(detail::ElementOp::Subtract, "subtract", A, B);
+  }
   Matrix R(A.rows(), A.cols());
   size_t N = A.rows() * A.cols();
 
@@ -38,6 +54,20 @@ Matrix OMPBackend::subtract(const Matrix& A, const Matrix& B) {
   return R;
 }
 
+Matrix OMPBackend::hadamard(const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return broadcast(detail::ElementOp::Multiply, "hadamard", A, B);
+  }
+  Matrix R(A.rows(), A.cols());
+  size_t N = A.rows() * A.cols();
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < N; i++) {
+    R.data()[i] = A.data()[i] * B.data()[i];
+  }
+  return R;
+}
+
 Matrix OMPBackend::scalar(double s, const Matrix& A) {
   Matrix R(A.rows(), A.cols());
   size_t N = A.rows() * A.cols();
@@ -50,8 +80,11 @@ Matrix OMPBackend::scalar(double s, const Matrix& A) {
 }
 
 Matrix OMPBackend::multiply(const Matrix& A, const Matrix& B) {
-  check_multiply_dims(A, B);
+  detail::check_multiply_dims(A, B);
   Matrix R(A.rows(), B.cols());
+  if (detail::multiply_as_gemv(*this, A, B, R)) {
+    return R;
+  }
 
   #pragma omp parallel for
   for (size_t i = 0; i < A.rows(); i++) {
@@ -66,7 +99,7 @@ Matrix OMPBackend::multiply(const Matrix& A, const Matrix& B) {
 }
 
 double OMPBackend::dot(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "dot");
+  detail::check_same_size("dot", A, B);
   double res = 0.0;
   size_t N = A.rows() * A.cols();
 
@@ -89,5 +122,410 @@ Matrix OMPBackend::transpose(const Matrix& A) {
   return R;
 }
 
+Matrix OMPBackend::spmv(const SparseMatrix& A, const Matrix& x) {
+  if (x.cols() != 1 || A.cols() != x.rows()) {
+    throw std::runtime_error("spmv dimension mismatch");
+  }
+  // CSC has no race-free row split, so it is re-compressed first
+  SparseMatrix converted;
+  const SparseMatrix& csr = (A.format() == SparseFormat::CSR) ? A : (converted = A.to_csr());
+  const size_t* ptr = csr.ptr().data();
+  const size_t* idx = csr.indices().data();
+  const double* val = csr.values().data();
+  const double* xv = x.data();
+  Matrix y(A.rows(), 1);
+  double* yv = y.data();
+
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (size_t i = 0; i < csr.rows(); i++) {
+    double sum = 0.0;
+    for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+      sum += val[p] * xv[idx[p]];
+    }
+    yv[i] = sum;
+  }
+  return y;
+}
+
+Matrix OMPBackend::spmm(const SparseMatrix& A, const Matrix& B) {
+  if (A.cols() != B.rows()) {
+    throw std::runtime_error("spmm dimension mismatch");
+  }
+  SparseMatrix converted;
+  const SparseMatrix& csr = (A.format() == SparseFormat::CSR) ? A : (converted = A.to_csr());
+  const size_t* ptr = csr.ptr().data();
+  const size_t* idx = csr.indices().data();
+  const double* val = csr.values().data();
+  size_t n = B.cols();
+  Matrix R(A.rows(), n);
+
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (size_t i = 0; i < csr.rows(); i++) {
+    double* r_row = R.data() + i * n;
+    for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+      double a = val[p];
+      const double* b_row = B.data() + idx[p] * n;
+      for (size_t j = 0; j < n; j++) {
+        r_row[j] += a * b_row[j];
+      }
+    }
+  }
+  return R;
+}
+
+// each thread takes whole blocks of output rows; the kernel packs and
+// blocks within them
+void OMPBackend::gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+                      const Matrix& B, double beta, Matrix& C) {
+  detail::check_gemm_dims(transA, transB, A, B, C);
+  size_t m = C.rows(), n = C.cols();
+  size_t k = detail::op_cols(transA, A.rows(), A.cols());
+  const long rows_per_block = 16;
+  long blocks = static_cast<long>((m + rows_per_block - 1) / rows_per_block);
+
+  #pragma omp parallel for schedule(static)
+  for (long b = 0; b < blocks; b++) {
+    size_t i0 = static_cast<size_t>(b * rows_per_block);
+    size_t i1 = std::min(m, i0 + rows_per_block);
+    detail::gemm_rows(transA, transB, i0, i1, n, k, alpha, A.data(), A.cols(),
+                      B.data(), B.cols(), beta, C.data(), n);
+  }
+}
+
+void OMPBackend::gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+                      double beta, Matrix& y) {
+  detail::check_gemv_dims(transA, A, x, y);
+  size_t m = A.rows(), n = A.cols();
+  if (transA == Trans::No) {
+    const long rows_per_block = 256;
+    long blocks = static_cast<long>((m + rows_per_block - 1) / rows_per_block);
+    #pragma omp parallel for schedule(static)
+    for (long b = 0; b < blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows_per_block);
+      detail::gemv_rows(i0, std::min(m, i0 + rows_per_block), n, alpha, A.data(), n,
+                        x.data(), beta, y.data());
+    }
+  }
+  else {
+    // each thread owns a strip of y and streams that strip of every row
+    const long cols_per_strip = 512;
+    long strips = static_cast<long>((n + cols_per_strip - 1) / cols_per_strip);
+    #pragma omp parallel for schedule(static)
+    for (long b = 0; b < strips; b++) {
+      size_t j0 = static_cast<size_t>(b * cols_per_strip);
+      detail::gemv_t_cols(j0, std::min(n, j0 + cols_per_strip), m, alpha, A.data(), n,
+                          x.data(), beta, y.data());
+    }
+  }
+}
+
+void OMPBackend::ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) {
+  detail::check_ger_dims(x, y, A);
+  size_t m = A.rows(), n = A.cols();
+  const long rows_per_block = 64;
+  long blocks = static_cast<long>((m + rows_per_block - 1) / rows_per_block);
+  #pragma omp parallel for schedule(static)
+  for (long b = 0; b < blocks; b++) {
+    size_t i0 = static_cast<size_t>(b * rows_per_block);
+    detail::ger_rows(i0, std::min(m, i0 + rows_per_block), n, alpha, x.data(), y.data(), A.data(), n);
+  }
+}
+
+// later rows reach further along the triangle, hence the dynamic schedule
+void OMPBackend::syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) {
+  detail::check_syrk_dims(trans, A, C);
+  size_t n = C.rows(), k = detail::op_cols(trans, A.rows(), A.cols());
+  const long rows_per_block = 16;
+  long blocks = static_cast<long>((n + rows_per_block - 1) / rows_per_block);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (long b = 0; b < blocks; b++) {
+    size_t i0 = static_cast<size_t>(b * rows_per_block);
+    detail::syrk_rows(trans, i0, std::min(n, i0 + rows_per_block), k, alpha, A.data(), A.cols(),
+                      beta, C.data(), n, 0);
+  }
+  #pragma omp parallel for schedule(dynamic)
+  for (long b = 0; b < blocks; b++) {
+    size_t i0 = static_cast<size_t>(b * rows_per_block);
+    detail::mirror_lower(i0, std::min(n, i0 + rows_per_block), n, C.data(), n);
+  }
+}
+
+void OMPBackend::trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+                      const Matrix& A, Matrix& B) {
+  detail::check_trsm_dims(side, A, B);
+  size_t n = A.rows();
+  size_t slices = (side == Side::Left) ? B.cols() : B.rows();
+  // columns of B for a left solve, rows for a right one; they are
+  // independent, and each slice runs the blocked solve on its own
+  const long per_block = (side == Side::Left) ? 32 : 16;
+  long blocks = static_cast<long>((slices + per_block - 1) / per_block);
+
+  #pragma omp parallel for
+  for (long b = 0; b < blocks; b++) {
+    size_t s0 = static_cast<size_t>(b * per_block);
+    detail::trsm_slice(side, uplo, transA, diag, s0, std::min(slices, s0 + per_block), n, alpha,
+                       A.data(), A.cols(), B.data(), B.cols());
+  }
+}
+
+/* Blocked right-looking LU as a task graph. Column blocks of
+ * FACTOR_BLOCK are tasks that depend on their first entry, a[j0]: the
+ * panel of step k and, for each block right of it, the update of that
+ * block by the panel. The panel of step k + 1 waits only for its own
+ * block's update, so it is factored while the rest of step k's updates
+ * still run, keeping the critical path of panels busy. */
+
+void OMPBackend::lu(Matrix& A, std::vector<size_t>& piv) {
+  size_t m = A.rows(), n = A.cols(), kmin = std::min(m, n);
+  const size_t nb = detail::FACTOR_BLOCK;
+  piv.resize(kmin);
+  double* a = A.data();
+  size_t* p = piv.data();
+  // only panel tasks touch it, and they run one after another
+  size_t zero_col = detail::npos;
+
+  #pragma omp parallel
+  #pragma omp single
+  {
+    for (size_t k = 0; k < kmin; k += nb) {
+      size_t kb = std::min(nb, kmin - k);
+      #pragma omp task depend(inout: a[k]) firstprivate(k, kb) shared(zero_col)
+      {
+        size_t z = detail::lu_panel(k, kb, m, a, n, p);
+        if (zero_col == detail::npos) zero_col = z;
+        // a short last panel shares its column block with the columns after it
+        detail::lu_update_cols(k, kb, m, k + kb, std::min(n, k + nb), a, n, p);
+      }
+      for (size_t j0 = k + nb; j0 < n; j0 += nb) {
+        size_t j1 = std::min(n, j0 + nb);
+        #pragma omp task depend(in: a[k]) depend(inout: a[j0]) firstprivate(k, kb, j0, j1)
+        detail::lu_update_cols(k, kb, m, j0, j1, a, n, p);
+      }
+    }
+  }
+
+  // each step's swaps on the finished column blocks left of it
+  long blocks = static_cast<long>((kmin + nb - 1) / nb);
+  #pragma omp parallel for
+  for (long b = 0; b < blocks; b++) {
+    size_t j0 = static_cast<size_t>(b) * nb, j1 = std::min(kmin, j0 + nb);
+    detail::laswp(j1, kmin, j0, j1, a, n, p);
+  }
+  detail::check_lu_pivot(zero_col);
+}
+
+/* Tiled Cholesky as a task graph over FACTOR_BLOCK tiles of the lower
+ * triangle, each identified by its first entry: factor the diagonal tile,
+ * solve the tiles below it, then update each trailing tile from the two
+ * panel tiles it reads. Updates of later steps start as soon as their
+ * inputs are ready rather than after the whole step. */
+
+void OMPBackend::cholesky(Matrix& A) {
+  if (A.rows() != A.cols()) {
+    throw std::runtime_error("cholesky: matrix must be square");
+  }
+  size_t n = A.rows();
+  const size_t nb = detail::FACTOR_BLOCK;
+  double* a = A.data();
+  // only diagonal tasks touch it, and they run one after another
+  size_t bad = detail::npos;
+
+  #pragma omp parallel
+  #pragma omp single
+  {
+    for (size_t k = 0; k < n; k += nb) {
+      size_t kb = std::min(nb, n - k), ke = k + kb;
+      #pragma omp task depend(inout: a[k * n + k]) firstprivate(k, kb) shared(bad)
+      {
+        if (bad == detail::npos) bad = detail::potrf_block(k, kb, a, n);
+      }
+      for (size_t i0 = ke; i0 < n; i0 += nb) {
+        size_t i1 = std::min(n, i0 + nb);
+        #pragma omp task depend(in: a[k * n + k]) depend(inout: a[i0 * n + k]) firstprivate(k, kb, i0, i1)
+        detail::cholesky_panel_rows(k, kb, i0, i1, a, n);
+      }
+      for (size_t i0 = ke; i0 < n; i0 += nb) {
+        size_t i1 = std::min(n, i0 + nb);
+        for (size_t j0 = ke; j0 <= i0; j0 += nb) {
+          size_t j1 = std::min(n, j0 + nb);
+          #pragma omp task depend(in: a[i0 * n + k], a[j0 * n + k]) depend(inout: a[i0 * n + j0]) \
+              firstprivate(k, kb, i0, i1, j0, j1)
+          detail::cholesky_update(k, kb, i0, i1, j0, j1, a, n);
+        }
+      }
+    }
+  }
+  detail::check_positive_definite(bad);
+
+  #pragma omp parallel for
+  for (long i = 0; i < static_cast<long>(n); i++) {
+    detail::zero_upper(static_cast<size_t>(i), static_cast<size_t>(i) + 1, n, a, n);
+  }
+}
+
+void OMPBackend::qr(Matrix& A, std::vector<double>& tau) {
+  size_t m = A.rows(), n = A.cols(), kmin = std::min(m, n);
+  const size_t nb = detail::FACTOR_BLOCK;
+  // narrower than a panel, so a tall-skinny matrix still has a few
+  // trailing blocks per thread
+  const size_t cols_per_block = 32;
+  tau.resize(kmin);
+  double* a = A.data();
+  std::vector<double> T(nb * nb);
+
+  for (size_t k = 0; k < kmin; k += nb) {
+    size_t kb = std::min(nb, kmin - k), ke = k + kb;
+    detail::qr_panel(k, kb, m, a, n, tau.data());
+    if (ke == n) continue;
+    detail::qr_block_t(k, kb, m, a, n, tau.data(), T.data());
+    long blocks = static_cast<long>((n - ke + cols_per_block - 1) / cols_per_block);
+
+    #pragma omp parallel for
+    for (long b = 0; b < blocks; b++) {
+      size_t c0 = ke + static_cast<size_t>(b) * cols_per_block;
+      detail::apply_block_reflector(Trans::Yes, k, kb, m, a, n, T.data(), c0,
+                                    std::min(n, c0 + cols_per_block), a, n);
+    }
+  }
+}
+
+Matrix OMPBackend::sq_distances(const Matrix& A, const Matrix& B) {
+  detail::check_distance_dims(A, B);
+  size_t n = A.rows(), m = B.rows(), d = A.cols();
+  std::vector<double> an(n), bn(m);
+  Matrix D(n, m);
+  const long rows_per_block = 16;
+  long a_blocks = static_cast<long>((n + rows_per_block - 1) / rows_per_block);
+  long b_blocks = static_cast<long>((m + rows_per_block - 1) / rows_per_block);
+
+  #pragma omp parallel
+  {
+    #pragma omp for
+    for (long b = 0; b < b_blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows_per_block);
+      detail::row_sq_norms(i0, std::min(m, i0 + rows_per_block), d, B.data(), d, bn.data());
+    }
+    #pragma omp for
+    for (long b = 0; b < a_blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows_per_block);
+      detail::row_sq_norms(i0, std::min(n, i0 + rows_per_block), d, A.data(), d, an.data());
+    }
+    #pragma omp for
+    for (long b = 0; b < a_blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows_per_block);
+      detail::sq_distance_rows(i0, std::min(n, i0 + rows_per_block), m, d, A.data(), d, B.data(), d,
+                               an.data(), bn.data(), D.data(), m);
+    }
+  }
+  return D;
+}
+
+void OMPBackend::knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+                     std::vector<size_t>& indices) {
+  detail::check_knn_dims(A, B, k);
+  size_t n = A.rows(), m = B.rows(), d = A.cols();
+  std::vector<double> an(n), bn(m);
+  distances = Matrix(n, k);
+  indices.resize(n * k);
+  const long rows_per_block = 16;
+  long a_blocks = static_cast<long>((n + rows_per_block - 1) / rows_per_block);
+  long b_blocks = static_cast<long>((m + rows_per_block - 1) / rows_per_block);
+
+  #pragma omp parallel
+  {
+    #pragma omp for
+    for (long b = 0; b < b_blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows_per_block);
+      detail::row_sq_norms(i0, std::min(m, i0 + rows_per_block), d, B.data(), d, bn.data());
+    }
+    #pragma omp for
+    for (long b = 0; b < a_blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows_per_block);
+      detail::row_sq_norms(i0, std::min(n, i0 + rows_per_block), d, A.data(), d, an.data());
+    }
+    #pragma omp for schedule(dynamic)
+    for (long b = 0; b < a_blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows_per_block);
+      detail::knn_rows(i0, std::min(n, i0 + rows_per_block), m, d, k, A.data(), d, B.data(), d,
+                       an.data(), bn.data(), distances.data(), indices.data());
+    }
+  }
+}
+
+// the split column kernels' tasks, one loop iteration each
+static void strip_tasks(size_t count, const std::function<void(size_t, size_t)>& body) {
+  #pragma omp parallel for
+  for (long t = 0; t < static_cast<long>(count); t++) {
+    body(static_cast<size_t>(t), static_cast<size_t>(t) + 1);
+  }
+}
+
+Matrix OMPBackend::reduce(Reduction op, Axis axis, const Matrix& A) {
+  size_t m = A.rows(), n = A.cols();
+  if (axis == Axis::Rows) {
+    Matrix R(m, 1);
+    long rows = rows_per_block(n);
+    long blocks = static_cast<long>((m + rows - 1) / rows);
+
+    #pragma omp parallel for
+    for (long b = 0; b < blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows);
+      detail::reduce_rows(op, i0, std::min(m, i0 + rows), n, A.data(), n, R.data());
+    }
+    return R;
+  }
+
+  std::vector<double> acc = detail::reduce_cols(strip_tasks, op, m, n, A.data());
+  Matrix R(1, n);
+  std::copy(acc.begin(), acc.end(), R.data());
+  return R;
+}
+
+std::vector<size_t> OMPBackend::argmax(Axis axis, const Matrix& A) {
+  detail::check_argmax_dims(axis, A);
+  size_t m = A.rows(), n = A.cols();
+  if (axis == Axis::Rows) {
+    std::vector<size_t> where(m);
+    long rows = rows_per_block(n);
+    long blocks = static_cast<long>((m + rows - 1) / rows);
+
+    #pragma omp parallel for
+    for (long b = 0; b < blocks; b++) {
+      size_t i0 = static_cast<size_t>(b * rows);
+      detail::argmax_rows(i0, std::min(m, i0 + rows), n, A.data(), n, where.data());
+    }
+    return where;
+  }
+
+  return detail::argmax_cols(strip_tasks, m, n, A.data());
+}
+
+Matrix OMPBackend::transform_rows(RowTransform op, const Matrix& A) {
+  size_t m = A.rows(), n = A.cols();
+  Matrix R(m, n);
+  long rows = rows_per_block(n);
+  long blocks = static_cast<long>((m + rows - 1) / rows);
+
+  #pragma omp parallel for
+  for (long b = 0; b < blocks; b++) {
+    size_t i0 = static_cast<size_t>(b * rows);
+    detail::transform_rows(op, i0, std::min(m, i0 + rows), n, A.data(), n, R.data(), n);
+  }
+  return R;
+}
+
+void OMPBackend::parallel_ranges(size_t n, const std::function<void(size_t, size_t)>& body) {
+  // blocks of about 16K entries, as rows_per_block gives for one long row
+  const size_t block = size_t(1) << 14;
+  long blocks = static_cast<long>((n + block - 1) / block);
+
+  #pragma omp parallel for
+  for (long b = 0; b < blocks; b++) {
+    size_t lo = static_cast<size_t>(b) * block;
+    body(lo, std::min(n, lo + block));
+  }
+}
+
 } // namespace lumin
 
@@ -0,0 +1,525 @@
+#include "lumin.hpp"
+#include "lumin/threadpool_backend.hpp"
+#include "../kernels.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace lumin {
+
+// elements per task for streaming ops; large enough to hide task overhead
+static const size_t ELEMENT_GRAIN = 1 << 14;
+// multiply recursion stops at blocks of about this many multiply-adds
+static const size_t MULTIPLY_LEAF = 1 << 15;
+static const size_t TRANSPOSE_BLOCK = 32;
+
+ThreadPoolBackend::ThreadPoolBackend()
+  : m_pool(&default_thread_pool(), [](ThreadPool*) { })
+{ }
+
+ThreadPoolBackend::ThreadPoolBackend(std::shared_ptr<ThreadPool> pool)
+  : m_pool(std::move(pool))
+{ }
+
+// rows per task for the row-wise ops, about ELEMENT_GRAIN entries
+static size_t rows_grain(size_t n) {
+  return std::max<size_t>(1, ELEMENT_GRAIN / std::max<size_t>(1, n));
+}
+
+// A op B with an operand broadcast along rows or columns, by row ranges
+static Matrix broadcast(ThreadPool& pool, detail::ElementOp op, const char* name, const Matrix& A,
+                        const Matrix& B) {
+  detail::check_broadcast_dims(name, A, B);
+  size_t rows = detail::broadcast_extent(A.rows(), B.rows());
+  size_t cols = detail::broadcast_extent(A.cols(), B.cols());
+  Matrix R(rows, cols);
+  const double* a = A.data();
+  const double* b = B.data();
+  double* r = R.data();
+  size_t a_rows = A.rows(), a_cols = A.cols(), b_rows = B.rows(), b_cols = B.cols();
+  pool.parallel_for(0, rows, rows_grain(cols), [=](size_t lo, size_t hi) {
+    detail::broadcast_rows(op, lo, hi, cols, a, a_rows, a_cols, b, b_rows, b_cols, r);
+  });
+  return R;
+}
+
+Matrix ThreadPoolBackend::add(const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return broadcast(*m_pool, detail::ElementOp::Add, "add", A, B);
+  }
+  Matrix R(A.rows(), A.cols());
+  const double* a = A.data();
+  const double* b = B.data();
+  double* r = R.data();
+  m_pool->parallel_for(0, A.rows() * A.cols(), ELEMENT_GRAIN, [=](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      r[i] = a[i] + b[i];
+    }
+  });
+  return R;
+}
+
+Matrix ThreadPoolBackend::subtract(const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return broadcast(*m_pool, detail::ElementOp::Subtract, "subtract", A, B);
+  }
+  Matrix R(A.rows(), A.cols());
+  const double* a = A.data();
+  const double* b = B.data();
+  double* r = R.data();
+  m_pool->parallel_for(0, A.rows() * A.cols(), ELEMENT_GRAIN, [=](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      r[i] = a[i] - b[i];
+    }
+  });
+  return R;
+}
+
+Matrix ThreadPoolBackend::hadamard(const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    return broadcast(*m_pool, detail::ElementOp::Multiply, "hadamard", A, B);
+  }
+  Matrix R(A.rows(), A.cols());
+  const double* a = A.data();
+  const double* b = B.data();
+  double* r = R.data();
+  m_pool->parallel_for(0, A.rows() * A.cols(), ELEMENT_GRAIN, [=](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      r[i] = a[i] * b[i];
+    }
+  });
+  return R;
+}
+
+Matrix ThreadPoolBackend::scalar(double s, const Matrix& A) {
+  Matrix R(A.rows(), A.cols());
+  const double* a = A.data();
+  double* r = R.data();
+  m_pool->parallel_for(0, A.rows() * A.cols(), ELEMENT_GRAIN, [=](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      r[i] = a[i] * s;
+    }
+  });
+  return R;
+}
+
+// Fixed chunks summed in order, so the result does not depend on which
+// thread ran which chunk.
+double ThreadPoolBackend::dot(const Matrix& A, const Matrix& B) {
+  detail::check_same_size("dot", A, B);
+  const double* a = A.data();
+  const double* b = B.data();
+  size_t n = A.rows() * A.cols();
+  size_t chunks = (n + ELEMENT_GRAIN - 1) / ELEMENT_GRAIN;
+  std::vector<double> partial(chunks, 0.0);
+  m_pool->parallel_for(0, chunks, 1, [&](size_t lo, size_t hi) {
+    for (size_t c = lo; c < hi; c++) {
+      size_t end = std::min(n, (c + 1) * ELEMENT_GRAIN);
+      double sum = 0.0;
+      for (size_t i = c * ELEMENT_GRAIN; i < end; i++) {
+        sum += a[i] * b[i];
+      }
+      partial[c] = sum;
+    }
+  });
+  double res = 0.0;
+  for (double p : partial) {
+    res += p;
+  }
+  return res;
+}
+
+Matrix ThreadPoolBackend::transpose(const Matrix& A) {
+  size_t rows = A.rows(), cols = A.cols();
+  Matrix R(cols, rows);
+  const double* a = A.data();
+  double* r = R.data();
+  size_t row_blocks = (rows + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+  size_t grain = std::max<size_t>(1, ELEMENT_GRAIN / (TRANSPOSE_BLOCK * std::max<size_t>(cols, 1)));
+  m_pool->parallel_for(0, row_blocks, grain, [=](size_t lo, size_t hi) {
+    for (size_t ib = lo * TRANSPOSE_BLOCK; ib < std::min(rows, hi * TRANSPOSE_BLOCK); ib += TRANSPOSE_BLOCK) {
+      size_t i_end = std::min(rows, ib + TRANSPOSE_BLOCK);
+      for (size_t jb = 0; jb < cols; jb += TRANSPOSE_BLOCK) {
+        size_t j_end = std::min(cols, jb + TRANSPOSE_BLOCK);
+        for (size_t i = ib; i < i_end; i++) {
+          for (size_t j = jb; j < j_end; j++) {
+            r[j * rows + i] = a[i * cols + j];
+          }
+        }
+      }
+    }
+  });
+  return R;
+}
+
+/* Multiply
+ * Divide and conquer on the output: the longer of the row and column
+ * ranges is halved, one half is spawned and the other recursed into, down
+ * to blocks small enough to stay in cache. k is never split, so blocks
+ * write disjoint parts of C and need no reduction. */
+
+struct MultiplyArgs {
+  const double* a;
+  const double* b;
+  double* c;
+  size_t k, lda, ldb, ldc;
+};
+
+static void multiply_block(const MultiplyArgs& m, size_t i0, size_t i1, size_t j0, size_t j1) {
+  for (size_t i = i0; i < i1; i++) {
+    double* c_row = m.c + i * m.ldc;
+    for (size_t p = 0; p < m.k; p++) {
+      double a_ip = m.a[i * m.lda + p];
+      const double* b_row = m.b + p * m.ldb;
+      for (size_t j = j0; j < j1; j++) {
+        c_row[j] += a_ip * b_row[j];
+      }
+    }
+  }
+}
+
+static void multiply_recursive(TaskGroup& group, const MultiplyArgs& m,
+                               size_t i0, size_t i1, size_t j0, size_t j1) {
+  for (;;) {
+    size_t rows = i1 - i0, cols = j1 - j0;
+    if (rows * cols * std::max<size_t>(m.k, 1) <= MULTIPLY_LEAF || (rows <= 1 && cols <= 16)) {
+      multiply_block(m, i0, i1, j0, j1);
+      return;
+    }
+    if (rows >= cols) {
+      size_t mid = i0 + rows / 2;
+      group.spawn([&group, &m, mid, i1, j0, j1] { multiply_recursive(group, m, mid, i1, j0, j1); });
+      i1 = mid;
+    }
+    else {
+      size_t mid = j0 + cols / 2;
+      group.spawn([&group, &m, i0, i1, mid, j1] { multiply_recursive(group, m, i0, i1, mid, j1); });
+      j1 = mid;
+    }
+  }
+}
+
+Matrix ThreadPoolBackend::multiply(const Matrix& A, const Matrix& B) {
+  detail::check_multiply_dims(A, B);
+  Matrix R(A.rows(), B.cols());
+  if (detail::multiply_as_gemv(*this, A, B, R)) {
+    return R;
+  }
+  MultiplyArgs m{A.data(), B.data(), R.data(), A.cols(), A.cols(), B.cols(), B.cols()};
+  TaskGroup group(*m_pool);
+  multiply_recursive(group, m, 0, A.rows(), 0, B.cols());
+  group.wait();
+  return R;
+}
+
+Matrix ThreadPoolBackend::spmv(const SparseMatrix& A, const Matrix& x) {
+  if (x.cols() != 1 || A.cols() != x.rows()) {
+    throw std::runtime_error("spmv dimension mismatch");
+  }
+  // CSC has no race-free row split, so it is re-compressed first
+  SparseMatrix converted;
+  const SparseMatrix& csr = (A.format() == SparseFormat::CSR) ? A : (converted = A.to_csr());
+  const size_t* ptr = csr.ptr().data();
+  const size_t* idx = csr.indices().data();
+  const double* val = csr.values().data();
+  const double* xv = x.data();
+  Matrix y(A.rows(), 1);
+  double* yv = y.data();
+
+  m_pool->parallel_for(0, csr.rows(), 256, [=](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      double sum = 0.0;
+      for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+        sum += val[p] * xv[idx[p]];
+      }
+      yv[i] = sum;
+    }
+  });
+  return y;
+}
+
+Matrix ThreadPoolBackend::spmm(const SparseMatrix& A, const Matrix& B) {
+  if (A.cols() != B.rows()) {
+    throw std::runtime_error("spmm dimension mismatch");
+  }
+  SparseMatrix converted;
+  const SparseMatrix& csr = (A.format() == SparseFormat::CSR) ? A : (converted = A.to_csr());
+  const size_t* ptr = csr.ptr().data();
+  const size_t* idx = csr.indices().data();
+  const double* val = csr.values().data();
+  const double* bv = B.data();
+  size_t n = B.cols();
+  Matrix R(A.rows(), n);
+  double* rv = R.data();
+
+  m_pool->parallel_for(0, csr.rows(), 64, [=](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      double* r_row = rv + i * n;
+      for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+        double a = val[p];
+        const double* b_row = bv + idx[p] * n;
+        for (size_t j = 0; j < n; j++) {
+          r_row[j] += a * b_row[j];
+        }
+      }
+    }
+  });
+  return R;
+}
+
+void ThreadPoolBackend::gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+                             const Matrix& B, double beta, Matrix& C) {
+  detail::check_gemm_dims(transA, transB, A, B, C);
+  size_t m = C.rows(), n = C.cols();
+  size_t k = detail::op_cols(transA, A.rows(), A.cols());
+  const double* a = A.data();
+  const double* b = B.data();
+  double* c = C.data();
+  size_t lda = A.cols(), ldb = B.cols();
+  size_t grain = std::max<size_t>(8, MULTIPLY_LEAF / std::max<size_t>(n * k, 1));
+  m_pool->parallel_for(0, m, grain, [=](size_t lo, size_t hi) {
+    detail::gemm_rows(transA, transB, lo, hi, n, k, alpha, a, lda, b, ldb, beta, c, n);
+  });
+}
+
+void ThreadPoolBackend::gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+                             double beta, Matrix& y) {
+  detail::check_gemv_dims(transA, A, x, y);
+  size_t m = A.rows(), n = A.cols();
+  const double* a = A.data();
+  const double* xv = x.data();
+  double* yv = y.data();
+  if (transA == Trans::No) {
+    size_t grain = std::max<size_t>(1, ELEMENT_GRAIN / std::max<size_t>(n, 1));
+    m_pool->parallel_for(0, m, grain, [=](size_t lo, size_t hi) {
+      detail::gemv_rows(lo, hi, n, alpha, a, n, xv, beta, yv);
+    });
+  }
+  else {
+    size_t grain = std::max<size_t>(64, ELEMENT_GRAIN / std::max<size_t>(m, 1));
+    m_pool->parallel_for(0, n, grain, [=](size_t lo, size_t hi) {
+      detail::gemv_t_cols(lo, hi, m, alpha, a, n, xv, beta, yv);
+    });
+  }
+}
+
+void ThreadPoolBackend::ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) {
+  detail::check_ger_dims(x, y, A);
+  size_t n = A.cols();
+  const double* xv = x.data();
+  const double* yv = y.data();
+  double* a = A.data();
+  size_t grain = std::max<size_t>(1, ELEMENT_GRAIN / std::max<size_t>(n, 1));
+  m_pool->parallel_for(0, A.rows(), grain, [=](size_t lo, size_t hi) {
+    detail::ger_rows(lo, hi, n, alpha, xv, yv, a, n);
+  });
+}
+
+void ThreadPoolBackend::syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) {
+  detail::check_syrk_dims(trans, A, C);
+  size_t n = C.rows(), k = detail::op_cols(trans, A.rows(), A.cols());
+  const double* a = A.data();
+  double* c = C.data();
+  size_t lda = A.cols();
+  // uneven rows are left to stealing to balance
+  m_pool->parallel_for(0, n, 16, [=](size_t lo, size_t hi) {
+    detail::syrk_rows(trans, lo, hi, k, alpha, a, lda, beta, c, n, 0);
+  });
+  m_pool->parallel_for(0, n, 32, [=](size_t lo, size_t hi) {
+    detail::mirror_lower(lo, hi, n, c, n);
+  });
+}
+
+void ThreadPoolBackend::trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+                             const Matrix& A, Matrix& B) {
+  detail::check_trsm_dims(side, A, B);
+  size_t n = A.rows(), lda = A.cols(), ldb = B.cols();
+  size_t slices = (side == Side::Left) ? B.cols() : B.rows();
+  const double* a = A.data();
+  double* b = B.data();
+  // columns of B for a left solve, rows for a right one
+  m_pool->parallel_for(0, slices, side == Side::Left ? 32 : 16, [=](size_t lo, size_t hi) {
+    detail::trsm_slice(side, uplo, transA, diag, lo, hi, n, alpha, a, lda, b, ldb);
+  });
+}
+
+// Fork/join per step: the panel is factored on the calling thread, then
+// the column blocks right of it are updated in parallel. The swaps on the
+// blocks left of each panel are applied once, at the end.
+void ThreadPoolBackend::lu(Matrix& A, std::vector<size_t>& piv) {
+  size_t m = A.rows(), n = A.cols(), kmin = std::min(m, n);
+  const size_t nb = detail::FACTOR_BLOCK;
+  piv.resize(kmin);
+  double* a = A.data();
+  size_t* p = piv.data();
+  size_t zero_col = detail::npos;
+
+  for (size_t k = 0; k < kmin; k += nb) {
+    size_t kb = std::min(nb, kmin - k);
+    size_t z = detail::lu_panel(k, kb, m, a, n, p);
+    if (zero_col == detail::npos) zero_col = z;
+    m_pool->parallel_for(k + kb, n, nb, [=](size_t lo, size_t hi) {
+      detail::lu_update_cols(k, kb, m, lo, hi, a, n, p);
+    });
+  }
+  // by step-aligned column block: rows from a block's end on are the
+  // pivots of the steps after it
+  m_pool->parallel_for(0, (kmin + nb - 1) / nb, 1, [=](size_t lo, size_t hi) {
+    for (size_t b = lo; b < hi; b++) {
+      size_t j0 = b * nb, j1 = std::min(kmin, j0 + nb);
+      detail::laswp(j1, kmin, j0, j1, a, n, p);
+    }
+  });
+  detail::check_lu_pivot(zero_col);
+}
+
+void ThreadPoolBackend::cholesky(Matrix& A) {
+  if (A.rows() != A.cols()) {
+    throw std::runtime_error("cholesky: matrix must be square");
+  }
+  size_t n = A.rows();
+  const size_t nb = detail::FACTOR_BLOCK;
+  double* a = A.data();
+
+  for (size_t k = 0; k < n; k += nb) {
+    size_t kb = std::min(nb, n - k), ke = k + kb;
+    detail::check_positive_definite(detail::potrf_block(k, kb, a, n));
+    m_pool->parallel_for(ke, n, 16, [=](size_t lo, size_t hi) {
+      detail::cholesky_panel_rows(k, kb, lo, hi, a, n);
+    });
+    // one task per block row of the trailing triangle; rows further down
+    // hold more tiles, which stealing evens out
+    size_t block_rows = (n - ke + nb - 1) / nb;
+    m_pool->parallel_for(0, block_rows, 1, [=](size_t lo, size_t hi) {
+      for (size_t r = lo; r < hi; r++) {
+        size_t i0 = ke + r * nb, i1 = std::min(n, i0 + nb);
+        for (size_t j0 = ke; j0 <= i0; j0 += nb) {
+          detail::cholesky_update(k, kb, i0, i1, j0, std::min(n, j0 + nb), a, n);
+        }
+      }
+    });
+  }
+  m_pool->parallel_for(0, n, 32, [=](size_t lo, size_t hi) {
+    detail::zero_upper(lo, hi, n, a, n);
+  });
+}
+
+void ThreadPoolBackend::qr(Matrix& A, std::vector<double>& tau) {
+  size_t m = A.rows(), n = A.cols(), kmin = std::min(m, n);
+  const size_t nb = detail::FACTOR_BLOCK;
+  tau.resize(kmin);
+  double* a = A.data();
+  double* t = tau.data();
+  std::vector<double> T(nb * nb);
+  const double* tb = T.data();
+
+  for (size_t k = 0; k < kmin; k += nb) {
+    size_t kb = std::min(nb, kmin - k), ke = k + kb;
+    detail::qr_panel(k, kb, m, a, n, t);
+    if (ke == n) continue;
+    detail::qr_block_t(k, kb, m, a, n, t, T.data());
+    m_pool->parallel_for(ke, n, 32, [=](size_t lo, size_t hi) {
+      detail::apply_block_reflector(Trans::Yes, k, kb, m, a, n, tb, lo, hi, a, n);
+    });
+  }
+}
+
+Matrix ThreadPoolBackend::sq_distances(const Matrix& A, const Matrix& B) {
+  detail::check_distance_dims(A, B);
+  size_t n = A.rows(), m = B.rows(), d = A.cols();
+  std::vector<double> an(n), bn(m);
+  const double* a = A.data();
+  const double* b = B.data();
+  double* pa = an.data();
+  double* pb = bn.data();
+  m_pool->parallel_for(0, m, 64, [=](size_t lo, size_t hi) { detail::row_sq_norms(lo, hi, d, b, d, pb); });
+  m_pool->parallel_for(0, n, 64, [=](size_t lo, size_t hi) { detail::row_sq_norms(lo, hi, d, a, d, pa); });
+
+  Matrix D(n, m);
+  double* out = D.data();
+  m_pool->parallel_for(0, n, 16, [=](size_t lo, size_t hi) {
+    detail::sq_distance_rows(lo, hi, m, d, a, d, b, d, pa, pb, out, m);
+  });
+  return D;
+}
+
+void ThreadPoolBackend::knn(const Matrix& A, const Matrix& B, size_t k, Matrix& distances,
+                            std::vector<size_t>& indices) {
+  detail::check_knn_dims(A, B, k);
+  size_t n = A.rows(), m = B.rows(), d = A.cols();
+  std::vector<double> an(n), bn(m);
+  const double* a = A.data();
+  const double* b = B.data();
+  double* pa = an.data();
+  double* pb = bn.data();
+  m_pool->parallel_for(0, m, 64, [=](size_t lo, size_t hi) { detail::row_sq_norms(lo, hi, d, b, d, pb); });
+  m_pool->parallel_for(0, n, 64, [=](size_t lo, size_t hi) { detail::row_sq_norms(lo, hi, d, a, d, pa); });
+
+  distances = Matrix(n, k);
+  indices.resize(n * k);
+  double* dist = distances.data();
+  size_t* idx = indices.data();
+  m_pool->parallel_for(0, n, 16, [=](size_t lo, size_t hi) {
+    detail::knn_rows(lo, hi, m, d, k, a, d, b, d, pa, pb, dist, idx);
+  });
+}
+
+// runs the split column kernels on the pool with a grain of one, so
+// each row block and strip can be stolen on its own
+static detail::RangeRunner strip_tasks(ThreadPool& pool) {
+  return [&pool](size_t count, const std::function<void(size_t, size_t)>& body) {
+    pool.parallel_for(0, count, 1, body);
+  };
+}
+
+Matrix ThreadPoolBackend::reduce(Reduction op, Axis axis, const Matrix& A) {
+  size_t m = A.rows(), n = A.cols();
+  const double* a = A.data();
+  if (axis == Axis::Rows) {
+    Matrix R(m, 1);
+    double* out = R.data();
+    m_pool->parallel_for(0, m, rows_grain(n), [=](size_t lo, size_t hi) {
+      detail::reduce_rows(op, lo, hi, n, a, n, out);
+    });
+    return R;
+  }
+
+  std::vector<double> acc = detail::reduce_cols(strip_tasks(*m_pool), op, m, n, a);
+  Matrix R(1, n);
+  std::copy(acc.begin(), acc.end(), R.data());
+  return R;
+}
+
+std::vector<size_t> ThreadPoolBackend::argmax(Axis axis, const Matrix& A) {
+  detail::check_argmax_dims(axis, A);
+  size_t m = A.rows(), n = A.cols();
+  const double* a = A.data();
+  if (axis == Axis::Rows) {
+    std::vector<size_t> where(m);
+    size_t* out = where.data();
+    m_pool->parallel_for(0, m, rows_grain(n), [=](size_t lo, size_t hi) {
+      detail::argmax_rows(lo, hi, n, a, n, out);
+    });
+    return where;
+  }
+
+  return detail::argmax_cols(strip_tasks(*m_pool), m, n, a);
+}
+
+Matrix ThreadPoolBackend::transform_rows(RowTransform op, const Matrix& A) {
+  size_t m = A.rows(), n = A.cols();
+  Matrix R(m, n);
+  const double* a = A.data();
+  double* r = R.data();
+  m_pool->parallel_for(0, m, rows_grain(n), [=](size_t lo, size_t hi) {
+    detail::transform_rows(op, lo, hi, n, a, n, r, n);
+  });
+  return R;
+}
+
+void ThreadPoolBackend::parallel_ranges(size_t n, const std::function<void(size_t, size_t)>& body) {
+  m_pool->parallel_for(0, n, ELEMENT_GRAIN, body);
+}
+
+}
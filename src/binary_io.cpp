@@ -0,0 +1,213 @@
+#include "lumin.hpp"
+#include "memory_pool.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace lumin {
+
+static const char MATRIX_MAGIC[8] = {'L', 'U', 'M', 'I', 'N', 'M', 'A', 'T'};
+static const uint32_t MATRIX_VERSION = 1;
+static const uint32_t MATRIX_BYTE_ORDER = 0x01020304;
+static const uint32_t DTYPE_FLOAT64 = 1;
+static const uint32_t LAYOUT_ROW_MAJOR = 0;
+static const size_t MATRIX_PAYLOAD_ALIGN = 64;
+
+struct MatrixFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t dtype;
+  uint32_t layout;
+  uint64_t payload_offset;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t checksum;
+  uint64_t reserved;
+};
+
+static_assert(sizeof(MatrixFileHeader) <= MATRIX_PAYLOAD_ALIGN, "header must fit before the payload");
+
+static void throw_errno(const std::string& what, const std::string& path) {
+  std::ostringstream oss;
+  oss << "Matrix: " << what << " '" << path << "': " << std::strerror(errno);
+  throw std::runtime_error(oss.str());
+}
+
+// FNV-1a over 64-bit words: one multiply per 8 bytes keeps verification
+// well below disk bandwidth
+static uint64_t payload_checksum(const double* values, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t w;
+    std::memcpy(&w, values + i, sizeof(w));
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static void read_full(int fd, void* buf, size_t bytes, const std::string& path) {
+  char* p = static_cast<char*>(buf);
+  while (bytes > 0) {
+    ssize_t n = ::read(fd, p, bytes);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("read failed on", path);
+    }
+    if (n == 0) {
+      throw std::runtime_error("Matrix: unexpected end of file in '" + path + "'");
+    }
+    p += n;
+    bytes -= static_cast<size_t>(n);
+  }
+}
+
+void Matrix::save(const std::string& path) const {
+  char header_block[MATRIX_PAYLOAD_ALIGN] = {};
+  MatrixFileHeader header{};
+  std::memcpy(header.magic, MATRIX_MAGIC, sizeof(MATRIX_MAGIC));
+  header.version = MATRIX_VERSION;
+  header.byte_order = MATRIX_BYTE_ORDER;
+  header.dtype = DTYPE_FLOAT64;
+  header.layout = LAYOUT_ROW_MAJOR;
+  header.payload_offset = MATRIX_PAYLOAD_ALIGN;
+  header.rows = m_rows;
+  header.cols = m_cols;
+  header.checksum = payload_checksum(data(), m_rows * m_cols);
+  std::memcpy(header_block, &header, sizeof(header));
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw_errno("cannot create", path);
+  }
+
+  // header and payload go out together through one gathered write
+  struct iovec iov[2];
+  iov[0].iov_base = header_block;
+  iov[0].iov_len = sizeof(header_block);
+  iov[1].iov_base = const_cast<double*>(data());
+  iov[1].iov_len = m_rows * m_cols * sizeof(double);
+  int iovcnt = 2;
+  struct iovec* cur = iov;
+  while (iovcnt > 0) {
+    ssize_t n = ::writev(fd, cur, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ::close(fd);
+      throw_errno("write failed on", path);
+    }
+    size_t written = static_cast<size_t>(n);
+    while (iovcnt > 0 && written >= cur->iov_len) {
+      written -= cur->iov_len;
+      cur++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      cur->iov_base = static_cast<char*>(cur->iov_base) + written;
+      cur->iov_len -= written;
+    }
+  }
+
+  if (::close(fd) != 0) {
+    throw_errno("close failed on", path);
+  }
+}
+
+Matrix Matrix::load(const std::string& path, LoadMode mode, bool verify_checksum) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw_errno("cannot open", path);
+  }
+
+  MatrixFileHeader header{};
+  struct stat st;
+  try {
+    read_full(fd, &header, sizeof(header), path);
+    if (::fstat(fd, &st) != 0) {
+      throw_errno("cannot stat", path);
+    }
+  }
+  catch (...) {
+    ::close(fd);
+    throw;
+  }
+
+  std::string error;
+  size_t n = 0;
+  if (std::memcmp(header.magic, MATRIX_MAGIC, sizeof(MATRIX_MAGIC)) != 0) {
+    error = "not a LUMIN matrix file";
+  }
+  else if (header.version != MATRIX_VERSION) {
+    error = "unsupported format version " + std::to_string(header.version);
+  }
+  else if (header.byte_order != MATRIX_BYTE_ORDER) {
+    error = "file was written with a different byte order";
+  }
+  else if (header.dtype != DTYPE_FLOAT64 || header.layout != LAYOUT_ROW_MAJOR) {
+    error = "unsupported dtype or layout";
+  }
+  else if (header.cols != 0 && header.rows > SIZE_MAX / header.cols) {
+    error = "matrix dimensions overflow";
+  }
+  else if (header.payload_offset % MATRIX_PAYLOAD_ALIGN != 0) {
+    error = "misaligned payload offset";
+  }
+  else {
+    // every bound is checked by division first so a hostile header cannot
+    // wrap the size arithmetic below the real file size
+    n = static_cast<size_t>(header.rows * header.cols);
+    uint64_t file_size = static_cast<uint64_t>(st.st_size);
+    if (n > (UINT64_MAX - header.payload_offset) / sizeof(double) ||
+        file_size < header.payload_offset ||
+        n > (file_size - header.payload_offset) / sizeof(double)) {
+      error = "file is truncated";
+    }
+  }
+  if (!error.empty()) {
+    ::close(fd);
+    throw std::runtime_error("Matrix::load: '" + path + "': " + error);
+  }
+
+  std::shared_ptr<double[]> values;
+  if (mode == LoadMode::Map && n > 0) {
+    size_t length = header.payload_offset + n * sizeof(double);
+    void* base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      throw_errno("cannot map", path);
+    }
+    double* payload = reinterpret_cast<double*>(static_cast<char*>(base) + header.payload_offset);
+    values = std::shared_ptr<double[]>(payload, [base, length](double*) { ::munmap(base, length); });
+  }
+  else {
+    try {
+      values = detail::tracked_buffer(detail::matrix_pool(get_default_backend().get()), n, false);
+      if (::lseek(fd, static_cast<off_t>(header.payload_offset), SEEK_SET) < 0) {
+        throw_errno("cannot seek in", path);
+      }
+      read_full(fd, values.get(), n * sizeof(double), path);
+    }
+    catch (...) {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+  }
+
+  if (verify_checksum && payload_checksum(values.get(), n) != header.checksum) {
+    throw std::runtime_error("Matrix::load: '" + path + "': checksum mismatch");
+  }
+
+  return Matrix(static_cast<size_t>(header.rows), static_cast<size_t>(header.cols), std::move(values));
+}
+
+}
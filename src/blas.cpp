@@ -0,0 +1,59 @@
+#include "lumin/blas.hpp"
+#include "lumin/factory.hpp"
+#include "graph_capture.hpp"
+#include "op_scope.hpp"
+
+namespace lumin {
+
+static const double D = sizeof(double);
+
+void gemm(Trans transA, Trans transB, double alpha, const Matrix& A,
+          const Matrix& B, double beta, Matrix& C) {
+  detail::refuse_capture("gemm");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double m = static_cast<double>(C.rows()), n = static_cast<double>(C.cols());
+  double k = static_cast<double>(transA == Trans::No ? A.cols() : A.rows());
+  OpScope scope("gemm", backend.get(), 2 * m * n * k,
+                (m * k + k * n + (beta != 0.0 ? m * n : 0)) * D, m * n * D);
+  backend->gemm(transA, transB, alpha, A, B, beta, C);
+}
+
+void gemv(Trans transA, double alpha, const Matrix& A, const Matrix& x,
+          double beta, Matrix& y) {
+  detail::refuse_capture("gemv");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double a = static_cast<double>(A.rows() * A.cols());
+  double len = static_cast<double>(y.rows() * y.cols());
+  OpScope scope("gemv", backend.get(), 2 * a, (a + x.rows() * x.cols() + (beta != 0.0 ? len : 0)) * D, len * D);
+  backend->gemv(transA, alpha, A, x, beta, y);
+}
+
+void ger(double alpha, const Matrix& x, const Matrix& y, Matrix& A) {
+  detail::refuse_capture("ger");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double a = static_cast<double>(A.rows() * A.cols());
+  OpScope scope("ger", backend.get(), 2 * a, (a + A.rows() + A.cols()) * D, a * D);
+  backend->ger(alpha, x, y, A);
+}
+
+void syrk(Trans trans, double alpha, const Matrix& A, double beta, Matrix& C) {
+  detail::refuse_capture("syrk");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double a = static_cast<double>(A.rows() * A.cols());
+  double c = static_cast<double>(C.rows() * C.cols());
+  OpScope scope("syrk", backend.get(), static_cast<double>(C.rows()) * a,
+                (a + (beta != 0.0 ? c / 2 : 0)) * D, c * D);
+  backend->syrk(trans, alpha, A, beta, C);
+}
+
+void trsm(Side side, Triangle uplo, Trans transA, Diag diag, double alpha,
+          const Matrix& A, Matrix& B) {
+  detail::refuse_capture("trsm");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double n = static_cast<double>(A.rows());
+  double b = static_cast<double>(B.rows() * B.cols());
+  OpScope scope("trsm", backend.get(), n * b, (n * n / 2 + b) * D, b * D);
+  backend->trsm(side, uplo, transA, diag, alpha, A, B);
+}
+
+}
@@ -0,0 +1,31 @@
+#include "lumin/distance.hpp"
+#include "lumin/factory.hpp"
+#include "graph_capture.hpp"
+#include "op_scope.hpp"
+
+namespace lumin {
+
+static const double D = sizeof(double);
+
+Matrix sq_distances(const Matrix& A, const Matrix& B) {
+  detail::refuse_capture("sq_distances");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double n = static_cast<double>(A.rows()), m = static_cast<double>(B.rows());
+  double d = static_cast<double>(A.cols());
+  OpScope scope("sq_distances", backend.get(), 2 * n * m * d + 2 * n * m, (n + m) * d * D, n * m * D);
+  return backend->sq_distances(A, B);
+}
+
+KNNResult knn(const Matrix& A, const Matrix& B, size_t k) {
+  detail::refuse_capture("knn");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double n = static_cast<double>(A.rows()), m = static_cast<double>(B.rows());
+  double d = static_cast<double>(A.cols());
+  OpScope scope("knn", backend.get(), 2 * n * m * d + 2 * n * m, (n + m) * d * D,
+                n * static_cast<double>(k) * 2 * D);
+  KNNResult r;
+  backend->knn(A, B, k, r.distances, r.indices);
+  return r;
+}
+
+}
@@ -1,7 +1,9 @@
 #include "lumin/factory.hpp"
 #include "lumin/backend.hpp"
 
+#include "lumin/auto_backend.hpp"
 #include "lumin/cpu_backend.hpp"
+#include "lumin/threadpool_backend.hpp"
 #ifdef LUMIN_ENABLE_MPI
 #include "lumin/mpi_backend.hpp"
 #endif
@@ -14,6 +16,7 @@
 
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 
 namespace lumin {
 
@@ -24,10 +27,22 @@ std::shared_ptr<Backend> create_cpu_backend() {
   return std::make_shared<CPUBackend>();
 }
 
+std::shared_ptr<Backend> create_threadpool_backend() {
+  return std::make_shared<ThreadPoolBackend>();
+}
+
+std::shared_ptr<Backend> create_auto_backend() {
+  return std::make_shared<AutoBackend>();
+}
+
 #ifdef LUMIN_ENABLE_MPI
 std::shared_ptr<Backend> create_mpi_backend(MPI_Comm comm) {
   return std::make_shared<MPIBackend>(comm);
 }
+
+std::shared_ptr<Backend> create_auto_backend(MPI_Comm comm) {
+  return std::make_shared<AutoBackend>(comm);
+}
 #endif
 
 #ifdef LUMIN_ENABLE_CUDA
@@ -55,4 +70,46 @@ std::shared_ptr<Backend> get_default_backend() {
   return default_backend_instance;
 }
 
+void set_backend(const std::string& name) {
+  std::shared_ptr<Backend> backend;
+  if (name == "cpu") {
+    backend = create_cpu_backend();
+  }
+  else if (name == "threadpool") {
+    backend = create_threadpool_backend();
+  }
+  else if (name == "auto") {
+    backend = create_auto_backend();
+#ifdef LUMIN_ENABLE_MPI
+    int initialized = 0, size = 1;
+    MPI_Initialized(&initialized);
+    if (initialized) {
+      MPI_Comm_size(MPI_COMM_WORLD, &size);
+    }
+    if (size > 1) {
+      backend = create_auto_backend(MPI_COMM_WORLD);
+    }
+#endif
+  }
+#ifdef LUMIN_ENABLE_OPENMP
+  else if (name == "openmp" || name == "omp") {
+    backend = create_omp_backend();
+  }
+#endif
+#ifdef LUMIN_ENABLE_CUDA
+  else if (name == "cuda") {
+    backend = create_cuda_backend();
+  }
+#endif
+#ifdef LUMIN_ENABLE_MPI
+  else if (name == "mpi") {
+    backend = create_mpi_backend(MPI_COMM_WORLD);
+  }
+#endif
+  else {
+    throw std::runtime_error("Unknown backend: " + name);
+  }
+  set_default_backend(backend);
+}
+
 }
@@ -0,0 +1,637 @@
+#include "lumin/graph.hpp"
+#include "lumin/thread_pool.hpp"
+#include "graph_capture.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace lumin {
+
+namespace detail {
+  std::atomic<int> active_captures{0};
+}
+
+static const size_t ELEMENT_GRAIN = 1 << 14;
+// fused chains are evaluated this many elements at a time, so the values
+// between their ops stay in L1
+static const size_t FUSE_BLOCK = 256;
+static const size_t MULTIPLY_LEAF = 1 << 15;
+static const size_t TRANSPOSE_BLOCK = 32;
+
+enum class NodeKind { Input, Constant, Add, Subtract, Hadamard, Scalar, Multiply, Transpose, Fused };
+
+static bool elementwise(NodeKind k) {
+  return k == NodeKind::Add || k == NodeKind::Subtract || k == NodeKind::Hadamard || k == NodeKind::Scalar;
+}
+
+static bool computed(NodeKind k) {
+  return k != NodeKind::Input && k != NodeKind::Constant;
+}
+
+// one step of a fused chain; registers are numbered by instruction
+struct Instr {
+  enum Kind { Load, Add, Sub, Mul, Scale } kind;
+  size_t a = 0, b = 0;   // Load: index into the node's args; else registers
+  double s = 0.0;
+};
+
+struct Node {
+  NodeKind kind;
+  size_t rows = 0, cols = 0;
+  std::vector<size_t> args;
+  double s = 0.0;
+  std::vector<Instr> program;   // Fused
+  std::string label;            // Fused: the ops it replaced
+  // constants; while capturing, every op's result, so that no buffer is
+  // freed and handed to a later op under the same address
+  Matrix value;
+  size_t input_index = 0;
+  int level = -1;
+  long slot = -1;
+  bool output = false;
+};
+
+/* Capture */
+
+struct Capture {
+  std::vector<Node> nodes;
+  std::unordered_map<const double*, size_t> by_buffer;
+  std::vector<size_t> inputs;
+  std::vector<size_t> outputs;
+
+  size_t add(Node node) {
+    const double* key = node.value.data();
+    nodes.push_back(std::move(node));
+    by_buffer[key] = nodes.size() - 1;
+    return nodes.size() - 1;
+  }
+
+  // the node that produced m, or a new constant holding it
+  size_t node_for(const Matrix& m) {
+    auto it = by_buffer.find(m.data());
+    if (it != by_buffer.end()) {
+      return it->second;
+    }
+    Node c;
+    c.kind = NodeKind::Constant;
+    c.rows = m.rows();
+    c.cols = m.cols();
+    c.value = m;
+    return add(std::move(c));
+  }
+};
+
+static thread_local Capture* capture_target = nullptr;
+
+bool detail::capturing_thread() {
+  return capture_target != nullptr;
+}
+
+void detail::capture_op(CaptureOp op, double s, const Matrix& a, const Matrix* b, const Matrix& result) {
+  Capture* c = capture_target;
+  Node n;
+  switch (op) {
+    case CaptureOp::Add: n.kind = NodeKind::Add; break;
+    case CaptureOp::Subtract: n.kind = NodeKind::Subtract; break;
+    case CaptureOp::Hadamard: n.kind = NodeKind::Hadamard; break;
+    case CaptureOp::Scalar: n.kind = NodeKind::Scalar; break;
+    case CaptureOp::Multiply: n.kind = NodeKind::Multiply; break;
+    case CaptureOp::Transpose: n.kind = NodeKind::Transpose; break;
+  }
+  n.args.push_back(c->node_for(a));
+  if (b) {
+    n.args.push_back(c->node_for(*b));
+  }
+  n.s = s;
+  n.rows = result.rows();
+  n.cols = result.cols();
+  n.value = result;
+  c->add(std::move(n));
+}
+
+void detail::capture_unsupported(const char* op) {
+  std::ostringstream oss;
+  oss << "Graph capture: " << op << " cannot be captured; "
+      << "end the capture before it or run it outside the graph";
+  throw std::runtime_error(oss.str());
+}
+
+/* Plan
+ * Built once by end_capture(): dead ops are dropped, elementwise chains
+ * are fused, chains of products are re-associated into the order with the
+ * fewest flops, ops are levelled by dependency depth and intermediates are
+ * packed into reusable buffers by the level at which they die. */
+
+struct Graph::Impl {
+  enum State { Empty, Capturing, Ready } state = Empty;
+  Capture capture;
+
+  std::vector<Node> plan;
+  std::vector<std::vector<size_t>> levels;
+  std::vector<size_t> inputs;
+  std::vector<size_t> outputs;
+  std::vector<Matrix> arena;
+  std::mutex replay_mutex;
+
+  void build();
+  size_t emit(const std::vector<Node>& old, const std::vector<bool>& absorbed,
+              const std::vector<size_t>& remap, size_t id, bool root, Node& fused);
+  size_t emit_product(const std::vector<size_t>& factors, const std::vector<size_t>& split,
+                      size_t i, size_t j);
+};
+
+size_t Graph::Impl::emit(const std::vector<Node>& old, const std::vector<bool>& absorbed,
+                         const std::vector<size_t>& remap, size_t id, bool root, Node& fused) {
+  const Node& n = old[id];
+  if (!root && !absorbed[id]) {
+    // a leaf of the chain: an input, constant or op computed on its own
+    size_t arg = std::find(fused.args.begin(), fused.args.end(), remap[id]) - fused.args.begin();
+    if (arg == fused.args.size()) {
+      fused.args.push_back(remap[id]);
+    }
+    Instr load;
+    load.kind = Instr::Load;
+    load.a = arg;
+    fused.program.push_back(load);
+    return fused.program.size() - 1;
+  }
+  Instr in;
+  in.a = emit(old, absorbed, remap, n.args[0], false, fused);
+  if (n.kind == NodeKind::Scalar) {
+    in.kind = Instr::Scale;
+    in.s = n.s;
+  }
+  else {
+    in.b = emit(old, absorbed, remap, n.args[1], false, fused);
+    in.kind = (n.kind == NodeKind::Add) ? Instr::Add : (n.kind == NodeKind::Subtract) ? Instr::Sub : Instr::Mul;
+  }
+  fused.program.push_back(in);
+  if (!fused.label.empty()) fused.label += ",";
+  switch (n.kind) {
+    case NodeKind::Add: fused.label += "add"; break;
+    case NodeKind::Subtract: fused.label += "subtract"; break;
+    case NodeKind::Hadamard: fused.label += "hadamard"; break;
+    default: fused.label += "scalar"; break;
+  }
+  return fused.program.size() - 1;
+}
+
+// the operands of the product chain ending at id, left to right
+static void chain_factors(const std::vector<Node>& old, const std::vector<bool>& chained, size_t id,
+                          std::vector<size_t>& factors) {
+  for (size_t a : old[id].args) {
+    if (chained[a]) chain_factors(old, chained, a, factors);
+    else factors.push_back(a);
+  }
+}
+
+// appends the product of plan nodes factors[i..j] in split order
+size_t Graph::Impl::emit_product(const std::vector<size_t>& factors, const std::vector<size_t>& split,
+                                 size_t i, size_t j) {
+  if (i == j) {
+    return factors[i];
+  }
+  size_t s = split[i * factors.size() + j];
+  Node n;
+  n.kind = NodeKind::Multiply;
+  n.args.push_back(emit_product(factors, split, i, s));
+  n.args.push_back(emit_product(factors, split, s + 1, j));
+  n.rows = plan[n.args[0]].rows;
+  n.cols = plan[n.args[1]].cols;
+  plan.push_back(std::move(n));
+  return plan.size() - 1;
+}
+
+void Graph::Impl::build() {
+  std::vector<Node>& old = capture.nodes;
+  size_t count = old.size();
+
+  std::vector<bool> is_output(count, false), live(count, false);
+  for (size_t o : capture.outputs) {
+    is_output[o] = true;
+    live[o] = true;
+  }
+  for (size_t i : capture.inputs) {
+    live[i] = true;   // replay still takes every declared input
+  }
+  for (size_t id = count; id-- > 0;) {
+    if (live[id]) {
+      for (size_t a : old[id].args) live[a] = true;
+    }
+  }
+
+  // an elementwise op folds into its consumer when that is its only use
+  std::vector<size_t> uses(count, 0), consumer(count, 0);
+  for (size_t id = 0; id < count; id++) {
+    if (!live[id]) continue;
+    for (size_t a : old[id].args) {
+      uses[a]++;
+      consumer[a] = id;
+    }
+  }
+  std::vector<bool> absorbed(count, false);
+  for (size_t id = 0; id < count; id++) {
+    absorbed[id] = live[id] && elementwise(old[id].kind) && !is_output[id] &&
+                   uses[id] == 1 && elementwise(old[consumer[id]].kind);
+  }
+  // likewise a product used only by another product; the chain of them is
+  // then multiplied in the order chain_order finds cheapest
+  std::vector<bool> chained(count, false);
+  for (size_t id = 0; id < count; id++) {
+    chained[id] = live[id] && old[id].kind == NodeKind::Multiply && !is_output[id] &&
+                  uses[id] == 1 && old[consumer[id]].kind == NodeKind::Multiply;
+  }
+
+  std::vector<size_t> remap(count, 0);
+  for (size_t id = 0; id < count; id++) {
+    if (!live[id] || absorbed[id] || chained[id]) continue;
+    Node n;
+    n.kind = old[id].kind;
+    n.rows = old[id].rows;
+    n.cols = old[id].cols;
+    n.s = old[id].s;
+    n.input_index = old[id].input_index;
+    n.output = is_output[id];
+    if (n.kind == NodeKind::Constant) {
+      n.value = old[id].value;
+    }
+    if (elementwise(n.kind)) {
+      n.kind = NodeKind::Fused;
+      emit(old, absorbed, remap, id, true, n);
+    }
+    else if (n.kind == NodeKind::Multiply) {
+      std::vector<size_t> factors;
+      chain_factors(old, chained, id, factors);
+      std::vector<size_t> dims;
+      for (size_t f : factors) dims.push_back(old[f].rows);
+      dims.push_back(old[factors.back()].cols);
+      std::vector<size_t> split = detail::chain_order(dims);
+      for (size_t& f : factors) f = remap[f];
+      size_t s = split[factors.size() - 1];
+      n.args.push_back(emit_product(factors, split, 0, s));
+      n.args.push_back(emit_product(factors, split, s + 1, factors.size() - 1));
+    }
+    else {
+      for (size_t a : old[id].args) n.args.push_back(remap[a]);
+    }
+    plan.push_back(std::move(n));
+    remap[id] = plan.size() - 1;
+  }
+  for (size_t i : capture.inputs) inputs.push_back(remap[i]);
+  for (size_t o : capture.outputs) outputs.push_back(remap[o]);
+  capture = Capture();
+
+  // level: one more than the deepest computed operand
+  std::vector<int> last_use(plan.size(), -1);
+  for (size_t id = 0; id < plan.size(); id++) {
+    Node& n = plan[id];
+    if (!computed(n.kind)) continue;
+    for (size_t a : n.args) {
+      n.level = std::max(n.level, plan[a].level);
+    }
+    n.level++;
+    if (static_cast<size_t>(n.level) >= levels.size()) {
+      levels.resize(n.level + 1);
+    }
+    levels[n.level].push_back(id);
+    for (size_t a : n.args) {
+      last_use[a] = std::max(last_use[a], n.level);
+    }
+  }
+
+  // Buffers are taken for a level's results before the level's dead
+  // operands give theirs back, so ops running side by side in a level
+  // never share one.
+  std::vector<long> free_slots;
+  for (size_t l = 0; l < levels.size(); l++) {
+    for (size_t id : levels[l]) {
+      Node& n = plan[id];
+      if (n.output) continue;
+      size_t size = n.rows * n.cols;
+      auto it = std::find_if(free_slots.begin(), free_slots.end(), [&](long s) {
+        return arena[s].rows() == size;
+      });
+      if (it != free_slots.end()) {
+        n.slot = *it;
+        free_slots.erase(it);
+      }
+      else {
+        arena.emplace_back(size, 1);
+        n.slot = static_cast<long>(arena.size()) - 1;
+      }
+    }
+    for (size_t id : levels[l]) {
+      for (size_t a : plan[id].args) {
+        Node& arg = plan[a];
+        if (arg.slot >= 0 && last_use[a] == static_cast<int>(l) &&
+            std::find(free_slots.begin(), free_slots.end(), arg.slot) == free_slots.end()) {
+          free_slots.push_back(arg.slot);
+        }
+      }
+    }
+  }
+}
+
+/* Kernels
+ * Replays write into planned buffers, so these take output pointers
+ * rather than going through Backend. */
+
+static void run_fused(ThreadPool& pool, const Node& n, const std::vector<const double*>& src, double* out) {
+  size_t total = n.rows * n.cols;
+  const std::vector<Instr>& prog = n.program;
+  std::vector<const double*> args;
+  for (size_t a : n.args) args.push_back(src[a]);
+
+  pool.parallel_for(0, total, ELEMENT_GRAIN, [&](size_t lo, size_t hi) {
+    std::vector<double> scratch(prog.size() * FUSE_BLOCK);
+    std::vector<const double*> reg(prog.size());
+    for (size_t b0 = lo; b0 < hi; b0 += FUSE_BLOCK) {
+      size_t len = std::min(FUSE_BLOCK, hi - b0);
+      for (size_t r = 0; r < prog.size(); r++) {
+        const Instr& in = prog[r];
+        if (in.kind == Instr::Load) {
+          reg[r] = args[in.a] + b0;
+          continue;
+        }
+        double* d = (r + 1 == prog.size()) ? out + b0 : scratch.data() + r * FUSE_BLOCK;
+        const double* x = reg[in.a];
+        if (in.kind == Instr::Scale) {
+          double s = in.s;
+          for (size_t i = 0; i < len; i++) d[i] = x[i] * s;
+        }
+        else if (in.kind == Instr::Add) {
+          const double* y = reg[in.b];
+          for (size_t i = 0; i < len; i++) d[i] = x[i] + y[i];
+        }
+        else if (in.kind == Instr::Mul) {
+          const double* y = reg[in.b];
+          for (size_t i = 0; i < len; i++) d[i] = x[i] * y[i];
+        }
+        else {
+          const double* y = reg[in.b];
+          for (size_t i = 0; i < len; i++) d[i] = x[i] - y[i];
+        }
+        reg[r] = d;
+      }
+    }
+  });
+}
+
+static void run_transpose(ThreadPool& pool, size_t rows, size_t cols, const double* a, double* r) {
+  size_t row_blocks = (rows + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+  size_t grain = std::max<size_t>(1, ELEMENT_GRAIN / (TRANSPOSE_BLOCK * std::max<size_t>(cols, 1)));
+  pool.parallel_for(0, row_blocks, grain, [=](size_t lo, size_t hi) {
+    for (size_t ib = lo * TRANSPOSE_BLOCK; ib < std::min(rows, hi * TRANSPOSE_BLOCK); ib += TRANSPOSE_BLOCK) {
+      size_t i_end = std::min(rows, ib + TRANSPOSE_BLOCK);
+      for (size_t jb = 0; jb < cols; jb += TRANSPOSE_BLOCK) {
+        size_t j_end = std::min(cols, jb + TRANSPOSE_BLOCK);
+        for (size_t i = ib; i < i_end; i++) {
+          for (size_t j = jb; j < j_end; j++) {
+            r[j * rows + i] = a[i * cols + j];
+          }
+        }
+      }
+    }
+  });
+}
+
+struct MultiplyArgs {
+  const double* a;
+  const double* b;
+  double* c;
+  size_t k, n;
+};
+
+// arena buffers hold stale values, so each block clears its part of C
+static void multiply_block(const MultiplyArgs& m, size_t i0, size_t i1, size_t j0, size_t j1) {
+  for (size_t i = i0; i < i1; i++) {
+    double* c_row = m.c + i * m.n;
+    std::fill(c_row + j0, c_row + j1, 0.0);
+    for (size_t p = 0; p < m.k; p++) {
+      double a_ip = m.a[i * m.k + p];
+      const double* b_row = m.b + p * m.n;
+      for (size_t j = j0; j < j1; j++) {
+        c_row[j] += a_ip * b_row[j];
+      }
+    }
+  }
+}
+
+static void multiply_recursive(TaskGroup& group, const MultiplyArgs& m,
+                               size_t i0, size_t i1, size_t j0, size_t j1) {
+  for (;;) {
+    size_t rows = i1 - i0, cols = j1 - j0;
+    if (rows * cols * std::max<size_t>(m.k, 1) <= MULTIPLY_LEAF || (rows <= 1 && cols <= 16)) {
+      multiply_block(m, i0, i1, j0, j1);
+      return;
+    }
+    if (rows >= cols) {
+      size_t mid = i0 + rows / 2;
+      group.spawn([&group, &m, mid, i1, j0, j1] { multiply_recursive(group, m, mid, i1, j0, j1); });
+      i1 = mid;
+    }
+    else {
+      size_t mid = j0 + cols / 2;
+      group.spawn([&group, &m, i0, i1, mid, j1] { multiply_recursive(group, m, i0, i1, mid, j1); });
+      j1 = mid;
+    }
+  }
+}
+
+static void run_node(ThreadPool& pool, const std::vector<Node>& plan, size_t id,
+                     const std::vector<const double*>& src, double* out) {
+  const Node& n = plan[id];
+  switch (n.kind) {
+    case NodeKind::Fused:
+      run_fused(pool, n, src, out);
+      break;
+    case NodeKind::Transpose: {
+      const Node& a = plan[n.args[0]];
+      run_transpose(pool, a.rows, a.cols, src[n.args[0]], out);
+      break;
+    }
+    case NodeKind::Multiply: {
+      MultiplyArgs m{src[n.args[0]], src[n.args[1]], out, plan[n.args[0]].cols, n.cols};
+      TaskGroup group(pool);
+      multiply_recursive(group, m, 0, n.rows, 0, n.cols);
+      group.wait();
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/* Graph */
+
+Graph::Graph() : impl(new Impl()) { }
+Graph::~Graph() {
+  if (impl && impl->state == Impl::Capturing && capture_target == &impl->capture) {
+    capture_target = nullptr;
+    detail::active_captures.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+Graph::Graph(Graph&&) noexcept = default;
+Graph& Graph::operator=(Graph&&) noexcept = default;
+
+void Graph::begin_capture() {
+  if (impl->state != Impl::Empty) {
+    throw std::runtime_error("Graph capture: this graph was already captured");
+  }
+  if (capture_target) {
+    throw std::runtime_error("Graph capture: this thread is already capturing another graph");
+  }
+  impl->state = Impl::Capturing;
+  capture_target = &impl->capture;
+  detail::active_captures.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void check_capturing(bool capturing, const char* call) {
+  if (!capturing) {
+    std::ostringstream oss;
+    oss << "Graph capture: " << call << " must be called between begin_capture() "
+        << "and end_capture(), on the capturing thread";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void Graph::input(const Matrix& m) {
+  check_capturing(impl->state == Impl::Capturing && capture_target == &impl->capture, "input()");
+  Capture& c = impl->capture;
+  if (c.by_buffer.count(m.data())) {
+    throw std::runtime_error("Graph capture: input() must come before the ops that read the matrix");
+  }
+  Node n;
+  n.kind = NodeKind::Input;
+  n.rows = m.rows();
+  n.cols = m.cols();
+  n.value = m;
+  n.input_index = c.inputs.size();
+  c.inputs.push_back(c.add(std::move(n)));
+}
+
+void Graph::output(const Matrix& m) {
+  check_capturing(impl->state == Impl::Capturing && capture_target == &impl->capture, "output()");
+  impl->capture.outputs.push_back(impl->capture.node_for(m));
+}
+
+void Graph::end_capture() {
+  check_capturing(impl->state == Impl::Capturing && capture_target == &impl->capture, "end_capture()");
+  capture_target = nullptr;
+  detail::active_captures.fetch_sub(1, std::memory_order_relaxed);
+  impl->build();
+  impl->state = Impl::Ready;
+}
+
+std::vector<Matrix> Graph::replay(const std::vector<Matrix>& inputs) {
+  if (impl->state != Impl::Ready) {
+    throw std::runtime_error("Graph replay: end_capture() has not been called");
+  }
+  std::lock_guard<std::mutex> lock(impl->replay_mutex);
+  const std::vector<Node>& plan = impl->plan;
+  if (inputs.size() != impl->inputs.size()) {
+    std::ostringstream oss;
+    oss << "Graph replay: expected " << impl->inputs.size() << " inputs, got " << inputs.size();
+    throw std::runtime_error(oss.str());
+  }
+
+  std::vector<const double*> src(plan.size(), nullptr);
+  std::vector<double*> dst(plan.size(), nullptr);
+  std::vector<Matrix> fresh(plan.size());
+  for (size_t i = 0; i < inputs.size(); i++) {
+    const Node& n = plan[impl->inputs[i]];
+    if (inputs[i].rows() != n.rows || inputs[i].cols() != n.cols) {
+      std::ostringstream oss;
+      oss << "Graph replay: input " << i << " is (" << inputs[i].rows() << "x" << inputs[i].cols()
+          << "), captured as (" << n.rows << "x" << n.cols << ")";
+      throw std::runtime_error(oss.str());
+    }
+    src[impl->inputs[i]] = inputs[i].data();
+  }
+  for (size_t id = 0; id < plan.size(); id++) {
+    const Node& n = plan[id];
+    if (n.kind == NodeKind::Constant) {
+      src[id] = n.value.data();
+    }
+    else if (computed(n.kind)) {
+      if (n.output) {
+        fresh[id] = Matrix(n.rows, n.cols);
+        dst[id] = fresh[id].data();
+      }
+      else {
+        dst[id] = impl->arena[n.slot].data();
+      }
+      src[id] = dst[id];
+    }
+  }
+
+  ThreadPool& pool = default_thread_pool();
+  for (const std::vector<size_t>& level : impl->levels) {
+    if (level.size() == 1) {
+      run_node(pool, plan, level[0], src, dst[level[0]]);
+      continue;
+    }
+    TaskGroup group(pool);
+    for (size_t id : level) {
+      group.spawn([&, id] { run_node(pool, plan, id, src, dst[id]); });
+    }
+    group.wait();
+  }
+
+  std::vector<Matrix> results;
+  for (size_t o : impl->outputs) {
+    const Node& n = plan[o];
+    if (n.kind == NodeKind::Input) {
+      results.push_back(inputs[n.input_index]);
+    }
+    else if (n.kind == NodeKind::Constant) {
+      results.push_back(n.value);
+    }
+    else {
+      results.push_back(fresh[o]);
+    }
+  }
+  return results;
+}
+
+std::string Graph::describe() const {
+  std::ostringstream oss;
+  for (size_t id = 0; id < impl->plan.size(); id++) {
+    const Node& n = impl->plan[id];
+    oss << "%" << id << " = ";
+    switch (n.kind) {
+      case NodeKind::Input: oss << "input " << n.input_index; break;
+      case NodeKind::Constant: oss << "constant"; break;
+      case NodeKind::Multiply: oss << "multiply"; break;
+      case NodeKind::Transpose: oss << "transpose"; break;
+      case NodeKind::Fused: oss << "fused(" << n.label << ")"; break;
+      default: break;
+    }
+    for (size_t a : n.args) oss << " %" << a;
+    oss << " [" << n.rows << "x" << n.cols << "]";
+    if (computed(n.kind)) {
+      oss << " level " << n.level;
+      if (n.output) oss << " output";
+      else oss << " buffer " << n.slot;
+    }
+    oss << "\n";
+  }
+  return oss.str();
+}
+
+size_t Graph::nodes() const {
+  return static_cast<size_t>(std::count_if(impl->plan.begin(), impl->plan.end(),
+                                            [](const Node& n) { return computed(n.kind); }));
+}
+
+size_t Graph::arena_bytes() const {
+  size_t bytes = 0;
+  for (const Matrix& m : impl->arena) bytes += m.rows() * sizeof(double);
+  return bytes;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+
+// Internal hook behind include/lumin/graph.hpp. Matrix ops report their
+// operands and result to capture_op() while the calling thread is
+// capturing into a Graph. While no thread captures, the check is one load
+// and a branch.
+
+namespace lumin {
+
+  class Matrix;
+
+  namespace detail {
+    enum class CaptureOp { Add, Subtract, Hadamard, Scalar, Multiply, Transpose };
+
+    extern std::atomic<int> active_captures;
+    bool capturing_thread();
+
+    inline bool capturing() {
+      return active_captures.load(std::memory_order_relaxed) != 0 && capturing_thread();
+    }
+
+    // b is null for unary ops; s is the factor of Scalar
+    void capture_op(CaptureOp op, double s, const Matrix& a, const Matrix* b, const Matrix& result);
+    // for ops a graph cannot replay
+    void capture_unsupported(const char* op);
+
+    // Called first by every op that neither records itself with
+    // capture_op() nor only composes ops that do. A graph would otherwise
+    // keep its result as a constant and replay stale values.
+    inline void refuse_capture(const char* op) {
+      if (capturing()) {
+        capture_unsupported(op);
+      }
+    }
+  }
+
+}
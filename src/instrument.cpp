@@ -0,0 +1,208 @@
+#include "lumin.hpp"
+#include "op_scope.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace lumin {
+
+namespace detail {
+  std::atomic<unsigned> active_hooks{0};
+}
+
+// allocations made by this thread since it started
+static thread_local uint64_t thread_allocs = 0;
+static thread_local uint64_t thread_alloc_bytes = 0;
+
+static std::mutex stats_mutex;
+static std::map<std::pair<std::string, std::string>, OpStats> op_table;
+static std::map<std::string, CollectiveStats> collective_table;
+
+void detail::enable_hook(Hook h, bool on) {
+  if (on) {
+    active_hooks.fetch_or(h, std::memory_order_relaxed);
+  }
+  else {
+    active_hooks.fetch_and(~static_cast<unsigned>(h), std::memory_order_relaxed);
+  }
+}
+
+void detail::note_allocation(size_t bytes) {
+  thread_allocs++;
+  thread_alloc_bytes += bytes;
+}
+
+static size_t histogram_bucket(double seconds) {
+  double us = seconds * 1e6;
+  size_t b = 0;
+  while (us >= 1.0 && b + 1 < TIME_HISTOGRAM_BUCKETS) {
+    us *= 0.5;
+    b++;
+  }
+  return b;
+}
+
+void OpScope::begin(unsigned hooks, const char* op, const Backend* backend,
+                    double flops, double bytes_read, double bytes_written) {
+  m_hooks = hooks;
+  m_op = op;
+  m_backend = backend;
+  m_flops = flops;
+  m_bytes_read = bytes_read;
+  m_bytes_written = bytes_written;
+  m_allocs_before = thread_allocs;
+  m_alloc_bytes_before = thread_alloc_bytes;
+  if (hooks & detail::HOOK_TRACE) {
+    detail::trace_begin("op", op, backend ? backend->name() : "host", 0);
+  }
+  if (hooks & detail::HOOK_PERF) {
+    detail::perf_read(m_counters_before);
+  }
+  m_start = std::chrono::steady_clock::now();
+}
+
+void OpScope::end() {
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+  if (m_hooks & detail::HOOK_PERF) {
+    uint64_t after[HW_COUNTER_KINDS];
+    detail::perf_read(after);
+    detail::perf_record(m_op, m_backend, secs, m_counters_before, after,
+                        m_flops, m_bytes_read + m_bytes_written);
+  }
+  if (m_hooks & detail::HOOK_TRACE) {
+    detail::trace_end("op", m_op, 0);
+  }
+  if (!(m_hooks & detail::HOOK_STATS)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  std::string backend = m_backend ? m_backend->name() : "host";
+  OpStats& s = op_table[{m_op, backend}];
+  if (s.calls == 0) {
+    s.op = m_op;
+    s.backend = backend;
+    s.min_seconds = secs;
+  }
+  s.calls++;
+  s.total_seconds += secs;
+  s.min_seconds = std::min(s.min_seconds, secs);
+  s.max_seconds = std::max(s.max_seconds, secs);
+  s.time_histogram[histogram_bucket(secs)]++;
+  s.flops += static_cast<uint64_t>(m_flops);
+  s.bytes_read += static_cast<uint64_t>(m_bytes_read);
+  s.bytes_written += static_cast<uint64_t>(m_bytes_written);
+  s.allocations += thread_allocs - m_allocs_before;
+  s.bytes_allocated += thread_alloc_bytes - m_alloc_bytes_before;
+}
+
+void AllocScope::begin(unsigned hooks, size_t bytes) {
+  m_hooks = hooks;
+  m_bytes = bytes;
+  if (hooks & detail::HOOK_STATS) {
+    detail::note_allocation(bytes);
+  }
+  if (hooks & detail::HOOK_TRACE) {
+    detail::trace_begin("alloc", "allocate", nullptr, bytes);
+  }
+}
+
+void AllocScope::end() {
+  if (m_hooks & detail::HOOK_TRACE) {
+    detail::trace_end("alloc", "allocate", m_bytes);
+  }
+}
+
+void CollectiveScope::begin(unsigned hooks, const char* name) {
+  m_hooks = hooks;
+  m_name = name;
+  if (hooks & detail::HOOK_TRACE) {
+    detail::trace_begin("mpi", name, nullptr, 0);
+  }
+  m_start = std::chrono::steady_clock::now();
+}
+
+void CollectiveScope::end() {
+  if (m_hooks & detail::HOOK_TRACE) {
+    detail::trace_end("mpi", m_name, m_bytes);
+  }
+  if (!(m_hooks & detail::HOOK_STATS)) {
+    return;
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  CollectiveStats& s = collective_table[m_name];
+  s.name = m_name;
+  s.calls++;
+  s.bytes += m_bytes;
+  s.total_seconds += secs;
+}
+
+void set_instrumentation(bool enabled) {
+  detail::enable_hook(detail::HOOK_STATS, enabled);
+}
+
+bool instrumentation_enabled() {
+  return detail::instrumenting();
+}
+
+std::vector<OpStats> op_stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  std::vector<OpStats> out;
+  for (const auto& kv : op_table) {
+    out.push_back(kv.second);
+  }
+  return out;
+}
+
+std::vector<CollectiveStats> collective_stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  std::vector<CollectiveStats> out;
+  for (const auto& kv : collective_table) {
+    out.push_back(kv.second);
+  }
+  return out;
+}
+
+void reset_stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  op_table.clear();
+  collective_table.clear();
+}
+
+std::string stats_report() {
+  std::ostringstream oss;
+  oss << std::left << std::setw(12) << "op" << std::setw(10) << "backend"
+      << std::right << std::setw(10) << "calls" << std::setw(14) << "total ms"
+      << std::setw(12) << "mean us" << std::setw(12) << "GFLOP/s"
+      << std::setw(12) << "GB/s" << std::setw(10) << "allocs" << "\n";
+  oss << std::fixed;
+  for (const OpStats& s : op_stats()) {
+    double secs = s.total_seconds > 0.0 ? s.total_seconds : 1.0;
+    oss << std::left << std::setw(12) << s.op << std::setw(10) << s.backend
+        << std::right << std::setw(10) << s.calls
+        << std::setw(14) << std::setprecision(3) << s.total_seconds * 1e3
+        << std::setw(12) << std::setprecision(2) << s.total_seconds * 1e6 / s.calls
+        << std::setw(12) << std::setprecision(3) << s.flops / secs * 1e-9
+        << std::setw(12) << (s.bytes_read + s.bytes_written) / secs * 1e-9
+        << std::setw(10) << s.allocations << "\n";
+  }
+  std::vector<CollectiveStats> coll = collective_stats();
+  if (!coll.empty()) {
+    oss << "\n" << std::left << std::setw(22) << "collective"
+        << std::right << std::setw(10) << "calls" << std::setw(14) << "total ms"
+        << std::setw(14) << "MiB" << "\n";
+    for (const CollectiveStats& c : coll) {
+      oss << std::left << std::setw(22) << c.name
+          << std::right << std::setw(10) << c.calls
+          << std::setw(14) << std::setprecision(3) << c.total_seconds * 1e3
+          << std::setw(14) << c.bytes / 1048576.0 << "\n";
+    }
+  }
+  return oss.str();
+}
+
+}
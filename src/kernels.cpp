@@ -0,0 +1,1207 @@
+#include "kernels.hpp"
+#include "lumin/matrix.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace lumin {
+
+// rows of op(A) handled together; transposed A is packed this many rows
+// at a time so each strided cache line read is used GEMM_ROWS times
+static const size_t GEMM_ROWS = 8;
+// k x n block of op(B) streamed per row block; 128 x 512 doubles is 512 KiB
+static const size_t GEMM_KC = 128;
+static const size_t GEMM_NC = 512;
+
+void detail::check_same_size(const char* op, const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    std::ostringstream oss;
+    oss << "Matrix " << op << " dimension mismatch: "
+        << "(" << A.rows() << "x" << A.cols() << ") vs "
+        << "(" << B.rows() << "x" << B.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void detail::check_multiply_dims(const Matrix& A, const Matrix& B) {
+  if (A.cols() != B.rows()) {
+    std::ostringstream oss;
+    oss << "Matrix multiply dimension mismatch: "
+        << "(" << A.rows() << "x" << A.cols() << ") vs "
+        << "(" << B.rows() << "x" << B.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+bool detail::multiply_as_gemv(Backend& backend, const Matrix& A, const Matrix& B, Matrix& R) {
+  if (B.cols() == 1) {
+    backend.gemv(Trans::No, 1.0, A, B, 0.0, R);
+    return true;
+  }
+  if (A.rows() == 1) {
+    backend.gemv(Trans::Yes, 1.0, B, A, 0.0, R);
+    return true;
+  }
+  return false;
+}
+
+void detail::check_gemm_dims(Trans transA, Trans transB, const Matrix& A, const Matrix& B, const Matrix& C) {
+  size_t m = op_rows(transA, A.rows(), A.cols()), k = op_cols(transA, A.rows(), A.cols());
+  size_t kb = op_rows(transB, B.rows(), B.cols()), n = op_cols(transB, B.rows(), B.cols());
+  if (k != kb || C.rows() != m || C.cols() != n) {
+    std::ostringstream oss;
+    oss << "gemm dimension mismatch: op(A) (" << m << "x" << k << ") * op(B) ("
+        << kb << "x" << n << ") into C (" << C.rows() << "x" << C.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+static void scale_rows(size_t i0, size_t i1, size_t n, double beta, double* C, size_t ldc) {
+  if (beta == 1.0) return;
+  for (size_t i = i0; i < i1; i++) {
+    double* c_row = C + i * ldc;
+    if (beta == 0.0) {
+      // BLAS convention: C is not read, so NaNs in it do not survive
+      std::fill(c_row, c_row + n, 0.0);
+    }
+    else {
+      for (size_t j = 0; j < n; j++) c_row[j] *= beta;
+    }
+  }
+}
+
+// An entry of C after its first update: beta is applied in the same write
+// rather than in a pass of its own, and with beta == 0 C is not read.
+static inline double beta_update(double beta, double c, double v) {
+  return (beta == 0.0) ? v : beta * c + v;
+}
+
+void detail::gemm_rows(Trans transA, Trans transB, size_t i0, size_t i1, size_t n, size_t k,
+                       double alpha, const double* A, size_t lda, const double* B, size_t ldb,
+                       double beta, double* C, size_t ldc) {
+  if (alpha == 0.0 || k == 0 || n == 0) {
+    scale_rows(i0, i1, n, beta, C, ldc);
+    return;
+  }
+
+  std::vector<double> pack;
+  if (transA == Trans::Yes) {
+    pack.resize(GEMM_ROWS * k);
+  }
+
+  for (size_t ib = i0; ib < i1; ib += GEMM_ROWS) {
+    size_t ie = std::min(i1, ib + GEMM_ROWS);
+    // rows ib..ie of op(A), contiguous in k
+    const double* a_rows = A + ib * lda;
+    size_t a_ld = lda;
+    if (transA == Trans::Yes) {
+      for (size_t p = 0; p < k; p++) {
+        const double* src = A + p * lda;
+        for (size_t i = ib; i < ie; i++) {
+          pack[(i - ib) * k + p] = src[i];
+        }
+      }
+      a_rows = pack.data();
+      a_ld = k;
+    }
+
+    if (transB == Trans::No) {
+      // rows of C accumulate scaled rows of B
+      for (size_t pb = 0; pb < k; pb += GEMM_KC) {
+        size_t pe = std::min(k, pb + GEMM_KC);
+        for (size_t jb = 0; jb < n; jb += GEMM_NC) {
+          size_t je = std::min(n, jb + GEMM_NC);
+          for (size_t i = ib; i < ie; i++) {
+            const double* a_row = a_rows + (i - ib) * a_ld;
+            double* c_row = C + i * ldc;
+            size_t p = pb;
+            if (p == 0) {
+              double a = alpha * a_row[0];
+              for (size_t j = jb; j < je; j++) {
+                c_row[j] = beta_update(beta, c_row[j], a * B[j]);
+              }
+              p++;
+            }
+            for (; p < pe; p++) {
+              double a = alpha * a_row[p];
+              const double* b_row = B + p * ldb;
+              for (size_t j = jb; j < je; j++) {
+                c_row[j] += a * b_row[j];
+              }
+            }
+          }
+        }
+      }
+    }
+    else {
+      // op(B) columns are rows of B: each entry of C is a contiguous dot
+      // product, four at a time so the row of op(A) is loaded once
+      for (size_t i = ib; i < ie; i++) {
+        const double* a_row = a_rows + (i - ib) * a_ld;
+        double* c_row = C + i * ldc;
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4) {
+          const double* b0 = B + j * ldb;
+          const double* b1 = b0 + ldb;
+          const double* b2 = b1 + ldb;
+          const double* b3 = b2 + ldb;
+          double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+          for (size_t p = 0; p < k; p++) {
+            double a = a_row[p];
+            s0 += a * b0[p];
+            s1 += a * b1[p];
+            s2 += a * b2[p];
+            s3 += a * b3[p];
+          }
+          c_row[j] = beta_update(beta, c_row[j], alpha * s0);
+          c_row[j + 1] = beta_update(beta, c_row[j + 1], alpha * s1);
+          c_row[j + 2] = beta_update(beta, c_row[j + 2], alpha * s2);
+          c_row[j + 3] = beta_update(beta, c_row[j + 3], alpha * s3);
+        }
+        for (; j < n; j++) {
+          const double* b_row = B + j * ldb;
+          double s = 0.0;
+          for (size_t p = 0; p < k; p++) s += a_row[p] * b_row[p];
+          c_row[j] = beta_update(beta, c_row[j], alpha * s);
+        }
+      }
+    }
+  }
+}
+
+static bool vector_of(const Matrix& v, size_t len) {
+  return (v.cols() == 1 || v.rows() == 1) && v.rows() * v.cols() == len;
+}
+
+void detail::check_gemv_dims(Trans transA, const Matrix& A, const Matrix& x, const Matrix& y) {
+  size_t m = op_rows(transA, A.rows(), A.cols()), n = op_cols(transA, A.rows(), A.cols());
+  if (!vector_of(x, n) || !vector_of(y, m)) {
+    std::ostringstream oss;
+    oss << "gemv dimension mismatch: op(A) (" << m << "x" << n << ") * x ("
+        << x.rows() << "x" << x.cols() << ") into y (" << y.rows() << "x" << y.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void detail::check_ger_dims(const Matrix& x, const Matrix& y, const Matrix& A) {
+  if (!vector_of(x, A.rows()) || !vector_of(y, A.cols())) {
+    std::ostringstream oss;
+    oss << "ger dimension mismatch: x (" << x.rows() << "x" << x.cols() << ") * y^T ("
+        << y.cols() << "x" << y.rows() << ") into A (" << A.rows() << "x" << A.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+// Four independent partial sums, so the compiler can keep them in one
+// vector register and the adds do not wait on each other.
+static double dot_kernel(const double* a, const double* x, size_t k) {
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  size_t p = 0;
+  for (; p + 4 <= k; p += 4) {
+    s0 += a[p] * x[p];
+    s1 += a[p + 1] * x[p + 1];
+    s2 += a[p + 2] * x[p + 2];
+    s3 += a[p + 3] * x[p + 3];
+  }
+  for (; p < k; p++) s0 += a[p] * x[p];
+  return (s0 + s1) + (s2 + s3);
+}
+
+void detail::gemv_rows(size_t i0, size_t i1, size_t k, double alpha, const double* A, size_t lda,
+                       const double* x, double beta, double* y) {
+  for (size_t i = i0; i < i1; i++) {
+    double s = alpha * dot_kernel(A + i * lda, x, k);
+    y[i] = (beta == 0.0) ? s : beta * y[i] + s;
+  }
+}
+
+void detail::gemv_t_cols(size_t j0, size_t j1, size_t m, double alpha, const double* A, size_t lda,
+                         const double* x, double beta, double* y) {
+  scale_rows(0, 1, j1 - j0, beta, y + j0, 0);
+  if (alpha == 0.0) return;
+  // two rows of A per pass halve the loads and stores of y
+  size_t p = 0;
+  for (; p + 2 <= m; p += 2) {
+    double a0 = alpha * x[p], a1 = alpha * x[p + 1];
+    const double* r0 = A + p * lda;
+    const double* r1 = r0 + lda;
+    for (size_t j = j0; j < j1; j++) {
+      y[j] += a0 * r0[j] + a1 * r1[j];
+    }
+  }
+  for (; p < m; p++) {
+    double a = alpha * x[p];
+    const double* r = A + p * lda;
+    for (size_t j = j0; j < j1; j++) y[j] += a * r[j];
+  }
+}
+
+void detail::ger_rows(size_t i0, size_t i1, size_t n, double alpha, const double* x, const double* y,
+                      double* A, size_t lda) {
+  for (size_t i = i0; i < i1; i++) {
+    double a = alpha * x[i];
+    if (a == 0.0) continue;
+    double* row = A + i * lda;
+    for (size_t j = 0; j < n; j++) row[j] += a * y[j];
+  }
+}
+
+void detail::check_broadcast_dims(const char* op, const Matrix& A, const Matrix& B) {
+  bool rows_ok = A.rows() == B.rows() || A.rows() == 1 || B.rows() == 1;
+  bool cols_ok = A.cols() == B.cols() || A.cols() == 1 || B.cols() == 1;
+  if (!rows_ok || !cols_ok) {
+    std::ostringstream oss;
+    oss << "Matrix " << op << " dimension mismatch: "
+        << "(" << A.rows() << "x" << A.cols() << ") vs "
+        << "(" << B.rows() << "x" << B.cols() << ") do not broadcast";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+// the ops as functors, so each instantiation inlines its arithmetic
+struct AddOp { double operator()(double a, double b) const { return a + b; } };
+struct SubtractOp { double operator()(double a, double b) const { return a - b; } };
+struct MultiplyOp { double operator()(double a, double b) const { return a * b; } };
+
+// One row of R from rows a and b, either of which may be a single value
+// repeated across the row; each case is its own loop so that it
+// vectorizes.
+template <class Op>
+static void broadcast_row(Op op, const double* a, bool a_repeat, const double* b, bool b_repeat, size_t n,
+                          double* r) {
+  if (!a_repeat && !b_repeat) {
+    for (size_t j = 0; j < n; j++) r[j] = op(a[j], b[j]);
+  }
+  else if (!b_repeat) {
+    double x = a[0];
+    for (size_t j = 0; j < n; j++) r[j] = op(x, b[j]);
+  }
+  else if (!a_repeat) {
+    double y = b[0];
+    for (size_t j = 0; j < n; j++) r[j] = op(a[j], y);
+  }
+  else {
+    std::fill(r, r + n, op(a[0], b[0]));
+  }
+}
+
+template <class Op>
+static void broadcast_rows_with(Op op, size_t i0, size_t i1, size_t cols, const double* A, size_t a_rows,
+                                size_t a_cols, const double* B, size_t b_rows, size_t b_cols, double* R) {
+  bool a_repeat = a_cols == 1 && cols != 1, b_repeat = b_cols == 1 && cols != 1;
+  for (size_t i = i0; i < i1; i++) {
+    const double* a = A + (a_rows == 1 ? 0 : i) * a_cols;
+    const double* b = B + (b_rows == 1 ? 0 : i) * b_cols;
+    broadcast_row(op, a, a_repeat, b, b_repeat, cols, R + i * cols);
+  }
+}
+
+void detail::broadcast_rows(ElementOp op, size_t i0, size_t i1, size_t cols, const double* A, size_t a_rows,
+                            size_t a_cols, const double* B, size_t b_rows, size_t b_cols, double* R) {
+  switch (op) {
+    case ElementOp::Add:
+      broadcast_rows_with(AddOp(), i0, i1, cols, A, a_rows, a_cols, B, b_rows, b_cols, R);
+      break;
+    case ElementOp::Subtract:
+      broadcast_rows_with(SubtractOp(), i0, i1, cols, A, a_rows, a_cols, B, b_rows, b_cols, R);
+      break;
+    case ElementOp::Multiply:
+      broadcast_rows_with(MultiplyOp(), i0, i1, cols, A, a_rows, a_cols, B, b_rows, b_cols, R);
+      break;
+  }
+}
+
+void detail::check_syrk_dims(Trans trans, const Matrix& A, const Matrix& C) {
+  size_t n = op_rows(trans, A.rows(), A.cols());
+  if (C.rows() != n || C.cols() != n) {
+    std::ostringstream oss;
+    oss << "syrk dimension mismatch: op(A) (" << n << "x" << op_cols(trans, A.rows(), A.cols())
+        << ") * op(A)^T into C (" << C.rows() << "x" << C.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+// Row i needs columns up to i only, so the rows are handed to gemm_rows
+// with the column count cut at the end of the range: with op(B) =
+// op(A)^T, columns of op(B) are rows of op(A).
+void detail::syrk_rows(Trans trans, size_t i0, size_t i1, size_t k, double alpha,
+                       const double* A, size_t lda, double beta, double* C, size_t ldc,
+                       size_t c_row0) {
+  Trans transB = (trans == Trans::No) ? Trans::Yes : Trans::No;
+  // op(A) from row c_row0, so its rows line up with those of C
+  const double* a_rows = (trans == Trans::No) ? A + c_row0 * lda : A + c_row0;
+  gemm_rows(trans, transB, i0 - c_row0, i1 - c_row0, i1, k, alpha, a_rows, lda, A, lda, beta, C, ldc);
+}
+
+void detail::mirror_lower(size_t i0, size_t i1, size_t n, double* C, size_t ldc) {
+  const size_t B = 32;
+  for (size_t ib = i0; ib < i1; ib += B) {
+    size_t ie = std::min(i1, ib + B);
+    for (size_t jb = ib; jb < n; jb += B) {
+      size_t je = std::min(n, jb + B);
+      for (size_t i = ib; i < ie; i++) {
+        for (size_t j = std::max(jb, i + 1); j < je; j++) {
+          C[i * ldc + j] = C[j * ldc + i];
+        }
+      }
+    }
+  }
+}
+
+void detail::check_trsm_dims(Side side, const Matrix& A, const Matrix& B) {
+  size_t nb = (side == Side::Left) ? B.rows() : B.cols();
+  if (A.rows() != A.cols() || A.rows() != nb) {
+    std::ostringstream oss;
+    oss << "trsm dimension mismatch: triangular A (" << A.rows() << "x" << A.cols() << ") "
+        << (side == Side::Left ? "left of" : "right of") << " B (" << B.rows() << "x" << B.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+// rows or columns per diagonal block of the blocked triangular solve
+static const size_t TRSM_BLOCK = 64;
+
+// Address of op(A)(r, c). Read from there, op(A)(r + p, c + q) is at
+// p * lda + q as stored, or at q * lda + p transposed, which is how
+// gemm_rows reads an operand with the same Trans.
+static const double* op_at(Trans t, const double* A, size_t lda, size_t r, size_t c) {
+  return t == Trans::No ? A + r * lda + c : A + c * lda + r;
+}
+
+static double op_get(Trans t, const double* A, size_t lda, size_t r, size_t c) {
+  return *op_at(t, A, lda, r, c);
+}
+
+// Rows [i0, i1) of the w columns at b, times op(A)^-1 of the diagonal
+// block [i0, i1) from the left; earlier blocks are already subtracted
+static void trsm_left_diag(bool lower, Trans t, Diag diag, size_t i0, size_t i1, size_t w,
+                           const double* A, size_t lda, double* b, size_t ldb) {
+  for (size_t s = 0; s < i1 - i0; s++) {
+    size_t i = lower ? i0 + s : i1 - 1 - s;
+    double* row = b + i * ldb;
+    size_t p0 = lower ? i0 : i + 1, p1 = lower ? i : i1;
+    for (size_t p = p0; p < p1; p++) {
+      double a = op_get(t, A, lda, i, p);
+      if (a == 0.0) continue;
+      const double* x = b + p * ldb;
+      for (size_t j = 0; j < w; j++) row[j] -= a * x[j];
+    }
+    if (diag == Diag::NonUnit) {
+      double inv = 1.0 / op_get(t, A, lda, i, i);
+      for (size_t j = 0; j < w; j++) row[j] *= inv;
+    }
+  }
+}
+
+// Columns [j0, j1) of rows [r0, r1) of B, times op(A)^-1 of the diagonal
+// block [j0, j1) from the right
+static void trsm_right_diag(bool upper, Trans t, Diag diag, size_t r0, size_t r1, size_t j0, size_t j1,
+                            const double* A, size_t lda, double* B, size_t ldb) {
+  for (size_t r = r0; r < r1; r++) {
+    double* x = B + r * ldb;
+    for (size_t s = 0; s < j1 - j0; s++) {
+      size_t j = upper ? j0 + s : j1 - 1 - s;
+      size_t p0 = upper ? j0 : j + 1, p1 = upper ? j : j1;
+      double v = x[j];
+      for (size_t p = p0; p < p1; p++) v -= x[p] * op_get(t, A, lda, p, j);
+      x[j] = (diag == Diag::NonUnit) ? v / op_get(t, A, lda, j, j) : v;
+    }
+  }
+}
+
+// Blocks of TRSM_BLOCK are solved in dependency order; before each, the
+// contribution of the blocks already solved is subtracted with one
+// gemm_rows call, so nearly all the work runs in the GEMM kernel.
+void detail::trsm_slice(Side side, Triangle uplo, Trans transA, Diag diag, size_t s0, size_t s1,
+                        size_t n, double alpha, const double* A, size_t lda, double* B, size_t ldb) {
+  // op(A) is lower triangular when exactly one of these holds
+  bool lower = (uplo == Triangle::Lower) == (transA == Trans::No);
+
+  if (side == Side::Left) {
+    // columns [s0, s1) of the n-row B
+    size_t w = s1 - s0;
+    double* b = B + s0;
+    scale_rows(0, n, w, alpha, b, ldb);
+    if (alpha == 0.0 || w == 0) return;
+    for (size_t done = 0; done < n; done += TRSM_BLOCK) {
+      size_t span = std::min(TRSM_BLOCK, n - done);
+      // forward from the top for lower op(A), backward from the bottom for upper
+      size_t i0 = lower ? done : n - done - span, i1 = i0 + span;
+      if (lower && i0 > 0) {
+        gemm_rows(transA, Trans::No, i0, i1, w, i0, -1.0, op_at(transA, A, lda, 0, 0), lda,
+                  b, ldb, 1.0, b, ldb);
+      }
+      else if (!lower && i1 < n) {
+        gemm_rows(transA, Trans::No, i0, i1, w, n - i1, -1.0, op_at(transA, A, lda, 0, i1), lda,
+                  b + i1 * ldb, ldb, 1.0, b, ldb);
+      }
+      trsm_left_diag(lower, transA, diag, i0, i1, w, A, lda, b, ldb);
+    }
+  }
+  else {
+    // rows [s0, s1) of the n-column B
+    scale_rows(s0, s1, n, alpha, B, ldb);
+    if (alpha == 0.0 || s1 == s0) return;
+    for (size_t done = 0; done < n; done += TRSM_BLOCK) {
+      size_t span = std::min(TRSM_BLOCK, n - done);
+      // x * op(A) = b: forward for upper op(A), backward for lower
+      size_t j0 = lower ? n - done - span : done, j1 = j0 + span;
+      if (!lower && j0 > 0) {
+        gemm_rows(Trans::No, transA, s0, s1, span, j0, -1.0, B, ldb,
+                  op_at(transA, A, lda, 0, j0), lda, 1.0, B + j0, ldb);
+      }
+      else if (lower && j1 < n) {
+        gemm_rows(Trans::No, transA, s0, s1, span, n - j1, -1.0, B + j1, ldb,
+                  op_at(transA, A, lda, j1, j0), lda, 1.0, B + j0, ldb);
+      }
+      trsm_right_diag(!lower, transA, diag, s0, s1, j0, j1, A, lda, B, ldb);
+    }
+  }
+}
+
+size_t detail::lu_panel(size_t k, size_t kb, size_t m, double* A, size_t lda, size_t* piv) {
+  size_t zero_col = npos;
+  size_t ke = k + kb;
+  for (size_t j = k; j < ke; j++) {
+    size_t p = j;
+    double best = std::abs(A[j * lda + j]);
+    for (size_t i = j + 1; i < m; i++) {
+      double v = std::abs(A[i * lda + j]);
+      if (v > best) {
+        best = v;
+        p = i;
+      }
+    }
+    piv[j] = p;
+    if (best == 0.0) {
+      // the column is already zero below the diagonal; LAPACK carries on
+      if (zero_col == npos) zero_col = j;
+      continue;
+    }
+    if (p != j) {
+      std::swap_ranges(A + j * lda + k, A + j * lda + ke, A + p * lda + k);
+    }
+    const double* pivot_row = A + j * lda;
+    double inv = 1.0 / pivot_row[j];
+    for (size_t i = j + 1; i < m; i++) {
+      double* row = A + i * lda;
+      double l = row[j] * inv;
+      row[j] = l;
+      if (l == 0.0) continue;
+      for (size_t c = j + 1; c < ke; c++) row[c] -= l * pivot_row[c];
+    }
+  }
+  return zero_col;
+}
+
+void detail::laswp(size_t k0, size_t k1, size_t j0, size_t j1, double* A, size_t lda, const size_t* piv) {
+  if (j0 >= j1) return;
+  for (size_t i = k0; i < k1; i++) {
+    if (piv[i] != i) {
+      std::swap_ranges(A + i * lda + j0, A + i * lda + j1, A + piv[i] * lda + j0);
+    }
+  }
+}
+
+void detail::lu_update_cols(size_t k, size_t kb, size_t m, size_t j0, size_t j1, double* A, size_t lda,
+                            const size_t* piv) {
+  laswp(k, k + kb, j0, j1, A, lda, piv);
+  // U12 = L11^-1 * A12
+  trsm_slice(Side::Left, Triangle::Lower, Trans::No, Diag::Unit, j0, j1, kb, 1.0,
+             A + k * lda + k, lda, A + k * lda, lda);
+  // A22 -= L21 * U12
+  if (k + kb < m) {
+    gemm_rows(Trans::No, Trans::No, k + kb, m, j1 - j0, kb, -1.0, A + k, lda,
+              A + k * lda + j0, lda, 1.0, A + j0, lda);
+  }
+}
+
+size_t detail::lu_factor(size_t m, size_t n, double* A, size_t lda, size_t* piv) {
+  size_t kmin = std::min(m, n);
+  size_t zero_col = npos;
+  for (size_t k = 0; k < kmin; k += FACTOR_BLOCK) {
+    size_t kb = std::min(FACTOR_BLOCK, kmin - k);
+    size_t z = lu_panel(k, kb, m, A, lda, piv);
+    if (zero_col == npos) zero_col = z;
+    lu_update_cols(k, kb, m, k + kb, n, A, lda, piv);
+    laswp(k, k + kb, 0, k, A, lda, piv);
+  }
+  return zero_col;
+}
+
+size_t detail::potrf_block(size_t k, size_t kb, double* A, size_t lda) {
+  size_t ke = k + kb;
+  for (size_t j = k; j < ke; j++) {
+    double* row_j = A + j * lda;
+    double d = row_j[j];
+    for (size_t p = k; p < j; p++) d -= row_j[p] * row_j[p];
+    // also catches NaN
+    if (!(d > 0.0)) return j;
+    d = std::sqrt(d);
+    row_j[j] = d;
+    for (size_t i = j + 1; i < ke; i++) {
+      double* row_i = A + i * lda;
+      double v = row_i[j];
+      for (size_t p = k; p < j; p++) v -= row_i[p] * row_j[p];
+      row_i[j] = v / d;
+    }
+  }
+  return npos;
+}
+
+void detail::cholesky_panel_rows(size_t k, size_t kb, size_t i0, size_t i1, double* A, size_t lda) {
+  // L21 = A21 * L11^-T
+  trsm_slice(Side::Right, Triangle::Lower, Trans::Yes, Diag::NonUnit, i0, i1, kb, 1.0,
+             A + k * lda + k, lda, A + k, lda);
+}
+
+void detail::cholesky_update(size_t k, size_t kb, size_t i0, size_t i1, size_t j0, size_t j1,
+                             double* A, size_t lda) {
+  if (i0 == j0) {
+    syrk_rows(Trans::No, 0, i1 - i0, kb, -1.0, A + i0 * lda + k, lda, 1.0, A + i0 * lda + i0, lda, 0);
+  }
+  else {
+    gemm_rows(Trans::No, Trans::Yes, i0, i1, j1 - j0, kb, -1.0, A + k, lda,
+              A + j0 * lda + k, lda, 1.0, A + j0, lda);
+  }
+}
+
+size_t detail::cholesky_factor(size_t n, double* A, size_t lda) {
+  for (size_t k = 0; k < n; k += FACTOR_BLOCK) {
+    size_t kb = std::min(FACTOR_BLOCK, n - k);
+    size_t bad = potrf_block(k, kb, A, lda);
+    if (bad != npos) return bad;
+    size_t ke = k + kb;
+    if (ke == n) break;
+    cholesky_panel_rows(k, kb, ke, n, A, lda);
+    for (size_t i0 = ke; i0 < n; i0 += FACTOR_BLOCK) {
+      size_t i1 = std::min(n, i0 + FACTOR_BLOCK);
+      for (size_t j0 = ke; j0 <= i0; j0 += FACTOR_BLOCK) {
+        cholesky_update(k, kb, i0, i1, j0, std::min(n, j0 + FACTOR_BLOCK), A, lda);
+      }
+    }
+  }
+  return npos;
+}
+
+void detail::zero_upper(size_t i0, size_t i1, size_t n, double* A, size_t lda) {
+  for (size_t i = i0; i < i1; i++) {
+    std::fill(A + i * lda + std::min(n, i + 1), A + i * lda + n, 0.0);
+  }
+}
+
+void detail::qr_panel(size_t k, size_t kb, size_t m, double* A, size_t lda, double* tau) {
+  size_t ke = k + kb;
+  std::vector<double> w(kb);
+  for (size_t j = k; j < ke; j++) {
+    // reflector zeroing A[j+1.., j], as LAPACK's dlarfg builds it
+    double alpha = A[j * lda + j];
+    double xnorm2 = 0.0;
+    for (size_t i = j + 1; i < m; i++) xnorm2 += A[i * lda + j] * A[i * lda + j];
+    if (xnorm2 == 0.0) {
+      tau[j] = 0.0;
+      continue;
+    }
+    double beta = -std::copysign(std::sqrt(alpha * alpha + xnorm2), alpha);
+    tau[j] = (beta - alpha) / beta;
+    double scale = 1.0 / (alpha - beta);
+    for (size_t i = j + 1; i < m; i++) A[i * lda + j] *= scale;
+    A[j * lda + j] = beta;
+
+    // the rest of the panel: w = v^T * A, then A -= tau * v * w
+    size_t nc = ke - j - 1;
+    if (nc == 0) continue;
+    std::copy(A + j * lda + j + 1, A + j * lda + ke, w.begin());
+    for (size_t i = j + 1; i < m; i++) {
+      const double* row = A + i * lda;
+      double v = row[j];
+      for (size_t c = 0; c < nc; c++) w[c] += v * row[j + 1 + c];
+    }
+    double t = tau[j];
+    for (size_t c = 0; c < nc; c++) A[j * lda + j + 1 + c] -= t * w[c];
+    for (size_t i = j + 1; i < m; i++) {
+      double* row = A + i * lda;
+      double tv = t * row[j];
+      for (size_t c = 0; c < nc; c++) row[j + 1 + c] -= tv * w[c];
+    }
+  }
+}
+
+// V's rows [k, k + kb) form a unit lower triangle stored in A's lower
+// part; the rows after it are a plain (m - k - kb) x kb block of A
+void detail::qr_block_t(size_t k, size_t kb, size_t m, const double* A, size_t lda, const double* tau,
+                        double* T) {
+  // G = V^T * V, the strictly upper part of which T needs
+  std::vector<double> G(kb * kb, 0.0);
+  for (size_t r = 1; r < kb; r++) {
+    const double* row = A + (k + r) * lda + k;
+    for (size_t i = 0; i < r; i++) {
+      // V(r, i) * V(r, r) with the unit entry at (r, r)
+      G[i * kb + r] += row[i];
+      for (size_t j = i + 1; j < r; j++) G[i * kb + j] += row[i] * row[j];
+    }
+  }
+  if (k + kb < m) {
+    const double* V2 = A + (k + kb) * lda + k;
+    gemm_rows(Trans::Yes, Trans::No, 0, kb, kb, m - k - kb, 1.0, V2, lda, V2, lda, 1.0, G.data(), kb);
+  }
+
+  // T(0:i, i) = -tau_i * T(0:i, 0:i) * G(0:i, i), as LAPACK's dlarft
+  std::fill(T, T + kb * kb, 0.0);
+  for (size_t i = 0; i < kb; i++) {
+    double t = tau[k + i];
+    T[i * kb + i] = t;
+    for (size_t r = 0; r < i; r++) {
+      double s = 0.0;
+      for (size_t j = r; j < i; j++) s += T[r * kb + j] * G[j * kb + i];
+      T[r * kb + i] = -t * s;
+    }
+  }
+}
+
+void detail::apply_block_reflector(Trans trans, size_t k, size_t kb, size_t m, const double* A, size_t lda,
+                                   const double* T, size_t c0, size_t c1, double* C, size_t ldc) {
+  size_t w = c1 - c0;
+  if (w == 0) return;
+  size_t ke = std::min(m, k + kb);
+  const double* V1 = A + k * lda + k;
+  double* C1 = C + k * ldc + c0;
+
+  // W = V^T * C: the unit lower triangle by hand, the block under it by GEMM
+  std::vector<double> W(kb * w, 0.0), W2(kb * w);
+  for (size_t r = 0; r < ke - k; r++) {
+    const double* c_row = C1 + r * ldc;
+    const double* v_row = V1 + r * lda;
+    for (size_t i = 0; i < r; i++) {
+      double v = v_row[i];
+      double* w_row = W.data() + i * w;
+      for (size_t j = 0; j < w; j++) w_row[j] += v * c_row[j];
+    }
+    double* w_row = W.data() + r * w;
+    for (size_t j = 0; j < w; j++) w_row[j] += c_row[j];
+  }
+  if (ke < m) {
+    gemm_rows(Trans::Yes, Trans::No, 0, kb, w, m - ke, 1.0, A + ke * lda + k, lda,
+              C + ke * ldc + c0, ldc, 1.0, W.data(), w);
+  }
+  // W2 = T^T * W for H^T, T * W for H
+  gemm_rows(trans, Trans::No, 0, kb, w, kb, 1.0, T, kb, W.data(), w, 0.0, W2.data(), w);
+
+  // C -= V * W2
+  for (size_t r = 0; r < ke - k; r++) {
+    double* c_row = C1 + r * ldc;
+    const double* v_row = V1 + r * lda;
+    for (size_t i = 0; i < r; i++) {
+      double v = v_row[i];
+      const double* w_row = W2.data() + i * w;
+      for (size_t j = 0; j < w; j++) c_row[j] -= v * w_row[j];
+    }
+    const double* w_row = W2.data() + r * w;
+    for (size_t j = 0; j < w; j++) c_row[j] -= w_row[j];
+  }
+  if (ke < m) {
+    gemm_rows(Trans::No, Trans::No, ke, m, w, kb, -1.0, A + k, lda, W2.data(), w, 1.0, C + c0, ldc);
+  }
+}
+
+void detail::qr_factor(size_t m, size_t n, double* A, size_t lda, double* tau) {
+  size_t kmin = std::min(m, n);
+  std::vector<double> T(FACTOR_BLOCK * FACTOR_BLOCK);
+  for (size_t k = 0; k < kmin; k += FACTOR_BLOCK) {
+    size_t kb = std::min(FACTOR_BLOCK, kmin - k);
+    qr_panel(k, kb, m, A, lda, tau);
+    if (k + kb < n) {
+      qr_block_t(k, kb, m, A, lda, tau, T.data());
+      apply_block_reflector(Trans::Yes, k, kb, m, A, lda, T.data(), k + kb, n, A, lda);
+    }
+  }
+}
+
+void detail::apply_q(Trans trans, size_t m, size_t kmin, const double* A, size_t lda, const double* tau,
+                     size_t c0, size_t c1, double* C, size_t ldc) {
+  if (c0 >= c1 || kmin == 0) return;
+  std::vector<double> T(FACTOR_BLOCK * FACTOR_BLOCK);
+  size_t blocks = (kmin + FACTOR_BLOCK - 1) / FACTOR_BLOCK;
+  for (size_t s = 0; s < blocks; s++) {
+    // Q^T = ... * B2^T * B1^T applies the first block first, Q the last
+    size_t b = (trans == Trans::Yes) ? s : blocks - 1 - s;
+    size_t k = b * FACTOR_BLOCK, kb = std::min(FACTOR_BLOCK, kmin - k);
+    qr_block_t(k, kb, m, A, lda, tau, T.data());
+    apply_block_reflector(trans, k, kb, m, A, lda, T.data(), c0, c1, C, ldc);
+  }
+}
+
+void detail::check_lu_pivot(size_t zero_col) {
+  if (zero_col != npos) {
+    std::ostringstream oss;
+    oss << "lu: matrix is singular (zero pivot in column " << zero_col << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void detail::check_positive_definite(size_t bad_col) {
+  if (bad_col != npos) {
+    std::ostringstream oss;
+    oss << "cholesky: matrix is not positive definite (leading minor of order "
+        << bad_col + 1 << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void detail::check_lstsq_dims(const Matrix& A, const Matrix& B) {
+  if (A.rows() < A.cols() || B.rows() != A.rows()) {
+    std::ostringstream oss;
+    oss << "lstsq dimension mismatch: A (" << A.rows() << "x" << A.cols()
+        << ") needs at least as many rows as columns, and B (" << B.rows() << "x" << B.cols()
+        << ") as many rows as A";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void detail::check_chain_dims(const std::vector<Matrix>& chain) {
+  if (chain.empty()) {
+    throw std::runtime_error("multi_dot: the chain is empty");
+  }
+  for (size_t i = 0; i + 1 < chain.size(); i++) {
+    if (chain[i].cols() != chain[i + 1].rows()) {
+      std::ostringstream oss;
+      oss << "multi_dot dimension mismatch: matrix " << i << " (" << chain[i].rows() << "x"
+          << chain[i].cols() << ") vs matrix " << i + 1 << " (" << chain[i + 1].rows() << "x"
+          << chain[i + 1].cols() << ")";
+      throw std::runtime_error(oss.str());
+    }
+  }
+}
+
+std::vector<size_t> detail::chain_order(const std::vector<size_t>& dims) {
+  size_t count = dims.size() - 1;
+  // costs in doubles, so products of three large dimensions cannot overflow
+  std::vector<double> cost(count * count, 0.0);
+  std::vector<size_t> split(count * count, 0);
+  for (size_t len = 1; len < count; len++) {
+    for (size_t i = 0; i + len < count; i++) {
+      size_t j = i + len;
+      double best = std::numeric_limits<double>::infinity();
+      for (size_t s = i; s < j; s++) {
+        double c = cost[i * count + s] + cost[(s + 1) * count + j] +
+                   static_cast<double>(dims[i]) * static_cast<double>(dims[s + 1]) *
+                   static_cast<double>(dims[j + 1]);
+        if (c < best) {
+          best = c;
+          split[i * count + j] = s;
+        }
+      }
+      cost[i * count + j] = best;
+    }
+  }
+  return split;
+}
+
+void detail::check_full_rank(size_t n, const double* R, size_t ldr) {
+  for (size_t i = 0; i < n; i++) {
+    if (R[i * ldr + i] == 0.0) {
+      std::ostringstream oss;
+      oss << "lstsq: A is rank deficient (zero in R at column " << i << ")";
+      throw std::runtime_error(oss.str());
+    }
+  }
+}
+
+void detail::check_distance_dims(const Matrix& A, const Matrix& B) {
+  if (A.cols() != B.cols()) {
+    std::ostringstream oss;
+    oss << "distance dimension mismatch: rows of A (" << A.rows() << "x" << A.cols()
+        << ") and B (" << B.rows() << "x" << B.cols() << ") differ in length";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void detail::check_knn_dims(const Matrix& A, const Matrix& B, size_t k) {
+  check_distance_dims(A, B);
+  if (k == 0 || k > B.rows()) {
+    std::ostringstream oss;
+    oss << "knn: k = " << k << " must be between 1 and the " << B.rows() << " points";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void detail::row_sq_norms(size_t i0, size_t i1, size_t d, const double* A, size_t lda, double* out) {
+  for (size_t i = i0; i < i1; i++) out[i] = dot_kernel(A + i * lda, A + i * lda, d);
+}
+
+// columns of D per tile: GEMM_ROWS rows of it stay in L1 while the norms
+// are added
+static const size_t DIST_TILE = 256;
+
+// rows [r0, r1) x columns [jb, je) of the GEMM tile plus the norms
+static void finish_distance_tile(size_t r0, size_t r1, size_t jb, size_t je, const double* a_norms,
+                                 const double* b_norms, double* D, size_t ldd) {
+  for (size_t i = r0; i < r1; i++) {
+    double* row = D + i * ldd;
+    double an = a_norms[i];
+    for (size_t j = jb; j < je; j++) {
+      row[j] = std::max(0.0, row[j] + an + b_norms[j]);
+    }
+  }
+}
+
+void detail::sq_distance_rows(size_t i0, size_t i1, size_t m, size_t d, const double* A, size_t lda,
+                              const double* B, size_t ldb, const double* a_norms, const double* b_norms,
+                              double* D, size_t ldd) {
+  for (size_t ib = i0; ib < i1; ib += GEMM_ROWS) {
+    size_t ie = std::min(i1, ib + GEMM_ROWS);
+    for (size_t jb = 0; jb < m; jb += DIST_TILE) {
+      size_t je = std::min(m, jb + DIST_TILE);
+      gemm_rows(Trans::No, Trans::Yes, ib, ie, je - jb, d, -2.0, A, lda, B + jb * ldb, ldb,
+                0.0, D + jb, ldd);
+      finish_distance_tile(ib, ie, jb, je, a_norms, b_norms, D, ldd);
+    }
+  }
+}
+
+void detail::knn_rows(size_t i0, size_t i1, size_t m, size_t d, size_t k, const double* A, size_t lda,
+                      const double* B, size_t ldb, const double* a_norms, const double* b_norms,
+                      double* dist, size_t* idx) {
+  typedef std::pair<double, size_t> Candidate;
+  std::vector<double> tile(GEMM_ROWS * DIST_TILE);
+  std::vector<std::vector<Candidate>> heaps(GEMM_ROWS);
+  for (std::vector<Candidate>& h : heaps) h.reserve(k);
+
+  for (size_t ib = i0; ib < i1; ib += GEMM_ROWS) {
+    size_t ie = std::min(i1, ib + GEMM_ROWS);
+    for (size_t r = 0; r < ie - ib; r++) heaps[r].clear();
+
+    for (size_t jb = 0; jb < m; jb += DIST_TILE) {
+      size_t je = std::min(m, jb + DIST_TILE), w = je - jb;
+      // the tile's rows are addressed from 0, so A starts at row ib
+      gemm_rows(Trans::No, Trans::Yes, 0, ie - ib, w, d, -2.0, A + ib * lda, lda, B + jb * ldb, ldb,
+                0.0, tile.data(), w);
+      for (size_t r = 0; r < ie - ib; r++) {
+        std::vector<Candidate>& h = heaps[r];
+        const double* t = tile.data() + r * w;
+        double an = a_norms[ib + r];
+        for (size_t j = 0; j < w; j++) {
+          // a max-heap of the k best so far; most candidates lose to its top
+          Candidate c(std::max(0.0, t[j] + an + b_norms[jb + j]), jb + j);
+          if (h.size() < k) {
+            h.push_back(c);
+            std::push_heap(h.begin(), h.end());
+          }
+          else if (c < h.front()) {
+            std::pop_heap(h.begin(), h.end());
+            h.back() = c;
+            std::push_heap(h.begin(), h.end());
+          }
+        }
+      }
+    }
+
+    for (size_t r = 0; r < ie - ib; r++) {
+      std::vector<Candidate>& h = heaps[r];
+      std::sort_heap(h.begin(), h.end());
+      for (size_t c = 0; c < k; c++) {
+        dist[(ib + r) * k + c] = h[c].first;
+        idx[(ib + r) * k + c] = h[c].second;
+      }
+    }
+  }
+}
+
+void detail::check_argmax_dims(Axis axis, const Matrix& A) {
+  if ((axis == Axis::Rows ? A.cols() : A.rows()) == 0) {
+    std::ostringstream oss;
+    oss << "argmax: the " << (axis == Axis::Rows ? "rows" : "columns") << " of A ("
+        << A.rows() << "x" << A.cols() << ") are empty";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+// Row folds keep four running values, like dot_kernel, so the compiler
+// can hold them in one vector register.
+static double row_sum(const double* a, size_t n) {
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  size_t p = 0;
+  for (; p + 4 <= n; p += 4) {
+    s0 += a[p];
+    s1 += a[p + 1];
+    s2 += a[p + 2];
+    s3 += a[p + 3];
+  }
+  for (; p < n; p++) s0 += a[p];
+  return (s0 + s1) + (s2 + s3);
+}
+
+static double row_abs_sum(const double* a, size_t n) {
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  size_t p = 0;
+  for (; p + 4 <= n; p += 4) {
+    s0 += std::abs(a[p]);
+    s1 += std::abs(a[p + 1]);
+    s2 += std::abs(a[p + 2]);
+    s3 += std::abs(a[p + 3]);
+  }
+  for (; p < n; p++) s0 += std::abs(a[p]);
+  return (s0 + s1) + (s2 + s3);
+}
+
+// written as compares rather than std::min / std::max so they map onto
+// the vector min and max instructions
+static double row_min(const double* a, size_t n) {
+  const double inf = std::numeric_limits<double>::infinity();
+  double m0 = inf, m1 = inf, m2 = inf, m3 = inf;
+  size_t p = 0;
+  for (; p + 4 <= n; p += 4) {
+    m0 = a[p] < m0 ? a[p] : m0;
+    m1 = a[p + 1] < m1 ? a[p + 1] : m1;
+    m2 = a[p + 2] < m2 ? a[p + 2] : m2;
+    m3 = a[p + 3] < m3 ? a[p + 3] : m3;
+  }
+  for (; p < n; p++) m0 = a[p] < m0 ? a[p] : m0;
+  m0 = m1 < m0 ? m1 : m0;
+  m2 = m3 < m2 ? m3 : m2;
+  return m2 < m0 ? m2 : m0;
+}
+
+static double row_max(const double* a, size_t n) {
+  const double inf = std::numeric_limits<double>::infinity();
+  double m0 = -inf, m1 = -inf, m2 = -inf, m3 = -inf;
+  size_t p = 0;
+  for (; p + 4 <= n; p += 4) {
+    m0 = a[p] > m0 ? a[p] : m0;
+    m1 = a[p + 1] > m1 ? a[p + 1] : m1;
+    m2 = a[p + 2] > m2 ? a[p + 2] : m2;
+    m3 = a[p + 3] > m3 ? a[p + 3] : m3;
+  }
+  for (; p < n; p++) m0 = a[p] > m0 ? a[p] : m0;
+  m0 = m1 > m0 ? m1 : m0;
+  m2 = m3 > m2 ? m3 : m2;
+  return m2 > m0 ? m2 : m0;
+}
+
+// sum of exp(a[p] - shift), written to r as well when r is not null
+static double row_exp_sum(const double* a, size_t n, double shift, double* r) {
+  double s = 0.0;
+  for (size_t p = 0; p < n; p++) {
+    double e = std::exp(a[p] - shift);
+    if (r) r[p] = e;
+    s += e;
+  }
+  return s;
+}
+
+// log(sum(exp(a))), shifted by the maximum; an infinite maximum is the
+// answer itself, and would make the shifted entries NaN
+static double row_log_sum_exp(const double* a, size_t n) {
+  double m = row_max(a, n);
+  if (std::isinf(m)) return m;
+  return m + std::log(row_exp_sum(a, n, m, nullptr));
+}
+
+void detail::reduce_rows(Reduction op, size_t i0, size_t i1, size_t n, const double* A, size_t lda,
+                         double* out) {
+  for (size_t i = i0; i < i1; i++) {
+    const double* a = A + i * lda;
+    switch (op) {
+      case Reduction::Sum: out[i] = row_sum(a, n); break;
+      case Reduction::Mean: out[i] = row_sum(a, n) / static_cast<double>(n); break;
+      case Reduction::Min: out[i] = row_min(a, n); break;
+      case Reduction::Max: out[i] = row_max(a, n); break;
+      case Reduction::L1: out[i] = row_abs_sum(a, n); break;
+      case Reduction::L2: out[i] = std::sqrt(dot_kernel(a, a, n)); break;
+      case Reduction::LogSumExp: out[i] = row_log_sum_exp(a, n); break;
+    }
+  }
+}
+
+size_t detail::reduce_col_parts(size_t m, size_t n) {
+  size_t parts = (m + REDUCE_ROWS - 1) / REDUCE_ROWS;
+  size_t cap = std::max<size_t>(1, (size_t(1) << 18) / std::max<size_t>(1, n));
+  return std::max<size_t>(1, std::min(parts, std::min<size_t>(64, cap)));
+}
+
+void detail::reduce_cols_init(Reduction op, size_t c0, size_t c1, double* acc) {
+  const double inf = std::numeric_limits<double>::infinity();
+  double identity = (op == Reduction::Min) ? inf : (op == Reduction::Max) ? -inf : 0.0;
+  std::fill(acc + c0, acc + c1, identity);
+}
+
+void detail::reduce_cols_fold(Reduction op, size_t r0, size_t r1, size_t c0, size_t c1, const double* A,
+                              size_t lda, const double* shift, double* acc) {
+  for (size_t r = r0; r < r1; r++) {
+    const double* a = A + r * lda;
+    switch (op) {
+      case Reduction::Sum:
+      case Reduction::Mean:
+        for (size_t c = c0; c < c1; c++) acc[c] += a[c];
+        break;
+      case Reduction::Min:
+        for (size_t c = c0; c < c1; c++) acc[c] = a[c] < acc[c] ? a[c] : acc[c];
+        break;
+      case Reduction::Max:
+        for (size_t c = c0; c < c1; c++) acc[c] = a[c] > acc[c] ? a[c] : acc[c];
+        break;
+      case Reduction::L1:
+        for (size_t c = c0; c < c1; c++) acc[c] += std::abs(a[c]);
+        break;
+      case Reduction::L2:
+        for (size_t c = c0; c < c1; c++) acc[c] += a[c] * a[c];
+        break;
+      case Reduction::LogSumExp:
+        for (size_t c = c0; c < c1; c++) {
+          if (!std::isinf(shift[c])) acc[c] += std::exp(a[c] - shift[c]);
+        }
+        break;
+    }
+  }
+}
+
+void detail::reduce_cols_merge(Reduction op, size_t c0, size_t c1, const double* part, double* acc) {
+  if (op == Reduction::Min) {
+    for (size_t c = c0; c < c1; c++) acc[c] = part[c] < acc[c] ? part[c] : acc[c];
+  }
+  else if (op == Reduction::Max) {
+    for (size_t c = c0; c < c1; c++) acc[c] = part[c] > acc[c] ? part[c] : acc[c];
+  }
+  else {
+    for (size_t c = c0; c < c1; c++) acc[c] += part[c];
+  }
+}
+
+void detail::reduce_cols_finish(Reduction op, size_t m, size_t c0, size_t c1, const double* shift,
+                                double* acc) {
+  for (size_t c = c0; c < c1; c++) {
+    if (op == Reduction::Mean) acc[c] /= static_cast<double>(m);
+    else if (op == Reduction::L2) acc[c] = std::sqrt(acc[c]);
+    else if (op == Reduction::LogSumExp) {
+      acc[c] = std::isinf(shift[c]) ? shift[c] : shift[c] + std::log(acc[c]);
+    }
+  }
+}
+
+void detail::argmax_rows(size_t i0, size_t i1, size_t n, const double* A, size_t lda, size_t* out) {
+  for (size_t i = i0; i < i1; i++) {
+    const double* a = A + i * lda;
+    size_t best = 0;
+    for (size_t p = 1; p < n; p++) {
+      if (a[p] > a[best]) best = p;
+    }
+    out[i] = best;
+  }
+}
+
+void detail::argmax_cols_fold(size_t r0, size_t r1, size_t c0, size_t c1, const double* A, size_t lda,
+                              double* best, size_t* where) {
+  for (size_t r = r0; r < r1; r++) {
+    const double* a = A + r * lda;
+    for (size_t c = c0; c < c1; c++) {
+      // the first row seen is taken even at -inf, so every column ends
+      // with an index
+      if (a[c] > best[c] || where[c] == npos) {
+        best[c] = a[c];
+        where[c] = r;
+      }
+    }
+  }
+}
+
+void detail::argmax_cols_merge(size_t c0, size_t c1, const double* part_best, const size_t* part_where,
+                               double* best, size_t* where) {
+  for (size_t c = c0; c < c1; c++) {
+    if (part_where[c] == npos) continue;
+    if (where[c] == npos || part_best[c] > best[c] ||
+        (part_best[c] == best[c] && part_where[c] < where[c])) {
+      best[c] = part_best[c];
+      where[c] = part_where[c];
+    }
+  }
+}
+
+// fold(p, r0, r1, c0, c1) folds rows [r0, r1) of columns [c0, c1) into
+// partial p; merge(p, c0, c1) merges partial p into partial 0
+template <typename Fold, typename Merge>
+static void split_cols(const detail::RangeRunner& run, size_t m, size_t n, size_t parts, Fold fold,
+                       Merge merge) {
+  size_t rows_per_part = (m + parts - 1) / parts;
+  size_t strips = (n + detail::REDUCE_STRIP - 1) / detail::REDUCE_STRIP;
+  run(parts * strips, [&](size_t lo, size_t hi) {
+    for (size_t t = lo; t < hi; t++) {
+      size_t p = t / strips, c0 = (t % strips) * detail::REDUCE_STRIP;
+      size_t c1 = std::min(n, c0 + detail::REDUCE_STRIP);
+      size_t r0 = std::min(m, p * rows_per_part), r1 = std::min(m, r0 + rows_per_part);
+      fold(p, r0, r1, c0, c1);
+    }
+  });
+  run(strips, [&](size_t lo, size_t hi) {
+    for (size_t s = lo; s < hi; s++) {
+      size_t c0 = s * detail::REDUCE_STRIP, c1 = std::min(n, c0 + detail::REDUCE_STRIP);
+      for (size_t p = 1; p < parts; p++) merge(p, c0, c1);
+    }
+  });
+}
+
+// the merged fold of op over each column, before reduce_cols_finish
+static std::vector<double> fold_cols(const detail::RangeRunner& run, Reduction op, size_t m, size_t n,
+                                     const double* A, const double* shift) {
+  size_t parts = detail::reduce_col_parts(m, n);
+  std::vector<double> acc(parts * n);
+  double* a = acc.data();
+  split_cols(run, m, n, parts,
+             [=](size_t p, size_t r0, size_t r1, size_t c0, size_t c1) {
+               detail::reduce_cols_init(op, c0, c1, a + p * n);
+               detail::reduce_cols_fold(op, r0, r1, c0, c1, A, n, shift, a + p * n);
+             },
+             [=](size_t p, size_t c0, size_t c1) { detail::reduce_cols_merge(op, c0, c1, a + p * n, a); });
+  acc.resize(n);
+  return acc;
+}
+
+std::vector<double> detail::reduce_cols(const RangeRunner& run, Reduction op, size_t m, size_t n,
+                                        const double* A) {
+  std::vector<double> shift;
+  if (op == Reduction::LogSumExp) shift = fold_cols(run, Reduction::Max, m, n, A, nullptr);
+  std::vector<double> acc = fold_cols(run, op, m, n, A, shift.data());
+  reduce_cols_finish(op, m, 0, n, shift.data(), acc.data());
+  return acc;
+}
+
+std::vector<size_t> detail::argmax_cols(const RangeRunner& run, size_t m, size_t n, const double* A) {
+  size_t parts = reduce_col_parts(m, n);
+  std::vector<double> best(parts * n, -std::numeric_limits<double>::infinity());
+  std::vector<size_t> where(parts * n, npos);
+  double* b = best.data();
+  size_t* w = where.data();
+  split_cols(run, m, n, parts,
+             [=](size_t p, size_t r0, size_t r1, size_t c0, size_t c1) {
+               argmax_cols_fold(r0, r1, c0, c1, A, n, b + p * n, w + p * n);
+             },
+             [=](size_t p, size_t c0, size_t c1) { argmax_cols_merge(c0, c1, b + p * n, w + p * n, b, w); });
+  where.resize(n);
+  return where;
+}
+
+void detail::transform_rows(RowTransform op, size_t i0, size_t i1, size_t n, const double* A, size_t lda,
+                            double* R, size_t ldr) {
+  for (size_t i = i0; i < i1; i++) {
+    const double* a = A + i * lda;
+    double* r = R + i * ldr;
+    double scale;
+    if (op == RowTransform::Softmax) {
+      // exp(a - max) goes straight to r, which the scaling then reads
+      // back from cache
+      scale = 1.0 / row_exp_sum(a, n, row_max(a, n), r);
+    }
+    else {
+      double norm = std::sqrt(dot_kernel(a, a, n));
+      scale = (norm > 0.0) ? 1.0 / norm : 1.0;
+      if (r != a) std::copy(a, a + n, r);
+    }
+    for (size_t p = 0; p < n; p++) r[p] *= scale;
+  }
+}
+
+}
@@ -0,0 +1,257 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "lumin/backend.hpp"
+
+// Serial dense kernels shared by the backends. They work on raw row-major
+// storage so that a backend can hand each thread or rank a range of output
+// rows, or a slice of an operand, by offsetting pointers. ld* arguments are
+// the row strides of the operands as stored.
+
+namespace lumin {
+
+  class Matrix;
+
+  namespace detail {
+
+    // shape of op(M) for a stored rows x cols matrix
+    inline size_t op_rows(Trans t, size_t rows, size_t cols) { return t == Trans::No ? rows : cols; }
+    inline size_t op_cols(Trans t, size_t rows, size_t cols) { return t == Trans::No ? cols : rows; }
+
+    // throw unless A and B have one shape, or A * B is defined
+    void check_same_size(const char* op, const Matrix& A, const Matrix& B);
+    void check_multiply_dims(const Matrix& A, const Matrix& B);
+    // If A * B is a matrix-vector product, writes it into R with
+    // backend.gemv and returns true. Outer products are left to the general
+    // multiply: ger skips zero rows, so NaN or Inf in B would not reach R.
+    bool multiply_as_gemv(Backend& backend, const Matrix& A, const Matrix& B, Matrix& R);
+
+    // throws unless op(A) * op(B) is defined and has C's shape
+    void check_gemm_dims(Trans transA, Trans transB, const Matrix& A, const Matrix& B, const Matrix& C);
+
+    // Rows [i0, i1) of C = alpha * op(A) * op(B) + beta * C, where op(A) is
+    // m x k and op(B) is k x n. Row i of op(A) and C are read at their
+    // full index; only the rows in range are written.
+    void gemm_rows(Trans transA, Trans transB, size_t i0, size_t i1, size_t n, size_t k,
+                   double alpha, const double* A, size_t lda, const double* B, size_t ldb,
+                   double beta, double* C, size_t ldc);
+
+    // the elementwise ops that broadcast
+    enum class ElementOp { Add, Subtract, Multiply };
+    // extent of a broadcast dimension: an extent of 1 stretches to the other
+    inline size_t broadcast_extent(size_t a, size_t b) { return a == 1 ? b : a; }
+    // throws unless each dimension of A and B is equal or 1 in one of them
+    void check_broadcast_dims(const char* op, const Matrix& A, const Matrix& B);
+    // Rows [i0, i1) of the rows x cols R = A op B, broadcast: an operand
+    // with one row is read at that row for every row of R, and one with
+    // one column at that column for every column. Neither is expanded.
+    void broadcast_rows(ElementOp op, size_t i0, size_t i1, size_t cols, const double* A, size_t a_rows,
+                        size_t a_cols, const double* B, size_t b_rows, size_t b_cols, double* R);
+
+    // throws unless C is square with the side of op(A)
+    void check_syrk_dims(Trans trans, const Matrix& A, const Matrix& C);
+
+    // Rows [i0, i1) of the lower triangle of C = alpha * op(A) * op(A)^T +
+    // beta * C, where op(A) is n x k. The strictly upper part of the
+    // diagonal block [i0, i1) is written too, with the same values
+    // mirror_lower() copies there. C holds the rows from c_row0 on, so a
+    // caller with only a band of C passes the band's own storage.
+    void syrk_rows(Trans trans, size_t i0, size_t i1, size_t k, double alpha,
+                   const double* A, size_t lda, double beta, double* C, size_t ldc, size_t c_row0);
+    // Rows [i0, i1) of C's upper triangle from its lower triangle
+    void mirror_lower(size_t i0, size_t i1, size_t n, double* C, size_t ldc);
+
+    // throws unless A is square and B has as many rows (Side::Left) or
+    // columns (Side::Right) as A
+    void check_trsm_dims(Side side, const Matrix& A, const Matrix& B);
+
+    // Slices [s0, s1) of B = alpha * op(A)^-1 * B or alpha * B * op(A)^-1,
+    // where A is n x n triangular. The slices are columns of B for
+    // Side::Left and rows for Side::Right: the solve never mixes them, so
+    // slices can go to different threads.
+    void trsm_slice(Side side, Triangle uplo, Trans transA, Diag diag, size_t s0, size_t s1,
+                    size_t n, double alpha, const double* A, size_t lda, double* B, size_t ldb);
+
+    // returned by the factorization kernels when they found no bad pivot
+    const size_t npos = static_cast<size_t>(-1);
+    // columns per step of the blocked factorizations
+    const size_t FACTOR_BLOCK = 64;
+
+    // Unblocked LU with partial pivoting of columns [k, k + kb) below row
+    // k of the m-row matrix A; rows are swapped within these columns only.
+    // Sets piv[k .. k + kb) and returns the first column with a zero
+    // pivot, or npos.
+    size_t lu_panel(size_t k, size_t kb, size_t m, double* A, size_t lda, size_t* piv);
+    // Swaps of rows [k0, k1) of piv applied to columns [j0, j1)
+    void laswp(size_t k0, size_t k1, size_t j0, size_t j1, double* A, size_t lda, const size_t* piv);
+    // Columns [j0, j1) right of the panel at k: its row swaps, the solve
+    // with its unit lower triangle and the trailing update below it
+    void lu_update_cols(size_t k, size_t kb, size_t m, size_t j0, size_t j1, double* A, size_t lda,
+                        const size_t* piv);
+    // Serial blocked LU of the m x n matrix A from the kernels above;
+    // returns the first column with a zero pivot, or npos
+    size_t lu_factor(size_t m, size_t n, double* A, size_t lda, size_t* piv);
+
+    // Unblocked Cholesky of the diagonal block [k, k + kb), whose earlier
+    // columns are already subtracted; returns the first column whose pivot
+    // is not positive, or npos
+    size_t potrf_block(size_t k, size_t kb, double* A, size_t lda);
+    // Rows [i0, i1) of the column panel below the diagonal block at k,
+    // times that block's L^-T
+    void cholesky_panel_rows(size_t k, size_t kb, size_t i0, size_t i1, double* A, size_t lda);
+    // Lower-triangle tile rows [i0, i1) x columns [j0, j1) of the trailing
+    // matrix minus the panel at k times its transpose; a tile with
+    // i0 == j0 is a diagonal tile
+    void cholesky_update(size_t k, size_t kb, size_t i0, size_t i1, size_t j0, size_t j1,
+                         double* A, size_t lda);
+    // Serial blocked Cholesky of the n x n matrix A from the kernels
+    // above, upper triangle not zeroed; returns potrf_block's failure
+    size_t cholesky_factor(size_t n, double* A, size_t lda);
+    // Rows [i0, i1) of A's strictly upper triangle set to zero
+    void zero_upper(size_t i0, size_t i1, size_t n, double* A, size_t lda);
+
+    // Unblocked Householder QR of columns [k, k + kb) below row k of the
+    // m-row matrix A, reflecting only these columns. Each reflector's
+    // vector overwrites the column below the diagonal, with its unit
+    // leading entry implied, and its scale goes to tau.
+    void qr_panel(size_t k, size_t kb, size_t m, double* A, size_t lda, double* tau);
+    // kb x kb upper triangular T of the compact WY form of the panel at
+    // k: H(k) * ... * H(k + kb - 1) = I - V * T * V^T
+    void qr_block_t(size_t k, size_t kb, size_t m, const double* A, size_t lda, const double* tau,
+                    double* T);
+    // Columns [c0, c1) of rows [k, m) of C = op(H) * C, where
+    // H = I - V * T * V^T is the panel at k's block of Q; Trans::Yes
+    // applies H^T. Two GEMMs against V and one against T do the work.
+    void apply_block_reflector(Trans trans, size_t k, size_t kb, size_t m, const double* A, size_t lda,
+                               const double* T, size_t c0, size_t c1, double* C, size_t ldc);
+    // Serial blocked QR of the m x n matrix A from the kernels above
+    void qr_factor(size_t m, size_t n, double* A, size_t lda, double* tau);
+    // Columns [c0, c1) of the m-row C = Q^T * C (Trans::Yes) or Q * C
+    // (Trans::No), for the first kmin reflectors of qr_factor's A
+    void apply_q(Trans trans, size_t m, size_t kmin, const double* A, size_t lda, const double* tau,
+                 size_t c0, size_t c1, double* C, size_t ldc);
+
+    // throw the factorizations' errors for a result other than npos
+    void check_lu_pivot(size_t zero_col);
+    void check_positive_definite(size_t bad_col);
+    // throws unless lstsq's A has at least as many rows as columns and B
+    // as many rows as A
+    void check_lstsq_dims(const Matrix& A, const Matrix& B);
+    // throws unless the chain is non-empty and each matrix has as many
+    // columns as the next has rows
+    void check_chain_dims(const std::vector<Matrix>& chain);
+    // Parenthesization of the chain of dims.size() - 1 matrices, matrix i
+    // being dims[i] x dims[i + 1], with the fewest multiply-adds, by the
+    // O(count^3) dynamic program over subchains. split[i * count + j] is
+    // the s at which the product of matrices i..j is best taken as
+    // (i..s) * (s+1..j); entries with i >= j are unused.
+    std::vector<size_t> chain_order(const std::vector<size_t>& dims);
+    // throws if the n x n R at A has a zero on its diagonal
+    void check_full_rank(size_t n, const double* R, size_t ldr);
+
+    // throws unless the rows of A and B have the same length
+    void check_distance_dims(const Matrix& A, const Matrix& B);
+    // throws unless the rows of A and B have the same length and
+    // 0 < k <= B.rows()
+    void check_knn_dims(const Matrix& A, const Matrix& B, size_t k);
+    // squared norms of rows [i0, i1) of the d-column A, into out[i0, i1)
+    void row_sq_norms(size_t i0, size_t i1, size_t d, const double* A, size_t lda, double* out);
+    // Rows [i0, i1) of D(i, j) = |a_i|^2 + |b_j|^2 - 2 * a_i . b_j, the
+    // squared distances from rows of A to the m rows of B. Each tile of
+    // the GEMM is corrected by the norms while it is in cache, and
+    // rounding below zero is clamped.
+    void sq_distance_rows(size_t i0, size_t i1, size_t m, size_t d, const double* A, size_t lda,
+                          const double* B, size_t ldb, const double* a_norms, const double* b_norms,
+                          double* D, size_t ldd);
+    // For each row i in [i0, i1) of A, the k rows of B nearest to it, by
+    // ascending squared distance and then index, into dist[i * k ..] and
+    // idx[i * k ..]. Distances are made one cache-sized tile at a time and
+    // only the k best per row are kept, in a heap, so rows of D are never
+    // stored.
+    void knn_rows(size_t i0, size_t i1, size_t m, size_t d, size_t k, const double* A, size_t lda,
+                  const double* B, size_t ldb, const double* a_norms, const double* b_norms,
+                  double* dist, size_t* idx);
+
+    // throws if argmax along axis would have nothing to pick from
+    void check_argmax_dims(Axis axis, const Matrix& A);
+
+    // Entries [i0, i1) of out: op over each n-entry row of A
+    void reduce_rows(Reduction op, size_t i0, size_t i1, size_t n, const double* A, size_t lda,
+                     double* out);
+
+    // Column reductions fold whole rows into one accumulator per column,
+    // so the inner loop runs along a row and vectorizes. A parallel caller
+    // folds REDUCE_ROWS-row blocks into partial accumulators, which merge
+    // in a fixed order, so the result does not depend on the threads.
+    const size_t REDUCE_ROWS = 256;
+    // columns of a column reduction folded per task
+    const size_t REDUCE_STRIP = 512;
+    // row blocks, and so partial accumulators, for an m x n column
+    // reduction: at most 64 of them and 2 MiB of partials
+    size_t reduce_col_parts(size_t m, size_t n);
+    // Columns [c0, c1) of acc set to op's identity
+    void reduce_cols_init(Reduction op, size_t c0, size_t c1, double* acc);
+    // Rows [r0, r1) of columns [c0, c1) folded into acc: their sum for Sum
+    // and Mean, of |x| for L1, of x^2 for L2 and of exp(x - shift[c]) for
+    // LogSumExp, and their minimum or maximum. shift is only read for
+    // LogSumExp, where it holds the column maxima.
+    void reduce_cols_fold(Reduction op, size_t r0, size_t r1, size_t c0, size_t c1, const double* A,
+                          size_t lda, const double* shift, double* acc);
+    // Columns [c0, c1) of part, the fold of other rows, merged into acc
+    void reduce_cols_merge(Reduction op, size_t c0, size_t c1, const double* part, double* acc);
+    // Columns [c0, c1) of the fold of all m rows turned into the result in
+    // place: divided by m for Mean, square rooted for L2, logged and
+    // shifted back for LogSumExp
+    void reduce_cols_finish(Reduction op, size_t m, size_t c0, size_t c1, const double* shift,
+                            double* acc);
+
+    // Entries [i0, i1) of out: the first largest entry's column in each
+    // n-entry row of A, n > 0
+    void argmax_rows(size_t i0, size_t i1, size_t n, const double* A, size_t lda, size_t* out);
+    // Rows [r0, r1) of columns [c0, c1) folded into the running best value
+    // and its row; only a larger value replaces, so ties keep the earlier
+    // row. best starts at -inf and where at npos.
+    void argmax_cols_fold(size_t r0, size_t r1, size_t c0, size_t c1, const double* A, size_t lda,
+                          double* best, size_t* where);
+    // Columns [c0, c1) of the fold of later rows merged into best / where
+    void argmax_cols_merge(size_t c0, size_t c1, const double* part_best, const size_t* part_where,
+                           double* best, size_t* where);
+
+    // Calls body(lo, hi) on ranges covering [0, count), concurrently on a
+    // backend that runs threads. It is all a parallel backend supplies to
+    // the split column kernels below.
+    using RangeRunner = std::function<void(size_t count, const std::function<void(size_t, size_t)>& body)>;
+    // The column reduction and argmax of an m x n A, split into
+    // reduce_col_parts() row blocks by REDUCE_STRIP-column strips, one
+    // range entry each. The blocks' partials are then merged strip by
+    // strip, in block order, so the result does not depend on how run
+    // schedules them. reduce_cols returns the finished 1 x n result.
+    std::vector<double> reduce_cols(const RangeRunner& run, Reduction op, size_t m, size_t n,
+                                    const double* A);
+    std::vector<size_t> argmax_cols(const RangeRunner& run, size_t m, size_t n, const double* A);
+
+    // Rows [i0, i1) of R = op of each n-entry row of A; R may be A
+    void transform_rows(RowTransform op, size_t i0, size_t i1, size_t n, const double* A, size_t lda,
+                        double* R, size_t ldr);
+
+    // throw unless the vector shapes fit gemv / ger; vectors may be
+    // stored as a column or a row
+    void check_gemv_dims(Trans transA, const Matrix& A, const Matrix& x, const Matrix& y);
+    void check_ger_dims(const Matrix& x, const Matrix& y, const Matrix& A);
+
+    // Entries [i0, i1) of y = alpha * A * x + beta * y, A is m x k
+    void gemv_rows(size_t i0, size_t i1, size_t k, double alpha, const double* A, size_t lda,
+                   const double* x, double beta, double* y);
+    // Entries [j0, j1) of y = alpha * A^T * x + beta * y, A is m x n. Each
+    // entry range streams the matching column strip of every row of A, so
+    // ranges split across threads never write the same entry.
+    void gemv_t_cols(size_t j0, size_t j1, size_t m, double alpha, const double* A, size_t lda,
+                     const double* x, double beta, double* y);
+    // Rows [i0, i1) of A += alpha * x * y^T, A is m x n
+    void ger_rows(size_t i0, size_t i1, size_t n, double alpha, const double* x, const double* y,
+                  double* A, size_t lda);
+
+  }
+
+}
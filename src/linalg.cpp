@@ -0,0 +1,329 @@
+#include "lumin/linalg.hpp"
+#include "lumin/factory.hpp"
+#include "graph_capture.hpp"
+#include "kernels.hpp"
+#include "op_scope.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace lumin {
+
+static const double D = sizeof(double);
+
+static Matrix copy_of(const Matrix& A) {
+  Matrix R(A.rows(), A.cols());
+  std::copy(A.data(), A.data() + A.rows() * A.cols(), R.data());
+  return R;
+}
+
+static void check_solve_dims(const char* op, const Matrix& A, const Matrix& B) {
+  if (A.rows() != A.cols() || B.rows() != A.rows()) {
+    std::ostringstream oss;
+    oss << op << " dimension mismatch: A (" << A.rows() << "x" << A.cols()
+        << ") must be square with as many rows as B (" << B.rows() << "x" << B.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+LUFactors lu(const Matrix& A) {
+  detail::refuse_capture("lu");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double m = static_cast<double>(A.rows()), n = static_cast<double>(A.cols());
+  double k = std::min(m, n);
+  OpScope scope("lu", backend.get(), m * n * k - (m + n) * k * k / 2 + k * k * k / 3,
+                m * n * D, m * n * D);
+  LUFactors f{copy_of(A), {}};
+  backend->lu(f.lu, f.piv);
+  return f;
+}
+
+Matrix cholesky(const Matrix& A) {
+  detail::refuse_capture("cholesky");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double n = static_cast<double>(A.rows());
+  OpScope scope("cholesky", backend.get(), n * n * n / 3, n * n / 2 * D, n * n * D);
+  Matrix L = copy_of(A);
+  backend->cholesky(L);
+  return L;
+}
+
+// the permutation, then unit lower L and upper U from the left
+static Matrix lu_solve_on(Backend& backend, const LUFactors& f, const Matrix& B) {
+  Matrix X = copy_of(B);
+  detail::laswp(0, f.piv.size(), 0, X.cols(), X.data(), X.cols(), f.piv.data());
+  backend.trsm(Side::Left, Triangle::Lower, Trans::No, Diag::Unit, 1.0, f.lu, X);
+  backend.trsm(Side::Left, Triangle::Upper, Trans::No, Diag::NonUnit, 1.0, f.lu, X);
+  return X;
+}
+
+Matrix lu_solve(const LUFactors& factors, const Matrix& B) {
+  detail::refuse_capture("lu_solve");
+  check_solve_dims("lu_solve", factors.lu, B);
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double n = static_cast<double>(B.rows()), b = static_cast<double>(B.rows() * B.cols());
+  OpScope scope("lu_solve", backend.get(), 2 * n * b, (n * n + b) * D, b * D);
+  return lu_solve_on(*backend, factors, B);
+}
+
+Matrix cholesky_solve(const Matrix& L, const Matrix& B) {
+  detail::refuse_capture("cholesky_solve");
+  check_solve_dims("cholesky_solve", L, B);
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double n = static_cast<double>(B.rows()), b = static_cast<double>(B.rows() * B.cols());
+  OpScope scope("cholesky_solve", backend.get(), 2 * n * b, (n * n + b) * D, b * D);
+  Matrix X = copy_of(B);
+  backend->trsm(Side::Left, Triangle::Lower, Trans::No, Diag::NonUnit, 1.0, L, X);
+  backend->trsm(Side::Left, Triangle::Lower, Trans::Yes, Diag::NonUnit, 1.0, L, X);
+  return X;
+}
+
+Matrix solve(const Matrix& A, const Matrix& B) {
+  detail::refuse_capture("solve");
+  check_solve_dims("solve", A, B);
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double n = static_cast<double>(A.rows()), b = static_cast<double>(B.rows() * B.cols());
+  OpScope scope("solve", backend.get(), 2 * n * n * n / 3 + 2 * n * b, (n * n + b) * D, b * D);
+  LUFactors f{copy_of(A), {}};
+  backend->lu(f.lu, f.piv);
+  return lu_solve_on(*backend, f, B);
+}
+
+QRFactors qr(const Matrix& A) {
+  detail::refuse_capture("qr");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double m = static_cast<double>(A.rows()), n = static_cast<double>(A.cols());
+  double k = std::min(m, n);
+  OpScope scope("qr", backend.get(), 2 * m * n * k - (m + n) * k * k + 2 * k * k * k / 3,
+                m * n * D, m * n * D);
+  QRFactors f{copy_of(A), {}};
+  backend->qr(f.qr, f.tau);
+  return f;
+}
+
+Matrix qr_q(const QRFactors& factors) {
+  size_t m = factors.qr.rows(), k = factors.tau.size();
+  // Q times the first k columns of the identity
+  Matrix Q(m, k);
+  for (size_t i = 0; i < k; i++) Q(i, i) = 1.0;
+  detail::apply_q(Trans::No, m, k, factors.qr.data(), factors.qr.cols(), factors.tau.data(), 0, k,
+                  Q.data(), k);
+  return Q;
+}
+
+Matrix qr_r(const QRFactors& factors) {
+  size_t n = factors.qr.cols(), k = factors.tau.size();
+  Matrix R(k, n);
+  for (size_t i = 0; i < k; i++) {
+    std::copy(factors.qr.data() + i * n + i, factors.qr.data() + (i + 1) * n, R.data() + i * n + i);
+  }
+  return R;
+}
+
+Matrix lstsq(const Matrix& A, const Matrix& B) {
+  detail::refuse_capture("lstsq");
+  detail::check_lstsq_dims(A, B);
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double m = static_cast<double>(A.rows()), n = static_cast<double>(A.cols());
+  double r = static_cast<double>(B.cols());
+  OpScope scope("lstsq", backend.get(), 2 * m * n * (n + 2 * r), m * (n + r) * D, n * r * D);
+  return backend->lstsq(A, B);
+}
+
+// Evaluates products of the chain by the splits chain_order chose. Every
+// intermediate is returned to spare once it has been multiplied, so a later
+// product of the same shape writes into its buffer instead of a new one.
+struct ChainProduct {
+  Backend& backend;
+  const std::vector<Matrix>& chain;
+  const std::vector<size_t>& split;
+  std::vector<Matrix> spare;
+
+  Matrix take(size_t rows, size_t cols) {
+    auto it = std::find_if(spare.begin(), spare.end(), [&](const Matrix& m) {
+      return m.rows() == rows && m.cols() == cols;
+    });
+    if (it == spare.end()) {
+      return Matrix(rows, cols);
+    }
+    Matrix m = *it;
+    spare.erase(it);
+    return m;
+  }
+
+  Matrix product(size_t i, size_t j) {
+    if (i == j) {
+      return chain[i];
+    }
+    size_t s = split[i * chain.size() + j];
+    Matrix L = product(i, s);
+    Matrix R = product(s + 1, j);
+    Matrix C = take(L.rows(), R.cols());
+    backend.gemm(Trans::No, Trans::No, 1.0, L, R, 0.0, C);
+    if (s > i) spare.push_back(L);
+    if (j > s + 1) spare.push_back(R);
+    return C;
+  }
+
+  // flops of the product of matrices i..j in split order
+  double flops(size_t i, size_t j) const {
+    if (i == j) {
+      return 0.0;
+    }
+    size_t s = split[i * chain.size() + j];
+    double m = static_cast<double>(chain[i].rows()), k = static_cast<double>(chain[s].cols());
+    double n = static_cast<double>(chain[j].cols());
+    return flops(i, s) + flops(s + 1, j) + 2 * m * k * n;
+  }
+};
+
+Matrix multi_dot(const std::vector<Matrix>& chain) {
+  detail::refuse_capture("multi_dot");
+  detail::check_chain_dims(chain);
+  std::shared_ptr<Backend> backend = get_default_backend();
+  if (chain.size() == 1) {
+    return backend->holds_results() ? copy_of(chain[0]) : Matrix(0, 0);
+  }
+  std::vector<size_t> dims;
+  double bytes_read = 0.0;
+  for (const Matrix& m : chain) {
+    dims.push_back(m.rows());
+    bytes_read += static_cast<double>(m.rows() * m.cols()) * D;
+  }
+  dims.push_back(chain.back().cols());
+  std::vector<size_t> split = detail::chain_order(dims);
+  ChainProduct p{*backend, chain, split, {}};
+  double out = static_cast<double>(dims.front() * dims.back());
+  OpScope scope("multi_dot", backend.get(), p.flops(0, chain.size() - 1), bytes_read, out * D);
+  Matrix R = p.product(0, chain.size() - 1);
+  return backend->holds_results() ? R : Matrix(0, 0);
+}
+
+// orthonormal basis of Y's columns
+static Matrix orthonormalize(Backend& backend, const Matrix& Y) {
+  QRFactors f{copy_of(Y), {}};
+  backend.qr(f.qr, f.tau);
+  return qr_q(f);
+}
+
+// One-sided Jacobi SVD of the l x l matrix X = W^T, rotating pairs of
+// W's rows (X's columns) until all are orthogonal; the same rotations
+// applied to the identity give V^T. On return the row norms of W are the
+// singular values, and the normalized rows the left singular vectors.
+static void jacobi_svd(size_t l, std::vector<double>& W, std::vector<double>& Vt) {
+  Vt.assign(l * l, 0.0);
+  for (size_t i = 0; i < l; i++) Vt[i * l + i] = 1.0;
+  const double eps = 1e-15;
+  for (int sweep = 0; sweep < 60; sweep++) {
+    bool rotated = false;
+    for (size_t p = 0; p + 1 < l; p++) {
+      for (size_t q = p + 1; q < l; q++) {
+        double* wp = W.data() + p * l;
+        double* wq = W.data() + q * l;
+        double a = 0.0, b = 0.0, c = 0.0;
+        for (size_t j = 0; j < l; j++) {
+          a += wp[j] * wp[j];
+          b += wq[j] * wq[j];
+          c += wp[j] * wq[j];
+        }
+        if (std::abs(c) <= eps * std::sqrt(a * b)) continue;
+        rotated = true;
+        double zeta = (b - a) / (2.0 * c);
+        double t = std::copysign(1.0, zeta) / (std::abs(zeta) + std::sqrt(1.0 + zeta * zeta));
+        double cs = 1.0 / std::sqrt(1.0 + t * t), sn = cs * t;
+        for (double* rows : {W.data(), Vt.data()}) {
+          double* rp = rows + p * l;
+          double* rq = rows + q * l;
+          for (size_t j = 0; j < l; j++) {
+            double x = rp[j], y = rq[j];
+            rp[j] = cs * x - sn * y;
+            rq[j] = sn * x + cs * y;
+          }
+        }
+      }
+    }
+    if (!rotated) break;
+  }
+}
+
+SVDResult randomized_svd(const Matrix& A, size_t k, size_t oversample, size_t power_iterations,
+                         uint64_t seed) {
+  detail::refuse_capture("randomized_svd");
+  size_t m = A.rows(), n = A.cols();
+  if (k == 0 || k > std::min(m, n)) {
+    std::ostringstream oss;
+    oss << "randomized_svd: rank " << k << " out of range for a " << m << "x" << n << " matrix";
+    throw std::runtime_error(oss.str());
+  }
+  size_t l = std::min(k + oversample, std::min(m, n));
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double passes = static_cast<double>(2 * power_iterations + 2);
+  OpScope scope("randomized_svd", backend.get(), passes * 2.0 * m * n * l, passes * m * n * D,
+                static_cast<double>((m + n) * k) * D);
+
+  Matrix Omega(n, l);
+  std::mt19937_64 rng(seed);
+  std::normal_distribution<double> normal;
+  for (size_t i = 0; i < n * l; i++) Omega.data()[i] = normal(rng);
+
+  // range of A: Q = orth(A * Omega), refined by subspace iteration
+  Matrix Y(m, l), Z(n, l);
+  backend->gemm(Trans::No, Trans::No, 1.0, A, Omega, 0.0, Y);
+  Matrix Q = orthonormalize(*backend, Y);
+  for (size_t it = 0; it < power_iterations; it++) {
+    backend->gemm(Trans::Yes, Trans::No, 1.0, A, Q, 0.0, Z);
+    Matrix Qz = orthonormalize(*backend, Z);
+    backend->gemm(Trans::No, Trans::No, 1.0, A, Qz, 0.0, Y);
+    Q = orthonormalize(*backend, Y);
+  }
+
+  // B = Q^T * A is l x n; factor B^T = A^T * Q = Qb * Rb, so that
+  // B = Rb^T * Qb^T and only the l x l Rb^T needs an SVD
+  backend->gemm(Trans::Yes, Trans::No, 1.0, A, Q, 0.0, Z);
+  QRFactors fb{copy_of(Z), {}};
+  backend->qr(fb.qr, fb.tau);
+  Matrix Qb = qr_q(fb);
+  std::vector<double> W(l * l, 0.0), Vt;
+  for (size_t i = 0; i < l; i++) {
+    std::copy(fb.qr.data() + i * l + i, fb.qr.data() + (i + 1) * l, W.data() + i * l + i);
+  }
+  jacobi_svd(l, W, Vt);
+
+  std::vector<double> sigma(l);
+  for (size_t i = 0; i < l; i++) {
+    const double* w = W.data() + i * l;
+    sigma[i] = std::sqrt(std::inner_product(w, w + l, w, 0.0));
+  }
+  std::vector<size_t> order(l);
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sigma[a] > sigma[b]; });
+
+  // the k leading pairs: columns of Us are rows of W over their norms,
+  // columns of Vs rows of Vt
+  Matrix Us(l, k), Vs(l, k);
+  SVDResult r;
+  r.S.resize(k);
+  for (size_t c = 0; c < k; c++) {
+    size_t i = order[c];
+    r.S[c] = sigma[i];
+    double inv = sigma[i] > 0.0 ? 1.0 / sigma[i] : 0.0;
+    for (size_t j = 0; j < l; j++) {
+      Us(j, c) = W[i * l + j] * inv;
+      Vs(j, c) = Vt[i * l + j];
+    }
+  }
+  r.U = Matrix(m, k);
+  r.V = Matrix(n, k);
+  backend->gemm(Trans::No, Trans::No, 1.0, Q, Us, 0.0, r.U);
+  backend->gemm(Trans::No, Trans::No, 1.0, Qb, Vs, 0.0, r.V);
+  if (!backend->holds_results()) {
+    return SVDResult{Matrix(0, 0), {}, Matrix(0, 0)};
+  }
+  return r;
+}
+
+}
@@ -0,0 +1,34 @@
+#include "lumin/map.hpp"
+#include "lumin/factory.hpp"
+#include "graph_capture.hpp"
+#include "op_scope.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace lumin {
+
+static const double D = sizeof(double);
+
+void detail::run_elementwise(const char* op, size_t n, size_t operands,
+                             const std::function<void(size_t, size_t)>& body) {
+  // a graph cannot replay an arbitrary functor
+  detail::refuse_capture(op);
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double N = static_cast<double>(n);
+  // one flop per entry whatever the functor costs
+  OpScope scope(op, backend.get(), N, static_cast<double>(operands) * N * D, N * D);
+  backend->parallel_ranges(n, body);
+}
+
+void detail::check_zip_dims(const Matrix& A, const Matrix& B) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    std::ostringstream oss;
+    oss << "zip dimension mismatch: "
+        << "(" << A.rows() << "x" << A.cols() << ") vs "
+        << "(" << B.rows() << "x" << B.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+}
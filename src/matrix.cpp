@@ -1,5 +1,9 @@
 #include "lumin.hpp"
 #include "lumin.hpp"
+#include "graph_capture.hpp"
+#include "kernels.hpp"
+#include "memory_pool.hpp"
+#include "op_scope.hpp"
 
 #include <memory>
 #include <cstring>
@@ -10,21 +14,27 @@
 
 namespace lumin {
 
-static std::shared_ptr<double[]> allocate_buffer(size_t n) {
+static std::shared_ptr<double[]> allocate_buffer(size_t n, const Backend* backend) {
   // return std::shared_ptr<double>(new double[n](), [](double* p){ delete[] p; });
-  return std::shared_ptr<double[]>(new double[n], std::default_delete<double[]>());
+  return detail::tracked_buffer(detail::matrix_pool(backend), n, true);
 }
 
 Matrix::Matrix(size_t rows, size_t cols)
   : m_rows(rows), m_cols(cols),
     backend(get_default_backend()), // backend(nullptr),
-    m_values( allocate_buffer(rows * cols) )
+    m_values( allocate_buffer(rows * cols, backend.get()) )
 { }
 
 Matrix::Matrix(size_t rows, size_t cols, std::shared_ptr<Backend> backend_ptr)
   : m_rows(rows), m_cols(cols),
     backend(std::move(backend_ptr)),
-    m_values( allocate_buffer(rows * cols) )
+    m_values( allocate_buffer(rows * cols, backend.get()) )
+{ }
+
+Matrix::Matrix(size_t rows, size_t cols, std::shared_ptr<double[]> values)
+  : m_rows(rows), m_cols(cols),
+    backend(get_default_backend()),
+    m_values(std::move(values))
 { }
 
 Matrix::Matrix()
@@ -39,45 +49,27 @@ Matrix::Matrix()
 //   return m_values.get();
 // }
 
-static void check_same_size(const Matrix& A, const Matrix& B, const char* op) {
-  if (A.rows() != B.rows() || A.cols() != B.cols()) {
-    std::ostringstream oss;
-    oss << "Matrix " << op << " dimension mismatch: "
-        << "(" << A.rows() << "x" << A.cols() << ") vs "
-        << "(" << B.rows() << "x" << B.cols() << ")";
-    throw std::runtime_error(oss.str());
-  }
-}
-
-static void check_multiply_dims(const Matrix& A, const Matrix& B) {
-  if (A.cols() != B.rows()) {
-    std::ostringstream oss;
-    oss << "Matrix multiply dimension mismatch: "
-        << "(" << A.rows() << "x" << A.cols() << ") vs "
-        << "(" << B.rows() << "x" << B.cols() << ")";
-    throw std::runtime_error(oss.str());
-  }
+// CPU fallback
+static Matrix cpu_broadcast(detail::ElementOp op, const char* name, const Matrix& A, const Matrix& B) {
+  detail::check_broadcast_dims(name, A, B);
+  size_t rows = detail::broadcast_extent(A.rows(), B.rows());
+  size_t cols = detail::broadcast_extent(A.cols(), B.cols());
+  Matrix R(rows, cols);
+  detail::broadcast_rows(op, 0, rows, cols, A.data(), A.rows(), A.cols(), B.data(), B.rows(), B.cols(),
+                         R.data());
+  return R;
 }
 
-// CPU fallback
 Matrix cpu_add(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "add");
-  Matrix R(A.rows(), A.cols());
-  size_t N = A.rows() * A.cols();
-  for (size_t i = 0; i < N; i++) {
-    R.data()[i] = A.data()[i] + B.data()[i];
-  }
-  return R;
+  return cpu_broadcast(detail::ElementOp::Add, "add", A, B);
 }
 
 Matrix cpu_subtract(const Matrix& A, const Matrix& B) {
-  check_same_size(A, B, "subtract");
-  Matrix R(A.rows(), A.cols());
-  size_t N = A.rows() * A.cols();
-  for (size_t i = 0; i < N; i++) {
-    R.data()[i] = A.data()[i] - B.data()[i];
-  }
-  return R;
+  return cpu_broadcast(detail::ElementOp::Subtract, "subtract", A, B);
+}
+
+Matrix cpu_hadamard(const Matrix& A, const Matrix& B) {
+  return cpu_broadcast(detail::ElementOp::Multiply, "hadamard", A, B);
 }
 
 Matrix cpu_scalar(double s, const Matrix& A) {
@@ -90,7 +82,7 @@ Matrix cpu_scalar(double s, const Matrix& A) {
 }
 
 Matrix cpu_multiply(const Matrix& A, const Matrix& B) {
-  check_multiply_dims(A, B);
+  detail::check_multiply_dims(A, B);
   Matrix R(A.rows(), B.cols());
   for (size_t i = 0; i < static_cast<size_t>(A.rows()); i++) {
     for (size_t k = 0; k < static_cast<size_t>(A.cols()); k++) {
@@ -126,35 +118,84 @@ Matrix cpu_transpose(const Matrix& A) {
 }
 
 // public API
+// Each dispatch is wrapped in an OpScope with the op's analytic FLOP and
+// byte counts; the arithmetic is sunk into the scope's enabled branch.
+static const double D = sizeof(double);
+
+// elements of an elementwise op's result, with A or B broadcast
+static double broadcast_elements(const Matrix& A, const Matrix& B) {
+  return static_cast<double>(detail::broadcast_extent(A.rows(), B.rows()) *
+                             detail::broadcast_extent(A.cols(), B.cols()));
+}
+
+// graphs replay elementwise ops on operands of one shape only
+static void check_capturable(const Matrix& A, const Matrix& B, const char* op) {
+  if (A.rows() != B.rows() || A.cols() != B.cols()) {
+    detail::refuse_capture(op);
+  }
+}
+
 Matrix Matrix::add(const Matrix& other) const {
-  if (backend) {
-    return backend->add(*this, other);
+  check_capturable(*this, other, "broadcasting add");
+  double n = broadcast_elements(*this, other);
+  double operands = static_cast<double>(m_rows * m_cols + other.rows() * other.cols());
+  OpScope scope("add", backend.get(), n, operands * D, n * D);
+  Matrix R = backend ? backend->add(*this, other) : cpu_add(*this, other);
+  if (detail::capturing()) {
+    detail::capture_op(detail::CaptureOp::Add, 0.0, *this, &other, R);
   }
-  return cpu_add(*this, other);
+  return R;
 }
 
 Matrix Matrix::subtract(const Matrix& other) const {
-  if (backend) {
-    return backend->subtract(*this, other);
+  check_capturable(*this, other, "broadcasting subtract");
+  double n = broadcast_elements(*this, other);
+  double operands = static_cast<double>(m_rows * m_cols + other.rows() * other.cols());
+  OpScope scope("subtract", backend.get(), n, operands * D, n * D);
+  Matrix R = backend ? backend->subtract(*this, other) : cpu_subtract(*this, other);
+  if (detail::capturing()) {
+    detail::capture_op(detail::CaptureOp::Subtract, 0.0, *this, &other, R);
   }
-  return cpu_subtract(*this, other);
+  return R;
+}
+
+Matrix Matrix::hadamard(const Matrix& other) const {
+  check_capturable(*this, other, "broadcasting hadamard");
+  double n = broadcast_elements(*this, other);
+  double operands = static_cast<double>(m_rows * m_cols + other.rows() * other.cols());
+  OpScope scope("hadamard", backend.get(), n, operands * D, n * D);
+  Matrix R = backend ? backend->hadamard(*this, other) : cpu_hadamard(*this, other);
+  if (detail::capturing()) {
+    detail::capture_op(detail::CaptureOp::Hadamard, 0.0, *this, &other, R);
+  }
+  return R;
 }
 
 Matrix Matrix::scalar(double s) const {
-  if (backend) {
-    return backend->scalar(s, *this);
+  double n = static_cast<double>(m_rows * m_cols);
+  OpScope scope("scalar", backend.get(), n, n * D, n * D);
+  Matrix R = backend ? backend->scalar(s, *this) : cpu_scalar(s, *this);
+  if (detail::capturing()) {
+    detail::capture_op(detail::CaptureOp::Scalar, s, *this, nullptr, R);
   }
-  return cpu_scalar(s, *this);
+  return R;
 }
 
 Matrix Matrix::multiply(const Matrix& other) const {
-  if (backend) {
-    return backend->multiply(*this, other);
+  double m = static_cast<double>(m_rows), k = static_cast<double>(m_cols);
+  double n = static_cast<double>(other.cols());
+  OpScope scope("multiply", backend.get(), 2 * m * k * n, (m * k + k * n) * D, m * n * D);
+  Matrix R = backend ? backend->multiply(*this, other) : cpu_multiply(*this, other);
+  if (detail::capturing()) {
+    detail::capture_op(detail::CaptureOp::Multiply, 0.0, *this, &other, R);
   }
-  return cpu_multiply(*this, other);
+  return R;
 }
 
 double Matrix::dot(const Matrix& other) const {
+  double n = static_cast<double>(m_rows * m_cols);
+  detail::refuse_capture("dot");
+  OpScope scope("dot", backend.get(), 2 * n, 2 * n * D, 0);
   if (backend) {
     return backend->dot(*this, other);
   }
@@ -162,10 +203,13 @@ double Matrix::dot(const Matrix& other) const {
 }
 
 Matrix Matrix::transpose() const {
-  if (backend) {
-    return backend->transpose(*this);
+  double n = static_cast<double>(m_rows * m_cols);
+  OpScope scope("transpose", backend.get(), 0, n * D, n * D);
+  Matrix R = backend ? backend->transpose(*this) : cpu_transpose(*this);
+  if (detail::capturing()) {
+    detail::capture_op(detail::CaptureOp::Transpose, 0.0, *this, nullptr, R);
   }
-  return cpu_transpose(*this);
+  return R;
 }
 
 Matrix Matrix::random_int(size_t rows, size_t cols, int max_value) {
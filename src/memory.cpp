@@ -0,0 +1,174 @@
+#include "lumin.hpp"
+#include "memory_pool.hpp"
+
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace lumin {
+
+struct detail::MemoryPool {
+  const char* backend;
+  const char* kind;
+  std::atomic<uint64_t> current{0};
+  std::atomic<uint64_t> peak{0};
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> frees{0};
+};
+
+static std::mutex pool_mutex;
+static std::map<std::pair<std::string, std::string>, std::unique_ptr<detail::MemoryPool>> pool_table;
+
+// process-wide totals, kept apart from the pools so the limit check is one
+// atomic add
+static detail::MemoryPool total_pool{"total", "total"};
+static std::atomic<uint64_t> limit_bytes{0};
+
+static void raise_peak(std::atomic<uint64_t>& peak, uint64_t value) {
+  uint64_t seen = peak.load(std::memory_order_relaxed);
+  while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) { }
+}
+
+static std::string format_bytes(uint64_t bytes) {
+  static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  double v = static_cast<double>(bytes);
+  size_t u = 0;
+  while (v >= 1024.0 && u + 1 < sizeof(units) / sizeof(units[0])) {
+    v /= 1024.0;
+    u++;
+  }
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(u == 0 ? 0 : 1) << v << " " << units[u];
+  return oss.str();
+}
+
+detail::MemoryPool* detail::memory_pool(const char* backend, const char* kind) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  std::unique_ptr<MemoryPool>& p = pool_table[{backend, kind}];
+  if (!p) {
+    p.reset(new MemoryPool());
+    p->backend = backend;
+    p->kind = kind;
+  }
+  return p.get();
+}
+
+detail::MemoryPool* detail::matrix_pool(const Backend* backend) {
+  // backend names are string literals, so the last one seen on this thread
+  // identifies its pool without taking the lock
+  static thread_local const char* last_name = nullptr;
+  static thread_local MemoryPool* last_pool = nullptr;
+  const char* name = backend ? backend->name() : "host";
+  if (name != last_name) {
+    last_pool = memory_pool(name, "matrix");
+    last_name = name;
+  }
+  return last_pool;
+}
+
+void detail::memory_acquire(MemoryPool* pool, size_t bytes) {
+  uint64_t limit = limit_bytes.load(std::memory_order_relaxed);
+  uint64_t now = total_pool.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  if (limit != 0 && now > limit) {
+    total_pool.current.fetch_sub(bytes, std::memory_order_relaxed);
+    std::ostringstream oss;
+    oss << "memory limit exceeded: allocating " << format_bytes(bytes) << " of " << pool->kind
+        << " for " << pool->backend << " with " << format_bytes(now - bytes) << " in use would pass the "
+        << format_bytes(limit) << " limit";
+    throw MemoryLimitError(oss.str());
+  }
+  raise_peak(total_pool.peak, now);
+  total_pool.allocations.fetch_add(1, std::memory_order_relaxed);
+  raise_peak(pool->peak, pool->current.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+  pool->allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void detail::memory_release(MemoryPool* pool, size_t bytes) noexcept {
+  total_pool.current.fetch_sub(bytes, std::memory_order_relaxed);
+  total_pool.frees.fetch_add(1, std::memory_order_relaxed);
+  pool->current.fetch_sub(bytes, std::memory_order_relaxed);
+  pool->frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<double[]> detail::tracked_buffer(MemoryPool* pool, size_t n, bool zero) {
+  size_t bytes = n * sizeof(double);
+  AllocScope scope(bytes);
+  memory_acquire(pool, bytes);
+  try {
+    double* p = zero ? new double[n]() : new double[n];
+    return std::shared_ptr<double[]>(p, [pool, bytes](double* q) {
+      delete[] q;
+      memory_release(pool, bytes);
+    });
+  }
+  catch (...) {
+    memory_release(pool, bytes);
+    throw;
+  }
+}
+
+static void copy_counts(const detail::MemoryPool& p, uint64_t& current, uint64_t& peak,
+                        uint64_t& allocations, uint64_t& frees) {
+  current = p.current.load(std::memory_order_relaxed);
+  peak = p.peak.load(std::memory_order_relaxed);
+  allocations = p.allocations.load(std::memory_order_relaxed);
+  frees = p.frees.load(std::memory_order_relaxed);
+}
+
+MemoryStats memory_stats() {
+  MemoryStats s;
+  copy_counts(total_pool, s.current_bytes, s.peak_bytes, s.allocations, s.frees);
+  s.limit_bytes = limit_bytes.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  for (const auto& kv : pool_table) {
+    MemoryPoolStats p;
+    p.backend = kv.second->backend;
+    p.kind = kv.second->kind;
+    copy_counts(*kv.second, p.current_bytes, p.peak_bytes, p.allocations, p.frees);
+    s.pools.push_back(std::move(p));
+  }
+  return s;
+}
+
+void set_memory_limit(uint64_t bytes) {
+  limit_bytes.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t memory_limit() {
+  return limit_bytes.load(std::memory_order_relaxed);
+}
+
+void reset_peak_memory() {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  total_pool.peak.store(total_pool.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  for (const auto& kv : pool_table) {
+    kv.second->peak.store(kv.second->current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+}
+
+std::string memory_report() {
+  MemoryStats s = memory_stats();
+  std::ostringstream oss;
+  oss << std::left << std::setw(10) << "backend" << std::setw(10) << "kind"
+      << std::right << std::setw(14) << "current" << std::setw(14) << "peak"
+      << std::setw(12) << "allocs" << std::setw(12) << "frees" << "\n";
+  for (const MemoryPoolStats& p : s.pools) {
+    oss << std::left << std::setw(10) << p.backend << std::setw(10) << p.kind
+        << std::right << std::setw(14) << format_bytes(p.current_bytes)
+        << std::setw(14) << format_bytes(p.peak_bytes)
+        << std::setw(12) << p.allocations << std::setw(12) << p.frees << "\n";
+  }
+  oss << std::left << std::setw(20) << "total"
+      << std::right << std::setw(14) << format_bytes(s.current_bytes)
+      << std::setw(14) << format_bytes(s.peak_bytes)
+      << std::setw(12) << s.allocations << std::setw(12) << s.frees << "\n";
+  if (s.limit_bytes != 0) {
+    oss << "limit " << format_bytes(s.limit_bytes) << "\n";
+  }
+  return oss.str();
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "lumin/memory.hpp"
+#include "op_scope.hpp"
+
+// Internal side of include/lumin/memory.hpp. Accounting is always on since
+// the soft limit has to hold whether or not anything is instrumenting; each
+// allocation and free costs a few relaxed atomic updates.
+
+namespace lumin {
+
+  class Backend;
+
+  namespace detail {
+    // one per (backend, kind); pools live for the whole process
+    struct MemoryPool;
+
+    MemoryPool* memory_pool(const char* backend, const char* kind);
+    MemoryPool* matrix_pool(const Backend* backend);
+
+    // charges bytes to pool, throwing MemoryLimitError instead if that
+    // would pass the limit
+    void memory_acquire(MemoryPool* pool, size_t bytes);
+    void memory_release(MemoryPool* pool, size_t bytes) noexcept;
+
+    // n doubles charged to pool until the last owner releases them
+    std::shared_ptr<double[]> tracked_buffer(MemoryPool* pool, size_t n, bool zero);
+
+    // Allocator for backend scratch vectors, charged to (Backend, "scratch").
+    template <class T, const char* Backend>
+    struct ScratchAllocator {
+      using value_type = T;
+      template <class U> struct rebind { using other = ScratchAllocator<U, Backend>; };
+
+      ScratchAllocator() = default;
+      template <class U>
+      ScratchAllocator(const ScratchAllocator<U, Backend>&) { }
+
+      T* allocate(size_t n) {
+        static MemoryPool* pool = memory_pool(Backend, "scratch");
+        AllocScope scope(n * sizeof(T));
+        memory_acquire(pool, n * sizeof(T));
+        try {
+          return std::allocator<T>().allocate(n);
+        }
+        catch (...) {
+          memory_release(pool, n * sizeof(T));
+          throw;
+        }
+      }
+      void deallocate(T* p, size_t n) noexcept {
+        static MemoryPool* pool = memory_pool(Backend, "scratch");
+        std::allocator<T>().deallocate(p, n);
+        memory_release(pool, n * sizeof(T));
+      }
+
+      template <class U>
+      bool operator==(const ScratchAllocator<U, Backend>&) const { return true; }
+      template <class U>
+      bool operator!=(const ScratchAllocator<U, Backend>&) const { return false; }
+    };
+
+    template <class T, const char* Backend>
+    using scratch_vector = std::vector<T, ScratchAllocator<T, Backend>>;
+  }
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "lumin/perf_counters.hpp"
+
+// Internal hooks behind include/lumin/instrument.hpp, trace.hpp and
+// perf_counters.hpp. Every public op wraps its backend dispatch in an
+// OpScope, buffer allocations run inside an AllocScope and MPIBackend wraps
+// each collective in a CollectiveScope. While no hook is enabled each scope
+// reduces to one load and a branch.
+
+namespace lumin {
+
+  class Backend;
+
+  namespace detail {
+    enum Hook : unsigned {
+      HOOK_STATS = 1u << 0,
+      HOOK_TRACE = 1u << 1,
+      HOOK_PERF = 1u << 2,
+    };
+
+    extern std::atomic<unsigned> active_hooks;
+
+    inline unsigned hooks() {
+      return active_hooks.load(std::memory_order_relaxed);
+    }
+    inline bool instrumenting() { return (hooks() & HOOK_STATS) != 0; }
+
+    void enable_hook(Hook h, bool on);
+
+    // counts an allocation against the op running on this thread
+    void note_allocation(size_t bytes);
+
+    // appends to the calling thread's trace buffer; detail may be null
+    void trace_begin(const char* cat, const char* name, const char* detail, uint64_t bytes);
+    void trace_end(const char* cat, const char* name, uint64_t bytes);
+
+    // hardware counters summed over the process's threads, by HwCounter
+    void perf_read(uint64_t* counts);
+    void perf_record(const char* op, const Backend* backend, double seconds,
+                     const uint64_t* before, const uint64_t* after,
+                     double flops, double bytes);
+  }
+
+  class OpScope {
+  public:
+    OpScope(const char* op, const Backend* backend,
+            double flops, double bytes_read, double bytes_written) {
+      if (unsigned h = detail::hooks()) {
+        begin(h, op, backend, flops, bytes_read, bytes_written);
+      }
+    }
+    ~OpScope() {
+      if (m_hooks) end();
+    }
+
+    OpScope(const OpScope&) = delete;
+    OpScope& operator=(const OpScope&) = delete;
+
+  private:
+    void begin(unsigned hooks, const char* op, const Backend* backend,
+               double flops, double bytes_read, double bytes_written);
+    void end();
+
+    unsigned m_hooks = 0;
+    const char* m_op = nullptr;
+    const Backend* m_backend = nullptr;
+    double m_flops = 0.0, m_bytes_read = 0.0, m_bytes_written = 0.0;
+    uint64_t m_allocs_before = 0, m_alloc_bytes_before = 0;
+    uint64_t m_counters_before[HW_COUNTER_KINDS];   // filled by begin()
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+  class AllocScope {
+  public:
+    explicit AllocScope(size_t bytes) {
+      if (unsigned h = detail::hooks()) {
+        begin(h, bytes);
+      }
+    }
+    ~AllocScope() {
+      if (m_hooks) end();
+    }
+
+    AllocScope(const AllocScope&) = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+
+  private:
+    void begin(unsigned hooks, size_t bytes);
+    void end();
+
+    unsigned m_hooks = 0;
+    size_t m_bytes = 0;
+  };
+
+  class CollectiveScope {
+  public:
+    explicit CollectiveScope(const char* name) {
+      if (unsigned h = detail::hooks()) {
+        begin(h, name);
+      }
+    }
+    ~CollectiveScope() {
+      if (m_hooks) end();
+    }
+
+    CollectiveScope(const CollectiveScope&) = delete;
+    CollectiveScope& operator=(const CollectiveScope&) = delete;
+
+    // false while no hook is enabled; guard byte counting with it
+    explicit operator bool() const { return m_hooks != 0; }
+    void add_bytes(uint64_t bytes) { m_bytes += bytes; }
+
+  private:
+    void begin(unsigned hooks, const char* name);
+    void end();
+
+    unsigned m_hooks = 0;
+    const char* m_name = nullptr;
+    uint64_t m_bytes = 0;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+}
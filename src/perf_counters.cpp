@@ -0,0 +1,433 @@
+#include "lumin.hpp"
+#include "lumin/perf_counters.hpp"
+#include "op_scope.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace lumin {
+
+struct EventSpec {
+  HwCounter kind;
+  uint32_t type;
+  uint64_t config;
+  uint64_t weight;   // FP events count instructions; weight converts to FLOPs
+};
+
+// perf_fd_mutex guards the open counters and is taken shared on every op
+// begin and end; perf_mutex guards the results table and configuration
+static std::shared_mutex perf_fd_mutex;
+static std::vector<EventSpec> perf_specs;            // events that opened at start
+static std::map<long, std::vector<int>> perf_fds;    // thread id -> fd per spec
+static std::chrono::steady_clock::time_point perf_last_scan;
+static std::mutex perf_mutex;
+static std::string perf_error;
+static std::map<std::pair<std::string, std::string>, HwCounterStats> perf_table;
+static Roofline perf_roofline;
+static bool perf_roofline_set = false;
+
+static const char* counter_name(HwCounter c) {
+  switch (c) {
+    case HwCounter::Cycles: return "cycles";
+    case HwCounter::Instructions: return "instructions";
+    case HwCounter::LLCMisses: return "llc-misses";
+    case HwCounter::DTLBMisses: return "dtlb-misses";
+    case HwCounter::FPOps: return "fp-ops";
+  }
+  return "?";
+}
+
+#ifdef __linux__
+static int open_event(const EventSpec& e, long tid) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = e.type;
+  attr.config = e.config;
+  // user-space only, which perf_event_paranoid <= 2 permits for our threads
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(::syscall(SYS_perf_event_open, &attr, static_cast<pid_t>(tid), -1, -1,
+                                    PERF_FLAG_FD_CLOEXEC));
+}
+
+static uint64_t hw_cache(uint64_t cache, uint64_t op, uint64_t result) {
+  return cache | (op << 8) | (result << 16);
+}
+
+static bool is_intel() {
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("vendor_id", 0) == 0) {
+      return line.find("GenuineIntel") != std::string::npos;
+    }
+  }
+  return false;
+}
+
+static std::vector<EventSpec> candidate_events() {
+  std::vector<EventSpec> v = {
+    {HwCounter::Cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 1},
+    {HwCounter::Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 1},
+    {HwCounter::LLCMisses, PERF_TYPE_HW_CACHE,
+     hw_cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+    {HwCounter::DTLBMisses, PERF_TYPE_HW_CACHE,
+     hw_cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+  };
+  if (is_intel()) {
+    // FP_ARITH_INST_RETIRED.{SCALAR,128B,256B,512B}_PACKED_DOUBLE, weighted
+    // by vector lanes; FMAs are already counted twice
+    const uint64_t umask[] = {0x01, 0x04, 0x10, 0x40};
+    const uint64_t lanes[] = {1, 2, 4, 8};
+    for (int i = 0; i < 4; i++) {
+      v.push_back({HwCounter::FPOps, PERF_TYPE_RAW, 0xC7 | (umask[i] << 8), lanes[i]});
+    }
+  }
+  return v;
+}
+
+static std::vector<long> process_threads() {
+  std::vector<long> tids;
+  DIR* dir = ::opendir("/proc/self/task");
+  if (!dir) return tids;
+  while (struct dirent* ent = ::readdir(dir)) {
+    if (ent->d_name[0] != '.') tids.push_back(std::atol(ent->d_name));
+  }
+  ::closedir(dir);
+  return tids;
+}
+
+// Threads are discovered by scanning /proc/self/task, which is far too slow
+// for every op. perf_read rescans when the calling thread has no counters
+// yet or the last scan is older than this; workers spawned inside an op are
+// picked up by the next rescan.
+static const std::chrono::milliseconds PERF_RESCAN_INTERVAL(100);
+
+// Opens counters on threads not seen yet. Counters of threads that exit
+// stay readable with their final values, so fds are kept until stop.
+static void attach_threads() {
+  perf_last_scan = std::chrono::steady_clock::now();
+  for (long tid : process_threads()) {
+    if (perf_fds.count(tid)) continue;
+    std::vector<int> fds;
+    for (const EventSpec& spec : perf_specs) {
+      fds.push_back(open_event(spec, tid));
+    }
+    perf_fds.emplace(tid, std::move(fds));
+  }
+}
+
+static uint64_t read_scaled(int fd) {
+  uint64_t v[3];   // value, time enabled, time running
+  if (::read(fd, v, sizeof(v)) != static_cast<ssize_t>(sizeof(v)) || v[2] == 0) {
+    return 0;
+  }
+  // the PMU multiplexes when more events are open than it has counters
+  return (v[1] == v[2]) ? v[0] : static_cast<uint64_t>(static_cast<double>(v[0]) * v[1] / v[2]);
+}
+
+static void close_all() {
+  for (auto& kv : perf_fds) {
+    for (int fd : kv.second) {
+      if (fd >= 0) ::close(fd);
+    }
+  }
+  perf_fds.clear();
+}
+
+static void sum_counters(uint64_t* counts) {
+  for (const auto& kv : perf_fds) {
+    for (size_t i = 0; i < perf_specs.size(); i++) {
+      if (kv.second[i] >= 0) {
+        counts[static_cast<size_t>(perf_specs[i].kind)] += read_scaled(kv.second[i]) * perf_specs[i].weight;
+      }
+    }
+  }
+}
+#endif
+
+void detail::perf_read(uint64_t* counts) {
+  std::fill(counts, counts + HW_COUNTER_KINDS, 0);
+#ifdef __linux__
+  static thread_local long self = static_cast<long>(::syscall(SYS_gettid));
+  {
+    std::shared_lock<std::shared_mutex> lock(perf_fd_mutex);
+    if (perf_specs.empty()) return;
+    if (perf_fds.count(self) &&
+        std::chrono::steady_clock::now() - perf_last_scan < PERF_RESCAN_INTERVAL) {
+      sum_counters(counts);
+      return;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(perf_fd_mutex);
+  if (perf_specs.empty()) return;
+  attach_threads();
+  sum_counters(counts);
+#endif
+}
+
+void detail::perf_record(const char* op, const Backend* backend, double seconds,
+                         const uint64_t* before, const uint64_t* after, double flops, double bytes) {
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  std::string name = backend ? backend->name() : "host";
+  HwCounterStats& s = perf_table[{op, name}];
+  s.op = op;
+  s.backend = name;
+  s.calls++;
+  s.seconds += seconds;
+  for (size_t k = 0; k < HW_COUNTER_KINDS; k++) {
+    s.counts[k] += (after[k] > before[k]) ? after[k] - before[k] : 0;
+  }
+  s.analytic_flops += flops;
+  s.analytic_bytes += bytes;
+}
+
+bool start_hw_counters() {
+  {
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    std::unique_lock<std::shared_mutex> fd_lock(perf_fd_mutex);
+    perf_specs.clear();
+    perf_error.clear();
+#ifdef __linux__
+    close_all();
+    long self = static_cast<long>(::syscall(SYS_gettid));
+    bool fp_ok = true;
+    for (const EventSpec& spec : candidate_events()) {
+      int fd = open_event(spec, self);
+      if (fd < 0) {
+        if (perf_error.empty()) {
+          perf_error = std::string("perf_event_open(") + counter_name(spec.kind) + "): " + std::strerror(errno);
+          if (errno == EACCES || errno == EPERM) {
+            perf_error += " (check /proc/sys/kernel/perf_event_paranoid)";
+          }
+        }
+        if (spec.kind == HwCounter::FPOps) fp_ok = false;
+        continue;
+      }
+      ::close(fd);
+      perf_specs.push_back(spec);
+    }
+    // a partial set of FP events would undercount, so use all or none
+    if (!fp_ok) {
+      perf_specs.erase(std::remove_if(perf_specs.begin(), perf_specs.end(),
+                                      [](const EventSpec& e) { return e.kind == HwCounter::FPOps; }),
+                       perf_specs.end());
+    }
+    if (!perf_specs.empty()) attach_threads();
+#else
+    perf_error = "hardware counters need Linux perf_event_open";
+#endif
+  }
+  // ops are timed and placed on the roofline even without counters
+  detail::enable_hook(detail::HOOK_PERF, true);
+  std::shared_lock<std::shared_mutex> lock(perf_fd_mutex);
+  return !perf_specs.empty();
+}
+
+void stop_hw_counters() {
+  detail::enable_hook(detail::HOOK_PERF, false);
+  std::unique_lock<std::shared_mutex> lock(perf_fd_mutex);
+#ifdef __linux__
+  close_all();
+#endif
+  perf_specs.clear();
+}
+
+bool hw_counters_enabled() {
+  return (detail::hooks() & detail::HOOK_PERF) != 0;
+}
+
+std::vector<HwCounter> available_hw_counters() {
+  std::shared_lock<std::shared_mutex> lock(perf_fd_mutex);
+  std::vector<HwCounter> out;
+  for (const EventSpec& spec : perf_specs) {
+    if (std::find(out.begin(), out.end(), spec.kind) == out.end()) out.push_back(spec.kind);
+  }
+  return out;
+}
+
+std::string hw_counter_error() {
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  return perf_error;
+}
+
+std::vector<HwCounterStats> hw_counter_stats() {
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  std::vector<HwCounterStats> out;
+  for (const auto& kv : perf_table) {
+    out.push_back(kv.second);
+  }
+  return out;
+}
+
+void reset_hw_counters() {
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  perf_table.clear();
+}
+
+/* Derived metrics */
+
+double Roofline::attainable_gflops(double intensity) const {
+  return std::min(peak_gflops, intensity * bandwidth_gbps);
+}
+
+double HwCounterStats::ipc() const {
+  uint64_t cycles = count(HwCounter::Cycles);
+  return cycles ? static_cast<double>(count(HwCounter::Instructions)) / cycles : 0.0;
+}
+
+double HwCounterStats::gflops() const {
+  uint64_t fp = count(HwCounter::FPOps);
+  double flops = fp ? static_cast<double>(fp) : analytic_flops;
+  return seconds > 0.0 ? flops / seconds * 1e-9 : 0.0;
+}
+
+double HwCounterStats::arithmetic_intensity() const {
+  uint64_t fp = count(HwCounter::FPOps);
+  uint64_t misses = count(HwCounter::LLCMisses);
+  double flops = fp ? static_cast<double>(fp) : analytic_flops;
+  double bytes = misses ? misses * 64.0 : analytic_bytes;
+  return bytes > 0.0 ? flops / bytes : 0.0;
+}
+
+/* Roofline ceilings */
+
+Roofline measure_roofline(unsigned threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  Roofline r;
+
+  // independent multiply-add lanes the compiler can vectorize without
+  // reassociation, so this is the peak reachable with the build's own flags
+  const size_t lanes = 32, steps = 2000000 / lanes;
+  for (int rep = 0; rep < 3; rep++) {
+    std::vector<std::thread> pool;
+    std::vector<double> sinks(threads);
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+      pool.emplace_back([&sinks, t] {
+        double acc[lanes];
+        for (size_t j = 0; j < lanes; j++) acc[j] = 1.0 + j * 1e-9;
+        for (size_t s = 0; s < steps; s++) {
+          for (size_t j = 0; j < lanes; j++) acc[j] = acc[j] * 0.999999 + 1e-7;
+        }
+        double sum = 0.0;
+        for (size_t j = 0; j < lanes; j++) sum += acc[j];
+        sinks[t] = sum;
+      });
+    }
+    for (std::thread& th : pool) th.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    r.peak_gflops = std::max(r.peak_gflops, 2.0 * lanes * steps * threads / secs * 1e-9);
+  }
+
+  // STREAM triad a = b + s * c over arrays well beyond the last-level cache;
+  // bytes counted the STREAM way (three arrays, no write-allocate). Each
+  // thread first touches the range it later streams.
+  const size_t n = size_t(1) << 23;
+  std::unique_ptr<double[]> a(new double[n]), b(new double[n]), c(new double[n]);
+  auto run = [&](const std::function<void(size_t, size_t)>& body) {
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++) {
+      pool.emplace_back([&, t] { body(n * t / threads, n * (t + 1) / threads); });
+    }
+    for (std::thread& th : pool) th.join();
+  };
+  run([&](size_t i0, size_t i1) {
+    for (size_t i = i0; i < i1; i++) {
+      a[i] = 0.0; b[i] = 1.0; c[i] = 2.0;
+    }
+  });
+  for (int rep = 0; rep < 5; rep++) {
+    auto t0 = std::chrono::steady_clock::now();
+    run([&](size_t i0, size_t i1) {
+      for (size_t i = i0; i < i1; i++) a[i] = b[i] + 3.0 * c[i];
+    });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    r.bandwidth_gbps = std::max(r.bandwidth_gbps, 3.0 * n * sizeof(double) / secs * 1e-9);
+  }
+  return r;
+}
+
+void set_roofline(const Roofline& roofline) {
+  std::lock_guard<std::mutex> lock(perf_mutex);
+  perf_roofline = roofline;
+  perf_roofline_set = true;
+}
+
+Roofline roofline() {
+  {
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    if (perf_roofline_set) return perf_roofline;
+  }
+  Roofline r = measure_roofline();
+  set_roofline(r);
+  return r;
+}
+
+std::string roofline_report() {
+  Roofline roof = roofline();
+  std::vector<HwCounter> available = available_hw_counters();
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(2);
+  oss << "roofline: peak " << roof.peak_gflops << " GFLOP/s, bandwidth " << roof.bandwidth_gbps
+      << " GB/s, ridge " << roof.ridge() << " FLOP/byte\n";
+  if (available.empty()) {
+    std::string err = hw_counter_error();
+    oss << "hardware counters unavailable" << (err.empty() ? "" : ": " + err)
+        << "; using analytic FLOPs and bytes\n";
+  }
+  else {
+    oss << "counters:";
+    for (HwCounter c : available) oss << " " << counter_name(c);
+    oss << "\n";
+  }
+  oss << std::left << std::setw(12) << "op" << std::setw(10) << "backend"
+      << std::right << std::setw(8) << "calls" << std::setw(12) << "total ms"
+      << std::setw(8) << "IPC" << std::setw(10) << "GFLOP/s" << std::setw(10) << "FLOP/B"
+      << std::setw(9) << "bound" << std::setw(12) << "% of roof" << "\n";
+  for (const HwCounterStats& s : hw_counter_stats()) {
+    double ai = s.arithmetic_intensity();
+    double roof_at = roof.attainable_gflops(ai);
+    // ops without FLOPs (transpose) are judged against bandwidth alone
+    double pct = 0.0;
+    if (s.gflops() > 0.0 && roof_at > 0.0) {
+      pct = 100.0 * s.gflops() / roof_at;
+    }
+    else if (s.seconds > 0.0 && roof.bandwidth_gbps > 0.0) {
+      pct = 100.0 * s.analytic_bytes / s.seconds * 1e-9 / roof.bandwidth_gbps;
+    }
+    oss << std::left << std::setw(12) << s.op << std::setw(10) << s.backend
+        << std::right << std::setw(8) << s.calls << std::setw(12) << s.seconds * 1e3
+        << std::setw(8) << s.ipc() << std::setw(10) << s.gflops() << std::setw(10) << ai
+        << std::setw(9) << (ai < roof.ridge() ? "memory" : "compute")
+        << std::setw(12) << pct << "\n";
+  }
+  return oss.str();
+}
+
+}
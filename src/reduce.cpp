@@ -0,0 +1,38 @@
+#include "lumin/reduce.hpp"
+#include "lumin/factory.hpp"
+#include "graph_capture.hpp"
+#include "op_scope.hpp"
+
+namespace lumin {
+
+static const double D = sizeof(double);
+
+Matrix reduce(Reduction op, Axis axis, const Matrix& A) {
+  detail::refuse_capture("reduce");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double m = static_cast<double>(A.rows()), n = static_cast<double>(A.cols());
+  double out = (axis == Axis::Rows) ? m : n;
+  // exp and log counted as one flop each
+  double flops = (op == Reduction::LogSumExp) ? 3 * m * n : m * n;
+  OpScope scope("reduce", backend.get(), flops, m * n * D, out * D);
+  return backend->reduce(op, axis, A);
+}
+
+std::vector<size_t> argmax(Axis axis, const Matrix& A) {
+  detail::refuse_capture("argmax");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double m = static_cast<double>(A.rows()), n = static_cast<double>(A.cols());
+  double out = (axis == Axis::Rows) ? m : n;
+  OpScope scope("argmax", backend.get(), m * n, m * n * D, out * sizeof(size_t));
+  return backend->argmax(axis, A);
+}
+
+Matrix transform_rows(RowTransform op, const Matrix& A) {
+  detail::refuse_capture("transform_rows");
+  std::shared_ptr<Backend> backend = get_default_backend();
+  double m = static_cast<double>(A.rows()), n = static_cast<double>(A.cols());
+  OpScope scope("transform_rows", backend.get(), 4 * m * n, m * n * D, m * n * D);
+  return backend->transform_rows(op, A);
+}
+
+}
@@ -0,0 +1,250 @@
+#include "lumin.hpp"
+#include "graph_capture.hpp"
+#include "op_scope.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+namespace lumin {
+
+static void check_compressed(size_t major, size_t minor, const std::vector<size_t>& ptr,
+                             const std::vector<size_t>& indices, const std::vector<double>& values) {
+  if (ptr.size() != major + 1 || ptr.front() != 0 || ptr.back() != indices.size() ||
+      indices.size() != values.size()) {
+    throw std::runtime_error("SparseMatrix: inconsistent compressed storage arrays");
+  }
+  for (size_t i = 0; i < major; i++) {
+    if (ptr[i] > ptr[i + 1]) {
+      throw std::runtime_error("SparseMatrix: ptr must be non-decreasing");
+    }
+    for (size_t p = ptr[i]; p < ptr[i + 1]; p++) {
+      if (indices[p] >= minor || (p > ptr[i] && indices[p] <= indices[p - 1])) {
+        std::ostringstream oss;
+        oss << "SparseMatrix: index " << indices[p] << " out of range or unsorted in slice " << i;
+        throw std::runtime_error(oss.str());
+      }
+    }
+  }
+}
+
+SparseMatrix::SparseMatrix(size_t rows, size_t cols, SparseFormat format)
+  : m_rows(rows), m_cols(cols), m_format(format),
+    backend(get_default_backend()),
+    m_ptr((format == SparseFormat::CSR ? rows : cols) + 1, 0)
+{ }
+
+SparseMatrix::SparseMatrix(size_t rows, size_t cols,
+                           std::vector<size_t> ptr, std::vector<size_t> indices, std::vector<double> values,
+                           SparseFormat format)
+  : m_rows(rows), m_cols(cols), m_format(format),
+    backend(get_default_backend()),
+    m_ptr(std::move(ptr)), m_indices(std::move(indices)), m_values(std::move(values))
+{
+  if (format == SparseFormat::CSR) {
+    check_compressed(rows, cols, m_ptr, m_indices, m_values);
+  }
+  else {
+    check_compressed(cols, rows, m_ptr, m_indices, m_values);
+  }
+}
+
+SparseMatrix::SparseMatrix()
+  : m_rows(0), m_cols(0), m_format(SparseFormat::CSR), backend(nullptr), m_ptr(1, 0)
+{ }
+
+SparseMatrix SparseMatrix::from_coo(size_t rows, size_t cols,
+                                    const std::vector<size_t>& row_idx,
+                                    const std::vector<size_t>& col_idx,
+                                    const std::vector<double>& values,
+                                    SparseFormat format) {
+  if (row_idx.size() != col_idx.size() || row_idx.size() != values.size()) {
+    throw std::runtime_error("SparseMatrix::from_coo: triplet arrays differ in length");
+  }
+  bool csr = (format == SparseFormat::CSR);
+  const std::vector<size_t>& major_idx = csr ? row_idx : col_idx;
+  const std::vector<size_t>& minor_idx = csr ? col_idx : row_idx;
+  size_t major = csr ? rows : cols;
+  size_t n = values.size();
+
+  for (size_t p = 0; p < n; p++) {
+    if (row_idx[p] >= rows || col_idx[p] >= cols) {
+      std::ostringstream oss;
+      oss << "SparseMatrix::from_coo: entry (" << row_idx[p] << ", " << col_idx[p]
+          << ") outside (" << rows << "x" << cols << ")";
+      throw std::runtime_error(oss.str());
+    }
+  }
+
+  // counting sort on the major index
+  std::vector<size_t> ptr(major + 1, 0);
+  for (size_t p = 0; p < n; p++) {
+    ptr[major_idx[p] + 1]++;
+  }
+  std::partial_sum(ptr.begin(), ptr.end(), ptr.begin());
+
+  std::vector<size_t> order(n);
+  std::vector<size_t> next(ptr.begin(), ptr.end() - 1);
+  for (size_t p = 0; p < n; p++) {
+    order[next[major_idx[p]]++] = p;
+  }
+
+  // sort each slice by minor index and merge duplicates
+  std::vector<size_t> out_ptr(major + 1, 0);
+  std::vector<size_t> out_idx;
+  std::vector<double> out_val;
+  out_idx.reserve(n);
+  out_val.reserve(n);
+  for (size_t i = 0; i < major; i++) {
+    auto first = order.begin() + ptr[i];
+    auto last = order.begin() + ptr[i + 1];
+    std::sort(first, last, [&](size_t a, size_t b) { return minor_idx[a] < minor_idx[b]; });
+    size_t start = out_idx.size();
+    for (auto it = first; it != last; ++it) {
+      if (out_idx.size() > start && out_idx.back() == minor_idx[*it]) {
+        out_val.back() += values[*it];
+      }
+      else {
+        out_idx.push_back(minor_idx[*it]);
+        out_val.push_back(values[*it]);
+      }
+    }
+    out_ptr[i + 1] = out_idx.size();
+  }
+
+  return SparseMatrix(rows, cols, std::move(out_ptr), std::move(out_idx), std::move(out_val), format);
+}
+
+SparseMatrix SparseMatrix::from_dense(const Matrix& A, SparseFormat format, double tol) {
+  detail::refuse_capture("SparseMatrix::from_dense");
+  std::vector<size_t> ptr, indices;
+  std::vector<double> values;
+  if (format == SparseFormat::CSR) {
+    ptr.assign(A.rows() + 1, 0);
+    for (size_t i = 0; i < A.rows(); i++) {
+      for (size_t j = 0; j < A.cols(); j++) {
+        double a = A(i, j);
+        if (a > tol || a < -tol) {
+          indices.push_back(j);
+          values.push_back(a);
+        }
+      }
+      ptr[i + 1] = indices.size();
+    }
+  }
+  else {
+    ptr.assign(A.cols() + 1, 0);
+    for (size_t j = 0; j < A.cols(); j++) {
+      for (size_t i = 0; i < A.rows(); i++) {
+        double a = A(i, j);
+        if (a > tol || a < -tol) {
+          indices.push_back(i);
+          values.push_back(a);
+        }
+      }
+      ptr[j + 1] = indices.size();
+    }
+  }
+  return SparseMatrix(A.rows(), A.cols(), std::move(ptr), std::move(indices), std::move(values), format);
+}
+
+Matrix SparseMatrix::to_dense() const {
+  detail::refuse_capture("SparseMatrix::to_dense");
+  Matrix R(m_rows, m_cols);
+  bool csr = (m_format == SparseFormat::CSR);
+  size_t major = csr ? m_rows : m_cols;
+  for (size_t i = 0; i < major; i++) {
+    for (size_t p = m_ptr[i]; p < m_ptr[i + 1]; p++) {
+      if (csr) {
+        R(i, m_indices[p]) = m_values[p];
+      }
+      else {
+        R(m_indices[p], i) = m_values[p];
+      }
+    }
+  }
+  return R;
+}
+
+// re-compress along the other dimension; walking the source slices in order
+// leaves every destination slice sorted
+SparseMatrix SparseMatrix::convert() const {
+  bool csr = (m_format == SparseFormat::CSR);
+  size_t major = csr ? m_rows : m_cols;
+  size_t minor = csr ? m_cols : m_rows;
+
+  std::vector<size_t> ptr(minor + 1, 0);
+  for (size_t idx : m_indices) {
+    ptr[idx + 1]++;
+  }
+  std::partial_sum(ptr.begin(), ptr.end(), ptr.begin());
+
+  std::vector<size_t> indices(nnz());
+  std::vector<double> values(nnz());
+  std::vector<size_t> next(ptr.begin(), ptr.end() - 1);
+  for (size_t i = 0; i < major; i++) {
+    for (size_t p = m_ptr[i]; p < m_ptr[i + 1]; p++) {
+      size_t dst = next[m_indices[p]]++;
+      indices[dst] = i;
+      values[dst] = m_values[p];
+    }
+  }
+
+  SparseMatrix R(m_rows, m_cols, csr ? SparseFormat::CSC : SparseFormat::CSR);
+  R.backend = backend;
+  R.m_ptr = std::move(ptr);
+  R.m_indices = std::move(indices);
+  R.m_values = std::move(values);
+  return R;
+}
+
+SparseMatrix SparseMatrix::to_csr() const {
+  return (m_format == SparseFormat::CSR) ? *this : convert();
+}
+
+SparseMatrix SparseMatrix::to_csc() const {
+  return (m_format == SparseFormat::CSC) ? *this : convert();
+}
+
+// CSR(A) and CSC(A^T) have the same arrays, so transposing needs no
+// reordering, only a copy of the index and value arrays
+SparseMatrix SparseMatrix::transpose() const {
+  SparseMatrix R = *this;
+  R.m_rows = m_cols;
+  R.m_cols = m_rows;
+  R.m_format = (m_format == SparseFormat::CSR) ? SparseFormat::CSC : SparseFormat::CSR;
+  return R;
+}
+
+// public API
+// compressed arrays are read once; x / B and the result once per use
+static double compressed_bytes(const SparseMatrix& A) {
+  size_t major = (A.format() == SparseFormat::CSR) ? A.rows() : A.cols();
+  return static_cast<double>(A.nnz() * (sizeof(double) + sizeof(size_t)) + (major + 1) * sizeof(size_t));
+}
+
+Matrix SparseMatrix::spmv(const Matrix& x) const {
+  detail::refuse_capture("spmv");
+  std::shared_ptr<Backend> b = backend ? backend : get_default_backend();
+  double nnz = static_cast<double>(m_values.size());
+  OpScope scope("spmv", b.get(), 2 * nnz, compressed_bytes(*this) + m_cols * sizeof(double),
+                m_rows * sizeof(double));
+  return b->spmv(*this, x);
+}
+
+Matrix SparseMatrix::multiply(const Matrix& B) const {
+  detail::refuse_capture("spmm");
+  std::shared_ptr<Backend> b = backend ? backend : get_default_backend();
+  double nnz = static_cast<double>(m_values.size());
+  double k = static_cast<double>(B.cols());
+  OpScope scope("spmm", b.get(), 2 * nnz * k, compressed_bytes(*this) + m_cols * k * sizeof(double),
+                m_rows * k * sizeof(double));
+  return b->spmm(*this, B);
+}
+
+Matrix SparseMatrix::operator*(const Matrix& B) const {
+  return (B.cols() == 1) ? spmv(B) : multiply(B);
+}
+
+}
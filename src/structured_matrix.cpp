@@ -0,0 +1,390 @@
+#include "lumin.hpp"
+#include "graph_capture.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+namespace lumin {
+
+static void check_dims(size_t ar, size_t ac, size_t br, size_t bc, bool multiply, const char* op) {
+  if (multiply ? (ac != br) : (ar != br || ac != bc)) {
+    std::ostringstream oss;
+    oss << op << " dimension mismatch: "
+        << "(" << ar << "x" << ac << ") vs "
+        << "(" << br << "x" << bc << ")";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+static Matrix copy_of(const Matrix& B) {
+  Matrix R(B.rows(), B.cols());
+  std::copy(B.data(), B.data() + B.rows() * B.cols(), R.data());
+  return R;
+}
+
+/* DiagonalMatrix */
+
+DiagonalMatrix::DiagonalMatrix(size_t n) : m_diag(n, 0.0) { }
+
+DiagonalMatrix::DiagonalMatrix(std::vector<double> diag) : m_diag(std::move(diag)) { }
+
+DiagonalMatrix::DiagonalMatrix() { }
+
+DiagonalMatrix DiagonalMatrix::from_dense(const Matrix& A) {
+  detail::refuse_capture("DiagonalMatrix::from_dense");
+  check_dims(A.rows(), A.cols(), A.cols(), A.cols(), false, "DiagonalMatrix::from_dense");
+  DiagonalMatrix D(A.rows());
+  for (size_t i = 0; i < A.rows(); i++) {
+    D(i) = A(i, i);
+  }
+  return D;
+}
+
+DiagonalMatrix DiagonalMatrix::add(const DiagonalMatrix& other) const {
+  check_dims(rows(), cols(), other.rows(), other.cols(), false, "Diagonal add");
+  DiagonalMatrix R(rows());
+  for (size_t i = 0; i < rows(); i++) {
+    R(i) = m_diag[i] + other(i);
+  }
+  return R;
+}
+
+DiagonalMatrix DiagonalMatrix::multiply(const DiagonalMatrix& other) const {
+  check_dims(rows(), cols(), other.rows(), other.cols(), true, "Diagonal multiply");
+  DiagonalMatrix R(rows());
+  for (size_t i = 0; i < rows(); i++) {
+    R(i) = m_diag[i] * other(i);
+  }
+  return R;
+}
+
+Matrix DiagonalMatrix::add(const Matrix& B) const {
+  detail::refuse_capture("DiagonalMatrix add");
+  check_dims(rows(), cols(), B.rows(), B.cols(), false, "Diagonal add");
+  Matrix R = copy_of(B);
+  for (size_t i = 0; i < rows(); i++) {
+    R(i, i) += m_diag[i];
+  }
+  return R;
+}
+
+Matrix DiagonalMatrix::multiply(const Matrix& B) const {
+  detail::refuse_capture("DiagonalMatrix multiply");
+  check_dims(rows(), cols(), B.rows(), B.cols(), true, "Diagonal multiply");
+  Matrix R(B.rows(), B.cols());
+  for (size_t i = 0; i < B.rows(); i++) {
+    double d = m_diag[i];
+    for (size_t j = 0; j < B.cols(); j++) {
+      R(i, j) = d * B(i, j);
+    }
+  }
+  return R;
+}
+
+Matrix DiagonalMatrix::to_dense() const {
+  detail::refuse_capture("DiagonalMatrix::to_dense");
+  Matrix R(rows(), cols());
+  for (size_t i = 0; i < rows(); i++) {
+    R(i, i) = m_diag[i];
+  }
+  return R;
+}
+
+Matrix DiagonalMatrix::operator*(const Matrix& B) const {
+  return multiply(B);
+}
+
+Matrix multiply(const Matrix& A, const DiagonalMatrix& D) {
+  detail::refuse_capture("DiagonalMatrix multiply");
+  check_dims(A.rows(), A.cols(), D.rows(), D.cols(), true, "Diagonal multiply");
+  Matrix R(A.rows(), A.cols());
+  for (size_t i = 0; i < A.rows(); i++) {
+    for (size_t j = 0; j < A.cols(); j++) {
+      R(i, j) = A(i, j) * D(j);
+    }
+  }
+  return R;
+}
+
+/* BandedMatrix */
+
+BandedMatrix::BandedMatrix(size_t rows, size_t cols, size_t kl, size_t ku)
+  : m_rows(rows), m_cols(cols),
+    m_kl(rows ? std::min(kl, rows - 1) : 0),
+    m_ku(cols ? std::min(ku, cols - 1) : 0),
+    m_band(rows * (m_kl + m_ku + 1), 0.0)
+{ }
+
+BandedMatrix::BandedMatrix() : m_rows(0), m_cols(0), m_kl(0), m_ku(0) { }
+
+BandedMatrix BandedMatrix::from_dense(const Matrix& A, size_t kl, size_t ku) {
+  detail::refuse_capture("BandedMatrix::from_dense");
+  BandedMatrix R(A.rows(), A.cols(), kl, ku);
+  for (size_t i = 0; i < R.rows(); i++) {
+    for (size_t j = R.row_begin(i); j < R.row_end(i); j++) {
+      R.slot(i, j) = A(i, j);
+    }
+  }
+  return R;
+}
+
+size_t BandedMatrix::nnz() const {
+  size_t n = 0;
+  for (size_t i = 0; i < m_rows; i++) {
+    size_t b = row_begin(i), e = row_end(i);
+    n += (e > b) ? e - b : 0;
+  }
+  return n;
+}
+
+double BandedMatrix::get(size_t i, size_t j) const {
+  return (i < m_rows && j < m_cols && in_band(i, j)) ? slot(i, j) : 0.0;
+}
+
+double& BandedMatrix::at(size_t i, size_t j) {
+  if (i >= m_rows || j >= m_cols || !in_band(i, j)) {
+    std::ostringstream oss;
+    oss << "BandedMatrix: entry (" << i << ", " << j << ") is outside the band";
+    throw std::out_of_range(oss.str());
+  }
+  return slot(i, j);
+}
+
+BandedMatrix BandedMatrix::add(const BandedMatrix& other) const {
+  check_dims(m_rows, m_cols, other.rows(), other.cols(), false, "Banded add");
+  BandedMatrix R(m_rows, m_cols, std::max(m_kl, other.lower()), std::max(m_ku, other.upper()));
+  for (size_t i = 0; i < m_rows; i++) {
+    for (size_t j = row_begin(i); j < row_end(i); j++) {
+      R.slot(i, j) = slot(i, j);
+    }
+    for (size_t j = other.row_begin(i); j < other.row_end(i); j++) {
+      R.slot(i, j) += other.slot(i, j);
+    }
+  }
+  return R;
+}
+
+BandedMatrix BandedMatrix::multiply(const BandedMatrix& other) const {
+  check_dims(m_rows, m_cols, other.rows(), other.cols(), true, "Banded multiply");
+  BandedMatrix R(m_rows, other.cols(), m_kl + other.lower(), m_ku + other.upper());
+  for (size_t i = 0; i < m_rows; i++) {
+    for (size_t k = row_begin(i); k < row_end(i); k++) {
+      double a = slot(i, k);
+      for (size_t j = other.row_begin(k); j < other.row_end(k); j++) {
+        R.slot(i, j) += a * other.slot(k, j);
+      }
+    }
+  }
+  return R;
+}
+
+BandedMatrix BandedMatrix::transpose() const {
+  BandedMatrix R(m_cols, m_rows, m_ku, m_kl);
+  for (size_t i = 0; i < m_rows; i++) {
+    for (size_t j = row_begin(i); j < row_end(i); j++) {
+      R.slot(j, i) = slot(i, j);
+    }
+  }
+  return R;
+}
+
+Matrix BandedMatrix::add(const Matrix& B) const {
+  detail::refuse_capture("BandedMatrix add");
+  check_dims(m_rows, m_cols, B.rows(), B.cols(), false, "Banded add");
+  Matrix R = copy_of(B);
+  for (size_t i = 0; i < m_rows; i++) {
+    for (size_t j = row_begin(i); j < row_end(i); j++) {
+      R(i, j) += slot(i, j);
+    }
+  }
+  return R;
+}
+
+Matrix BandedMatrix::multiply(const Matrix& B) const {
+  detail::refuse_capture("BandedMatrix multiply");
+  check_dims(m_rows, m_cols, B.rows(), B.cols(), true, "Banded multiply");
+  size_t n = B.cols();
+  Matrix R(m_rows, n);
+  for (size_t i = 0; i < m_rows; i++) {
+    double* r_row = R.data() + i * n;
+    for (size_t k = row_begin(i); k < row_end(i); k++) {
+      double a = slot(i, k);
+      const double* b_row = B.data() + k * n;
+      for (size_t j = 0; j < n; j++) {
+        r_row[j] += a * b_row[j];
+      }
+    }
+  }
+  return R;
+}
+
+Matrix BandedMatrix::to_dense() const {
+  detail::refuse_capture("BandedMatrix::to_dense");
+  Matrix R(m_rows, m_cols);
+  for (size_t i = 0; i < m_rows; i++) {
+    for (size_t j = row_begin(i); j < row_end(i); j++) {
+      R(i, j) = slot(i, j);
+    }
+  }
+  return R;
+}
+
+Matrix BandedMatrix::operator*(const Matrix& B) const {
+  return multiply(B);
+}
+
+Matrix multiply(const Matrix& A, const BandedMatrix& B) {
+  detail::refuse_capture("BandedMatrix multiply");
+  check_dims(A.rows(), A.cols(), B.rows(), B.cols(), true, "Banded multiply");
+  Matrix R(A.rows(), B.cols());
+  for (size_t r = 0; r < A.rows(); r++) {
+    double* r_row = R.data() + r * R.cols();
+    for (size_t k = 0; k < B.rows(); k++) {
+      double a = A(r, k);
+      for (size_t j = B.row_begin(k); j < B.row_end(k); j++) {
+        r_row[j] += a * B.get(k, j);
+      }
+    }
+  }
+  return R;
+}
+
+/* TriangularMatrix */
+
+TriangularMatrix::TriangularMatrix(size_t n, Triangle uplo)
+  : m_n(n), m_uplo(uplo), m_packed(n * (n + 1) / 2, 0.0)
+{ }
+
+TriangularMatrix::TriangularMatrix() : m_n(0), m_uplo(Triangle::Lower) { }
+
+TriangularMatrix TriangularMatrix::from_dense(const Matrix& A, Triangle uplo) {
+  detail::refuse_capture("TriangularMatrix::from_dense");
+  check_dims(A.rows(), A.cols(), A.cols(), A.cols(), false, "TriangularMatrix::from_dense");
+  TriangularMatrix R(A.rows(), uplo);
+  for (size_t i = 0; i < R.rows(); i++) {
+    for (size_t j = R.row_begin(i); j < R.row_end(i); j++) {
+      R.slot(i, j) = A(i, j);
+    }
+  }
+  return R;
+}
+
+double TriangularMatrix::get(size_t i, size_t j) const {
+  return (i < m_n && j < m_n && in_triangle(i, j)) ? slot(i, j) : 0.0;
+}
+
+double& TriangularMatrix::at(size_t i, size_t j) {
+  if (i >= m_n || j >= m_n || !in_triangle(i, j)) {
+    std::ostringstream oss;
+    oss << "TriangularMatrix: entry (" << i << ", " << j << ") is outside the triangle";
+    throw std::out_of_range(oss.str());
+  }
+  return slot(i, j);
+}
+
+TriangularMatrix TriangularMatrix::add(const TriangularMatrix& other) const {
+  check_dims(m_n, m_n, other.rows(), other.cols(), false, "Triangular add");
+  if (other.uplo() != m_uplo) {
+    throw std::runtime_error("Triangular add: operands must share the same triangle");
+  }
+  TriangularMatrix R(m_n, m_uplo);
+  for (size_t p = 0; p < m_packed.size(); p++) {
+    R.m_packed[p] = m_packed[p] + other.m_packed[p];
+  }
+  return R;
+}
+
+// the product of two lower (upper) triangular matrices is lower (upper)
+// triangular; only k between j and i contributes to entry (i, j)
+TriangularMatrix TriangularMatrix::multiply(const TriangularMatrix& other) const {
+  check_dims(m_n, m_n, other.rows(), other.cols(), true, "Triangular multiply");
+  if (other.uplo() != m_uplo) {
+    throw std::runtime_error("Triangular multiply: operands must share the same triangle");
+  }
+  TriangularMatrix R(m_n, m_uplo);
+  for (size_t i = 0; i < m_n; i++) {
+    for (size_t k = row_begin(i); k < row_end(i); k++) {
+      double a = slot(i, k);
+      size_t jb = std::max(row_begin(i), other.row_begin(k));
+      size_t je = std::min(row_end(i), other.row_end(k));
+      for (size_t j = jb; j < je; j++) {
+        R.slot(i, j) += a * other.slot(k, j);
+      }
+    }
+  }
+  return R;
+}
+
+TriangularMatrix TriangularMatrix::transpose() const {
+  TriangularMatrix R(m_n, m_uplo == Triangle::Lower ? Triangle::Upper : Triangle::Lower);
+  for (size_t i = 0; i < m_n; i++) {
+    for (size_t j = row_begin(i); j < row_end(i); j++) {
+      R.slot(j, i) = slot(i, j);
+    }
+  }
+  return R;
+}
+
+Matrix TriangularMatrix::add(const Matrix& B) const {
+  detail::refuse_capture("TriangularMatrix add");
+  check_dims(m_n, m_n, B.rows(), B.cols(), false, "Triangular add");
+  Matrix R = copy_of(B);
+  for (size_t i = 0; i < m_n; i++) {
+    for (size_t j = row_begin(i); j < row_end(i); j++) {
+      R(i, j) += slot(i, j);
+    }
+  }
+  return R;
+}
+
+Matrix TriangularMatrix::multiply(const Matrix& B) const {
+  detail::refuse_capture("TriangularMatrix multiply");
+  check_dims(m_n, m_n, B.rows(), B.cols(), true, "Triangular multiply");
+  size_t n = B.cols();
+  Matrix R(m_n, n);
+  for (size_t i = 0; i < m_n; i++) {
+    double* r_row = R.data() + i * n;
+    for (size_t k = row_begin(i); k < row_end(i); k++) {
+      double a = slot(i, k);
+      const double* b_row = B.data() + k * n;
+      for (size_t j = 0; j < n; j++) {
+        r_row[j] += a * b_row[j];
+      }
+    }
+  }
+  return R;
+}
+
+Matrix TriangularMatrix::to_dense() const {
+  detail::refuse_capture("TriangularMatrix::to_dense");
+  Matrix R(m_n, m_n);
+  for (size_t i = 0; i < m_n; i++) {
+    for (size_t j = row_begin(i); j < row_end(i); j++) {
+      R(i, j) = slot(i, j);
+    }
+  }
+  return R;
+}
+
+Matrix TriangularMatrix::operator*(const Matrix& B) const {
+  return multiply(B);
+}
+
+Matrix multiply(const Matrix& A, const TriangularMatrix& T) {
+  detail::refuse_capture("TriangularMatrix multiply");
+  check_dims(A.rows(), A.cols(), T.rows(), T.cols(), true, "Triangular multiply");
+  Matrix R(A.rows(), T.cols());
+  for (size_t r = 0; r < A.rows(); r++) {
+    double* r_row = R.data() + r * R.cols();
+    for (size_t k = 0; k < T.rows(); k++) {
+      double a = A(r, k);
+      for (size_t j = T.row_begin(k); j < T.row_end(k); j++) {
+        r_row[j] += a * T.get(k, j);
+      }
+    }
+  }
+  return R;
+}
+
+}
@@ -0,0 +1,598 @@
+#include "lumin.hpp"
+#include "lumin/io.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace lumin {
+
+// chunks smaller than this are not worth a thread
+static const size_t MIN_CHUNK_BYTES = size_t(1) << 20;
+
+static void throw_errno(const std::string& what, const std::string& path) {
+  std::ostringstream oss;
+  oss << what << " '" << path << "': " << std::strerror(errno);
+  throw std::runtime_error(oss.str());
+}
+
+// Read-only private mapping of a whole file.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw_errno("cannot open", path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw_errno("cannot stat", path);
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size > 0) {
+      void* p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw_errno("cannot map", path);
+      }
+      ::madvise(p, m_size, MADV_SEQUENTIAL);
+      m_data = static_cast<const char*>(p);
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (m_data) {
+      ::munmap(const_cast<char*>(m_data), m_size);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* begin() const { return m_data; }
+  const char* end() const { return m_data + m_size; }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+};
+
+struct LineChunk {
+  const char* begin;
+  const char* end;
+  size_t lines;   // non-blank lines in the chunk
+  size_t first;   // global index of the chunk's first non-blank line
+  std::exception_ptr error;
+};
+
+static size_t resolve_threads(size_t requested, size_t bytes) {
+  size_t n = requested ? requested : std::max(1u, std::thread::hardware_concurrency());
+  return std::max<size_t>(1, std::min(n, bytes / MIN_CHUNK_BYTES));
+}
+
+static bool is_blank(const char* b, const char* e) {
+  for (; b < e; ++b) {
+    if (!std::isspace(static_cast<unsigned char>(*b))) return false;
+  }
+  return true;
+}
+
+// calls fn(begin, end) for every non-blank line, with any '\r' stripped
+template <class Fn>
+static void for_each_line(const char* begin, const char* end, Fn fn) {
+  const char* p = begin;
+  while (p < end) {
+    const char* nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+    const char* le = nl ? nl : end;
+    const char* trimmed = (le > p && le[-1] == '\r') ? le - 1 : le;
+    if (!is_blank(p, trimmed)) {
+      fn(p, trimmed);
+    }
+    p = nl ? nl + 1 : end;
+  }
+}
+
+static std::vector<LineChunk> split_lines(const char* begin, const char* end, size_t threads) {
+  std::vector<LineChunk> chunks;
+  size_t total = static_cast<size_t>(end - begin);
+  const char* p = begin;
+  for (size_t t = 0; t < threads && p < end; t++) {
+    const char* stop = (t + 1 == threads) ? end : begin + total * (t + 1) / threads;
+    if (stop < p) {
+      stop = p;
+    }
+    if (stop < end) {
+      const char* nl = static_cast<const char*>(std::memchr(stop, '\n', static_cast<size_t>(end - stop)));
+      stop = nl ? nl + 1 : end;
+    }
+    chunks.push_back(LineChunk{p, stop, 0, 0, nullptr});
+    p = stop;
+  }
+  return chunks;
+}
+
+// runs fn on every chunk, one thread per chunk, and rethrows the first error
+template <class Fn>
+static void run_chunks(std::vector<LineChunk>& chunks, Fn fn) {
+  auto guarded = [&fn](LineChunk& c) {
+    try {
+      fn(c);
+    }
+    catch (...) {
+      c.error = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < chunks.size(); t++) {
+    threads.emplace_back(guarded, std::ref(chunks[t]));
+  }
+  if (!chunks.empty()) {
+    guarded(chunks[0]);
+  }
+  for (std::thread& th : threads) {
+    th.join();
+  }
+  for (LineChunk& c : chunks) {
+    if (c.error) std::rethrow_exception(c.error);
+  }
+}
+
+// counts lines per chunk and assigns global line offsets; returns the total
+static size_t count_chunk_lines(std::vector<LineChunk>& chunks) {
+  run_chunks(chunks, [](LineChunk& c) {
+    size_t n = 0;
+    for_each_line(c.begin, c.end, [&n](const char*, const char*) { n++; });
+    c.lines = n;
+  });
+  size_t total = 0;
+  for (LineChunk& c : chunks) {
+    c.first = total;
+    total += c.lines;
+  }
+  return total;
+}
+
+static bool parse_value(const char* b, const char* e, double& out) {
+  while (b < e && (*b == ' ' || *b == '\t')) b++;
+  while (e > b && (e[-1] == ' ' || e[-1] == '\t')) e--;
+  if (b < e && *b == '+') b++;
+  std::from_chars_result res = std::from_chars(b, e, out);
+  return res.ec == std::errc() && res.ptr == e;
+}
+
+// next whitespace-separated token in [p, e)
+static bool next_token(const char*& p, const char* e, const char*& tb, const char*& te) {
+  while (p < e && std::isspace(static_cast<unsigned char>(*p))) p++;
+  if (p == e) return false;
+  tb = p;
+  while (p < e && !std::isspace(static_cast<unsigned char>(*p))) p++;
+  te = p;
+  return true;
+}
+
+static bool next_index(const char*& p, const char* e, size_t& out) {
+  const char *tb, *te;
+  if (!next_token(p, e, tb, te)) return false;
+  std::from_chars_result res = std::from_chars(tb, te, out);
+  return res.ec == std::errc() && res.ptr == te;
+}
+
+static bool next_value(const char*& p, const char* e, double& out) {
+  const char *tb, *te;
+  return next_token(p, e, tb, te) && parse_value(tb, te, out);
+}
+
+[[noreturn]] static void throw_line(const char* who, size_t line, const std::string& msg) {
+  std::ostringstream oss;
+  oss << who << ": data line " << line + 1 << ": " << msg;
+  throw std::runtime_error(oss.str());
+}
+
+/* CSV */
+
+Matrix read_csv(const std::string& path, char delimiter, bool skip_header, size_t num_threads) {
+  MappedFile file(path);
+  const char* begin = file.begin();
+  const char* end = file.end();
+
+  // the first non-blank line fixes the column count (after the header, if any)
+  const char* first_b = nullptr;
+  const char* first_e = nullptr;
+  bool header_pending = skip_header;
+  const char* p = begin;
+  while (p < end && !first_b) {
+    const char* nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+    const char* le = nl ? nl : end;
+    const char* trimmed = (le > p && le[-1] == '\r') ? le - 1 : le;
+    const char* next = nl ? nl + 1 : end;
+    if (!is_blank(p, trimmed)) {
+      if (header_pending) {
+        header_pending = false;
+        begin = next;
+      }
+      else {
+        first_b = p;
+        first_e = trimmed;
+      }
+    }
+    p = next;
+  }
+  if (!first_b) {
+    return Matrix(0, 0);
+  }
+  size_t cols = static_cast<size_t>(std::count(first_b, first_e, delimiter)) + 1;
+
+  std::vector<LineChunk> chunks = split_lines(begin, end, resolve_threads(num_threads, end - begin));
+  size_t rows = count_chunk_lines(chunks);
+
+  Matrix R(rows, cols);
+  double* out = R.data();
+  run_chunks(chunks, [&](LineChunk& c) {
+    size_t row = c.first;
+    for_each_line(c.begin, c.end, [&](const char* lb, const char* le) {
+      double* dst = out + row * cols;
+      size_t n = 0;
+      const char* fb = lb;
+      for (;;) {
+        const char* fe = static_cast<const char*>(std::memchr(fb, delimiter, static_cast<size_t>(le - fb)));
+        if (!fe) fe = le;
+        if (n == cols) {
+          throw_line("read_csv", row, "more than " + std::to_string(cols) + " fields");
+        }
+        if (!parse_value(fb, fe, dst[n])) {
+          throw_line("read_csv", row, "cannot parse '" + std::string(fb, fe) + "'");
+        }
+        n++;
+        if (fe == le) break;
+        fb = fe + 1;
+      }
+      if (n != cols) {
+        throw_line("read_csv", row, std::to_string(n) + " fields, expected " + std::to_string(cols));
+      }
+      row++;
+    });
+  });
+  return R;
+}
+
+/* Writers */
+
+static size_t field_bound(int precision) {
+  return 32 + static_cast<size_t>(std::max(precision, 0));
+}
+
+static char* put_double(char* out, double v, int precision) {
+  std::to_chars_result res = (precision < 0)
+    ? std::to_chars(out, out + field_bound(precision), v)
+    : std::to_chars(out, out + field_bound(precision), v, std::chars_format::general, precision);
+  return res.ptr;
+}
+
+static char* put_index(char* out, size_t v) {
+  return std::to_chars(out, out + 24, v).ptr;
+}
+
+// one output slice per thread, so every slice has its own buffer
+static std::vector<size_t> even_bounds(size_t n, size_t threads) {
+  std::vector<size_t> bounds(threads + 1);
+  for (size_t t = 0; t <= threads; t++) {
+    bounds[t] = n * t / threads;
+  }
+  return bounds;
+}
+
+// Formats slice t, items [bounds[t], bounds[t+1]), on its own thread into a
+// buffer of capacity(i0, i1) bytes; fmt(i0, i1, buf) returns the new end.
+// The prefix and all buffers then go out in a single gathered write.
+template <class Capacity, class Fmt>
+static void write_formatted(const std::string& path, const std::string& prefix,
+                            const std::vector<size_t>& bounds, Capacity capacity, Fmt fmt) {
+  size_t threads = bounds.size() - 1;
+  std::vector<std::vector<char>> bufs(threads);
+  std::vector<std::exception_ptr> errors(threads);
+  auto work = [&](size_t t) {
+    try {
+      size_t i0 = bounds[t], i1 = bounds[t + 1];
+      bufs[t].resize(capacity(i0, i1));
+      char* endp = fmt(i0, i1, bufs[t].data());
+      bufs[t].resize(static_cast<size_t>(endp - bufs[t].data()));
+    }
+    catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; t++) {
+    pool.emplace_back(work, t);
+  }
+  work(0);
+  for (std::thread& th : pool) {
+    th.join();
+  }
+  for (std::exception_ptr& e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+
+  std::vector<struct iovec> iov;
+  if (!prefix.empty()) {
+    iov.push_back({const_cast<char*>(prefix.data()), prefix.size()});
+  }
+  for (std::vector<char>& b : bufs) {
+    if (!b.empty()) iov.push_back({b.data(), b.size()});
+  }
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw_errno("cannot create", path);
+  }
+  size_t next = 0;
+  while (next < iov.size()) {
+    ssize_t w = ::writev(fd, iov.data() + next, static_cast<int>(std::min<size_t>(iov.size() - next, IOV_MAX)));
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      ::close(fd);
+      throw_errno("write failed on", path);
+    }
+    size_t written = static_cast<size_t>(w);
+    while (next < iov.size() && written >= iov[next].iov_len) {
+      written -= iov[next].iov_len;
+      next++;
+    }
+    if (next < iov.size()) {
+      iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + written;
+      iov[next].iov_len -= written;
+    }
+  }
+  if (::close(fd) != 0) {
+    throw_errno("close failed on", path);
+  }
+}
+
+void write_csv(const Matrix& A, const std::string& path, char delimiter, int precision, size_t num_threads) {
+  size_t rows = A.rows(), cols = A.cols();
+  size_t per_row = cols * (field_bound(precision) + 1) + 1;
+  size_t threads = std::min(resolve_threads(num_threads, rows * per_row), std::max<size_t>(rows, 1));
+  write_formatted(path, "", even_bounds(rows, threads),
+    [per_row](size_t r0, size_t r1) { return (r1 - r0) * per_row; },
+    [&](size_t r0, size_t r1, char* out) {
+      for (size_t i = r0; i < r1; i++) {
+        const double* row = A.data() + i * cols;
+        for (size_t j = 0; j < cols; j++) {
+          out = put_double(out, row[j], precision);
+          *out++ = (j + 1 < cols) ? delimiter : '\n';
+        }
+        if (cols == 0) *out++ = '\n';
+      }
+      return out;
+    });
+}
+
+/* Matrix Market */
+
+struct MMHeader {
+  bool coordinate = false;
+  bool pattern = false;
+  bool symmetric = false;
+  bool skew = false;
+  size_t rows = 0, cols = 0, entries = 0;
+  const char* body = nullptr;
+};
+
+static std::string lower(const char* b, const char* e) {
+  std::string s(b, e);
+  for (char& c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  return s;
+}
+
+static MMHeader parse_mm_header(const char* begin, const char* end, const std::string& path) {
+  auto fail = [&path](const std::string& msg) -> MMHeader {
+    throw std::runtime_error("read_matrix_market: '" + path + "': " + msg);
+  };
+
+  const char* nl = static_cast<const char*>(std::memchr(begin, '\n', static_cast<size_t>(end - begin)));
+  const char* le = nl ? nl : end;
+  const char* p = begin;
+  const char *tb, *te;
+  std::string tokens[5];
+  for (std::string& t : tokens) {
+    if (!next_token(p, le, tb, te)) return fail("malformed banner line");
+    t = lower(tb, te);
+  }
+  if (tokens[0] != "%%matrixmarket" || tokens[1] != "matrix") {
+    return fail("missing %%MatrixMarket matrix banner");
+  }
+
+  MMHeader h;
+  if (tokens[2] == "coordinate") h.coordinate = true;
+  else if (tokens[2] != "array") return fail("unknown format '" + tokens[2] + "'");
+
+  if (tokens[3] == "pattern") h.pattern = true;
+  else if (tokens[3] != "real" && tokens[3] != "integer" && tokens[3] != "double") {
+    return fail("unsupported field '" + tokens[3] + "'");
+  }
+
+  if (tokens[4] == "symmetric") h.symmetric = true;
+  else if (tokens[4] == "skew-symmetric") h.skew = true;
+  else if (tokens[4] != "general") return fail("unsupported symmetry '" + tokens[4] + "'");
+
+  if (!h.coordinate && (h.pattern || h.symmetric || h.skew)) {
+    return fail("only general real array files are supported");
+  }
+
+  // skip comments and blank lines up to the size line
+  p = nl ? nl + 1 : end;
+  while (p < end) {
+    nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+    le = nl ? nl : end;
+    if (*p != '%' && !is_blank(p, le)) break;
+    p = nl ? nl + 1 : end;
+  }
+  if (p == end) return fail("missing size line");
+
+  const char* q = p;
+  if (!next_index(q, le, h.rows) || !next_index(q, le, h.cols) ||
+      (h.coordinate && !next_index(q, le, h.entries))) {
+    return fail("malformed size line");
+  }
+  if (!h.coordinate) h.entries = h.rows * h.cols;
+  if ((h.symmetric || h.skew) && h.rows != h.cols) return fail("symmetric matrix must be square");
+  h.body = nl ? nl + 1 : end;
+  return h;
+}
+
+SparseMatrix read_matrix_market_sparse(const std::string& path, size_t num_threads) {
+  MappedFile file(path);
+  MMHeader h = parse_mm_header(file.begin(), file.end(), path);
+  if (!h.coordinate) {
+    return SparseMatrix::from_dense(read_matrix_market(path, num_threads));
+  }
+
+  std::vector<LineChunk> chunks = split_lines(h.body, file.end(),
+                                              resolve_threads(num_threads, file.end() - h.body));
+  size_t n = count_chunk_lines(chunks);
+  if (n != h.entries) {
+    throw std::runtime_error("read_matrix_market: '" + path + "': expected " + std::to_string(h.entries) +
+                             " entries, found " + std::to_string(n));
+  }
+
+  std::vector<size_t> ri(n), ci(n);
+  std::vector<double> vals(n);
+  run_chunks(chunks, [&](LineChunk& c) {
+    size_t k = c.first;
+    for_each_line(c.begin, c.end, [&](const char* lb, const char* le) {
+      const char* p = lb;
+      size_t i, j;
+      double v = 1.0;
+      if (!next_index(p, le, i) || !next_index(p, le, j) || (!h.pattern && !next_value(p, le, v))) {
+        throw_line("read_matrix_market", k, "malformed entry '" + std::string(lb, le) + "'");
+      }
+      if (i == 0 || j == 0 || i > h.rows || j > h.cols) {
+        throw_line("read_matrix_market", k, "index out of range");
+      }
+      ri[k] = i - 1;
+      ci[k] = j - 1;
+      vals[k] = v;
+      k++;
+    });
+  });
+
+  if (h.symmetric || h.skew) {
+    double sign = h.skew ? -1.0 : 1.0;
+    for (size_t k = 0; k < n; k++) {
+      if (ri[k] != ci[k]) {
+        ri.push_back(ci[k]);
+        ci.push_back(ri[k]);
+        vals.push_back(sign * vals[k]);
+      }
+    }
+  }
+  return SparseMatrix::from_coo(h.rows, h.cols, ri, ci, vals);
+}
+
+Matrix read_matrix_market(const std::string& path, size_t num_threads) {
+  MappedFile file(path);
+  MMHeader h = parse_mm_header(file.begin(), file.end(), path);
+  if (h.coordinate) {
+    return read_matrix_market_sparse(path, num_threads).to_dense();
+  }
+
+  std::vector<LineChunk> chunks = split_lines(h.body, file.end(),
+                                              resolve_threads(num_threads, file.end() - h.body));
+  size_t n = count_chunk_lines(chunks);
+  if (n != h.entries) {
+    throw std::runtime_error("read_matrix_market: '" + path + "': expected " + std::to_string(h.entries) +
+                             " values, found " + std::to_string(n));
+  }
+
+  // array files are column-major, one value per line
+  Matrix R(h.rows, h.cols);
+  double* out = R.data();
+  size_t rows = h.rows, cols = h.cols;
+  run_chunks(chunks, [&](LineChunk& c) {
+    size_t k = c.first;
+    for_each_line(c.begin, c.end, [&](const char* lb, const char* le) {
+      if (!parse_value(lb, le, out[(k % rows) * cols + k / rows])) {
+        throw_line("read_matrix_market", k, "cannot parse '" + std::string(lb, le) + "'");
+      }
+      k++;
+    });
+  });
+  return R;
+}
+
+void write_matrix_market(const Matrix& A, const std::string& path, int precision, size_t num_threads) {
+  std::string prefix = "%%MatrixMarket matrix array real general\n" +
+                       std::to_string(A.rows()) + " " + std::to_string(A.cols()) + "\n";
+  size_t rows = A.rows(), cols = A.cols();
+  size_t per_col = rows * (field_bound(precision) + 1);
+  size_t threads = std::min(resolve_threads(num_threads, cols * per_col), std::max<size_t>(cols, 1));
+  write_formatted(path, prefix, even_bounds(cols, threads),
+    [per_col](size_t c0, size_t c1) { return (c1 - c0) * per_col; },
+    [&](size_t c0, size_t c1, char* out) {
+      for (size_t j = c0; j < c1; j++) {
+        for (size_t i = 0; i < rows; i++) {
+          out = put_double(out, A.data()[i * cols + j], precision);
+          *out++ = '\n';
+        }
+      }
+      return out;
+    });
+}
+
+void write_matrix_market(const SparseMatrix& A, const std::string& path, int precision, size_t num_threads) {
+  std::string prefix = "%%MatrixMarket matrix coordinate real general\n" +
+                       std::to_string(A.rows()) + " " + std::to_string(A.cols()) + " " +
+                       std::to_string(A.nnz()) + "\n";
+  bool csr = (A.format() == SparseFormat::CSR);
+  size_t major = csr ? A.rows() : A.cols();
+  const std::vector<size_t>& ptr = A.ptr();
+  const std::vector<size_t>& idx = A.indices();
+  const std::vector<double>& val = A.values();
+  size_t per_entry = 2 * 21 + field_bound(precision) + 3;
+
+  // split on entries rather than slices so that skewed rows still balance
+  size_t threads = std::min(resolve_threads(num_threads, A.nnz() * per_entry), std::max<size_t>(major, 1));
+  std::vector<size_t> bounds(threads + 1, major);
+  bounds[0] = 0;
+  for (size_t t = 1; t < threads; t++) {
+    size_t target = A.nnz() * t / threads;
+    size_t slice = static_cast<size_t>(std::lower_bound(ptr.begin(), ptr.end(), target) - ptr.begin());
+    bounds[t] = std::max(bounds[t - 1], std::min(slice, major));
+  }
+
+  write_formatted(path, prefix, bounds,
+    [&](size_t s0, size_t s1) { return (ptr[s1] - ptr[s0]) * per_entry; },
+    [&](size_t s0, size_t s1, char* out) {
+      for (size_t s = s0; s < s1; s++) {
+        for (size_t k = ptr[s]; k < ptr[s + 1]; k++) {
+          size_t i = csr ? s : idx[k];
+          size_t j = csr ? idx[k] : s;
+          out = put_index(out, i + 1);
+          *out++ = ' ';
+          out = put_index(out, j + 1);
+          *out++ = ' ';
+          out = put_double(out, val[k], precision);
+          *out++ = '\n';
+        }
+      }
+      return out;
+    });
+}
+
+}
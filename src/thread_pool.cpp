@@ -0,0 +1,352 @@
+#include "lumin/thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <vector>
+
+namespace lumin {
+
+struct ThreadPool::Task {
+  std::function<void()> fn;
+  TaskGroup* group;
+};
+
+/* Chase-Lev deque
+ * After Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (PPoPP 2013). Only the owner calls
+ * push and pop; any thread may steal. Rings outgrown by push are kept until
+ * the deque is destroyed because a stealer may still be reading one. */
+
+class WorkDeque {
+public:
+  WorkDeque() {
+    m_rings.emplace_back(new Ring(256));
+    m_ring.store(m_rings.back().get(), std::memory_order_relaxed);
+  }
+
+  void push(void* task) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    Ring* ring = m_ring.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(ring->capacity) - 1) {
+      ring = grow(ring, t, b);
+    }
+    ring->put(b, task);
+    // a release store rather than the paper's fence, which thread
+    // sanitizers cannot see; the cost is the same on x86 and ARM
+    m_bottom.store(b + 1, std::memory_order_release);
+  }
+
+  void* pop() {
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Ring* ring = m_ring.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    void* task = ring->get(b);
+    if (t == b) {
+      // last entry: race the stealers for it
+      if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        task = nullptr;
+      }
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  void* steal() {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    Ring* ring = m_ring.load(std::memory_order_acquire);
+    void* task = ring->get(t);
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return task;
+  }
+
+  bool empty() const {
+    return m_bottom.load(std::memory_order_seq_cst) <= m_top.load(std::memory_order_seq_cst);
+  }
+
+private:
+  struct Ring {
+    explicit Ring(size_t cap) : capacity(cap), slots(new std::atomic<void*>[cap]) { }
+    size_t capacity;   // a power of two
+    std::unique_ptr<std::atomic<void*>[]> slots;
+
+    void put(int64_t i, void* task) {
+      slots[static_cast<size_t>(i) & (capacity - 1)].store(task, std::memory_order_relaxed);
+    }
+    void* get(int64_t i) const {
+      return slots[static_cast<size_t>(i) & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+  };
+
+  Ring* grow(Ring* old, int64_t t, int64_t b) {
+    m_rings.emplace_back(new Ring(old->capacity * 2));
+    Ring* ring = m_rings.back().get();
+    for (int64_t i = t; i < b; i++) {
+      ring->put(i, old->get(i));
+    }
+    m_ring.store(ring, std::memory_order_release);
+    return ring;
+  }
+
+  alignas(64) std::atomic<int64_t> m_top{0};
+  alignas(64) std::atomic<int64_t> m_bottom{0};
+  std::atomic<Ring*> m_ring{nullptr};
+  std::vector<std::unique_ptr<Ring>> m_rings;
+};
+
+struct ThreadPool::Impl {
+  std::vector<std::unique_ptr<WorkDeque>> deques;
+  std::vector<std::thread> workers;
+
+  // tasks spawned from threads outside the pool
+  std::mutex inject_mutex;
+  std::deque<Task*> injected;
+  std::atomic<size_t> injected_size{0};
+
+  // idle workers sleep here; submit only takes the lock when one might be
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  std::atomic<int> sleepers{0};
+  std::atomic<bool> stop{false};
+
+  bool has_work() const {
+    if (injected_size.load(std::memory_order_seq_cst) != 0) return true;
+    for (const std::unique_ptr<WorkDeque>& d : deques) {
+      if (!d->empty()) return true;
+    }
+    return false;
+  }
+};
+
+// the pool and deque of the worker running on this thread, if any
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local WorkDeque* current_deque = nullptr;
+static thread_local size_t steal_seed = 0;
+
+static const int SPINS_BEFORE_SLEEP = 64;
+
+ThreadPool::ThreadPool(size_t threads) : impl(new Impl()) {
+  if (threads == 0) {
+    threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+  for (size_t w = 0; w + 1 < threads; w++) {
+    impl->deques.emplace_back(new WorkDeque());
+  }
+  for (size_t w = 0; w + 1 < threads; w++) {
+    impl->workers.emplace_back([this, w] {
+      current_pool = this;
+      current_deque = impl->deques[w].get();
+      steal_seed = w;
+      int idle = 0;
+      while (!impl->stop.load(std::memory_order_acquire)) {
+        if (run_one()) {
+          idle = 0;
+          continue;
+        }
+        if (++idle < SPINS_BEFORE_SLEEP) {
+          std::this_thread::yield();
+          continue;
+        }
+        // announce the sleep before looking once more, so a concurrent
+        // submit either sees the sleeper or has its task seen here
+        std::unique_lock<std::mutex> lock(impl->sleep_mutex);
+        impl->sleepers.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!impl->stop.load(std::memory_order_acquire) && !impl->has_work()) {
+          impl->wake.wait(lock);
+        }
+        impl->sleepers.fetch_sub(1, std::memory_order_relaxed);
+        idle = 0;
+      }
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(impl->sleep_mutex);
+    impl->stop.store(true, std::memory_order_release);
+  }
+  impl->wake.notify_all();
+  for (std::thread& t : impl->workers) {
+    t.join();
+  }
+  // tasks left behind belong to groups that were never waited on
+  for (Task* task : impl->injected) {
+    delete task;
+  }
+  for (std::unique_ptr<WorkDeque>& d : impl->deques) {
+    while (void* task = d->steal()) {
+      delete static_cast<Task*>(task);
+    }
+  }
+}
+
+size_t ThreadPool::threads() const {
+  return impl->workers.size() + 1;
+}
+
+void ThreadPool::submit(Task* task) {
+  if (current_pool == this) {
+    current_deque->push(task);
+  }
+  else {
+    std::lock_guard<std::mutex> lock(impl->inject_mutex);
+    impl->injected.push_back(task);
+    impl->injected_size.fetch_add(1, std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (impl->sleepers.load(std::memory_order_relaxed) > 0) {
+    { std::lock_guard<std::mutex> lock(impl->sleep_mutex); }
+    impl->wake.notify_one();
+  }
+}
+
+bool ThreadPool::run_one() {
+  Task* task = nullptr;
+  if (current_pool == this) {
+    task = static_cast<Task*>(current_deque->pop());
+  }
+  if (!task && impl->injected_size.load(std::memory_order_relaxed) != 0) {
+    std::lock_guard<std::mutex> lock(impl->inject_mutex);
+    if (!impl->injected.empty()) {
+      task = impl->injected.front();
+      impl->injected.pop_front();
+      impl->injected_size.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+  size_t n = impl->deques.size();
+  for (size_t i = 0; !task && i < n; i++) {
+    WorkDeque* victim = impl->deques[(steal_seed + i) % n].get();
+    if (victim != current_deque) {
+      task = static_cast<Task*>(victim->steal());
+    }
+  }
+  if (!task) {
+    return false;
+  }
+  steal_seed++;
+
+  std::exception_ptr error;
+  try {
+    task->fn();
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+  TaskGroup* group = task->group;
+  delete task;
+  group->finish(error);
+  return true;
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+                              const std::function<void(size_t, size_t)>& body) {
+  grain = std::max<size_t>(grain, 1);
+  if (end <= begin) return;
+  if (end - begin <= grain || threads() == 1) {
+    body(begin, end);
+    return;
+  }
+  // split outlives group: if body throws on the caller's range, ~TaskGroup
+  // still drains spawned tasks that call split
+  std::function<void(size_t, size_t)> split;
+  TaskGroup group(*this);
+  // keep the left half and hand the right half to a thief, recursively
+  split = [&](size_t lo, size_t hi) {
+    while (hi - lo > grain) {
+      size_t mid = lo + (hi - lo) / 2;
+      group.spawn([&split, mid, hi] { split(mid, hi); });
+      hi = mid;
+    }
+    body(lo, hi);
+  };
+  split(begin, end);
+  group.wait();
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool) : m_pool(pool) { }
+
+TaskGroup::~TaskGroup() {
+  drain();
+}
+
+void TaskGroup::spawn(std::function<void()> fn) {
+  m_pending.fetch_add(1, std::memory_order_relaxed);
+  m_pool.submit(new ThreadPool::Task{std::move(fn), this});
+}
+
+void TaskGroup::finish(std::exception_ptr error) {
+  if (error) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_error) m_error = error;
+  }
+  size_t pending = m_pending.load(std::memory_order_relaxed);
+  while (pending > 1) {
+    if (m_pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel)) {
+      return;
+    }
+  }
+  // possibly the last task: the waiter may destroy the group as soon as it
+  // sees zero, so the count only reaches zero under the lock it takes last
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    m_done.notify_all();
+  }
+}
+
+void TaskGroup::drain() {
+  int idle = 0;
+  while (m_pending.load(std::memory_order_acquire) != 0) {
+    if (m_pool.run_one()) {
+      idle = 0;
+      continue;
+    }
+    if (++idle < SPINS_BEFORE_SLEEP) {
+      std::this_thread::yield();
+      continue;
+    }
+    // wake up now and then to help with tasks spawned by running ones
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait_for(lock, std::chrono::microseconds(200),
+                    [this] { return m_pending.load(std::memory_order_acquire) == 0; });
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+}
+
+void TaskGroup::wait() {
+  drain();
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(error, m_error);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+ThreadPool& default_thread_pool() {
+  static ThreadPool pool([] {
+    const char* env = std::getenv("LUMIN_NUM_THREADS");
+    return env ? static_cast<size_t>(std::strtoul(env, nullptr, 10)) : size_t(0);
+  }());
+  return pool;
+}
+
+}
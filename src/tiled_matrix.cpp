@@ -0,0 +1,566 @@
+#include "lumin.hpp"
+#include "memory_pool.hpp"
+#include "graph_capture.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lumin {
+
+static const char TILED_MAGIC[8] = {'L', 'U', 'M', 'I', 'N', 'T', 'I', 'L'};
+static const uint32_t TILED_VERSION = 1;
+// header is padded to a page so tile payloads stay page-aligned for mmap
+static const size_t TILED_HEADER_BYTES = 4096;
+
+struct TiledHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t tile;
+};
+
+static void throw_errno(const std::string& what, const std::string& path) {
+  std::ostringstream oss;
+  oss << "TiledMatrix: " << what << " '" << path << "': " << std::strerror(errno);
+  throw std::runtime_error(oss.str());
+}
+
+static void pread_full(int fd, void* buf, size_t bytes, off_t offset, const std::string& path) {
+  char* p = static_cast<char*>(buf);
+  while (bytes > 0) {
+    ssize_t n = ::pread(fd, p, bytes, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("read failed on", path);
+    }
+    if (n == 0) {
+      throw std::runtime_error("TiledMatrix: unexpected end of file in '" + path + "'");
+    }
+    p += n;
+    bytes -= static_cast<size_t>(n);
+    offset += n;
+  }
+}
+
+static void pwrite_full(int fd, const void* buf, size_t bytes, off_t offset, const std::string& path) {
+  const char* p = static_cast<const char*>(buf);
+  while (bytes > 0) {
+    ssize_t n = ::pwrite(fd, p, bytes, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("write failed on", path);
+    }
+    p += n;
+    bytes -= static_cast<size_t>(n);
+    offset += n;
+  }
+}
+
+// cached tiles are charged to their own pool; see memory.hpp
+static detail::MemoryPool* tile_pool() {
+  static detail::MemoryPool* pool = detail::memory_pool("host", "tiles");
+  return pool;
+}
+
+struct TiledMatrix::Impl {
+  std::string path;
+  int fd = -1;
+  size_t rows = 0, cols = 0, tile = 0;
+  size_t tile_rows = 0, tile_cols = 0;
+  TileAccess access = TileAccess::Cached;
+
+  // Mapped access
+  char* map = nullptr;
+  size_t map_bytes = 0;
+
+  // Cached access: LRU list front is most recently used
+  struct Entry {
+    std::shared_ptr<double[]> values;
+    std::list<size_t>::iterator lru;
+  };
+  std::mutex mu;
+  std::condition_variable cv;
+  std::unordered_map<size_t, Entry> cache;
+  std::list<size_t> lru;
+  std::unordered_set<size_t> inflight;
+  size_t budget = 0;
+  size_t cached_bytes = 0;
+  TileCacheStats stats;
+
+  // read-ahead
+  std::thread worker;
+  std::deque<size_t> queue;
+  bool stop = false;
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      stop = true;
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+      worker.join();
+    }
+    if (map) {
+      ::munmap(map, map_bytes);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  size_t tile_elems() const { return tile * tile; }
+  size_t tile_bytes() const { return tile_elems() * sizeof(double); }
+  off_t tile_offset(size_t idx) const {
+    return static_cast<off_t>(TILED_HEADER_BYTES + idx * tile_bytes());
+  }
+
+  void check_tile(size_t ti, size_t tj) const {
+    if (ti >= tile_rows || tj >= tile_cols) {
+      std::ostringstream oss;
+      oss << "TiledMatrix: tile (" << ti << ", " << tj << ") outside ("
+          << tile_rows << "x" << tile_cols << ") grid";
+      throw std::out_of_range(oss.str());
+    }
+  }
+
+  void evict_locked() {
+    while (cached_bytes > budget && cache.size() > 1) {
+      size_t victim = lru.back();
+      lru.pop_back();
+      cache.erase(victim);
+      cached_bytes -= tile_bytes();
+      stats.evictions++;
+    }
+  }
+
+  std::shared_ptr<double[]> load(size_t idx, bool prefetch) {
+    std::unique_lock<std::mutex> lock(mu);
+    for (;;) {
+      auto it = cache.find(idx);
+      if (it != cache.end()) {
+        lru.splice(lru.begin(), lru, it->second.lru);
+        if (!prefetch) stats.hits++;
+        return it->second.values;
+      }
+      if (inflight.count(idx) == 0) break;
+      cv.wait(lock);
+    }
+    if (prefetch) stats.prefetched++;
+    else stats.misses++;
+    inflight.insert(idx);
+    lock.unlock();
+
+    std::shared_ptr<double[]> values;
+    try {
+      values = detail::tracked_buffer(tile_pool(), tile_elems(), false);
+      pread_full(fd, values.get(), tile_bytes(), tile_offset(idx), path);
+    }
+    catch (...) {
+      lock.lock();
+      inflight.erase(idx);
+      cv.notify_all();
+      throw;
+    }
+
+    lock.lock();
+    inflight.erase(idx);
+    stats.bytes_read += tile_bytes();
+    lru.push_front(idx);
+    cache[idx] = Entry{values, lru.begin()};
+    cached_bytes += tile_bytes();
+    evict_locked();
+    cv.notify_all();
+    return values;
+  }
+
+  void run_worker() {
+    std::unique_lock<std::mutex> lock(mu);
+    for (;;) {
+      cv.wait(lock, [this] { return stop || !queue.empty(); });
+      if (stop) return;
+      size_t idx = queue.front();
+      queue.pop_front();
+      lock.unlock();
+      try {
+        load(idx, true);
+      }
+      catch (...) {
+        // a failed read-ahead is retried (and reported) by the demand load
+      }
+      lock.lock();
+    }
+  }
+};
+
+TiledMatrix::TiledMatrix() : impl(nullptr) { }
+
+TiledMatrix::TiledMatrix(std::shared_ptr<Impl> impl_ptr) : impl(std::move(impl_ptr)) { }
+
+TiledMatrix TiledMatrix::create(const std::string& path, size_t rows, size_t cols,
+                                size_t tile_size, TileAccess access, size_t cache_bytes) {
+  if (tile_size == 0) {
+    throw std::runtime_error("TiledMatrix: tile size must be positive");
+  }
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw_errno("cannot create", path);
+  }
+
+  TiledHeader header{};
+  std::memcpy(header.magic, TILED_MAGIC, sizeof(TILED_MAGIC));
+  header.version = TILED_VERSION;
+  header.rows = rows;
+  header.cols = cols;
+  header.tile = tile_size;
+
+  size_t tiles = ((rows + tile_size - 1) / tile_size) * ((cols + tile_size - 1) / tile_size);
+  size_t bytes = TILED_HEADER_BYTES + tiles * tile_size * tile_size * sizeof(double);
+  try {
+    pwrite_full(fd, &header, sizeof(header), 0, path);
+    // the payload starts out as a hole in the file and reads back as zeros
+    if (::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+      throw_errno("cannot size", path);
+    }
+  }
+  catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+
+  return TiledMatrix(open_impl(path, access, cache_bytes));
+}
+
+TiledMatrix TiledMatrix::open(const std::string& path, TileAccess access, size_t cache_bytes) {
+  return TiledMatrix(open_impl(path, access, cache_bytes));
+}
+
+std::shared_ptr<TiledMatrix::Impl> TiledMatrix::open_impl(const std::string& path,
+                                                          TileAccess access, size_t cache_bytes) {
+  auto impl = std::make_shared<TiledMatrix::Impl>();
+  impl->path = path;
+  impl->access = access;
+  impl->budget = cache_bytes;
+  impl->fd = ::open(path.c_str(), O_RDWR);
+  if (impl->fd < 0) {
+    throw_errno("cannot open", path);
+  }
+
+  TiledHeader header{};
+  pread_full(impl->fd, &header, sizeof(header), 0, path);
+  if (std::memcmp(header.magic, TILED_MAGIC, sizeof(TILED_MAGIC)) != 0 ||
+      header.version != TILED_VERSION || header.tile == 0) {
+    throw std::runtime_error("TiledMatrix: '" + path + "' is not a tiled matrix file");
+  }
+  impl->rows = header.rows;
+  impl->cols = header.cols;
+  impl->tile = header.tile;
+  impl->tile_rows = (impl->rows + impl->tile - 1) / impl->tile;
+  impl->tile_cols = (impl->cols + impl->tile - 1) / impl->tile;
+
+  struct stat st;
+  size_t expected = TILED_HEADER_BYTES + impl->tile_rows * impl->tile_cols * impl->tile_bytes();
+  if (::fstat(impl->fd, &st) != 0 || static_cast<size_t>(st.st_size) < expected) {
+    throw std::runtime_error("TiledMatrix: '" + path + "' is truncated");
+  }
+
+  if (access == TileAccess::Mapped && expected > 0) {
+    void* p = ::mmap(nullptr, expected, PROT_READ | PROT_WRITE, MAP_SHARED, impl->fd, 0);
+    if (p == MAP_FAILED) {
+      throw_errno("cannot map", path);
+    }
+    impl->map = static_cast<char*>(p);
+    impl->map_bytes = expected;
+  }
+  return impl;
+}
+
+TiledMatrix TiledMatrix::from_matrix(const Matrix& A, const std::string& path,
+                                     size_t tile_size, TileAccess access, size_t cache_bytes) {
+  detail::refuse_capture("TiledMatrix::from_matrix");
+  TiledMatrix T = create(path, A.rows(), A.cols(), tile_size, access, cache_bytes);
+  std::vector<double> buf(tile_size * tile_size);
+  for (size_t ti = 0; ti < T.tile_rows(); ti++) {
+    for (size_t tj = 0; tj < T.tile_cols(); tj++) {
+      std::fill(buf.begin(), buf.end(), 0.0);
+      size_t r0 = ti * tile_size, c0 = tj * tile_size;
+      size_t nr = std::min(tile_size, A.rows() - r0);
+      size_t nc = std::min(tile_size, A.cols() - c0);
+      for (size_t i = 0; i < nr; i++) {
+        std::copy(A.data() + (r0 + i) * A.cols() + c0,
+                  A.data() + (r0 + i) * A.cols() + c0 + nc,
+                  buf.data() + i * tile_size);
+      }
+      T.write_tile(ti, tj, buf.data());
+    }
+  }
+  return T;
+}
+
+size_t TiledMatrix::rows() const { return impl ? impl->rows : 0; }
+size_t TiledMatrix::cols() const { return impl ? impl->cols : 0; }
+size_t TiledMatrix::tile_size() const { return impl ? impl->tile : 0; }
+size_t TiledMatrix::tile_rows() const { return impl ? impl->tile_rows : 0; }
+size_t TiledMatrix::tile_cols() const { return impl ? impl->tile_cols : 0; }
+
+const std::string& TiledMatrix::path() const {
+  static const std::string empty;
+  return impl ? impl->path : empty;
+}
+
+std::shared_ptr<const double[]> TiledMatrix::tile(size_t ti, size_t tj) const {
+  impl->check_tile(ti, tj);
+  size_t idx = ti * impl->tile_cols + tj;
+  if (impl->access == TileAccess::Mapped) {
+    const double* p = reinterpret_cast<const double*>(impl->map + impl->tile_offset(idx));
+    return std::shared_ptr<const double[]>(impl, p);
+  }
+  return impl->load(idx, false);
+}
+
+void TiledMatrix::write_tile(size_t ti, size_t tj, const double* values) {
+  impl->check_tile(ti, tj);
+  size_t idx = ti * impl->tile_cols + tj;
+  if (impl->access == TileAccess::Mapped) {
+    std::memcpy(impl->map + impl->tile_offset(idx), values, impl->tile_bytes());
+    std::lock_guard<std::mutex> lock(impl->mu);
+    impl->stats.bytes_written += impl->tile_bytes();
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(impl->mu);
+  // a queued read-ahead would fetch the old contents, and one in flight
+  // could cache them after the write: drop the first, wait out the second,
+  // and hold the tile in flight so no read starts until the write is done
+  impl->queue.erase(std::remove(impl->queue.begin(), impl->queue.end(), idx), impl->queue.end());
+  impl->cv.wait(lock, [&] { return impl->inflight.count(idx) == 0; });
+  impl->inflight.insert(idx);
+  lock.unlock();
+  try {
+    pwrite_full(impl->fd, values, impl->tile_bytes(), impl->tile_offset(idx), impl->path);
+  }
+  catch (...) {
+    lock.lock();
+    impl->inflight.erase(idx);
+    impl->cv.notify_all();
+    throw;
+  }
+
+  lock.lock();
+  impl->inflight.erase(idx);
+  impl->stats.bytes_written += impl->tile_bytes();
+  auto it = impl->cache.find(idx);
+  if (it != impl->cache.end()) {
+    // keep the cached copy coherent without disturbing readers of the old one
+    std::shared_ptr<double[]> fresh = detail::tracked_buffer(tile_pool(), impl->tile_elems(), false);
+    std::memcpy(fresh.get(), values, impl->tile_bytes());
+    it->second.values = fresh;
+  }
+  impl->cv.notify_all();
+}
+
+void TiledMatrix::prefetch(size_t ti, size_t tj) const {
+  if (ti >= impl->tile_rows || tj >= impl->tile_cols) {
+    return;
+  }
+  size_t idx = ti * impl->tile_cols + tj;
+  if (impl->access == TileAccess::Mapped) {
+    long page = ::sysconf(_SC_PAGESIZE);
+    size_t begin = static_cast<size_t>(impl->tile_offset(idx));
+    size_t aligned = begin - begin % static_cast<size_t>(page);
+    ::madvise(impl->map + aligned, impl->tile_bytes() + (begin - aligned), MADV_WILLNEED);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(impl->mu);
+  if (impl->cache.count(idx) || impl->inflight.count(idx) ||
+      std::find(impl->queue.begin(), impl->queue.end(), idx) != impl->queue.end()) {
+    return;
+  }
+  impl->queue.push_back(idx);
+  if (!impl->worker.joinable()) {
+    Impl* self = impl.get();
+    impl->worker = std::thread([self] { self->run_worker(); });
+  }
+  impl->cv.notify_all();
+}
+
+Matrix TiledMatrix::to_matrix() const {
+  detail::refuse_capture("TiledMatrix::to_matrix");
+  Matrix R(rows(), cols());
+  size_t T = tile_size();
+  for (size_t ti = 0; ti < tile_rows(); ti++) {
+    for (size_t tj = 0; tj < tile_cols(); tj++) {
+      prefetch(ti, tj + 1);
+      std::shared_ptr<const double[]> t = tile(ti, tj);
+      size_t r0 = ti * T, c0 = tj * T;
+      size_t nr = std::min(T, rows() - r0);
+      size_t nc = std::min(T, cols() - c0);
+      for (size_t i = 0; i < nr; i++) {
+        std::copy(t.get() + i * T, t.get() + i * T + nc, R.data() + (r0 + i) * cols() + c0);
+      }
+    }
+  }
+  return R;
+}
+
+TiledMatrix TiledMatrix::elementwise(const TiledMatrix* B, const std::string& out_path,
+                                     double sa, double sb) const {
+  if (B && (B->rows() != rows() || B->cols() != cols() || B->tile_size() != tile_size())) {
+    std::ostringstream oss;
+    oss << "TiledMatrix elementwise mismatch: "
+        << "(" << rows() << "x" << cols() << ", tile " << tile_size() << ") vs "
+        << "(" << B->rows() << "x" << B->cols() << ", tile " << B->tile_size() << ")";
+    throw std::runtime_error(oss.str());
+  }
+  TiledMatrix C = create(out_path, rows(), cols(), tile_size(), impl->access, impl->budget);
+  size_t n = impl->tile_elems();
+  std::vector<double> out(n);
+
+  // every tile is read exactly once, so stream in file order
+  for (size_t ti = 0; ti < tile_rows(); ti++) {
+    for (size_t tj = 0; tj < tile_cols(); tj++) {
+      size_t ni = (tj + 1 < tile_cols()) ? ti : ti + 1;
+      size_t nj = (tj + 1 < tile_cols()) ? tj + 1 : 0;
+      prefetch(ni, nj);
+      if (B) B->prefetch(ni, nj);
+
+      std::shared_ptr<const double[]> a = tile(ti, tj);
+      if (B) {
+        std::shared_ptr<const double[]> b = B->tile(ti, tj);
+        for (size_t k = 0; k < n; k++) {
+          out[k] = sa * a[k] + sb * b[k];
+        }
+      }
+      else {
+        for (size_t k = 0; k < n; k++) {
+          out[k] = sa * a[k];
+        }
+      }
+      C.write_tile(ti, tj, out.data());
+    }
+  }
+  return C;
+}
+
+TiledMatrix TiledMatrix::add(const TiledMatrix& B, const std::string& out_path) const {
+  return elementwise(&B, out_path, 1.0, 1.0);
+}
+
+TiledMatrix TiledMatrix::subtract(const TiledMatrix& B, const std::string& out_path) const {
+  return elementwise(&B, out_path, 1.0, -1.0);
+}
+
+TiledMatrix TiledMatrix::scalar(double s, const std::string& out_path) const {
+  return elementwise(nullptr, out_path, s, 0.0);
+}
+
+TiledMatrix TiledMatrix::transpose(const std::string& out_path) const {
+  TiledMatrix C = create(out_path, cols(), rows(), tile_size(), impl->access, impl->budget);
+  size_t T = tile_size();
+  std::vector<double> out(T * T);
+  for (size_t ti = 0; ti < tile_rows(); ti++) {
+    for (size_t tj = 0; tj < tile_cols(); tj++) {
+      prefetch((tj + 1 < tile_cols()) ? ti : ti + 1, (tj + 1 < tile_cols()) ? tj + 1 : 0);
+      std::shared_ptr<const double[]> a = tile(ti, tj);
+      for (size_t i = 0; i < T; i++) {
+        for (size_t j = 0; j < T; j++) {
+          out[j * T + i] = a[i * T + j];
+        }
+      }
+      C.write_tile(tj, ti, out.data());
+    }
+  }
+  return C;
+}
+
+// C(i, j) = sum_k A(i, k) B(k, j), one output tile at a time. The A row
+// panel is reused across the whole j sweep, and j runs in serpentine order
+// so the B column panel touched last is the first one needed on the next
+// row. Each step queues the next pair of input tiles for read-ahead.
+TiledMatrix TiledMatrix::multiply(const TiledMatrix& B, const std::string& out_path) const {
+  if (cols() != B.rows() || tile_size() != B.tile_size()) {
+    std::ostringstream oss;
+    oss << "TiledMatrix multiply mismatch: "
+        << "(" << rows() << "x" << cols() << ", tile " << tile_size() << ") vs "
+        << "(" << B.rows() << "x" << B.cols() << ", tile " << B.tile_size() << ")";
+    throw std::runtime_error(oss.str());
+  }
+  TiledMatrix C = create(out_path, rows(), B.cols(), tile_size(), impl->access, impl->budget);
+  size_t T = tile_size();
+  size_t TI = tile_rows(), TK = tile_cols(), TJ = B.tile_cols();
+  std::vector<double> acc(T * T);
+
+  auto col_at = [TJ](size_t ti, size_t jj) { return (ti % 2 == 0) ? jj : TJ - 1 - jj; };
+
+  for (size_t ti = 0; ti < TI; ti++) {
+    for (size_t jj = 0; jj < TJ; jj++) {
+      size_t tj = col_at(ti, jj);
+      std::fill(acc.begin(), acc.end(), 0.0);
+      for (size_t tk = 0; tk < TK; tk++) {
+        if (tk + 1 < TK) {
+          prefetch(ti, tk + 1);
+          B.prefetch(tk + 1, tj);
+        }
+        else if (jj + 1 < TJ) {
+          B.prefetch(0, col_at(ti, jj + 1));
+        }
+        else if (ti + 1 < TI) {
+          prefetch(ti + 1, 0);
+          B.prefetch(0, col_at(ti + 1, 0));
+        }
+
+        std::shared_ptr<const double[]> a = tile(ti, tk);
+        std::shared_ptr<const double[]> b = B.tile(tk, tj);
+        for (size_t i = 0; i < T; i++) {
+          double* c_row = acc.data() + i * T;
+          for (size_t k = 0; k < T; k++) {
+            double a_val = a[i * T + k];
+            const double* b_row = b.get() + k * T;
+            for (size_t j = 0; j < T; j++) {
+              c_row[j] += a_val * b_row[j];
+            }
+          }
+        }
+      }
+      C.write_tile(ti, tj, acc.data());
+    }
+  }
+  return C;
+}
+
+void TiledMatrix::set_cache_budget(size_t bytes) {
+  std::lock_guard<std::mutex> lock(impl->mu);
+  impl->budget = bytes;
+  impl->evict_locked();
+}
+
+TileCacheStats TiledMatrix::cache_stats() const {
+  std::lock_guard<std::mutex> lock(impl->mu);
+  return impl->stats;
+}
+
+void TiledMatrix::reset_cache_stats() {
+  std::lock_guard<std::mutex> lock(impl->mu);
+  impl->stats = TileCacheStats();
+}
+
+}
@@ -0,0 +1,295 @@
+#include "lumin.hpp"
+#include "lumin/trace.hpp"
+#include "op_scope.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef LUMIN_ENABLE_MPI
+#include <mpi.h>
+#endif
+
+namespace lumin {
+
+struct TraceEvent {
+  const char* cat;
+  const char* name;
+  const char* detail;
+  uint64_t ts_ns;
+  uint64_t bytes;
+  char phase;
+};
+
+// Written only by its owning thread. size is published with release so
+// write_trace can read a consistent prefix while the thread keeps going.
+struct ThreadTrace {
+  std::unique_ptr<TraceEvent[]> events;
+  size_t capacity = 0;
+  std::atomic<size_t> size{0};
+  std::atomic<uint64_t> dropped{0};
+  int tid = 0;
+  long os_tid = 0;
+};
+
+static std::mutex trace_mutex;
+static std::vector<std::shared_ptr<ThreadTrace>> trace_threads;
+static std::atomic<uint64_t> trace_generation{0};
+static size_t trace_capacity = DEFAULT_TRACE_EVENTS_PER_THREAD;
+static int trace_rank = 0;
+static double trace_offset_us = 0.0;
+
+static thread_local std::shared_ptr<ThreadTrace> local_trace;
+static thread_local uint64_t local_generation = 0;
+
+static uint64_t now_ns() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// the calling thread's buffer for the current session; registering is the
+// only step that locks and happens once per thread and session
+static ThreadTrace* thread_trace() {
+  uint64_t gen = trace_generation.load(std::memory_order_acquire);
+  if (!local_trace || local_generation != gen) {
+    auto t = std::make_shared<ThreadTrace>();
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    t->capacity = trace_capacity;
+    t->events.reset(new TraceEvent[trace_capacity]);
+    t->tid = static_cast<int>(trace_threads.size()) + 1;
+    t->os_tid = static_cast<long>(::syscall(SYS_gettid));
+    trace_threads.push_back(t);
+    local_trace = std::move(t);
+    local_generation = gen;
+  }
+  return local_trace.get();
+}
+
+static void record(char phase, const char* cat, const char* name, const char* detail, uint64_t bytes) {
+  ThreadTrace* t = thread_trace();
+  size_t i = t->size.load(std::memory_order_relaxed);
+  if (i == t->capacity) {
+    t->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  t->events[i] = TraceEvent{cat, name, detail, now_ns(), bytes, phase};
+  t->size.store(i + 1, std::memory_order_release);
+}
+
+void detail::trace_begin(const char* cat, const char* name, const char* det, uint64_t bytes) {
+  record('B', cat, name, det, bytes);
+}
+
+void detail::trace_end(const char* cat, const char* name, uint64_t bytes) {
+  record('E', cat, name, nullptr, bytes);
+}
+
+void start_tracing(size_t events_per_thread) {
+  if (events_per_thread == 0) {
+    throw std::runtime_error("start_tracing: events_per_thread must be positive");
+  }
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_threads.clear();
+    trace_capacity = events_per_thread;
+    trace_generation.fetch_add(1, std::memory_order_release);
+  }
+  detail::enable_hook(detail::HOOK_TRACE, true);
+}
+
+void stop_tracing() {
+  detail::enable_hook(detail::HOOK_TRACE, false);
+}
+
+bool tracing_enabled() {
+  return (detail::hooks() & detail::HOOK_TRACE) != 0;
+}
+
+void set_trace_rank(int rank, double clock_offset_us) {
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  trace_rank = rank;
+  trace_offset_us = clock_offset_us;
+}
+
+static void put_ts(std::ostream& os, double us) {
+  char buf[64];
+  std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), us, std::chars_format::fixed, 3);
+  os.write(buf, res.ptr - buf);
+}
+
+void write_trace(const std::string& path) {
+  std::vector<std::shared_ptr<ThreadTrace>> threads;
+  int rank;
+  double offset;
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    threads = trace_threads;
+    rank = trace_rank;
+    offset = trace_offset_us;
+  }
+
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("write_trace: cannot create '" + path + "'");
+  }
+  // one event per line; merge_traces relies on this layout
+  out << "{\"traceEvents\":[\n";
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank
+      << ",\"tid\":0,\"args\":{\"name\":\"rank " << rank << "\"}}";
+  uint64_t dropped = 0;
+  for (const std::shared_ptr<ThreadTrace>& t : threads) {
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << rank << ",\"tid\":" << t->tid
+        << ",\"args\":{\"name\":\"thread " << t->tid << " (tid " << t->os_tid << ")\"}}";
+    size_t n = t->size.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; i++) {
+      const TraceEvent& e = t->events[i];
+      out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.cat << "\",\"ph\":\"" << e.phase
+          << "\",\"ts\":";
+      put_ts(out, e.ts_ns * 1e-3);
+      out << ",\"pid\":" << rank << ",\"tid\":" << t->tid;
+      if (e.detail || e.bytes) {
+        out << ",\"args\":{";
+        if (e.detail) out << "\"backend\":\"" << e.detail << "\"";
+        if (e.detail && e.bytes) out << ",";
+        if (e.bytes) out << "\"bytes\":" << e.bytes;
+        out << "}";
+      }
+      out << "}";
+    }
+    dropped += t->dropped.load(std::memory_order_relaxed);
+  }
+  out << "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"rank\":" << rank
+      << ",\"clock_offset_us\":";
+  put_ts(out, offset);
+  out << ",\"dropped_events\":" << dropped << "}}\n";
+  if (!out) {
+    throw std::runtime_error("write_trace: write failed on '" + path + "'");
+  }
+}
+
+// value of a numeric field in a line written by write_trace
+static bool find_number(const std::string& line, const char* key, size_t& begin, size_t& end, double& value) {
+  size_t k = line.find(key);
+  if (k == std::string::npos) return false;
+  begin = k + std::strlen(key);
+  std::from_chars_result res = std::from_chars(line.data() + begin, line.data() + line.size(), value);
+  if (res.ec != std::errc()) return false;
+  end = static_cast<size_t>(res.ptr - line.data());
+  return true;
+}
+
+void merge_traces(const std::vector<std::string>& inputs, const std::string& output) {
+  std::ofstream out(output, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("merge_traces: cannot create '" + output + "'");
+  }
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  uint64_t dropped = 0;
+  for (const std::string& path : inputs) {
+    std::ifstream in(path);
+    if (!in) {
+      throw std::runtime_error("merge_traces: cannot open '" + path + "'");
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    double offset = 0.0;
+    while (std::getline(in, line)) {
+      size_t b, e;
+      double v;
+      if (line.rfind("\"otherData\"", 0) == 0) {
+        if (find_number(line, "\"clock_offset_us\":", b, e, offset) &&
+            find_number(line, "\"dropped_events\":", b, e, v)) {
+          dropped += static_cast<uint64_t>(v);
+        }
+      }
+      else if (line.rfind("{\"name\"", 0) == 0) {
+        if (line.back() == ',') line.pop_back();
+        lines.push_back(std::move(line));
+      }
+    }
+    for (std::string& l : lines) {
+      size_t b, e;
+      double ts;
+      out << (first ? "\n" : ",\n");
+      first = false;
+      if (find_number(l, "\"ts\":", b, e, ts)) {
+        out.write(l.data(), static_cast<std::streamsize>(b));
+        put_ts(out, ts + offset);
+        out << l.substr(e);
+      }
+      else {
+        out << l;
+      }
+    }
+  }
+  out << "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"ranks\":" << inputs.size()
+      << ",\"dropped_events\":" << dropped << "}}\n";
+  if (!out) {
+    throw std::runtime_error("merge_traces: write failed on '" + output + "'");
+  }
+}
+
+#ifdef LUMIN_ENABLE_MPI
+void sync_trace_clocks(MPI_Comm comm) {
+  const int rounds = 16;
+  const int tag = 0x7ace;
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  double offset = 0.0;
+  for (int r = 1; r < size; r++) {
+    if (rank == 0) {
+      for (int k = 0; k < rounds; k++) {
+        double ping;
+        MPI_Recv(&ping, 1, MPI_DOUBLE, r, tag, comm, MPI_STATUS_IGNORE);
+        double t = now_ns() * 1e-3;
+        MPI_Send(&t, 1, MPI_DOUBLE, r, tag, comm);
+      }
+    }
+    else if (rank == r) {
+      double best_rtt = 0.0;
+      for (int k = 0; k < rounds; k++) {
+        double t0 = now_ns() * 1e-3;
+        MPI_Send(&t0, 1, MPI_DOUBLE, 0, tag, comm);
+        double t_root;
+        MPI_Recv(&t_root, 1, MPI_DOUBLE, 0, tag, comm, MPI_STATUS_IGNORE);
+        double t1 = now_ns() * 1e-3;
+        // rank 0 read its clock roughly halfway through the round trip
+        if (k == 0 || t1 - t0 < best_rtt) {
+          best_rtt = t1 - t0;
+          offset = t_root - 0.5 * (t0 + t1);
+        }
+      }
+    }
+  }
+  set_trace_rank(rank, offset);
+}
+
+void gather_trace(MPI_Comm comm, const std::string& path) {
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  write_trace(path + ".rank" + std::to_string(rank));
+  MPI_Barrier(comm);
+  if (rank == 0) {
+    std::vector<std::string> inputs;
+    for (int r = 0; r < size; r++) {
+      inputs.push_back(path + ".rank" + std::to_string(r));
+    }
+    merge_traces(inputs, path);
+  }
+  MPI_Barrier(comm);
+}
+#endif
+
+}
@@ -1,6 +1,21 @@
 #include <gtest/gtest.h>
 #include "lumin.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
 // CPU-only tests - these use the default CPU backend
 class CPUMatrixTest : public ::testing::Test {
 protected:
@@ -9,6 +24,12 @@ protected:
     auto backend = lumin::create_cpu_backend();
     lumin::set_default_backend(backend);
   }
+
+  // the serial kernels and the work-stealing pool, checked against each other
+  static std::vector<std::shared_ptr<lumin::Backend>> kernel_backends() {
+    return {lumin::create_cpu_backend(),
+            std::make_shared<lumin::ThreadPoolBackend>(std::make_shared<lumin::ThreadPool>(3))};
+  }
 };
 
 TEST_F(CPUMatrixTest, CreateAndFill) {
@@ -112,3 +133,1390 @@ TEST_F(CPUMatrixTest, SubtractMatrices) {
   EXPECT_EQ(C(1, 0), 2);
 }
 
+
+TEST_F(CPUMatrixTest, SparseFromCOOSumsDuplicates) {
+  std::vector<size_t> rows = {2, 0, 1, 0, 2};
+  std::vector<size_t> cols = {1, 2, 0, 2, 1};
+  std::vector<double> vals = {1.0, 2.0, 3.0, 4.0, 5.0};
+
+  lumin::SparseMatrix S = lumin::SparseMatrix::from_coo(3, 3, rows, cols, vals);
+
+  EXPECT_EQ(S.nnz(), 3);
+  lumin::Matrix D = S.to_dense();
+  EXPECT_EQ(D(0, 2), 6.0);
+  EXPECT_EQ(D(1, 0), 3.0);
+  EXPECT_EQ(D(2, 1), 6.0);
+  EXPECT_EQ(D(1, 1), 0.0);
+}
+
+TEST_F(CPUMatrixTest, SparseDenseRoundTripAndCSC) {
+  lumin::Matrix A(3, 4);
+  for (size_t i = 0; i < 12; ++i) {
+    A.data()[i] = (i % 3 == 0) ? static_cast<double>(i + 1) : 0.0;
+  }
+
+  lumin::SparseMatrix csr = lumin::SparseMatrix::from_dense(A);
+  lumin::SparseMatrix csc = csr.to_csc();
+  EXPECT_EQ(csr.nnz(), 4);
+  EXPECT_EQ(csc.format(), lumin::SparseFormat::CSC);
+  EXPECT_EQ(csc.ptr().size(), 5);
+
+  lumin::Matrix D = csc.to_dense();
+  for (size_t i = 0; i < 12; ++i) {
+    EXPECT_EQ(D.data()[i], A.data()[i]);
+  }
+
+  lumin::Matrix T = csr.transpose().to_dense();
+  EXPECT_EQ(T.rows(), 4);
+  EXPECT_EQ(T(3, 0), A(0, 3));
+  EXPECT_EQ(T(2, 2), A(2, 2));
+}
+
+TEST_F(CPUMatrixTest, SparseMultiplyMatchesDense) {
+  lumin::Matrix A(4, 3), B(3, 2);
+  double a[] = {1, 0, 2,
+                0, 0, 3,
+                4, 0, 0,
+                0, 5, 6};
+  for (size_t i = 0; i < 12; ++i) A.data()[i] = a[i];
+  for (size_t i = 0; i < 6; ++i) B.data()[i] = static_cast<double>(i + 1);
+
+  lumin::Matrix expected = A * B;
+  for (auto format : {lumin::SparseFormat::CSR, lumin::SparseFormat::CSC}) {
+    lumin::SparseMatrix S = lumin::SparseMatrix::from_dense(A, format);
+    lumin::Matrix R = S * B;
+    ASSERT_EQ(R.rows(), 4);
+    ASSERT_EQ(R.cols(), 2);
+    for (size_t i = 0; i < 8; ++i) {
+      EXPECT_EQ(R.data()[i], expected.data()[i]);
+    }
+  }
+
+  lumin::Matrix x(3, 1);
+  x.data()[0] = 1; x.data()[1] = 2; x.data()[2] = 3;
+  lumin::Matrix y = lumin::SparseMatrix::from_dense(A).spmv(x);
+  EXPECT_EQ(y(0, 0), 7.0);
+  EXPECT_EQ(y(3, 0), 28.0);
+}
+
+TEST_F(CPUMatrixTest, DiagonalMatrixOps) {
+  lumin::DiagonalMatrix D(std::vector<double>{1.0, 2.0, 3.0});
+  lumin::Matrix B(3, 2);
+  for (size_t i = 0; i < 6; ++i) B.data()[i] = static_cast<double>(i + 1);
+
+  lumin::Matrix R = D * B;
+  lumin::Matrix expected = D.to_dense() * B;
+  for (size_t i = 0; i < 6; ++i) {
+    EXPECT_EQ(R.data()[i], expected.data()[i]);
+  }
+
+  lumin::Matrix L = lumin::multiply(B.transpose(), D);
+  EXPECT_EQ(L(1, 2), B(2, 1) * 3.0);
+
+  lumin::DiagonalMatrix S = D + D * D;
+  EXPECT_EQ(S(2), 12.0);
+}
+
+TEST_F(CPUMatrixTest, BandedMatrixMatchesDense) {
+  size_t n = 6;
+  lumin::BandedMatrix T(n, n, 1, 1);
+  for (size_t i = 0; i < n; ++i) {
+    T.at(i, i) = 2.0;
+    if (i > 0) T.at(i, i - 1) = -1.0;
+    if (i + 1 < n) T.at(i, i + 1) = static_cast<double>(i);
+  }
+  EXPECT_EQ(T.nnz(), 3 * n - 2);
+  EXPECT_THROW(T.at(0, 3), std::out_of_range);
+
+  lumin::Matrix Td = T.to_dense();
+  lumin::Matrix B = lumin::Matrix::random_int(n, 3, 9);
+
+  lumin::Matrix R = T * B;
+  lumin::Matrix expected = Td * B;
+  for (size_t i = 0; i < n * 3; ++i) {
+    EXPECT_EQ(R.data()[i], expected.data()[i]);
+  }
+
+  // product of two tridiagonals is pentadiagonal
+  lumin::BandedMatrix P = T * T.transpose();
+  EXPECT_EQ(P.lower(), 2);
+  EXPECT_EQ(P.upper(), 2);
+  lumin::Matrix Pd = P.to_dense();
+  lumin::Matrix Pexpected = Td * Td.transpose();
+  lumin::Matrix Sum = (T + P).to_dense();
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      EXPECT_EQ(Pd(i, j), Pexpected(i, j));
+      EXPECT_EQ(Sum(i, j), Td(i, j) + Pexpected(i, j));
+    }
+  }
+}
+
+TEST_F(CPUMatrixTest, TriangularMatrixMatchesDense) {
+  size_t n = 5;
+  lumin::Matrix A = lumin::Matrix::random_int(n, n, 9);
+  lumin::TriangularMatrix L = lumin::TriangularMatrix::from_dense(A, lumin::Triangle::Lower);
+  lumin::TriangularMatrix U = L.transpose();
+  EXPECT_EQ(L.nnz(), n * (n + 1) / 2);
+  EXPECT_EQ(U.uplo(), lumin::Triangle::Upper);
+  EXPECT_EQ(U.get(1, 3), A(3, 1));
+  EXPECT_EQ(U.get(3, 1), 0.0);
+
+  lumin::Matrix Ld = L.to_dense();
+  lumin::Matrix LL = (L * L).to_dense();
+  lumin::Matrix expected = Ld * Ld;
+  lumin::Matrix UU = (U * U).to_dense();
+  lumin::Matrix Ud = U.to_dense();
+  lumin::Matrix expectedU = Ud * Ud;
+  lumin::Matrix B = lumin::Matrix::random_int(n, 2, 9);
+  lumin::Matrix UB = U * B;
+  lumin::Matrix expectedUB = Ud * B;
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      EXPECT_EQ(LL(i, j), expected(i, j));
+      EXPECT_EQ(UU(i, j), expectedU(i, j));
+    }
+    for (size_t j = 0; j < 2; ++j) {
+      EXPECT_EQ(UB(i, j), expectedUB(i, j));
+    }
+  }
+}
+
+static std::string temp_path(const std::string& name) {
+  return (std::filesystem::temp_directory_path() /
+          ("lumin_test_" + std::to_string(::getpid()) + "_" + name)).string();
+}
+
+TEST_F(CPUMatrixTest, TiledMatrixOutOfCoreOps) {
+  lumin::Matrix A = lumin::Matrix::random_int(10, 7, 9);
+  lumin::Matrix B = lumin::Matrix::random_int(7, 9, 9);
+  lumin::Matrix C = lumin::Matrix::random_int(10, 7, 9);
+
+  // a two-tile cache budget forces evictions and re-reads
+  size_t budget = 2 * 4 * 4 * sizeof(double);
+  std::vector<std::string> files;
+  auto path = [&](const std::string& name) {
+    files.push_back(temp_path(name));
+    return files.back();
+  };
+
+  lumin::TiledMatrix tA = lumin::TiledMatrix::from_matrix(A, path("a.tiled"), 4,
+                                                          lumin::TileAccess::Cached, budget);
+  lumin::TiledMatrix tB = lumin::TiledMatrix::from_matrix(B, path("b.tiled"), 4);
+  lumin::TiledMatrix tC = lumin::TiledMatrix::from_matrix(C, path("c.tiled"), 4,
+                                                          lumin::TileAccess::Mapped);
+  EXPECT_EQ(tA.tile_rows(), 3);
+  EXPECT_EQ(tA.tile_cols(), 2);
+
+  lumin::Matrix product = tA.multiply(tB, path("ab.tiled")).to_matrix();
+  lumin::Matrix sum = tA.add(tC, path("ac.tiled")).to_matrix();
+  lumin::Matrix diff = tA.subtract(tC, path("a-c.tiled")).to_matrix();
+  lumin::Matrix scaled = tC.scalar(3.0, path("3c.tiled")).to_matrix();
+  lumin::Matrix transposed = tA.transpose(path("at.tiled")).to_matrix();
+
+  lumin::Matrix expected = A * B;
+  ASSERT_EQ(product.rows(), 10);
+  ASSERT_EQ(product.cols(), 9);
+  for (size_t i = 0; i < 90; ++i) {
+    EXPECT_EQ(product.data()[i], expected.data()[i]);
+  }
+  for (size_t i = 0; i < 10; ++i) {
+    for (size_t j = 0; j < 7; ++j) {
+      EXPECT_EQ(sum(i, j), A(i, j) + C(i, j));
+      EXPECT_EQ(diff(i, j), A(i, j) - C(i, j));
+      EXPECT_EQ(scaled(i, j), 3.0 * C(i, j));
+      EXPECT_EQ(transposed(j, i), A(i, j));
+    }
+  }
+
+  lumin::TileCacheStats stats = tA.cache_stats();
+  EXPECT_GT(stats.evictions, 0);
+  EXPECT_GT(stats.bytes_read, 0);
+  // both access modes count the tiles written by from_matrix
+  EXPECT_EQ(stats.bytes_written, 6 * 4 * 4 * sizeof(double));
+  EXPECT_EQ(tC.cache_stats().bytes_written, 6 * 4 * 4 * sizeof(double));
+
+  // reopening reads the same data back from disk
+  lumin::Matrix reopened = lumin::TiledMatrix::open(files[0]).to_matrix();
+  for (size_t i = 0; i < 70; ++i) {
+    EXPECT_EQ(reopened.data()[i], A.data()[i]);
+  }
+
+  for (const std::string& f : files) {
+    std::remove(f.c_str());
+  }
+}
+
+TEST_F(CPUMatrixTest, TiledWriteWinsOverPendingPrefetch) {
+  // tiles large enough that a read-ahead is still in flight when the write
+  // starts; the cache holds one tile
+  const size_t T = 256;
+  std::string path = temp_path("prefetch.tiled");
+  lumin::TiledMatrix tiled = lumin::TiledMatrix::create(path, 2 * T, T, T, lumin::TileAccess::Cached,
+                                                        T * T * sizeof(double));
+  std::vector<double> values(T * T);
+  for (int k = 1; k <= 400; k++) {
+    // reading the other tile evicts tile (0, 0), so the prefetch goes to disk
+    tiled.tile(1, 0);
+    tiled.prefetch(0, 0);
+    std::this_thread::sleep_for(std::chrono::microseconds(k % 4 * 50));
+    std::fill(values.begin(), values.end(), static_cast<double>(k));
+    tiled.write_tile(0, 0, values.data());
+    ASSERT_EQ(tiled.tile(0, 0)[0], k);
+    ASSERT_EQ(tiled.tile(0, 0)[T * T - 1], k);
+  }
+  std::remove(path.c_str());
+}
+
+TEST_F(CPUMatrixTest, BinarySaveLoadRoundTrip) {
+  lumin::Matrix A = lumin::Matrix::random_int(13, 5, 1000);
+  A(0, 0) = -0.125;
+  std::string path = temp_path("roundtrip.lmat");
+  A.save(path);
+
+  EXPECT_EQ(std::filesystem::file_size(path), 64 + 13 * 5 * sizeof(double));
+
+  lumin::Matrix copied = lumin::Matrix::load(path);
+  lumin::Matrix mapped = lumin::Matrix::load(path, lumin::LoadMode::Map);
+  ASSERT_EQ(copied.rows(), 13);
+  ASSERT_EQ(mapped.cols(), 5);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(mapped.data()) % 64, 0);
+  for (size_t i = 0; i < 65; ++i) {
+    EXPECT_EQ(copied.data()[i], A.data()[i]);
+    EXPECT_EQ(mapped.data()[i], A.data()[i]);
+  }
+
+  // writes to a mapped matrix stay private to the process
+  mapped(1, 1) = 42.0;
+  EXPECT_EQ(lumin::Matrix::load(path)(1, 1), A(1, 1));
+
+  std::remove(path.c_str());
+}
+
+TEST_F(CPUMatrixTest, BinaryLoadDetectsCorruption) {
+  lumin::Matrix A = lumin::Matrix::random_int(4, 4, 9);
+  std::string path = temp_path("corrupt.lmat");
+  A.save(path);
+  {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(64 + 3 * sizeof(double));
+    double bad = 12345.0;
+    f.write(reinterpret_cast<const char*>(&bad), sizeof(bad));
+  }
+  EXPECT_THROW(lumin::Matrix::load(path), std::runtime_error);
+  EXPECT_NO_THROW(lumin::Matrix::load(path, lumin::LoadMode::Map, false));
+
+  // rows * cols wraps to zero in 64 bits and must not pass the size check
+  A.save(path);
+  {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t shape[2] = {uint64_t(1) << 33, uint64_t(1) << 31};
+    f.seekp(32);
+    f.write(reinterpret_cast<const char*>(shape), sizeof(shape));
+  }
+  EXPECT_THROW(lumin::Matrix::load(path, lumin::LoadMode::Map, false), std::runtime_error);
+
+  std::ofstream(path, std::ios::binary) << "not a matrix file at all, just text padding";
+  EXPECT_THROW(lumin::Matrix::load(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST_F(CPUMatrixTest, CsvRoundTrip) {
+  lumin::Matrix A(37, 6);
+  for (size_t i = 0; i < 37 * 6; ++i) {
+    A.data()[i] = (i % 2 ? -1.0 : 1.0) * i / 7.0;
+  }
+  A(0, 0) = -1e-300;
+  A(3, 2) = 0.1;
+  std::string path = temp_path("matrix.csv");
+
+  // several threads on a tiny file still split on line boundaries
+  lumin::write_csv(A, path, ';', -1, 4);
+  lumin::Matrix B = lumin::read_csv(path, ';', false, 4);
+  ASSERT_EQ(B.rows(), 37);
+  ASSERT_EQ(B.cols(), 6);
+  for (size_t i = 0; i < 37 * 6; ++i) {
+    EXPECT_EQ(B.data()[i], A.data()[i]);
+  }
+
+  std::ofstream(path) << "a,b,c\r\n1, 2,+3\r\n\r\n4,5.5,-6e1\r\n";
+  lumin::Matrix C = lumin::read_csv(path, ',', true);
+  ASSERT_EQ(C.rows(), 2);
+  ASSERT_EQ(C.cols(), 3);
+  EXPECT_DOUBLE_EQ(C(0, 2), 3.0);
+  EXPECT_DOUBLE_EQ(C(1, 1), 5.5);
+  EXPECT_DOUBLE_EQ(C(1, 2), -60.0);
+
+  std::ofstream(path) << "1,2,3\n4,5\n";
+  EXPECT_THROW(lumin::read_csv(path), std::runtime_error);
+  std::ofstream(path) << "1,2\n3,x\n";
+  EXPECT_THROW(lumin::read_csv(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST_F(CPUMatrixTest, MatrixMarketRoundTrip) {
+  lumin::Matrix A(5, 3);
+  for (size_t i = 0; i < 15; ++i) {
+    A.data()[i] = 1.0 / (i + 3);
+  }
+  std::string path = temp_path("matrix.mtx");
+  lumin::write_matrix_market(A, path);
+  lumin::Matrix B = lumin::read_matrix_market(path);
+  ASSERT_EQ(B.rows(), 5);
+  ASSERT_EQ(B.cols(), 3);
+  for (size_t i = 0; i < 15; ++i) {
+    EXPECT_EQ(B.data()[i], A.data()[i]);
+  }
+
+  lumin::SparseMatrix S = lumin::SparseMatrix::from_coo(4, 6, {0, 1, 3, 3}, {5, 0, 2, 4}, {1.5, -2.0, 3.0, 4.25},
+                                                        lumin::SparseFormat::CSC);
+  lumin::write_matrix_market(S, path, -1, 3);
+  lumin::SparseMatrix T = lumin::read_matrix_market_sparse(path, 3);
+  EXPECT_EQ(T.nnz(), 4);
+  lumin::Matrix Sd = S.to_dense(), Td = T.to_dense();
+  for (size_t i = 0; i < 24; ++i) {
+    EXPECT_EQ(Td.data()[i], Sd.data()[i]);
+  }
+
+  std::ofstream(path) << "%%MatrixMarket matrix coordinate integer symmetric\n"
+                         "% lower triangle only\n"
+                         "3 3 3\n1 1 2\n3 1 -1\n3 2 5\n";
+  lumin::Matrix D = lumin::read_matrix_market(path);
+  EXPECT_DOUBLE_EQ(D(0, 0), 2.0);
+  EXPECT_DOUBLE_EQ(D(0, 2), -1.0);
+  EXPECT_DOUBLE_EQ(D(2, 0), -1.0);
+  EXPECT_DOUBLE_EQ(D(1, 2), 5.0);
+  EXPECT_DOUBLE_EQ(D(1, 1), 0.0);
+
+  std::ofstream(path) << "%%MatrixMarket matrix coordinate real general\n2 2 2\n1 1 1.0\n";
+  EXPECT_THROW(lumin::read_matrix_market(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST_F(CPUMatrixTest, InstrumentationCountsOps) {
+  lumin::Matrix A = lumin::Matrix::random_int(4, 3, 9);
+  lumin::Matrix B = lumin::Matrix::random_int(3, 5, 9);
+
+  lumin::reset_stats();
+  A.multiply(B);
+  EXPECT_TRUE(lumin::op_stats().empty());
+
+  lumin::set_instrumentation(true);
+  A.multiply(B);
+  A.multiply(B);
+  A.add(A);
+  lumin::set_instrumentation(false);
+  A.add(A);
+
+  std::vector<lumin::OpStats> stats = lumin::op_stats();
+  ASSERT_EQ(stats.size(), 2);
+  const lumin::OpStats& add = (stats[0].op == "add") ? stats[0] : stats[1];
+  const lumin::OpStats& mul = (stats[0].op == "add") ? stats[1] : stats[0];
+  EXPECT_EQ(mul.op, "multiply");
+  EXPECT_EQ(mul.backend, "CPU");
+  EXPECT_EQ(mul.calls, 2);
+  EXPECT_EQ(mul.flops, 2 * 2 * 4 * 3 * 5);
+  EXPECT_EQ(mul.bytes_written, 2 * 4 * 5 * sizeof(double));
+  EXPECT_EQ(mul.allocations, 2);
+  EXPECT_EQ(mul.bytes_allocated, 2 * 4 * 5 * sizeof(double));
+  EXPECT_LE(mul.min_seconds, mul.max_seconds);
+  uint64_t binned = 0;
+  for (uint64_t n : mul.time_histogram) binned += n;
+  EXPECT_EQ(binned, 2);
+  EXPECT_EQ(add.calls, 1);
+  EXPECT_NE(lumin::stats_report().find("multiply"), std::string::npos);
+
+  lumin::reset_stats();
+  EXPECT_TRUE(lumin::op_stats().empty());
+}
+
+TEST_F(CPUMatrixTest, TraceRecordsOpsAndMerges) {
+  lumin::Matrix A = lumin::Matrix::random_int(8, 8, 9);
+  lumin::start_tracing(64);
+  lumin::Matrix C = A * A;
+  std::thread worker([&A] { lumin::Matrix D = A + A; });
+  worker.join();
+  lumin::stop_tracing();
+  lumin::Matrix untraced = A + A;
+
+  std::string rank0 = temp_path("trace0.json");
+  std::string rank1 = temp_path("trace1.json");
+  std::string merged = temp_path("trace.json");
+  lumin::set_trace_rank(0, 0.0);
+  lumin::write_trace(rank0);
+  lumin::set_trace_rank(1, 1000.0);
+  lumin::write_trace(rank1);
+  lumin::set_trace_rank(0, 0.0);
+  lumin::merge_traces({rank0, rank1}, merged);
+
+  auto slurp = [](const std::string& path) {
+    std::ifstream in(path);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  };
+  auto count = [](const std::string& text, const std::string& what) {
+    size_t n = 0;
+    for (size_t p = text.find(what); p != std::string::npos; p = text.find(what, p + 1)) n++;
+    return n;
+  };
+  std::string one = slurp(rank0);
+  EXPECT_EQ(count(one, "\"name\":\"multiply\",\"cat\":\"op\",\"ph\":\"B\""), 1);
+  EXPECT_EQ(count(one, "\"name\":\"multiply\",\"cat\":\"op\",\"ph\":\"E\""), 1);
+  EXPECT_EQ(count(one, "\"name\":\"add\",\"cat\":\"op\",\"ph\":\"B\""), 1);
+  EXPECT_EQ(count(one, "\"cat\":\"alloc\",\"ph\":\"B\""), 2);
+  EXPECT_EQ(count(one, "\"name\":\"thread_name\""), 2);
+  EXPECT_NE(one.find("\"dropped_events\":0"), std::string::npos);
+
+  std::string both = slurp(merged);
+  EXPECT_EQ(count(both, "\"ph\":\"B\""), 2 * count(one, "\"ph\":\"B\""));
+  EXPECT_NE(both.find("\"pid\":1"), std::string::npos);
+
+  // the second file's events are shifted by its clock offset
+  auto first_ts = [](const std::string& text, size_t from) {
+    size_t p = text.find("\"ph\":\"B\",\"ts\":", from);
+    return std::stod(text.substr(p + 15));
+  };
+  size_t second = both.find("\"pid\":1");
+  EXPECT_NEAR(first_ts(both, second) - first_ts(both, 0), 1000.0, 1e-3);
+
+  for (const std::string& f : {rank0, rank1, merged}) {
+    std::remove(f.c_str());
+  }
+}
+
+TEST_F(CPUMatrixTest, HardwareCountersDegradeGracefully) {
+  lumin::Matrix A = lumin::Matrix::random_int(64, 64, 9);
+  lumin::set_roofline({10.0, 5.0});
+  lumin::reset_hw_counters();
+
+  bool have_counters = lumin::start_hw_counters();
+  EXPECT_TRUE(lumin::hw_counters_enabled());
+  EXPECT_EQ(have_counters, !lumin::available_hw_counters().empty());
+  if (!have_counters) {
+    EXPECT_FALSE(lumin::hw_counter_error().empty());
+  }
+  lumin::Matrix C = A * A;
+  lumin::stop_hw_counters();
+  lumin::Matrix untimed = A * A;
+
+  std::vector<lumin::HwCounterStats> stats = lumin::hw_counter_stats();
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[0].op, "multiply");
+  EXPECT_EQ(stats[0].calls, 1);
+  EXPECT_DOUBLE_EQ(stats[0].analytic_flops, 2.0 * 64 * 64 * 64);
+  EXPECT_GT(stats[0].gflops(), 0.0);
+  EXPECT_GT(stats[0].arithmetic_intensity(), 0.0);
+  if (have_counters && stats[0].count(lumin::HwCounter::Cycles) > 0) {
+    EXPECT_GT(stats[0].ipc(), 0.0);
+  }
+
+  EXPECT_DOUBLE_EQ(lumin::roofline().ridge(), 2.0);
+  EXPECT_DOUBLE_EQ(lumin::roofline().attainable_gflops(1.0), 5.0);
+  EXPECT_NE(lumin::roofline_report().find("multiply"), std::string::npos);
+  lumin::reset_hw_counters();
+}
+
+static lumin::MemoryPoolStats find_pool(const lumin::MemoryStats& s, const std::string& backend,
+                                        const std::string& kind) {
+  for (const lumin::MemoryPoolStats& p : s.pools) {
+    if (p.backend == backend && p.kind == kind) return p;
+  }
+  return lumin::MemoryPoolStats{};
+}
+
+TEST_F(CPUMatrixTest, MemoryAccountingAndLimit) {
+  lumin::MemoryStats before = lumin::memory_stats();
+  lumin::reset_peak_memory();
+  {
+    lumin::Matrix A(100, 50);
+    lumin::Matrix B = A.transpose();
+    lumin::MemoryStats during = lumin::memory_stats();
+    EXPECT_EQ(during.current_bytes, before.current_bytes + 2 * 100 * 50 * sizeof(double));
+    EXPECT_EQ(during.allocations, before.allocations + 2);
+    lumin::MemoryPoolStats cpu = find_pool(during, "CPU", "matrix");
+    EXPECT_GE(cpu.current_bytes, 2 * 100 * 50 * sizeof(double));
+  }
+  lumin::MemoryStats after = lumin::memory_stats();
+  EXPECT_EQ(after.current_bytes, before.current_bytes);
+  EXPECT_EQ(after.frees, before.frees + 2);
+  EXPECT_GE(after.peak_bytes, before.current_bytes + 2 * 100 * 50 * sizeof(double));
+
+  // operands exist before the limit, so only the 2 MiB product can trip it
+  lumin::Matrix small(64, 64);
+  lumin::Matrix wide(64, 4096);
+  uint64_t base = lumin::memory_stats().current_bytes;
+  lumin::set_memory_limit(base + (1 << 20));
+  EXPECT_EQ(lumin::memory_limit(), base + (1 << 20));
+  EXPECT_THROW(lumin::Matrix(1024, 1024), lumin::MemoryLimitError);
+  EXPECT_THROW(small.multiply(wide), lumin::MemoryLimitError);
+  EXPECT_EQ(lumin::memory_stats().current_bytes, base);
+  lumin::set_memory_limit(0);
+  EXPECT_NO_THROW(lumin::Matrix(1024, 1024));
+  EXPECT_NE(lumin::memory_report().find("matrix"), std::string::npos);
+}
+
+TEST_F(CPUMatrixTest, AutoBackendCalibratesAndCaches) {
+  std::string cache = temp_path("auto_backend_cache");
+  std::remove(cache.c_str());
+  setenv("LUMIN_AUTO_CACHE", cache.c_str(), 1);
+
+  auto first = std::make_shared<lumin::AutoBackend>();
+  lumin::AutoThresholds measured = first->thresholds();
+  ASSERT_TRUE(std::filesystem::exists(cache));
+
+  // a second instance takes the cached crossovers instead of measuring
+  lumin::AutoBackend second;
+  lumin::AutoThresholds cached = second.thresholds();
+  EXPECT_EQ(cached.parallel, measured.parallel);
+  EXPECT_EQ(cached.distributed, measured.distributed);
+
+  lumin::AutoThresholds t;
+  t.parallel.fill(lumin::AUTO_NEVER);
+  t.distributed.fill(lumin::AUTO_NEVER);
+  t.parallel[static_cast<size_t>(lumin::AutoOp::Multiply)] = 1000;
+  first->set_thresholds(t);
+  EXPECT_STREQ(first->route(lumin::AutoOp::Multiply, 999).name(), "CPU");
+  EXPECT_STREQ(first->route(lumin::AutoOp::Elementwise, 1u << 30).name(), "CPU");
+
+  lumin::set_default_backend(first);
+  lumin::Matrix A(12, 12), B(12, 12);
+  for (size_t i = 0; i < 144; i++) {
+    A.data()[i] = static_cast<double>(i % 7);
+    B.data()[i] = static_cast<double>(i % 5);
+  }
+  lumin::Matrix C = A * B, S = A + B;
+  lumin::set_default_backend(lumin::create_cpu_backend());
+  lumin::Matrix C_ref = A * B, S_ref = A + B;
+  for (size_t i = 0; i < 144; i++) {
+    EXPECT_DOUBLE_EQ(C.data()[i], C_ref.data()[i]);
+    EXPECT_DOUBLE_EQ(S.data()[i], S_ref.data()[i]);
+  }
+
+  unsetenv("LUMIN_AUTO_CACHE");
+  std::remove(cache.c_str());
+}
+
+TEST_F(CPUMatrixTest, ThreadPoolBackendMatchesCPU) {
+  auto pool = std::make_shared<lumin::ThreadPool>(4);
+  auto threads = std::make_shared<lumin::ThreadPoolBackend>(pool);
+  lumin::CPUBackend cpu;
+
+  lumin::Matrix A = lumin::Matrix::random_int(67, 45, 9);
+  lumin::Matrix B = lumin::Matrix::random_int(45, 83, 9);
+  lumin::Matrix C = lumin::Matrix::random_int(67, 45, 9);
+  auto expect_equal = [](const lumin::Matrix& X, const lumin::Matrix& Y) {
+    ASSERT_EQ(X.rows(), Y.rows());
+    ASSERT_EQ(X.cols(), Y.cols());
+    for (size_t i = 0; i < X.rows() * X.cols(); i++) {
+      ASSERT_DOUBLE_EQ(X.data()[i], Y.data()[i]);
+    }
+  };
+  expect_equal(threads->add(A, C), cpu.add(A, C));
+  expect_equal(threads->subtract(A, C), cpu.subtract(A, C));
+  expect_equal(threads->scalar(2.5, A), cpu.scalar(2.5, A));
+  expect_equal(threads->transpose(A), cpu.transpose(A));
+  expect_equal(threads->multiply(A, B), cpu.multiply(A, B));
+  EXPECT_DOUBLE_EQ(threads->dot(A, C), cpu.dot(A, C));
+
+  lumin::Matrix big = lumin::Matrix::random_int(300, 300, 9);
+  expect_equal(threads->multiply(big, big), cpu.multiply(big, big));
+  expect_equal(threads->transpose(big), cpu.transpose(big));
+
+  lumin::SparseMatrix S = lumin::SparseMatrix::from_dense(lumin::Matrix::random_int(45, 67, 1),
+                                                          lumin::SparseFormat::CSC);
+  lumin::Matrix x = lumin::Matrix::random_int(67, 1, 9);
+  expect_equal(threads->spmv(S, x), cpu.spmv(S, x));
+  lumin::Matrix X = lumin::Matrix::random_int(67, 5, 9);
+  expect_equal(threads->spmm(S, X), cpu.spmm(S, X));
+}
+
+TEST_F(CPUMatrixTest, ThreadPoolNestsTasksAndPropagatesErrors) {
+  lumin::ThreadPool pool(4);
+  EXPECT_EQ(pool.threads(), 4);
+
+  // parallel_for inside spawned tasks, issued from several user threads
+  std::atomic<size_t> total{0};
+  std::vector<std::thread> callers;
+  for (int c = 0; c < 3; c++) {
+    callers.emplace_back([&] {
+      lumin::TaskGroup group(pool);
+      for (int t = 0; t < 8; t++) {
+        group.spawn([&] {
+          pool.parallel_for(0, 1000, 7, [&](size_t lo, size_t hi) {
+            total.fetch_add(hi - lo);
+          });
+        });
+      }
+      group.wait();
+    });
+  }
+  for (std::thread& t : callers) {
+    t.join();
+  }
+  EXPECT_EQ(total.load(), 3u * 8 * 1000);
+
+  EXPECT_THROW(pool.parallel_for(0, 100, 1, [](size_t lo, size_t) {
+    if (lo == 57) throw std::runtime_error("task failed");
+  }), std::runtime_error);
+  // the caller's own first range throws while stolen halves are in flight
+  EXPECT_THROW(pool.parallel_for(0, 100, 1, [](size_t lo, size_t) {
+    if (lo == 0) throw std::runtime_error("caller failed");
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }), std::runtime_error);
+
+  // a one-thread pool runs everything on the waiting caller
+  lumin::ThreadPool serial(1);
+  std::vector<int> hits(100, 0);
+  serial.parallel_for(0, 100, 10, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) hits[i]++;
+  });
+  EXPECT_EQ(std::count(hits.begin(), hits.end(), 1), 100);
+}
+
+TEST_F(CPUMatrixTest, StreamRunsOpsInOrderWithDependencies) {
+  lumin::Matrix A = lumin::Matrix::random_int(40, 30, 9);
+  lumin::Matrix B = lumin::Matrix::random_int(30, 20, 9);
+
+  lumin::Stream s1, s2;
+  // ops on s2 wait for s1's results
+  lumin::Future<lumin::Matrix> AB = s1.multiply(A, B);
+  lumin::Future<lumin::Matrix> ABt = s2.transpose(AB);
+  lumin::Future<lumin::Matrix> twice = s2.add(ABt, ABt);
+  lumin::Future<double> norm = s2.dot(twice, twice);
+
+  lumin::Matrix expected = A.multiply(B).transpose().scalar(2.0);
+  const lumin::Matrix& got = twice.get();
+  ASSERT_EQ(got.rows(), 20);
+  ASSERT_EQ(got.cols(), 40);
+  for (size_t i = 0; i < got.rows() * got.cols(); i++) {
+    ASSERT_DOUBLE_EQ(got.data()[i], expected.data()[i]);
+  }
+  EXPECT_DOUBLE_EQ(norm.get(), expected.dot(expected));
+
+  // in order: each op sees the effect of the one before it
+  std::vector<int> order;
+  for (int i = 0; i < 20; i++) {
+    s1.enqueue([&order, i] { order.push_back(i); return i; });
+  }
+  bool called = false;
+  lumin::Future<int> last = s1.enqueue([] { return 7; });
+  s1.synchronize();
+  EXPECT_TRUE(last.ready());
+  last.on_ready([&] { called = true; });
+  EXPECT_TRUE(called);
+  ASSERT_EQ(order.size(), 20);
+  EXPECT_TRUE(std::is_sorted(order.begin(), order.end()));
+
+  // errors reach the future and every op depending on it
+  lumin::Future<lumin::Matrix> bad = lumin::add_async(A, B);
+  lumin::Future<lumin::Matrix> after = lumin::multiply_async(bad, B);
+  EXPECT_THROW(bad.get(), std::runtime_error);
+  EXPECT_THROW(after.get(), std::runtime_error);
+  EXPECT_THROW(lumin::Future<int>().get(), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, GraphFusesPlansAndReplays) {
+  lumin::Matrix X = lumin::Matrix::random_int(32, 24, 9);
+  lumin::Matrix W1 = lumin::Matrix::random_int(24, 16, 9);
+  lumin::Matrix W2 = lumin::Matrix::random_int(24, 16, 9);
+  lumin::Matrix bias = lumin::Matrix::random_int(32, 16, 9);
+
+  // two independent multiplies feeding one elementwise chain
+  auto forward = [&](const lumin::Matrix& x) {
+    lumin::Matrix h1 = x.multiply(W1);
+    lumin::Matrix h2 = x.multiply(W2);
+    lumin::Matrix unused = h1.transpose();
+    return h1.add(h2).scalar(0.5).subtract(bias).transpose();
+  };
+
+  lumin::Graph g;
+  g.begin_capture();
+  g.input(X);
+  lumin::Matrix captured = forward(X);
+  g.output(captured);
+  EXPECT_THROW(X.dot(X), std::runtime_error);
+  g.end_capture();
+
+  // multiply, multiply, fused(add,scalar,subtract), transpose
+  EXPECT_EQ(g.nodes(), 4u) << g.describe();
+  EXPECT_NE(g.describe().find("fused(add,scalar,subtract)"), std::string::npos) << g.describe();
+
+  for (int run = 0; run < 3; run++) {
+    lumin::Matrix x = lumin::Matrix::random_int(32, 24, 9);
+    std::vector<lumin::Matrix> out = g.replay({x});
+    ASSERT_EQ(out.size(), 1u);
+    lumin::Matrix expected = forward(x);
+    ASSERT_EQ(out[0].rows(), 16);
+    ASSERT_EQ(out[0].cols(), 32);
+    for (size_t i = 0; i < expected.rows() * expected.cols(); i++) {
+      ASSERT_DOUBLE_EQ(out[0].data()[i], expected.data()[i]);
+    }
+  }
+  EXPECT_THROW(g.replay({lumin::Matrix(3, 3)}), std::runtime_error);
+  EXPECT_THROW(g.replay({}), std::runtime_error);
+
+  // a chain of same-shape intermediates needs only two buffers
+  lumin::Matrix S = lumin::Matrix::random_int(20, 20, 9);
+  lumin::Graph chain;
+  chain.begin_capture();
+  chain.input(S);
+  lumin::Matrix t = S;
+  for (int i = 0; i < 6; i++) {
+    t = t.multiply(S);
+  }
+  chain.output(t);
+  chain.end_capture();
+  EXPECT_EQ(chain.arena_bytes(), 2 * 20 * 20 * sizeof(double));
+  lumin::Matrix y = chain.replay({S})[0];
+  for (size_t i = 0; i < t.rows() * t.cols(); i++) {
+    ASSERT_DOUBLE_EQ(y.data()[i], t.data()[i]);
+  }
+}
+
+TEST_F(CPUMatrixTest, GraphRefusesOpsItCannotReplay) {
+  lumin::Matrix X = lumin::Matrix::random_int(12, 12, 9);
+  lumin::Matrix S = X.transpose().multiply(X);
+  for (size_t i = 0; i < 12; i++) {
+    S(i, i) += 12.0;
+  }
+  lumin::Matrix L = lumin::cholesky(S);
+  lumin::LUFactors factors = lumin::lu(S);
+  lumin::Matrix v(12, 1), row(1, 12), C(12, 12);
+  lumin::SparseMatrix sp = lumin::SparseMatrix::from_dense(X);
+  lumin::DiagonalMatrix diag = lumin::DiagonalMatrix::from_dense(X);
+  lumin::BandedMatrix band = lumin::BandedMatrix::from_dense(X, 1, 2);
+  lumin::TriangularMatrix tri = lumin::TriangularMatrix::from_dense(X, lumin::Triangle::Lower);
+  std::string path = temp_path("refuse.tiled");
+  lumin::TiledMatrix tiled = lumin::TiledMatrix::from_matrix(X, path, 4);
+
+  // each of these would be recorded as a constant and replayed stale
+  using lumin::Trans;
+  std::vector<std::pair<std::string, std::function<void()>>> ops = {
+      {"dot", [&] { X.dot(X); }},
+      {"broadcast add", [&] { X.add(row); }},
+      {"map", [&] { lumin::map(X, [](double x) { return x + 1.0; }); }},
+      {"zip", [&] { lumin::zip(X, X, [](double a, double b) { return a * b; }); }},
+      {"reduce", [&] { lumin::reduce(lumin::Reduction::Sum, lumin::Axis::Rows, X); }},
+      {"argmax", [&] { lumin::argmax(lumin::Axis::Cols, X); }},
+      {"transform_rows", [&] { lumin::transform_rows(lumin::RowTransform::Softmax, X); }},
+      {"sq_distances", [&] { lumin::sq_distances(X, X); }},
+      {"knn", [&] { lumin::knn(X, X, 3); }},
+      {"gemm", [&] { lumin::gemm(Trans::No, Trans::No, 1.0, X, X, 0.0, C); }},
+      {"gemv", [&] { lumin::gemv(Trans::No, 1.0, X, v, 0.0, v); }},
+      {"ger", [&] { lumin::ger(1.0, v, v, C); }},
+      {"syrk", [&] { lumin::syrk(Trans::No, 1.0, X, 0.0, C); }},
+      {"trsm", [&] {
+         lumin::trsm(lumin::Side::Left, lumin::Triangle::Lower, Trans::No, lumin::Diag::NonUnit,
+                     1.0, L, C);
+       }},
+      {"lu", [&] { lumin::lu(S); }},
+      {"cholesky", [&] { lumin::cholesky(S); }},
+      {"lu_solve", [&] { lumin::lu_solve(factors, v); }},
+      {"cholesky_solve", [&] { lumin::cholesky_solve(L, v); }},
+      {"solve", [&] { lumin::solve(S, v); }},
+      {"qr", [&] { lumin::qr(X); }},
+      {"lstsq", [&] { lumin::lstsq(X, v); }},
+      {"multi_dot", [&] { lumin::multi_dot({X, X, v}); }},
+      {"randomized_svd", [&] { lumin::randomized_svd(X, 2); }},
+      {"SparseMatrix::from_dense", [&] { lumin::SparseMatrix::from_dense(X); }},
+      {"SparseMatrix::to_dense", [&] { sp.to_dense(); }},
+      {"spmv", [&] { sp.spmv(v); }},
+      {"spmm", [&] { sp.multiply(X); }},
+      {"DiagonalMatrix::add", [&] { diag.add(X); }},
+      {"DiagonalMatrix::multiply", [&] { diag.multiply(X); }},
+      {"multiply(Matrix, DiagonalMatrix)", [&] { lumin::multiply(X, diag); }},
+      {"BandedMatrix::add", [&] { band.add(X); }},
+      {"BandedMatrix::multiply", [&] { band * X; }},
+      {"TriangularMatrix::to_dense", [&] { tri.to_dense(); }},
+      {"multiply(Matrix, TriangularMatrix)", [&] { lumin::multiply(X, tri); }},
+      {"TiledMatrix::from_matrix", [&] { lumin::TiledMatrix::from_matrix(X, path + ".2", 4); }},
+      {"TiledMatrix::to_matrix", [&] { tiled.to_matrix(); }},
+      {"add_async", [&] { lumin::add_async(X, X); }},
+  };
+
+  lumin::Graph g;
+  g.begin_capture();
+  g.input(X);
+  for (const auto& op : ops) {
+    EXPECT_THROW(op.second(), std::runtime_error) << op.first;
+  }
+  lumin::Matrix out = X.add(X);
+  g.output(out);
+  g.end_capture();
+  std::remove(path.c_str());
+
+  // refused ops leave nothing behind: the graph replays only the add
+  EXPECT_EQ(g.nodes(), 1u) << g.describe();
+  lumin::Matrix x = lumin::Matrix::random_int(12, 12, 9);
+  lumin::Matrix replayed = g.replay({x})[0];
+  for (size_t i = 0; i < x.rows() * x.cols(); i++) {
+    ASSERT_EQ(replayed.data()[i], 2.0 * x.data()[i]);
+  }
+}
+
+TEST_F(CPUMatrixTest, GemmTransposesByIndexingAndAccumulates) {
+  auto backends = kernel_backends();
+  const size_t m = 37, k = 21, n = 13;
+  for (lumin::Trans ta : {lumin::Trans::No, lumin::Trans::Yes}) {
+    for (lumin::Trans tb : {lumin::Trans::No, lumin::Trans::Yes}) {
+      lumin::Matrix A = ta == lumin::Trans::No ? lumin::Matrix::random_int(m, k, 9) : lumin::Matrix::random_int(k, m, 9);
+      lumin::Matrix B = tb == lumin::Trans::No ? lumin::Matrix::random_int(k, n, 9) : lumin::Matrix::random_int(n, k, 9);
+      lumin::Matrix C0 = lumin::Matrix::random_int(m, n, 9);
+      lumin::Matrix opA = ta == lumin::Trans::No ? A : A.transpose();
+      lumin::Matrix opB = tb == lumin::Trans::No ? B : B.transpose();
+      lumin::Matrix expected = opA.multiply(opB).scalar(1.5).add(C0.scalar(-0.5));
+
+      for (const auto& be : backends) {
+        lumin::Matrix C(m, n);
+        std::copy(C0.data(), C0.data() + m * n, C.data());
+        be->gemm(ta, tb, 1.5, A, B, -0.5, C);
+        for (size_t i = 0; i < m * n; i++) {
+          ASSERT_DOUBLE_EQ(C.data()[i], expected.data()[i]) << be->name();
+        }
+      }
+    }
+  }
+
+  // beta == 0 ignores C, NaNs included, on both ways of reading op(B)
+  lumin::Matrix A = lumin::Matrix::random_int(5, 4, 9);
+  lumin::Matrix At = A.transpose();
+  lumin::Matrix gram = At.multiply(A);
+  for (lumin::Trans tb : {lumin::Trans::No, lumin::Trans::Yes}) {
+    lumin::Matrix C(4, 4);
+    std::fill(C.data(), C.data() + 16, std::nan(""));
+    lumin::gemm(lumin::Trans::Yes, tb, 1.0, A, tb == lumin::Trans::No ? A : At, 0.0, C);
+    for (size_t i = 0; i < 16; i++) {
+      ASSERT_DOUBLE_EQ(C.data()[i], gram.data()[i]);
+    }
+  }
+  lumin::Matrix wrong(3, 4);
+  EXPECT_THROW(lumin::gemm(lumin::Trans::No, lumin::Trans::No, 1.0, A, A, 0.0, wrong), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, GemvAndGerMatchGeneralMultiply) {
+  auto backends = kernel_backends();
+  lumin::Matrix A = lumin::Matrix::random_int(301, 77, 9);
+  lumin::Matrix x = lumin::Matrix::random_int(77, 1, 9);
+  lumin::Matrix u = lumin::Matrix::random_int(301, 1, 9);
+
+  // reference: the generic loop on plain products
+  auto reference = [](const lumin::Matrix& L, const lumin::Matrix& R) {
+    lumin::Matrix out(L.rows(), R.cols());
+    for (size_t i = 0; i < L.rows(); i++)
+      for (size_t p = 0; p < L.cols(); p++)
+        for (size_t j = 0; j < R.cols(); j++)
+          out(i, j) += L(i, p) * R(p, j);
+    return out;
+  };
+  auto expect_equal = [](const lumin::Matrix& X, const lumin::Matrix& Y) {
+    ASSERT_EQ(X.rows() * X.cols(), Y.rows() * Y.cols());
+    for (size_t i = 0; i < X.rows() * X.cols(); i++) {
+      ASSERT_DOUBLE_EQ(X.data()[i], Y.data()[i]);
+    }
+  };
+
+  for (const auto& be : backends) {
+    lumin::Matrix Ax = reference(A, x);
+    lumin::Matrix y(301, 1);
+    std::copy(u.data(), u.data() + 301, y.data());
+    be->gemv(lumin::Trans::No, 2.0, A, x, -1.0, y);
+    for (size_t i = 0; i < 301; i++) {
+      ASSERT_DOUBLE_EQ(y.data()[i], 2.0 * Ax.data()[i] - u.data()[i]);
+    }
+
+    // A^T u into a row vector
+    lumin::Matrix At_u(1, 77);
+    be->gemv(lumin::Trans::Yes, 1.0, A, u, 0.0, At_u);
+    expect_equal(At_u, reference(A.transpose(), u));
+
+    lumin::Matrix G = lumin::Matrix::random_int(301, 77, 9);
+    lumin::Matrix expected = G.add(reference(u, x.transpose()).scalar(0.5));
+    be->ger(0.5, u, x, G);
+    expect_equal(G, expected);
+
+    // multiply routes matrix-vector shapes to gemv
+    expect_equal(be->multiply(A, x), reference(A, x));
+    lumin::Matrix row = u.transpose();
+    expect_equal(be->multiply(row, A), reference(row, A));
+    expect_equal(be->multiply(u, x.transpose()), reference(u, x.transpose()));
+
+    // an outer product keeps 0 * NaN = NaN in the rows of a zero entry
+    lumin::Matrix col(3, 1), nan_row(1, 4);
+    col(1, 0) = 1.0;
+    nan_row(0, 2) = std::nan("");
+    lumin::Matrix outer = be->multiply(col, nan_row);
+    for (size_t i = 0; i < 3; i++) {
+      EXPECT_TRUE(std::isnan(outer(i, 2))) << be->name() << " row " << i;
+    }
+  }
+  lumin::Matrix bad(5, 1);
+  EXPECT_THROW(lumin::gemv(lumin::Trans::No, 1.0, A, bad, 0.0, bad), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, SyrkComputesOneTriangleAndMirrors) {
+  auto backends = kernel_backends();
+  lumin::Matrix A = lumin::Matrix::random_int(70, 23, 9);
+  lumin::Matrix S = lumin::Matrix::random_int(70, 70, 9);
+  lumin::Matrix sym = S.add(S.transpose());
+
+  for (const auto& be : backends) {
+    lumin::Matrix C(70, 70);
+    std::copy(sym.data(), sym.data() + 70 * 70, C.data());
+    be->syrk(lumin::Trans::No, 2.0, A, 0.5, C);
+    lumin::Matrix expected = A.multiply(A.transpose()).scalar(2.0).add(sym.scalar(0.5));
+    for (size_t i = 0; i < 70 * 70; i++) {
+      ASSERT_DOUBLE_EQ(C.data()[i], expected.data()[i]) << be->name();
+    }
+
+    lumin::Matrix G(23, 23);
+    be->syrk(lumin::Trans::Yes, 1.0, A, 0.0, G);
+    lumin::Matrix gram = A.transpose().multiply(A);
+    for (size_t i = 0; i < 23 * 23; i++) {
+      ASSERT_DOUBLE_EQ(G.data()[i], gram.data()[i]) << be->name();
+    }
+  }
+  lumin::Matrix wrong(23, 23);
+  EXPECT_THROW(lumin::syrk(lumin::Trans::No, 1.0, A, 0.0, wrong), std::runtime_error);
+}
+
+static double max_abs_diff(const lumin::Matrix& A, const lumin::Matrix& B) {
+  double d = 0.0;
+  for (size_t i = 0; i < A.rows() * A.cols(); i++) d = std::max(d, std::abs(A.data()[i] - B.data()[i]));
+  return d;
+}
+
+TEST_F(CPUMatrixTest, TrsmSolvesEveryTriangleSideAndTranspose) {
+  auto backends = kernel_backends();
+  const size_t n = 150, rhs = 37;
+  // garbage outside the triangle must not be read
+  lumin::Matrix A = lumin::Matrix::random_int(n, n, 9);
+  for (size_t i = 0; i < n; i++) A(i, i) = 4.0 * n;
+
+  for (const auto& be : backends) {
+    for (lumin::Side side : {lumin::Side::Left, lumin::Side::Right}) {
+      for (lumin::Triangle uplo : {lumin::Triangle::Lower, lumin::Triangle::Upper}) {
+        for (lumin::Trans t : {lumin::Trans::No, lumin::Trans::Yes}) {
+          for (lumin::Diag diag : {lumin::Diag::NonUnit, lumin::Diag::Unit}) {
+            lumin::Matrix T(n, n);
+            for (size_t i = 0; i < n; i++) {
+              for (size_t j = 0; j < n; j++) {
+                bool in = (uplo == lumin::Triangle::Lower) ? j <= i : j >= i;
+                T(i, j) = !in ? 0.0 : (i == j && diag == lumin::Diag::Unit) ? 1.0 : A(i, j);
+              }
+            }
+            lumin::Matrix opT = (t == lumin::Trans::No) ? T : T.transpose();
+            lumin::Matrix X = (side == lumin::Side::Left) ? lumin::Matrix::random_int(n, rhs, 9)
+                                                          : lumin::Matrix::random_int(rhs, n, 9);
+            lumin::Matrix B = (side == lumin::Side::Left) ? opT.multiply(X) : X.multiply(opT);
+            be->trsm(side, uplo, t, diag, 0.5, A, B);
+            EXPECT_LT(max_abs_diff(B, X.scalar(0.5)), 1e-9) << be->name();
+          }
+        }
+      }
+    }
+  }
+  lumin::Matrix wrong(n + 1, rhs);
+  EXPECT_THROW(lumin::trsm(lumin::Side::Left, lumin::Triangle::Lower, lumin::Trans::No,
+                           lumin::Diag::NonUnit, 1.0, A, wrong), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, BlockedFactorizationsSolve) {
+  auto backends = kernel_backends();
+  const size_t n = 150;
+
+  for (const auto& be : backends) {
+    // P * A = L * U, for square, tall and wide A
+    for (auto shape : {std::make_pair(n, n), std::make_pair(n, size_t(90)), std::make_pair(size_t(90), n)}) {
+      lumin::Matrix A = lumin::Matrix::random_int(shape.first, shape.second, 9);
+      lumin::Matrix F(A.rows(), A.cols());
+      std::copy(A.data(), A.data() + A.rows() * A.cols(), F.data());
+      std::vector<size_t> piv;
+      be->lu(F, piv);
+      size_t m = A.rows(), k = std::min(A.rows(), A.cols());
+      lumin::Matrix L(m, k), U(k, A.cols());
+      for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < A.cols(); j++) {
+          if (j < i && j < k) L(i, j) = F(i, j);
+          if (i == j) L(i, j) = 1.0;
+          if (j >= i && i < k) U(i, j) = F(i, j);
+        }
+      }
+      lumin::Matrix PA(m, A.cols());
+      std::copy(A.data(), A.data() + m * A.cols(), PA.data());
+      for (size_t i = 0; i < k; i++) {
+        ASSERT_GE(piv[i], i);
+        for (size_t j = 0; j < A.cols(); j++) std::swap(PA(i, j), PA(piv[i], j));
+      }
+      EXPECT_LT(max_abs_diff(L.multiply(U), PA), 1e-9) << be->name();
+    }
+
+    // A = L * L^T, with the upper triangle ignored and zeroed
+    lumin::Matrix M = lumin::Matrix::random_int(n, n, 9);
+    lumin::Matrix S = M.multiply(M.transpose());
+    for (size_t i = 0; i < n; i++) S(i, i) += n;
+    lumin::Matrix L(n, n);
+    std::copy(S.data(), S.data() + n * n, L.data());
+    for (size_t i = 0; i < n; i++) L(i, n - 1) = (i == n - 1) ? L(i, i) : -1.0;
+    be->cholesky(L);
+    EXPECT_EQ(L(0, 1), 0.0);
+    EXPECT_LT(max_abs_diff(L.multiply(L.transpose()), S), 1e-8) << be->name();
+  }
+
+  lumin::Matrix A = lumin::Matrix::random_int(n, n, 9);
+  lumin::Matrix X = lumin::Matrix::random_int(n, 5, 9);
+  lumin::Matrix B = A.multiply(X);
+  EXPECT_LT(max_abs_diff(lumin::solve(A, B), X), 1e-8);
+  lumin::LUFactors f = lumin::lu(A);
+  EXPECT_LT(max_abs_diff(lumin::lu_solve(f, B), X), 1e-8);
+
+  lumin::Matrix S = A.multiply(A.transpose());
+  for (size_t i = 0; i < n; i++) S(i, i) += n;
+  EXPECT_LT(max_abs_diff(lumin::cholesky_solve(lumin::cholesky(S), S.multiply(X)), X), 1e-8);
+
+  lumin::Matrix singular(3, 3);
+  singular(0, 0) = 1.0;
+  singular(1, 1) = 1.0;
+  EXPECT_THROW(lumin::solve(singular, B), std::runtime_error);
+  EXPECT_THROW(lumin::lu(singular), std::runtime_error);
+  lumin::Matrix indefinite(2, 2);
+  indefinite(0, 0) = 1.0;
+  indefinite(1, 1) = -1.0;
+  EXPECT_THROW(lumin::cholesky(indefinite), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, HouseholderQRAndLeastSquares) {
+  lumin::CPUBackend cpu;
+
+  for (const auto& be : kernel_backends()) {
+    lumin::set_default_backend(be);
+    // tall with a short last panel, and wide
+    for (auto shape : {std::make_pair(size_t(300), size_t(150)), std::make_pair(size_t(130), size_t(200))}) {
+      lumin::Matrix A = lumin::Matrix::random_int(shape.first, shape.second, 9);
+      lumin::QRFactors f = lumin::qr(A);
+      lumin::Matrix Q = lumin::qr_q(f), R = lumin::qr_r(f);
+      size_t k = std::min(shape.first, shape.second);
+      ASSERT_EQ(Q.cols(), k);
+      EXPECT_LT(max_abs_diff(cpu.multiply(Q, R), A), 1e-9) << be->name();
+      lumin::Matrix QtQ = cpu.multiply(cpu.transpose(Q), Q);
+      for (size_t i = 0; i < k; i++) QtQ(i, i) -= 1.0;
+      EXPECT_LT(max_abs_diff(QtQ, lumin::Matrix(k, k)), 1e-12) << be->name();
+      EXPECT_EQ(R(1, 0), 0.0);
+    }
+
+    // the residual of a least-squares fit is orthogonal to A's columns
+    lumin::Matrix A = lumin::Matrix::random_int(400, 70, 9);
+    lumin::Matrix B = lumin::Matrix::random_int(400, 3, 9);
+    lumin::Matrix X = lumin::lstsq(A, B);
+    ASSERT_EQ(X.rows(), 70u);
+    lumin::Matrix normal = cpu.multiply(cpu.transpose(A), cpu.subtract(cpu.multiply(A, X), B));
+    EXPECT_LT(max_abs_diff(normal, lumin::Matrix(70, 3)), 1e-7) << be->name();
+  }
+
+  lumin::Matrix wide(3, 5), B(3, 1);
+  EXPECT_THROW(lumin::lstsq(wide, B), std::runtime_error);
+  lumin::Matrix deficient(4, 2), b(4, 1);
+  deficient(0, 0) = 1.0;
+  EXPECT_THROW(lumin::lstsq(deficient, b), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, RandomizedSVDRecoversLowRank) {
+  lumin::CPUBackend cpu;
+  // rank 6 with well separated singular values, plus small noise
+  lumin::Matrix X = lumin::Matrix::random_int(300, 6, 9), Y = lumin::Matrix::random_int(6, 200, 9);
+  for (size_t j = 0; j < 6; j++) {
+    for (size_t c = 0; c < 200; c++) Y(j, c) *= std::pow(4.0, 5.0 - j);
+  }
+  lumin::Matrix A = cpu.multiply(X, Y);
+  lumin::Matrix noise = lumin::Matrix::random_int(300, 200, 9).scalar(1e-6);
+  A = cpu.add(A, noise);
+
+  lumin::SVDResult svd = lumin::randomized_svd(A, 6, 8, 1, 42);
+  ASSERT_EQ(svd.U.rows(), 300u);
+  ASSERT_EQ(svd.U.cols(), 6u);
+  ASSERT_EQ(svd.V.rows(), 200u);
+  ASSERT_EQ(svd.S.size(), 6u);
+  for (size_t i = 1; i < 6; i++) EXPECT_GE(svd.S[i - 1], svd.S[i]);
+
+  lumin::Matrix US(300, 6);
+  for (size_t i = 0; i < 300; i++) {
+    for (size_t j = 0; j < 6; j++) US(i, j) = svd.U(i, j) * svd.S[j];
+  }
+  lumin::Matrix approx = cpu.multiply(US, cpu.transpose(svd.V));
+  // the truncation error is the noise, far below A's scale
+  EXPECT_LT(max_abs_diff(approx, A), 1e-6 * svd.S[0]);
+  for (const lumin::Matrix* M : {&svd.U, &svd.V}) {
+    lumin::Matrix G = cpu.multiply(cpu.transpose(*M), *M);
+    for (size_t i = 0; i < 6; i++) G(i, i) -= 1.0;
+    EXPECT_LT(max_abs_diff(G, lumin::Matrix(6, 6)), 1e-10);
+  }
+
+  // A * v_i = s_i * u_i for each returned pair
+  lumin::Matrix AV = cpu.multiply(A, svd.V);
+  for (size_t i = 0; i < 300; i++) {
+    for (size_t j = 0; j < 6; j++) EXPECT_NEAR(AV(i, j), US(i, j), 1e-6 * svd.S[0]);
+  }
+  EXPECT_THROW(lumin::randomized_svd(A, 201), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, MultiDotPicksCheapestOrder) {
+  lumin::CPUBackend cpu;
+  // left to right, A * B makes a 400 x 400 intermediate; B * C is 5 x 5
+  lumin::Matrix A = lumin::Matrix::random_int(400, 5, 9), B = lumin::Matrix::random_int(5, 400, 9);
+  lumin::Matrix C = lumin::Matrix::random_int(400, 5, 9), D = lumin::Matrix::random_int(5, 7, 9);
+  lumin::Matrix expected = cpu.multiply(cpu.multiply(cpu.multiply(A, B), C), D);
+
+  lumin::reset_stats();
+  lumin::set_instrumentation(true);
+  lumin::Matrix R = lumin::multi_dot({A, B, C, D});
+  lumin::set_instrumentation(false);
+  ASSERT_EQ(R.rows(), 400u);
+  ASSERT_EQ(R.cols(), 7u);
+  EXPECT_EQ(max_abs_diff(R, expected), 0.0);
+  std::vector<lumin::OpStats> stats = lumin::op_stats();
+  ASSERT_EQ(stats.size(), 1u);
+  // A * ((B * C) * D)
+  EXPECT_EQ(stats[0].flops, 2u * (5 * 400 * 5 + 5 * 5 * 7 + 400 * 5 * 7));
+
+  // square factors all cost the same: E * (F * (G * H)), and the last
+  // product reuses the buffer of G * H
+  lumin::Matrix E = lumin::Matrix::random_int(30, 30, 9), F = lumin::Matrix::random_int(30, 30, 9);
+  lumin::Matrix G = lumin::Matrix::random_int(30, 30, 9), H = lumin::Matrix::random_int(30, 30, 9);
+  lumin::reset_stats();
+  lumin::set_instrumentation(true);
+  lumin::Matrix S = lumin::multi_dot({E, F, G, H});
+  lumin::set_instrumentation(false);
+  EXPECT_EQ(max_abs_diff(S, cpu.multiply(cpu.multiply(cpu.multiply(E, F), G), H)), 0.0);
+  EXPECT_EQ(lumin::op_stats()[0].allocations, 2u);
+  lumin::reset_stats();
+
+  EXPECT_EQ(max_abs_diff(lumin::multi_dot({A}), A), 0.0);
+  EXPECT_THROW(lumin::multi_dot({A, C}), std::runtime_error);
+  EXPECT_THROW(lumin::multi_dot({}), std::runtime_error);
+
+  // a captured chain is re-associated the same way
+  lumin::Graph g;
+  g.begin_capture();
+  g.input(A);
+  lumin::Matrix out = A * B * C * D;
+  g.output(out);
+  g.end_capture();
+  EXPECT_EQ(g.nodes(), 3u) << g.describe();
+  EXPECT_EQ(g.arena_bytes(), (5 * 5 + 5 * 7) * sizeof(double)) << g.describe();
+  lumin::Matrix x = lumin::Matrix::random_int(400, 5, 9);
+  EXPECT_EQ(max_abs_diff(g.replay({x})[0], cpu.multiply(cpu.multiply(cpu.multiply(x, B), C), D)), 0.0);
+}
+
+TEST_F(CPUMatrixTest, FusedDistancesAndTopK) {
+  auto backends = kernel_backends();
+  // more points than one distance tile, queries not a multiple of the row block
+  lumin::Matrix Q = lumin::Matrix::random_int(37, 11, 9), P = lumin::Matrix::random_int(600, 11, 9);
+  lumin::Matrix expected(37, 600);
+  for (size_t i = 0; i < 37; i++) {
+    for (size_t j = 0; j < 600; j++) {
+      double s = 0.0;
+      for (size_t c = 0; c < 11; c++) s += (Q(i, c) - P(j, c)) * (Q(i, c) - P(j, c));
+      expected(i, j) = s;
+    }
+  }
+
+  for (const auto& be : backends) {
+    lumin::Matrix D = be->sq_distances(Q, P);
+    EXPECT_LT(max_abs_diff(D, expected), 1e-9) << be->name();
+
+    lumin::Matrix dist;
+    std::vector<size_t> idx;
+    be->knn(Q, P, 5, dist, idx);
+    ASSERT_EQ(dist.rows(), 37u);
+    ASSERT_EQ(dist.cols(), 5u);
+    for (size_t i = 0; i < 37; i++) {
+      std::vector<std::pair<double, size_t>> all;
+      for (size_t j = 0; j < 600; j++) all.emplace_back(expected(i, j), j);
+      std::sort(all.begin(), all.end());
+      for (size_t c = 0; c < 5; c++) {
+        EXPECT_EQ(idx[i * 5 + c], all[c].second) << be->name();
+        EXPECT_NEAR(dist(i, c), all[c].first, 1e-9);
+      }
+    }
+  }
+  // a point's nearest neighbour in its own set is itself, at distance 0
+  lumin::KNNResult self = lumin::knn(P, P, 1);
+  for (size_t j = 0; j < 600; j++) EXPECT_EQ(self.distances(j, 0), 0.0);
+  EXPECT_THROW(lumin::knn(Q, P, 601), std::runtime_error);
+  EXPECT_THROW(lumin::sq_distances(Q, lumin::Matrix(3, 4)), std::runtime_error);
+}
+
+TEST_F(CPUMatrixTest, BroadcastingElementwiseOps) {
+  auto backends = kernel_backends();
+  const size_t m = 37, n = 23;
+  lumin::Matrix A = lumin::Matrix::random_int(m, n, 9), B = lumin::Matrix::random_int(m, n, 9);
+  lumin::Matrix row = lumin::Matrix::random_int(1, n, 9), col = lumin::Matrix::random_int(m, 1, 9);
+  lumin::Matrix one(1, 1);
+  one(0, 0) = 3.0;
+
+  // the value of an operand at (i, j) of the result, repeating its single row or column
+  auto at = [](const lumin::Matrix& X, size_t i, size_t j) {
+    return X(X.rows() == 1 ? 0 : i, X.cols() == 1 ? 0 : j);
+  };
+  std::vector<std::pair<const lumin::Matrix*, const lumin::Matrix*>> pairs = {
+    {&A, &B}, {&A, &row}, {&row, &A}, {&A, &col}, {&col, &A}, {&col, &row}, {&A, &one}, {&one, &col}};
+
+  for (const auto& be : backends) {
+    for (const auto& p : pairs) {
+      const lumin::Matrix& X = *p.first;
+      const lumin::Matrix& Y = *p.second;
+      lumin::Matrix S = be->add(X, Y), D = be->subtract(X, Y), H = be->hadamard(X, Y);
+      size_t rows = std::max(X.rows(), Y.rows()), cols = std::max(X.cols(), Y.cols());
+      ASSERT_EQ(S.rows(), rows);
+      ASSERT_EQ(S.cols(), cols);
+      ASSERT_EQ(H.rows(), rows);
+      for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+          ASSERT_EQ(S(i, j), at(X, i, j) + at(Y, i, j)) << be->name();
+          ASSERT_EQ(D(i, j), at(X, i, j) - at(Y, i, j)) << be->name();
+          ASSERT_EQ(H(i, j), at(X, i, j) * at(Y, i, j)) << be->name();
+        }
+      }
+    }
+    EXPECT_THROW(be->add(A, lumin::Matrix(1, n + 1)), std::runtime_error);
+    EXPECT_THROW(be->hadamard(A, lumin::Matrix(m - 1, n)), std::runtime_error);
+  }
+
+  // hadamard fuses into a graph's elementwise chains
+  lumin::Matrix X = lumin::Matrix::random_int(m, n, 9);
+  lumin::Graph g;
+  g.begin_capture();
+  g.input(X);
+  lumin::Matrix out = X.hadamard(B).add(A);
+  g.output(out);
+  g.end_capture();
+  EXPECT_EQ(g.nodes(), 1u) << g.describe();
+  EXPECT_NE(g.describe().find("fused(hadamard,add)"), std::string::npos) << g.describe();
+  lumin::Matrix x = lumin::Matrix::random_int(m, n, 9);
+  lumin::Matrix replayed = g.replay({x})[0];
+  lumin::Matrix expected = x.hadamard(B).add(A);
+  for (size_t i = 0; i < m * n; i++) {
+    ASSERT_EQ(replayed.data()[i], expected.data()[i]);
+  }
+}
+
+TEST_F(CPUMatrixTest, RowAndColumnReductions) {
+  auto backends = kernel_backends();
+  // several row blocks and column strips, neither a whole number of them;
+  // small integers make ties for argmax
+  const size_t m = 600, n = 700;
+  lumin::Matrix A = lumin::Matrix::random_int(m, n, 9);
+  for (size_t i = 0; i < m * n; i++) A.data()[i] -= 4.0;
+
+  // reference value of op over the count entries at a, step apart
+  auto fold = [](lumin::Reduction op, const double* a, size_t count, size_t step) {
+    double sum = 0.0, abs_sum = 0.0, sq_sum = 0.0, lo = a[0], hi = a[0];
+    for (size_t p = 0; p < count; p++) {
+      double x = a[p * step];
+      sum += x;
+      abs_sum += std::abs(x);
+      sq_sum += x * x;
+      lo = std::min(lo, x);
+      hi = std::max(hi, x);
+    }
+    double exp_sum = 0.0;
+    for (size_t p = 0; p < count; p++) exp_sum += std::exp(a[p * step] - hi);
+    switch (op) {
+      case lumin::Reduction::Sum: return sum;
+      case lumin::Reduction::Mean: return sum / static_cast<double>(count);
+      case lumin::Reduction::Min: return lo;
+      case lumin::Reduction::Max: return hi;
+      case lumin::Reduction::L1: return abs_sum;
+      case lumin::Reduction::L2: return std::sqrt(sq_sum);
+      case lumin::Reduction::LogSumExp: return hi + std::log(exp_sum);
+    }
+    return 0.0;
+  };
+
+  const lumin::Reduction ops[] = {lumin::Reduction::Sum, lumin::Reduction::Mean, lumin::Reduction::Min,
+                                  lumin::Reduction::Max, lumin::Reduction::L1, lumin::Reduction::L2,
+                                  lumin::Reduction::LogSumExp};
+  for (const auto& be : backends) {
+    for (lumin::Reduction op : ops) {
+      lumin::Matrix rows = be->reduce(op, lumin::Axis::Rows, A);
+      ASSERT_EQ(rows.rows(), m);
+      ASSERT_EQ(rows.cols(), 1u);
+      for (size_t i = 0; i < m; i++) {
+        ASSERT_NEAR(rows(i, 0), fold(op, A.data() + i * n, n, 1), 1e-9) << be->name();
+      }
+      lumin::Matrix cols = be->reduce(op, lumin::Axis::Cols, A);
+      ASSERT_EQ(cols.rows(), 1u);
+      ASSERT_EQ(cols.cols(), n);
+      for (size_t j = 0; j < n; j++) {
+        ASSERT_NEAR(cols(0, j), fold(op, A.data() + j, m, n), 1e-9) << be->name();
+      }
+    }
+
+    std::vector<size_t> row_max = be->argmax(lumin::Axis::Rows, A);
+    for (size_t i = 0; i < m; i++) {
+      const double* a = A.data() + i * n;
+      EXPECT_EQ(row_max[i], static_cast<size_t>(std::max_element(a, a + n) - a)) << be->name();
+    }
+    std::vector<size_t> col_max = be->argmax(lumin::Axis::Cols, A);
+    for (size_t j = 0; j < n; j++) {
+      size_t best = 0;
+      for (size_t i = 1; i < m; i++) {
+        if (A(i, j) > A(best, j)) best = i;
+      }
+      EXPECT_EQ(col_max[j], best) << be->name();
+    }
+    EXPECT_THROW(be->argmax(lumin::Axis::Rows, lumin::Matrix(3, 0)), std::runtime_error);
+
+    lumin::Matrix S = be->transform_rows(lumin::RowTransform::Softmax, A);
+    lumin::Matrix U = be->transform_rows(lumin::RowTransform::Normalize, A);
+    lumin::Matrix lse = be->reduce(lumin::Reduction::LogSumExp, lumin::Axis::Rows, A);
+    lumin::Matrix norms = be->reduce(lumin::Reduction::L2, lumin::Axis::Rows, A);
+    for (size_t i = 0; i < m; i++) {
+      for (size_t j = 0; j < n; j++) {
+        ASSERT_NEAR(S(i, j), std::exp(A(i, j) - lse(i, 0)), 1e-12) << be->name();
+        ASSERT_NEAR(U(i, j), A(i, j) / norms(i, 0), 1e-12) << be->name();
+      }
+    }
+  }
+
+  // shifting by the maximum keeps large entries finite, and a zero row
+  // stays zero when normalized
+  lumin::Matrix big(2, 3);
+  big(0, 0) = 1000.0; big(0, 1) = 1000.0; big(0, 2) = 1000.0;
+  lumin::Matrix lse = lumin::reduce(lumin::Reduction::LogSumExp, lumin::Axis::Rows, big);
+  EXPECT_NEAR(lse(0, 0), 1000.0 + std::log(3.0), 1e-9);
+  lumin::Matrix S = lumin::transform_rows(lumin::RowTransform::Softmax, big);
+  EXPECT_NEAR(S(0, 1), 1.0 / 3.0, 1e-15);
+  lumin::Matrix U = lumin::transform_rows(lumin::RowTransform::Normalize, big);
+  EXPECT_EQ(U(1, 2), 0.0);
+}
+
+TEST_F(CPUMatrixTest, MapAndZipInlineFunctors) {
+  // enough entries for several thread pool ranges, and not a whole number of them
+  const size_t m = 301, n = 170;
+  lumin::Matrix A = lumin::Matrix::random_int(m, n, 9), B = lumin::Matrix::random_int(m, n, 9);
+  for (size_t i = 0; i < m * n; i++) A.data()[i] -= 4.0;
+
+  for (const auto& be : kernel_backends()) {
+    lumin::set_default_backend(be);
+    const double scale = 0.5;
+    lumin::Matrix F = lumin::map(A, [scale](double x) { return scale * x * x + 1.0; });
+    lumin::Matrix R = lumin::map(A, lumin::ufunc::Relu());
+    lumin::Matrix C = lumin::map(A, lumin::ufunc::Clamp{-1.0, 2.0});
+    lumin::Matrix E = lumin::map(A, lumin::ufunc::Exp());
+    lumin::Matrix Z = lumin::zip(A, B, [](double x, double y) { return 2.0 * x - y; });
+    lumin::Matrix M = lumin::zip(A, B, lumin::ufunc::Maximum());
+    ASSERT_EQ(F.rows(), m);
+    ASSERT_EQ(Z.cols(), n);
+    for (size_t i = 0; i < m * n; i++) {
+      double a = A.data()[i], b = B.data()[i];
+      ASSERT_EQ(F.data()[i], scale * a * a + 1.0) << be->name();
+      ASSERT_EQ(R.data()[i], a > 0.0 ? a : 0.0) << be->name();
+      ASSERT_EQ(C.data()[i], std::min(std::max(a, -1.0), 2.0)) << be->name();
+      ASSERT_EQ(E.data()[i], std::exp(a)) << be->name();
+      ASSERT_EQ(Z.data()[i], 2.0 * a - b) << be->name();
+      ASSERT_EQ(M.data()[i], std::max(a, b)) << be->name();
+    }
+    EXPECT_THROW(lumin::zip(A, lumin::Matrix(m, n + 1), lumin::ufunc::Divide()), std::runtime_error);
+    EXPECT_EQ(lumin::map(lumin::Matrix(0, 0), lumin::ufunc::Exp()).rows(), 0u);
+  }
+  lumin::set_default_backend(lumin::create_cpu_backend());
+}
@@ -4,6 +4,11 @@
 #include <mpi.h>
 #endif
 
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
 #ifdef LUMIN_ENABLE_MPI
 
 class MPIMatrixTest : public ::testing::Test {
@@ -34,6 +39,405 @@ TEST_F(MPIMatrixTest, AddMatrices) {
   }
 }
 
+TEST_F(MPIMatrixTest, SparseMatrixVectorHalo) {
+  // tridiagonal stencil: every row block needs one ghost entry from each neighbour
+  size_t n = 37;
+  std::vector<size_t> rows, cols;
+  std::vector<double> vals;
+  for (size_t i = 0; i < n; ++i) {
+    if (i > 0) { rows.push_back(i); cols.push_back(i - 1); vals.push_back(-1.0); }
+    rows.push_back(i); cols.push_back(i); vals.push_back(2.0);
+    if (i + 1 < n) { rows.push_back(i); cols.push_back(i + 1); vals.push_back(-1.0); }
+  }
+  lumin::SparseMatrix S = lumin::SparseMatrix::from_coo(n, n, rows, cols, vals);
+
+  lumin::Matrix x(n, 1), B(n, 2);
+  for (size_t i = 0; i < n; ++i) {
+    x.data()[i] = static_cast<double>(i * i);
+    B(i, 0) = 1.0;
+    B(i, 1) = static_cast<double>(i);
+  }
+
+  lumin::Matrix y = S.spmv(x);
+  lumin::Matrix R = S * B;
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  if (rank == 0) {
+    // second difference of i^2 is -2 in the interior
+    EXPECT_EQ(y(0, 0), -1.0);
+    for (size_t i = 1; i + 1 < n; ++i) {
+      EXPECT_EQ(y(i, 0), -2.0);
+      EXPECT_EQ(R(i, 0), 0.0);
+      EXPECT_EQ(R(i, 1), 0.0);
+    }
+    EXPECT_EQ(R(0, 0), 1.0);
+  }
+}
+
+TEST_F(MPIMatrixTest, InstrumentationCountsCollectives) {
+  lumin::Matrix A(6, 4), B(6, 4);
+  lumin::reset_stats();
+  lumin::set_instrumentation(true);
+  lumin::Matrix C = A + B;
+  lumin::set_instrumentation(false);
+
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  uint64_t scatter_calls = 0, moved = 0;
+  for (const lumin::CollectiveStats& c : lumin::collective_stats()) {
+    if (c.name == "MPI_Scatterv") scatter_calls = c.calls;
+    moved += c.bytes;
+  }
+  EXPECT_EQ(scatter_calls, 2);
+  // rank 0 sends both operands and receives the whole result
+  if (rank == 0 && size > 1) {
+    EXPECT_GE(moved, 3 * 6 * 4 * sizeof(double));
+  }
+  lumin::reset_stats();
+}
+
+TEST_F(MPIMatrixTest, GatherTraceMergesRanks) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  lumin::sync_trace_clocks(MPI_COMM_WORLD);
+  lumin::start_tracing();
+  lumin::Matrix A(8, 8), B(8, 8);
+  lumin::Matrix C = A + B;
+  lumin::stop_tracing();
+
+  std::string path = "/tmp/lumin_mpi_trace.json";
+  lumin::gather_trace(MPI_COMM_WORLD, path);
+  if (rank == 0) {
+    std::ifstream in(path);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_NE(text.find("\"name\":\"MPI_Scatterv\",\"cat\":\"mpi\""), std::string::npos);
+    for (int r = 0; r < size; r++) {
+      std::string pid = "\"pid\":" + std::to_string(r);
+      EXPECT_NE(text.find(pid), std::string::npos);
+      std::remove((path + ".rank" + std::to_string(r)).c_str());
+    }
+    std::remove(path.c_str());
+  }
+  lumin::set_trace_rank(0, 0.0);
+}
+
+TEST_F(MPIMatrixTest, MemoryAccountsScratch) {
+  auto scratch = [] {
+    for (const lumin::MemoryPoolStats& p : lumin::memory_stats().pools) {
+      if (p.backend == "MPI" && p.kind == "scratch") return p;
+    }
+    return lumin::MemoryPoolStats{};
+  };
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  lumin::Matrix A(8, 4), B(8, 4);
+  lumin::MemoryPoolStats before = scratch();
+  lumin::reset_peak_memory();
+  lumin::Matrix C = A + B;
+  lumin::MemoryPoolStats after = scratch();
+
+  // localA, localB and localC for this rank's rows, all freed on return
+  size_t local_rows = 8 / size + (rank < 8 % size ? 1 : 0);
+  EXPECT_EQ(after.allocations, before.allocations + (local_rows ? 3 : 0));
+  EXPECT_EQ(after.current_bytes, before.current_bytes);
+  EXPECT_GE(after.peak_bytes, 3 * local_rows * 4 * sizeof(double));
+}
+
+TEST_F(MPIMatrixTest, AutoBackendRoutesBySize) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  auto b = std::make_shared<lumin::AutoBackend>(MPI_COMM_WORLD);
+  lumin::AutoThresholds t;
+  t.parallel.fill(lumin::AUTO_NEVER);
+  t.distributed.fill(100);
+  b->set_thresholds(t);
+  EXPECT_STREQ(b->route(lumin::AutoOp::Elementwise, 99).name(), "CPU");
+  EXPECT_STREQ(b->route(lumin::AutoOp::Elementwise, 100).name(), "MPI");
+  lumin::set_default_backend(b);
+
+  lumin::Matrix small(3, 3), big(20, 10);
+  for (size_t i = 0; i < 9; i++) small.data()[i] = static_cast<double>(i);
+  for (size_t i = 0; i < 200; i++) big.data()[i] = static_cast<double>(i);
+
+  // local ops hand every rank the full result, MPI ones only rank 0
+  lumin::Matrix s = small + small;
+  ASSERT_EQ(s.rows(), 3);
+  EXPECT_DOUBLE_EQ(s.data()[8], 16.0);
+  lumin::Matrix r = big + big;
+  if (rank == 0) {
+    ASSERT_EQ(r.rows(), 20);
+    EXPECT_DOUBLE_EQ(r.data()[199], 398.0);
+  }
+}
+
+TEST_F(MPIMatrixTest, GemmSplitsRowsOrSharedDimension) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  const size_t m = 23, k = 17, n = 9;
+  lumin::CPUBackend cpu;
+  for (lumin::Trans ta : {lumin::Trans::No, lumin::Trans::Yes}) {
+    for (lumin::Trans tb : {lumin::Trans::No, lumin::Trans::Yes}) {
+      lumin::Matrix A = ta == lumin::Trans::No ? lumin::Matrix::random_int(m, k, 9) : lumin::Matrix::random_int(k, m, 9);
+      lumin::Matrix B = tb == lumin::Trans::No ? lumin::Matrix::random_int(k, n, 9) : lumin::Matrix::random_int(n, k, 9);
+      lumin::Matrix C = lumin::Matrix::random_int(m, n, 9);
+      lumin::Matrix expected(m, n);
+      std::copy(C.data(), C.data() + m * n, expected.data());
+      cpu.gemm(ta, tb, -1.0, A, B, 3.0, expected);
+
+      lumin::gemm(ta, tb, -1.0, A, B, 3.0, C);
+      if (rank == 0) {
+        for (size_t i = 0; i < m * n; ++i) {
+          ASSERT_DOUBLE_EQ(C.data()[i], expected.data()[i]);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(MPIMatrixTest, GemvAndGerDistributeRows) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  const size_t m = 41, n = 29;
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(m, n, 9);
+  lumin::Matrix x = lumin::Matrix::random_int(n, 1, 9);
+  lumin::Matrix u = lumin::Matrix::random_int(m, 1, 9);
+
+  lumin::Matrix y = lumin::Matrix::random_int(m, 1, 9), y_ref(m, 1);
+  std::copy(y.data(), y.data() + m, y_ref.data());
+  lumin::gemv(lumin::Trans::No, 1.5, A, x, 2.0, y);
+  cpu.gemv(lumin::Trans::No, 1.5, A, x, 2.0, y_ref);
+
+  lumin::Matrix z(n, 1), z_ref(n, 1);
+  lumin::gemv(lumin::Trans::Yes, 1.0, A, u, 0.0, z);
+  cpu.gemv(lumin::Trans::Yes, 1.0, A, u, 0.0, z_ref);
+
+  lumin::Matrix G = lumin::Matrix::random_int(m, n, 9), G_ref(m, n);
+  std::copy(G.data(), G.data() + m * n, G_ref.data());
+  lumin::ger(3.0, u, x, G);
+  cpu.ger(3.0, u, x, G_ref);
+
+  lumin::Matrix Ax = A * x;
+  lumin::Matrix Ax_ref = cpu.multiply(A, x);
+  if (rank == 0) {
+    for (size_t i = 0; i < m; ++i) {
+      ASSERT_DOUBLE_EQ(y.data()[i], y_ref.data()[i]);
+      ASSERT_DOUBLE_EQ(Ax.data()[i], Ax_ref.data()[i]);
+    }
+    for (size_t j = 0; j < n; ++j) {
+      ASSERT_DOUBLE_EQ(z.data()[j], z_ref.data()[j]);
+    }
+    for (size_t i = 0; i < m * n; ++i) {
+      ASSERT_DOUBLE_EQ(G.data()[i], G_ref.data()[i]);
+    }
+  }
+}
+
+TEST_F(MPIMatrixTest, SyrkSplitsTriangleOrReducesGram) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(53, 19, 9);
+  lumin::Matrix S = lumin::Matrix::random_int(53, 53, 9);
+  lumin::Matrix C = cpu.add(S, cpu.transpose(S));
+  lumin::Matrix C_ref(53, 53);
+  std::copy(C.data(), C.data() + 53 * 53, C_ref.data());
+  lumin::syrk(lumin::Trans::No, 1.0, A, -1.0, C);
+  cpu.syrk(lumin::Trans::No, 1.0, A, -1.0, C_ref);
+
+  lumin::Matrix G(19, 19), G_ref(19, 19);
+  lumin::syrk(lumin::Trans::Yes, 0.5, A, 0.0, G);
+  cpu.syrk(lumin::Trans::Yes, 0.5, A, 0.0, G_ref);
+  if (rank == 0) {
+    for (size_t i = 0; i < 53 * 53; ++i) {
+      ASSERT_DOUBLE_EQ(C.data()[i], C_ref.data()[i]);
+    }
+    for (size_t i = 0; i < 19 * 19; ++i) {
+      ASSERT_DOUBLE_EQ(G.data()[i], G_ref.data()[i]);
+    }
+  }
+}
+
+TEST_F(MPIMatrixTest, TrsmScattersRowsAndFactorizationsAgree) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  lumin::CPUBackend cpu;
+  const size_t n = 70;
+  lumin::Matrix A = lumin::Matrix::random_int(n, n, 9);
+  for (size_t i = 0; i < n; ++i) A.data()[i * n + i] = 4.0 * n;
+
+  for (lumin::Side side : {lumin::Side::Left, lumin::Side::Right}) {
+    lumin::Matrix B = (side == lumin::Side::Left) ? lumin::Matrix::random_int(n, 9, 9)
+                                                  : lumin::Matrix::random_int(9, n, 9);
+    lumin::Matrix B_ref(B.rows(), B.cols());
+    std::copy(B.data(), B.data() + B.rows() * B.cols(), B_ref.data());
+    lumin::trsm(side, lumin::Triangle::Upper, lumin::Trans::Yes, lumin::Diag::NonUnit, 2.0, A, B);
+    cpu.trsm(side, lumin::Triangle::Upper, lumin::Trans::Yes, lumin::Diag::NonUnit, 2.0, A, B_ref);
+    if (rank == 0) {
+      for (size_t i = 0; i < B.rows() * B.cols(); ++i) {
+        ASSERT_NEAR(B.data()[i], B_ref.data()[i], 1e-12);
+      }
+    }
+  }
+
+  lumin::Matrix X = lumin::Matrix::random_int(n, 2, 9);
+  lumin::Matrix solved = lumin::solve(A, cpu.multiply(A, X));
+  lumin::Matrix singular(4, 4);
+  EXPECT_THROW(lumin::lu(singular), std::runtime_error);
+  if (rank == 0) {
+    for (size_t i = 0; i < n * 2; ++i) {
+      ASSERT_NEAR(solved.data()[i], X.data()[i], 1e-9);
+    }
+  }
+}
+
+TEST_F(MPIMatrixTest, TSQRLeastSquaresMatchesSerial) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  lumin::CPUBackend cpu;
+  // the second shape leaves every rank fewer rows than columns
+  for (size_t m : {size_t(90), size_t(30)}) {
+    lumin::Matrix A = lumin::Matrix::random_int(m, 20, 9);
+    lumin::Matrix B = lumin::Matrix::random_int(m, 2, 9);
+    lumin::Matrix X = lumin::lstsq(A, B);
+    if (rank == 0) {
+      lumin::Matrix X_ref = cpu.lstsq(A, B);
+      ASSERT_EQ(X.rows(), 20u);
+      for (size_t i = 0; i < 20 * 2; ++i) {
+        ASSERT_NEAR(X.data()[i], X_ref.data()[i], 1e-9);
+      }
+    }
+  }
+  lumin::Matrix deficient(8, 3), b(8, 1);
+  EXPECT_THROW(lumin::lstsq(deficient, b), std::runtime_error);
+}
+
+TEST_F(MPIMatrixTest, RandomizedSVDOnDistributedGemm) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  lumin::CPUBackend cpu;
+  lumin::Matrix X = lumin::Matrix::random_int(120, 3, 9), Y = lumin::Matrix::random_int(3, 80, 9);
+  lumin::Matrix A = cpu.multiply(X, Y);
+  lumin::SVDResult svd = lumin::randomized_svd(A, 3, 5, 1, 7);
+  if (rank == 0) {
+    lumin::Matrix US(120, 3);
+    for (size_t i = 0; i < 120; ++i) {
+      for (size_t j = 0; j < 3; ++j) US.data()[i * 3 + j] = svd.U.data()[i * 3 + j] * svd.S[j];
+    }
+    lumin::Matrix approx = cpu.multiply(US, cpu.transpose(svd.V));
+    for (size_t i = 0; i < 120 * 80; ++i) {
+      ASSERT_NEAR(approx.data()[i], A.data()[i], 1e-8 * svd.S[0]);
+    }
+  }
+  else {
+    // like the backend's own ops, the other ranks get no result
+    EXPECT_EQ(svd.U.rows() * svd.U.cols(), 0u);
+    EXPECT_EQ(svd.V.rows() * svd.V.cols(), 0u);
+    EXPECT_TRUE(svd.S.empty());
+  }
+
+  // multi_dot is a chain of distributed gemms, with its result on rank 0
+  lumin::Matrix Z = lumin::Matrix::random_int(80, 5, 9);
+  lumin::Matrix chain = lumin::multi_dot({X, Y, Z});
+  if (rank == 0) {
+    lumin::Matrix expected = cpu.multiply(A, Z);
+    ASSERT_EQ(chain.rows(), 120u);
+    ASSERT_EQ(chain.cols(), 5u);
+    for (size_t i = 0; i < 120 * 5; ++i) {
+      ASSERT_EQ(chain.data()[i], expected.data()[i]);
+    }
+  }
+  else {
+    EXPECT_EQ(chain.rows() * chain.cols(), 0u);
+  }
+}
+
+TEST_F(MPIMatrixTest, DistancesAndKnnScatterQueries) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  lumin::CPUBackend cpu;
+  lumin::Matrix Q = lumin::Matrix::random_int(41, 6, 9), P = lumin::Matrix::random_int(300, 6, 9);
+  lumin::Matrix D = lumin::sq_distances(Q, P);
+  lumin::KNNResult r = lumin::knn(Q, P, 4);
+  if (rank == 0) {
+    lumin::Matrix D_ref = cpu.sq_distances(Q, P);
+    for (size_t i = 0; i < 41 * 300; ++i) {
+      ASSERT_EQ(D.data()[i], D_ref.data()[i]);
+    }
+    lumin::Matrix dist;
+    std::vector<size_t> idx;
+    cpu.knn(Q, P, 4, dist, idx);
+    EXPECT_EQ(r.indices, idx);
+    for (size_t i = 0; i < 41 * 4; ++i) {
+      ASSERT_EQ(r.distances.data()[i], dist.data()[i]);
+    }
+  }
+}
+
+TEST_F(MPIMatrixTest, BroadcastOperandsAreNotScattered) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(29, 13, 9);
+  lumin::Matrix row = lumin::Matrix::random_int(1, 13, 9), col = lumin::Matrix::random_int(29, 1, 9);
+  lumin::Matrix R = A + row, C = col - A, H = A.hadamard(col), O = col.hadamard(row);
+  if (rank == 0) {
+    lumin::Matrix R_ref = cpu.add(A, row), C_ref = cpu.subtract(col, A), H_ref = cpu.hadamard(A, col);
+    lumin::Matrix O_ref = cpu.hadamard(col, row);
+    for (size_t i = 0; i < 29 * 13; ++i) {
+      ASSERT_EQ(R.data()[i], R_ref.data()[i]);
+      ASSERT_EQ(C.data()[i], C_ref.data()[i]);
+      ASSERT_EQ(H.data()[i], H_ref.data()[i]);
+      ASSERT_EQ(O.data()[i], O_ref.data()[i]);
+    }
+  }
+}
+
+TEST_F(MPIMatrixTest, ColumnReductionsAllreducePartials) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(53, 17, 9);
+  // every rank checks the column results, so every rank needs rank 0's A
+  MPI_Bcast(A.data(), 53 * 17, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  const lumin::Reduction ops[] = {lumin::Reduction::Sum, lumin::Reduction::Mean, lumin::Reduction::Min,
+                                  lumin::Reduction::L1, lumin::Reduction::LogSumExp};
+  for (lumin::Reduction op : ops) {
+    // column results reach every rank
+    lumin::Matrix C = lumin::reduce(op, lumin::Axis::Cols, A);
+    lumin::Matrix C_ref = cpu.reduce(op, lumin::Axis::Cols, A);
+    ASSERT_EQ(C.cols(), 17u);
+    for (size_t j = 0; j < 17; ++j) {
+      ASSERT_NEAR(C.data()[j], C_ref.data()[j], 1e-12 * (1.0 + std::abs(C_ref.data()[j])));
+    }
+    lumin::Matrix R = lumin::reduce(op, lumin::Axis::Rows, A);
+    if (rank == 0) {
+      lumin::Matrix R_ref = cpu.reduce(op, lumin::Axis::Rows, A);
+      for (size_t i = 0; i < 53; ++i) {
+        ASSERT_EQ(R.data()[i], R_ref.data()[i]);
+      }
+    }
+  }
+  EXPECT_EQ(lumin::argmax(lumin::Axis::Cols, A), cpu.argmax(lumin::Axis::Cols, A));
+  std::vector<size_t> rows = lumin::argmax(lumin::Axis::Rows, A);
+  lumin::Matrix S = lumin::transform_rows(lumin::RowTransform::Normalize, A);
+  if (rank == 0) {
+    EXPECT_EQ(rows, cpu.argmax(lumin::Axis::Rows, A));
+    lumin::Matrix S_ref = cpu.transform_rows(lumin::RowTransform::Normalize, A);
+    for (size_t i = 0; i < 53 * 17; ++i) {
+      ASSERT_EQ(S.data()[i], S_ref.data()[i]);
+    }
+  }
+}
+
 // Add more MPI-specific tests here
 
 #else
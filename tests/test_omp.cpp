@@ -101,6 +101,209 @@ TEST_F(OMPMatrixTest, ParallelDotProductMatrices) {
 }
 
 
+TEST_F(OMPMatrixTest, ParallelSparseMultiply) {
+  // tridiagonal [-1 2 -1] stencil
+  size_t n = 500;
+  std::vector<size_t> rows, cols;
+  std::vector<double> vals;
+  for (size_t i = 0; i < n; ++i) {
+    if (i > 0) { rows.push_back(i); cols.push_back(i - 1); vals.push_back(-1.0); }
+    rows.push_back(i); cols.push_back(i); vals.push_back(2.0);
+    if (i + 1 < n) { rows.push_back(i); cols.push_back(i + 1); vals.push_back(-1.0); }
+  }
+  lumin::SparseMatrix S = lumin::SparseMatrix::from_coo(n, n, rows, cols, vals, lumin::SparseFormat::CSC);
+
+  lumin::Matrix x(n, 1), B(n, 3);
+  for (size_t i = 0; i < n; ++i) {
+    x.data()[i] = static_cast<double>(i);
+    for (size_t j = 0; j < 3; ++j) {
+      B(i, j) = static_cast<double>(i);
+    }
+  }
+
+  // interior rows of the stencil annihilate a linear ramp
+  lumin::Matrix y = S.spmv(x);
+  lumin::Matrix R = S * B;
+  EXPECT_EQ(y(0, 0), -1.0);
+  EXPECT_EQ(y(n - 1, 0), static_cast<double>(n));
+  for (size_t i = 1; i + 1 < n; ++i) {
+    EXPECT_EQ(y(i, 0), 0.0);
+    EXPECT_EQ(R(i, 2), 0.0);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelGemmTransposed) {
+  const size_t m = 70, k = 33, n = 19;
+  lumin::Matrix A = lumin::Matrix::random_int(k, m, 9);
+  lumin::Matrix B = lumin::Matrix::random_int(n, k, 9);
+  lumin::Matrix C = lumin::Matrix::random_int(m, n, 9);
+  lumin::Matrix expected = A.transpose().multiply(B.transpose()).scalar(2.0).add(C);
+
+  lumin::gemm(lumin::Trans::Yes, lumin::Trans::Yes, 2.0, A, B, 1.0, C);
+  for (size_t i = 0; i < m * n; ++i) {
+    ASSERT_DOUBLE_EQ(C.data()[i], expected.data()[i]);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelGemvAndGer) {
+  const size_t m = 1500, n = 1100;
+  lumin::Matrix A = lumin::Matrix::random_int(m, n, 9);
+  lumin::Matrix x = lumin::Matrix::random_int(m, 1, 9);
+  lumin::CPUBackend cpu;
+
+  lumin::Matrix y(n, 1), expected(n, 1);
+  lumin::gemv(lumin::Trans::Yes, 1.0, A, x, 0.0, y);
+  cpu.gemv(lumin::Trans::Yes, 1.0, A, x, 0.0, expected);
+  for (size_t j = 0; j < n; ++j) {
+    ASSERT_DOUBLE_EQ(y.data()[j], expected.data()[j]);
+  }
+
+  lumin::Matrix G(m, n), H(m, n);
+  lumin::ger(-2.0, x, y, G);
+  cpu.ger(-2.0, x, y, H);
+  for (size_t i = 0; i < m * n; ++i) {
+    ASSERT_DOUBLE_EQ(G.data()[i], H.data()[i]);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelSyrk) {
+  lumin::Matrix A = lumin::Matrix::random_int(150, 40, 9);
+  lumin::Matrix C(150, 150);
+  lumin::syrk(lumin::Trans::No, 1.0, A, 0.0, C);
+  lumin::CPUBackend cpu;
+  lumin::Matrix expected = cpu.multiply(A, cpu.transpose(A));
+  for (size_t i = 0; i < 150 * 150; ++i) {
+    ASSERT_DOUBLE_EQ(C.data()[i], expected.data()[i]);
+  }
+}
+
+TEST_F(OMPMatrixTest, TaskParallelFactorizations) {
+  const size_t n = 200;
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(n, n, 9);
+  lumin::Matrix X = lumin::Matrix::random_int(n, 3, 9);
+  lumin::Matrix B = cpu.multiply(A, X);
+  lumin::Matrix solved = lumin::solve(A, B);
+  for (size_t i = 0; i < n * 3; ++i) {
+    ASSERT_NEAR(solved.data()[i], X.data()[i], 1e-8);
+  }
+
+  // a wide matrix ends in a short panel that shares its column block
+  lumin::Matrix W = lumin::Matrix::random_int(100, 230, 9);
+  lumin::LUFactors f = lumin::lu(W);
+  lumin::Matrix F(100, 230);
+  std::copy(W.data(), W.data() + 100 * 230, F.data());
+  std::vector<size_t> piv;
+  cpu.lu(F, piv);
+  EXPECT_EQ(f.piv, piv);
+  for (size_t i = 0; i < 100 * 230; ++i) {
+    ASSERT_NEAR(f.lu.data()[i], F.data()[i], 1e-9);
+  }
+
+  lumin::Matrix S = cpu.multiply(A, cpu.transpose(A));
+  for (size_t i = 0; i < n; ++i) S.data()[i * n + i] += n;
+  lumin::Matrix L = lumin::cholesky(S);
+  lumin::Matrix LLt = cpu.multiply(L, cpu.transpose(L));
+  for (size_t i = 0; i < n * n; ++i) {
+    ASSERT_NEAR(LLt.data()[i], S.data()[i], 1e-8);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelQRLeastSquares) {
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(500, 100, 9);
+  lumin::Matrix B = lumin::Matrix::random_int(500, 2, 9);
+  lumin::Matrix X = lumin::lstsq(A, B);
+  lumin::Matrix X_ref = cpu.lstsq(A, B);
+  for (size_t i = 0; i < 100 * 2; ++i) {
+    ASSERT_NEAR(X.data()[i], X_ref.data()[i], 1e-10);
+  }
+  lumin::QRFactors f = lumin::qr(A);
+  lumin::Matrix QR = cpu.multiply(lumin::qr_q(f), lumin::qr_r(f));
+  for (size_t i = 0; i < 500 * 100; ++i) {
+    ASSERT_NEAR(QR.data()[i], A.data()[i], 1e-9);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelRandomizedSVD) {
+  lumin::CPUBackend cpu;
+  lumin::Matrix X = lumin::Matrix::random_int(400, 4, 9), Y = lumin::Matrix::random_int(4, 150, 9);
+  lumin::Matrix A = cpu.multiply(X, Y);
+  lumin::SVDResult svd = lumin::randomized_svd(A, 4);
+  lumin::Matrix US(400, 4);
+  for (size_t i = 0; i < 400; ++i) {
+    for (size_t j = 0; j < 4; ++j) US.data()[i * 4 + j] = svd.U.data()[i * 4 + j] * svd.S[j];
+  }
+  lumin::Matrix approx = cpu.multiply(US, cpu.transpose(svd.V));
+  for (size_t i = 0; i < 400 * 150; ++i) {
+    ASSERT_NEAR(approx.data()[i], A.data()[i], 1e-8 * svd.S[0]);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelDistancesAndKnn) {
+  lumin::CPUBackend cpu;
+  lumin::Matrix Q = lumin::Matrix::random_int(90, 8, 9), P = lumin::Matrix::random_int(700, 8, 9);
+  lumin::Matrix D = lumin::sq_distances(Q, P);
+  lumin::Matrix D_ref = cpu.sq_distances(Q, P);
+  for (size_t i = 0; i < 90 * 700; ++i) {
+    ASSERT_EQ(D.data()[i], D_ref.data()[i]);
+  }
+  lumin::KNNResult r = lumin::knn(Q, P, 7);
+  lumin::Matrix dist;
+  std::vector<size_t> idx;
+  cpu.knn(Q, P, 7, dist, idx);
+  EXPECT_EQ(r.indices, idx);
+}
+
+TEST_F(OMPMatrixTest, BroadcastingOpsMatchSerial) {
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(500, 300, 9);
+  lumin::Matrix row = lumin::Matrix::random_int(1, 300, 9), col = lumin::Matrix::random_int(500, 1, 9);
+  lumin::Matrix R = A + row, C = A - col, H = A.hadamard(row), O = col.hadamard(row);
+  lumin::Matrix R_ref = cpu.add(A, row), C_ref = cpu.subtract(A, col), H_ref = cpu.hadamard(A, row);
+  lumin::Matrix O_ref = cpu.hadamard(col, row);
+  for (size_t i = 0; i < 500 * 300; ++i) {
+    ASSERT_EQ(R.data()[i], R_ref.data()[i]);
+    ASSERT_EQ(C.data()[i], C_ref.data()[i]);
+    ASSERT_EQ(H.data()[i], H_ref.data()[i]);
+    ASSERT_EQ(O.data()[i], O_ref.data()[i]);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelReductionsMatchSerial) {
+  lumin::CPUBackend cpu;
+  lumin::Matrix A = lumin::Matrix::random_int(1500, 900, 9);
+  const lumin::Reduction ops[] = {lumin::Reduction::Sum, lumin::Reduction::Max, lumin::Reduction::L2,
+                                  lumin::Reduction::LogSumExp};
+  for (lumin::Reduction op : ops) {
+    for (lumin::Axis axis : {lumin::Axis::Rows, lumin::Axis::Cols}) {
+      lumin::Matrix R = lumin::reduce(op, axis, A);
+      lumin::Matrix R_ref = cpu.reduce(op, axis, A);
+      ASSERT_EQ(R.rows(), R_ref.rows());
+      for (size_t i = 0; i < R.rows() * R.cols(); ++i) {
+        ASSERT_NEAR(R.data()[i], R_ref.data()[i], 1e-9 * std::abs(R_ref.data()[i]));
+      }
+    }
+  }
+  EXPECT_EQ(lumin::argmax(lumin::Axis::Rows, A), cpu.argmax(lumin::Axis::Rows, A));
+  EXPECT_EQ(lumin::argmax(lumin::Axis::Cols, A), cpu.argmax(lumin::Axis::Cols, A));
+  lumin::Matrix S = lumin::transform_rows(lumin::RowTransform::Softmax, A);
+  lumin::Matrix S_ref = cpu.transform_rows(lumin::RowTransform::Softmax, A);
+  for (size_t i = 0; i < 1500 * 900; ++i) {
+    ASSERT_EQ(S.data()[i], S_ref.data()[i]);
+  }
+}
+
+TEST_F(OMPMatrixTest, ParallelMapAndZip) {
+  lumin::Matrix A = lumin::Matrix::random_int(700, 300, 9), B = lumin::Matrix::random_int(700, 300, 9);
+  lumin::Matrix S = lumin::map(A, lumin::ufunc::Sigmoid());
+  lumin::Matrix D = lumin::zip(A, B, [](double x, double y) { return x * y - x; });
+  for (size_t i = 0; i < 700 * 300; ++i) {
+    ASSERT_EQ(S.data()[i], 1.0 / (1.0 + std::exp(-A.data()[i])));
+    ASSERT_EQ(D.data()[i], A.data()[i] * B.data()[i] - A.data()[i]);
+  }
+}
+
 #else
 
 // If OpenMP is not enabled, provide a dummy test to avoid empty test suite